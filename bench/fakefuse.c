@@ -0,0 +1,32 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ *
+ * A stand-in for the part of libfuse that the operations use: the context of
+ * the current request.  Each thread has its own context.
+ */
+
+#include "harness.h"
+
+#include <string.h>
+
+static __thread struct fuse_context bench_context;
+
+struct fuse_context *fuse_get_context(void)
+{
+	return &bench_context;
+}
+
+void bench_set_context(uid_t uid, gid_t gid, pid_t pid, void *private_data)
+{
+	memset(&bench_context, 0, sizeof(bench_context));
+	bench_context.uid = uid;
+	bench_context.gid = gid;
+	bench_context.pid = pid;
+	bench_context.private_data = private_data;
+}
@@ -0,0 +1,384 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+// for nftw and mkdtemp
+#define _XOPEN_SOURCE 700
+
+#include "harness.h"
+#include "log.h"
+
+#include <errno.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+
+const char *const bench_metric_names[BENCH_METRICS] = {
+	[BENCH_NS_PER_OP] = "ns_per_op",
+	[BENCH_OPS_PER_SEC] = "ops_per_sec",
+	[BENCH_SYSCALLS_PER_OP] = "syscalls_per_op",
+	[BENCH_P50_NS] = "p50_ns",
+	[BENCH_P90_NS] = "p90_ns",
+	[BENCH_P99_NS] = "p99_ns",
+};
+
+struct bench_thread {
+	struct bench_worker worker;
+	pthread_t thread;
+	pthread_barrier_t *start;
+	bench_prepare_fn prepare;
+	bench_fn fn;
+	unsigned long iterations;
+	unsigned long batch;
+	uint64_t *latency;     /* mean latency of every batch */
+	uint64_t start_ns;
+	uint64_t end_ns;
+	uint64_t syscalls;
+};
+
+// the environment that is set up, for cleaning up if a benchmark fails:
+static struct bench_env *bench_active = NULL;
+
+static int bench_remove(const char *path, const struct stat *sb, int type, struct FTW *ftw)
+{
+	return remove(path);
+}
+
+static void bench_cleanup(void)
+{
+	if (bench_active != NULL && bench_active->basedir[0])
+		nftw(bench_active->basedir, bench_remove, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+uint64_t bench_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int bench_mkdir_owned(const char *path, uid_t uid, gid_t gid)
+{
+	if (mkdir(path, 0755) != 0)
+		return 0;
+	if (getuid() == 0 && chown(path, uid, gid) != 0)
+		return 0;
+	return 1;
+}
+
+int bench_env_setup(struct bench_env *env, int nusers, enum unsharedfs_fsmode fsmode, const char *defaultdir, bool check_ownership)
+{
+	struct unsharedfs_state *pdata;
+	struct fuse_conn_info conn;
+	char path[PATH_MAX];
+	int i;
+
+	memset(env, 0, sizeof(*env));
+	if (bench_active == NULL)
+		atexit(bench_cleanup);
+	env->root = getuid() == 0;
+	env->nusers = env->root ? nusers : 1;
+	snprintf(env->basedir, sizeof(env->basedir), "%s/unsharedfs-bench.XXXXXX", getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+	if (mkdtemp(env->basedir) == NULL)
+		return 0;
+	bench_active = env;
+	// the workers' users must be able to reach their directories:
+	if (chmod(env->basedir, 0755) != 0)
+		return 0;
+	for (i = 0; i < env->nusers; i++)
+	{
+		uid_t uid = env->root ? BENCH_FIRST_UID + i : getuid();
+		gid_t gid = env->root ? BENCH_FIRST_UID + i : getgid();
+		if (snprintf(path, sizeof(path), "%s/%ld", env->basedir, (long) (fsmode == UID_ONLY ? uid : gid)) >= (int) sizeof(path))
+		{
+			errno = ENAMETOOLONG;
+			return 0;
+		}
+		if (!bench_mkdir_owned(path, uid, gid))
+			return 0;
+	}
+	if (defaultdir)
+	{
+		if (snprintf(path, sizeof(path), "%s/%s", env->basedir, defaultdir) >= (int) sizeof(path))
+		{
+			errno = ENAMETOOLONG;
+			return 0;
+		}
+		if (!bench_mkdir_owned(path, getuid(), getgid()))
+			return 0;
+	}
+
+	// the same defaults as main():
+	pdata = calloc(1, sizeof(*pdata));
+	if (pdata == NULL)
+		return 0;
+	pdata->base_uid = getuid();
+	pdata->base_gid = getgid();
+	pdata->rootdir = strdup(env->basedir);
+	pdata->defaultdir = defaultdir ? strdup(defaultdir) : NULL;
+	pdata->allow_other_isset = true;
+	pdata->check_ownership = check_ownership;
+	pdata->fsmode = fsmode;
+	pdata->use_syslog = false;
+	pdata->loglevel = LOG_WARNING;
+	pdata->log_burst = 10;
+	pdata->log_interval = 60;
+	pdata->flightrec_size = 4096;
+	pdata->flightrec_threshold_ms = 1000;
+	pdata->trace_seconds = 10;
+	env->pdata = pdata;
+
+	// unsharedfs_init() runs in the context of the mounting process:
+	memset(&conn, 0, sizeof(conn));
+	conn.max_write = 4096;
+	conn.max_readahead = 131072;
+	bench_set_context(getuid(), getgid(), 0, pdata);
+	unsharedfs_init(&conn);
+	return 1;
+}
+
+int bench_env_add_user(struct bench_env *env, uid_t uid, gid_t gid)
+{
+	char path[PATH_MAX];
+
+	if (snprintf(path, sizeof(path), "%s/%ld", env->basedir, (long) (env->pdata->fsmode == UID_ONLY ? uid : gid)) >= (int) sizeof(path))
+	{
+		errno = ENAMETOOLONG;
+		return 0;
+	}
+	if (!bench_mkdir_owned(path, uid, gid))
+		return errno == EEXIST;
+	return 1;
+}
+
+void bench_env_teardown(struct bench_env *env)
+{
+	if (env->pdata)
+	{
+		bench_set_context(getuid(), getgid(), 0, env->pdata);
+		// frees pdata:
+		unsharedfs_destroy(env->pdata);
+		env->pdata = NULL;
+	}
+	if (env->basedir[0])
+		nftw(env->basedir, bench_remove, 16, FTW_DEPTH | FTW_PHYS);
+	env->basedir[0] = '\0';
+	bench_active = NULL;
+}
+
+void bench_userdir(const struct bench_worker *w, char path[PATH_MAX])
+{
+	const struct unsharedfs_state *pdata = w->env->pdata;
+	// BASEDIR/uid was created by bench_env_setup(), so it fits:
+	if (snprintf(path, PATH_MAX, "%s/%ld", w->env->basedir, (long) (pdata->fsmode == UID_ONLY ? w->uid : w->gid)) >= PATH_MAX)
+		abort();
+}
+
+static void *bench_thread_main(void *arg)
+{
+	struct bench_thread *t = arg;
+	struct bench_worker *w = &t->worker;
+	unsigned long done, n, b;
+	uint64_t t0, t1;
+
+	// a request from a process of the worker's user:
+	bench_set_context(w->uid, w->gid, getpid(), w->env->pdata);
+	if (t->prepare)
+		t->prepare(w);
+	pthread_barrier_wait(t->start);
+	t->syscalls = bench_syscalls();
+	t->start_ns = t1 = bench_now_ns();
+	for (done = 0, b = 0; done < t->iterations; done += n, b++)
+	{
+		n = t->iterations - done < t->batch ? t->iterations - done : t->batch;
+		t0 = t1;
+		t->fn(w, n);
+		t1 = bench_now_ns();
+		if (t->latency)
+			t->latency[b] = (t1 - t0) / n;
+	}
+	t->end_ns = t1;
+	t->syscalls = bench_syscalls() - t->syscalls;
+	return NULL;
+}
+
+static int bench_compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+	return x < y ? -1 : x > y;
+}
+
+int bench_run_batched(struct bench_env *env, int nthreads, unsigned long iterations, unsigned long batch
+		, bench_prepare_fn prepare, bench_fn fn, void *arg, struct bench_result *result)
+{
+	struct bench_thread *threads;
+	pthread_barrier_t start;
+	uint64_t start_ns = UINT64_MAX, end_ns = 0;
+	uint64_t *latency = NULL;
+	size_t batches, count;
+	int i, rc;
+
+	if (batch == 0)
+		batch = 1;
+	batches = (iterations + batch - 1) / batch;
+	threads = calloc(nthreads, sizeof(*threads));
+	// with a single batch, there is nothing to take percentiles from:
+	if (threads == NULL || (batch < iterations && (latency = calloc(nthreads * batches, sizeof(*latency))) == NULL))
+	{
+		free(threads);
+		return 0;
+	}
+	// the main thread releases the workers once all of them are prepared:
+	pthread_barrier_init(&start, NULL, nthreads + 1);
+	for (i = 0; i < nthreads; i++)
+	{
+		struct bench_thread *t = &threads[i];
+		int user = i % env->nusers;
+		t->worker.env = env;
+		t->worker.index = i;
+		t->worker.uid = env->root ? BENCH_FIRST_UID + user : getuid();
+		t->worker.gid = env->root ? BENCH_FIRST_UID + user : getgid();
+		t->worker.arg = arg;
+		t->start = &start;
+		t->prepare = prepare;
+		t->fn = fn;
+		t->iterations = iterations;
+		t->batch = batch;
+		t->latency = latency ? latency + i * batches : NULL;
+		rc = pthread_create(&t->thread, NULL, bench_thread_main, t);
+		if (rc != 0)
+		{
+			fprintf(stderr, "bench: cannot create thread: %s\n", strerror(rc));
+			exit(1);
+		}
+	}
+	pthread_barrier_wait(&start);
+	memset(result, 0, sizeof(*result));
+	// the workers take the time themselves: the main thread may not be
+	// scheduled again before they are done
+	for (i = 0; i < nthreads; i++)
+	{
+		pthread_join(threads[i].thread, NULL);
+		if (threads[i].start_ns < start_ns)
+			start_ns = threads[i].start_ns;
+		if (threads[i].end_ns > end_ns)
+			end_ns = threads[i].end_ns;
+		result->syscalls += threads[i].syscalls;
+	}
+	result->ns = end_ns - start_ns;
+	if (latency)
+	{
+		count = nthreads * batches;
+		qsort(latency, count, sizeof(*latency), bench_compare_u64);
+		result->p50_ns = latency[count * 50 / 100];
+		result->p90_ns = latency[count * 90 / 100];
+		result->p99_ns = latency[count * 99 / 100];
+	}
+	else
+		result->p50_ns = result->p90_ns = result->p99_ns = iterations ? result->ns / iterations : 0;
+	pthread_barrier_destroy(&start);
+	free(latency);
+	free(threads);
+	return 1;
+}
+
+uint64_t bench_run(struct bench_env *env, int nthreads, unsigned long iterations
+		, bench_prepare_fn prepare, bench_fn fn, void *arg, uint64_t *syscalls)
+{
+	struct bench_result result;
+
+	if (!bench_run_batched(env, nthreads, iterations, iterations, prepare, fn, arg, &result))
+		return 0;
+	if (syscalls)
+		*syscalls = result.syscalls;
+	return result.ns;
+}
+
+void bench_series_add(struct bench_series *s, const struct bench_result *r, long threads, unsigned long iterations)
+{
+	unsigned int i = s->runs;
+
+	if (i == BENCH_MAX_RUNS)
+		return;
+	s->threads = threads;
+	// ns/op is the time per operation and thread (i.e. latency), ops/s the aggregate throughput:
+	s->samples[BENCH_NS_PER_OP][i] = (double) r->ns / iterations;
+	s->samples[BENCH_OPS_PER_SEC][i] = (double) iterations * threads * 1e9 / r->ns;
+	s->samples[BENCH_SYSCALLS_PER_OP][i] = (double) r->syscalls / iterations / threads;
+	s->samples[BENCH_P50_NS][i] = r->p50_ns;
+	s->samples[BENCH_P90_NS][i] = r->p90_ns;
+	s->samples[BENCH_P99_NS][i] = r->p99_ns;
+	s->runs++;
+}
+
+double bench_series_mean(const struct bench_series *s, enum bench_metric m)
+{
+	double sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < s->runs; i++)
+		sum += s->samples[m][i];
+	return s->runs ? sum / s->runs : 0;
+}
+
+int bench_write_json(const char *file, const char *benchmark, unsigned long iterations
+		, const struct bench_series *series, size_t count)
+{
+	FILE *fp = strcmp(file, "-") == 0 ? stdout : fopen(file, "w");
+	struct utsname un;
+	unsigned int r;
+	size_t i;
+	int m;
+
+	if (fp == NULL)
+		return 0;
+	if (uname(&un) != 0)
+		strcpy(un.machine, "unknown");
+	fprintf(fp, "{\n"
+			"  \"format\": 1,\n"
+			"  \"benchmark\": \"%s\",\n"
+			"  \"iterations\": %lu,\n"
+			"  \"root\": %s,\n"
+			"  \"cpus\": %ld,\n"
+			"  \"machine\": \"%s\",\n"
+			"  \"results\": [\n"
+			, benchmark
+			, iterations
+			, getuid() == 0 ? "true" : "false"
+			, sysconf(_SC_NPROCESSORS_ONLN)
+			, un.machine);
+	for (i = 0; i < count; i++)
+	{
+		const struct bench_series *s = &series[i];
+
+		fprintf(fp, "    {\"name\": \"%s\", \"threads\": %ld, \"runs\": %u", s->name, s->threads, s->runs);
+		// the means, then the samples of every run:
+		for (m = 0; m < BENCH_METRICS; m++)
+			fprintf(fp, ", \"%s\": %.2f", bench_metric_names[m], bench_series_mean(s, m));
+		fprintf(fp, ",\n      \"samples\": {");
+		for (m = 0; m < BENCH_METRICS; m++)
+		{
+			fprintf(fp, "%s\"%s\": [", m ? ", " : "", bench_metric_names[m]);
+			for (r = 0; r < s->runs; r++)
+				fprintf(fp, "%s%.2f", r ? ", " : "", s->samples[m][r]);
+			fprintf(fp, "]");
+		}
+		fprintf(fp, "}}%s\n", i + 1 < count ? "," : "");
+	}
+	fprintf(fp, "  ]\n}\n");
+	if (fp == stdout)
+		return fflush(fp) == 0;
+	return fclose(fp) == 0;
+}
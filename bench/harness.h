@@ -0,0 +1,184 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_BENCH_HARNESS_H_
+#define UNSHAREDFS_BENCH_HARNESS_H_
+
+#include "fs.h"
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Benchmark harness: runs the unsharedfs operations without a mount.
+ *
+ * The benchmarks are linked against libunsharedfs.a and fakefuse.c instead of
+ * libfuse; fakefuse.c provides fuse_get_context() with a per-thread context
+ * that the harness sets up for every worker thread.
+ */
+
+// uid (and gid) of the first worker thread when running as root:
+#define BENCH_FIRST_UID 40000
+
+/* a temporary BASEDIR and the file system state operating on it */
+struct bench_env {
+	char basedir[PATH_MAX];
+	struct unsharedfs_state *pdata;
+	int nusers;        /* number of uid directories */
+	bool root;         /* running as root: every worker has its own uid */
+};
+
+/* the context of a worker thread */
+struct bench_worker {
+	struct bench_env *env;
+	int index;
+	uid_t uid;
+	gid_t gid;
+	void *arg;         /* benchmark-specific data */
+};
+
+/**
+ * Set the FUSE context of the calling thread (see fakefuse.c).
+ */
+void bench_set_context(uid_t uid, gid_t gid, pid_t pid, void *private_data);
+
+/**
+ * Create a temporary BASEDIR with a directory for each of nusers users, and
+ * initialise the file system state as unsharedfs_init() would.
+ * @param env the environment to set up
+ * @param nusers number of uid/gid directories to create (as root), or 1
+ * @param fsmode UID_ONLY or GID_ONLY
+ * @param defaultdir name of the fallback directory to create, or NULL
+ * @param check_ownership see --no-check-ownership
+ * @return 1 on success, 0 on error (errno is set).
+ */
+int bench_env_setup(struct bench_env *env, int nusers, enum unsharedfs_fsmode fsmode, const char *defaultdir, bool check_ownership);
+
+/**
+ * Create the directory of another user in the BASEDIR (as root, owned by
+ * that user).  An existing directory is not an error.
+ * @return 1 on success, 0 on error (errno is set).
+ */
+int bench_env_add_user(struct bench_env *env, uid_t uid, gid_t gid);
+
+/**
+ * Shut down the file system state and remove the BASEDIR.
+ */
+void bench_env_teardown(struct bench_env *env);
+
+/**
+ * Return the uid directory of a worker (BASEDIR/uid).
+ */
+void bench_userdir(const struct bench_worker *w, char path[PATH_MAX]);
+
+/**
+ * The benchmarked code: run the operation iterations times.
+ */
+typedef void (*bench_fn)(struct bench_worker *w, unsigned long iterations);
+
+/**
+ * Optional per-worker preparation, not included in the measurement.
+ */
+typedef void (*bench_prepare_fn)(struct bench_worker *w);
+
+/**
+ * Run a benchmark on nthreads threads.  Every thread gets the context of its
+ * own user (the first nusers are used round-robin).
+ * @param env the environment
+ * @param nthreads number of worker threads
+ * @param iterations operations per thread
+ * @param prepare called on each worker thread before the measurement (may be NULL)
+ * @param fn the benchmark
+ * @param arg passed to the workers
+ * @param syscalls if not NULL, set to the number of system calls the
+ *        workers made during the measurement (see bench_syscalls())
+ * @return the wall-clock time of the run in nanoseconds.
+ */
+uint64_t bench_run(struct bench_env *env, int nthreads, unsigned long iterations
+		, bench_prepare_fn prepare, bench_fn fn, void *arg, uint64_t *syscalls);
+
+/* the measurements of one run */
+struct bench_result {
+	uint64_t ns;           /* wall-clock time of the run */
+	uint64_t syscalls;     /* system calls of all workers */
+	uint64_t p50_ns;       /* latency percentiles of an operation, from */
+	uint64_t p90_ns;       /* the mean latency of every batch */
+	uint64_t p99_ns;
+};
+
+/**
+ * Like bench_run(), but call fn with batch iterations at a time, and take
+ * the latency percentiles from the time of every batch.
+ * @param batch operations per call of fn (at least 1)
+ * @param result the measurements
+ * @return 1 on success, 0 on error (errno is set).
+ */
+int bench_run_batched(struct bench_env *env, int nthreads, unsigned long iterations, unsigned long batch
+		, bench_prepare_fn prepare, bench_fn fn, void *arg, struct bench_result *result);
+
+/* the metrics written by bench_write_json() */
+enum bench_metric {
+	BENCH_NS_PER_OP
+	,BENCH_OPS_PER_SEC
+	,BENCH_SYSCALLS_PER_OP
+	,BENCH_P50_NS
+	,BENCH_P90_NS
+	,BENCH_P99_NS
+	,BENCH_METRICS
+};
+
+extern const char *const bench_metric_names[BENCH_METRICS];
+
+// repetitions of a benchmark that are kept:
+#define BENCH_MAX_RUNS 64
+
+/* the repeated runs of a benchmark */
+struct bench_series {
+	const char *name;
+	long threads;
+	unsigned int runs;
+	double samples[BENCH_METRICS][BENCH_MAX_RUNS];
+};
+
+/**
+ * Add the metrics of a run to a series (once it holds BENCH_MAX_RUNS runs,
+ * further runs are ignored).
+ */
+void bench_series_add(struct bench_series *s, const struct bench_result *r, long threads, unsigned long iterations);
+
+/**
+ * Return the mean of a metric over the runs of a series.
+ */
+double bench_series_mean(const struct bench_series *s, enum bench_metric m);
+
+/**
+ * Write benchmark results as JSON, with the samples of every run (the format
+ * that unsharedfs-compare reads).
+ * @param file the file, or "-" for stdout
+ * @param benchmark the name of the benchmark program
+ * @return 1 on success, 0 on error (errno is set).
+ */
+int bench_write_json(const char *file, const char *benchmark, unsigned long iterations
+		, const struct bench_series *series, size_t count);
+
+/**
+ * Return the number of system calls the calling thread has made through
+ * libunsharedfs.a so far (see syscount.c).
+ */
+uint64_t bench_syscalls(void);
+
+/**
+ * Return the current CLOCK_MONOTONIC time in nanoseconds.
+ */
+uint64_t bench_now_ns(void);
+
+#endif
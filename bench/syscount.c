@@ -0,0 +1,98 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ *
+ * Counts the system calls made by the file system code.
+ * The benchmarks are linked with -Wl,--wrap for every system call wrapper
+ * that libunsharedfs.a uses (see BENCH_WRAP in the Makefile), so the linker
+ * routes those calls through the __wrap_ functions below.  Calls made inside
+ * libc itself (e.g. the write() behind fprintf()) are not seen.
+ */
+
+// for O_TMPFILE
+#define _GNU_SOURCE
+
+#include "harness.h"
+
+#include <stdarg.h>
+#include <fcntl.h>
+#include <sys/types.h>
+
+static __thread uint64_t bench_syscall_count = 0;
+
+uint64_t bench_syscalls(void)
+{
+	return bench_syscall_count;
+}
+
+/*
+ * Define __wrap_NAME, which counts the call and passes it on to the real
+ * NAME.  Structures are passed as void pointers: only the calling
+ * convention matters here, and that avoids the _FILE_OFFSET_BITS renames in
+ * the system headers.
+ */
+#define BENCH_WRAP(ret, name, params, args) \
+	ret __real_##name params; \
+	ret __wrap_##name params; \
+	ret __wrap_##name params \
+	{ \
+		bench_syscall_count++; \
+		return __real_##name args; \
+	}
+
+BENCH_WRAP(int, stat64, (const char *path, void *buf), (path, buf))
+BENCH_WRAP(int, lstat64, (const char *path, void *buf), (path, buf))
+BENCH_WRAP(int, fstat64, (int fd, void *buf), (fd, buf))
+BENCH_WRAP(int, statvfs64, (const char *path, void *buf), (path, buf))
+BENCH_WRAP(int, access, (const char *path, int mode), (path, mode))
+BENCH_WRAP(int, setfsuid, (uid_t uid), (uid))
+BENCH_WRAP(int, setfsgid, (gid_t gid), (gid))
+BENCH_WRAP(int, close, (int fd), (fd))
+BENCH_WRAP(ssize_t, read, (int fd, void *buf, size_t size), (fd, buf, size))
+BENCH_WRAP(ssize_t, pread64, (int fd, void *buf, size_t size, off_t offset), (fd, buf, size, offset))
+BENCH_WRAP(ssize_t, pwrite64, (int fd, const void *buf, size_t size, off_t offset), (fd, buf, size, offset))
+BENCH_WRAP(int, fsync, (int fd), (fd))
+BENCH_WRAP(int, fdatasync, (int fd), (fd))
+BENCH_WRAP(int, ftruncate64, (int fd, off_t length), (fd, length))
+BENCH_WRAP(int, truncate64, (const char *path, off_t length), (path, length))
+BENCH_WRAP(int, mkdir, (const char *path, mode_t mode), (path, mode))
+BENCH_WRAP(int, rmdir, (const char *path), (path))
+BENCH_WRAP(int, unlink, (const char *path), (path))
+BENCH_WRAP(int, rename, (const char *from, const char *to), (from, to))
+BENCH_WRAP(int, link, (const char *from, const char *to), (from, to))
+BENCH_WRAP(int, symlink, (const char *from, const char *to), (from, to))
+BENCH_WRAP(ssize_t, readlink, (const char *path, char *buf, size_t size), (path, buf, size))
+BENCH_WRAP(int, chmod, (const char *path, mode_t mode), (path, mode))
+BENCH_WRAP(int, chown, (const char *path, uid_t uid, gid_t gid), (path, uid, gid))
+BENCH_WRAP(int, mknod, (const char *path, mode_t mode, dev_t dev), (path, mode, dev))
+BENCH_WRAP(int, mkfifo, (const char *path, mode_t mode), (path, mode))
+BENCH_WRAP(int, utimensat, (int dirfd, const char *path, const void *times, int flags), (dirfd, path, times, flags))
+BENCH_WRAP(ssize_t, lgetxattr, (const char *path, const char *name, void *value, size_t size), (path, name, value, size))
+BENCH_WRAP(int, lsetxattr, (const char *path, const char *name, const void *value, size_t size, int flags), (path, name, value, size, flags))
+BENCH_WRAP(ssize_t, llistxattr, (const char *path, char *list, size_t size), (path, list, size))
+BENCH_WRAP(int, lremovexattr, (const char *path, const char *name), (path, name))
+// opendir() is one openat() (plus an fstat() inside libc):
+BENCH_WRAP(void *, opendir, (const char *path), (path))
+BENCH_WRAP(int, closedir, (void *dir), (dir))
+
+int __real_open64(const char *path, int flags, ...);
+int __wrap_open64(const char *path, int flags, ...);
+int __wrap_open64(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+
+	bench_syscall_count++;
+	if (flags & (O_CREAT | O_TMPFILE))
+	{
+		va_list args;
+		va_start(args, flags);
+		mode = va_arg(args, int);
+		va_end(args);
+	}
+	return __real_open64(path, flags, mode);
+}
@@ -0,0 +1,346 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ *
+ * unsharedfs-bench calls the file system operations directly, without a
+ * mount, to measure the cost of the daemon itself.  Like unsharedfs-microbench,
+ * it can repeat every benchmark and write the results as JSON.
+ */
+
+#include "harness.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// files per directory for the readdir benchmark:
+#define BENCH_DIR_ENTRIES 100
+
+struct bench_case {
+	const char *name;
+	bench_prepare_fn prepare;
+	bench_fn fn;
+};
+
+static void bench_fail(const char *what, int rc)
+{
+	fprintf(stderr, "unsharedfs-bench: %s failed: %s\n", what, strerror(-rc));
+	exit(1);
+}
+
+/* create a file named after the worker in its user directory */
+static void bench_prepare_file(struct bench_worker *w)
+{
+	char path[PATH_MAX];
+	char buf[4096];
+	int fd;
+
+	bench_userdir(w, path);
+	snprintf(path + strlen(path), PATH_MAX - strlen(path), "/file%d", w->index);
+	fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+	memset(buf, 'x', sizeof(buf));
+	if (fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf) || close(fd) != 0
+			|| (getuid() == 0 && chown(path, w->uid, w->gid) != 0))
+		bench_fail("creating the test file", -errno);
+}
+
+static void bench_prepare_dir(struct bench_worker *w)
+{
+	char path[PATH_MAX];
+	size_t len;
+	int i, fd;
+
+	bench_userdir(w, path);
+	len = strlen(path);
+	snprintf(path + len, PATH_MAX - len, "/dir%d", w->index);
+	if (mkdir(path, 0755) != 0 || (getuid() == 0 && chown(path, w->uid, w->gid) != 0))
+		bench_fail("creating the test directory", -errno);
+	len = strlen(path);
+	for (i = 0; i < BENCH_DIR_ENTRIES; i++)
+	{
+		snprintf(path + len, PATH_MAX - len, "/entry%d", i);
+		fd = open(path, O_CREAT | O_WRONLY, 0644);
+		if (fd < 0)
+			bench_fail("creating the directory entries", -errno);
+		close(fd);
+	}
+}
+
+static void bench_getattr(struct bench_worker *w, unsigned long iterations)
+{
+	char path[64];
+	struct stat st;
+	unsigned long i;
+	int rc;
+
+	snprintf(path, sizeof(path), "/file%d", w->index);
+	for (i = 0; i < iterations; i++)
+		if ((rc = unsharedfs_getattr(path, &st)) != 0)
+			bench_fail("getattr", rc);
+}
+
+static void bench_getattr_missing(struct bench_worker *w, unsigned long iterations)
+{
+	struct stat st;
+	unsigned long i;
+	int rc;
+
+	for (i = 0; i < iterations; i++)
+		if ((rc = unsharedfs_getattr("/does-not-exist", &st)) != -ENOENT)
+			bench_fail("getattr", rc);
+}
+
+static void bench_read(struct bench_worker *w, unsigned long iterations)
+{
+	char path[64];
+	char buf[4096];
+	struct fuse_file_info fi;
+	unsigned long i;
+	int rc;
+
+	snprintf(path, sizeof(path), "/file%d", w->index);
+	memset(&fi, 0, sizeof(fi));
+	fi.flags = O_RDONLY;
+	if ((rc = unsharedfs_open(path, &fi)) != 0)
+		bench_fail("open", rc);
+	for (i = 0; i < iterations; i++)
+		if ((rc = unsharedfs_read(NULL, buf, sizeof(buf), 0, &fi)) != sizeof(buf))
+			bench_fail("read", rc);
+	unsharedfs_release(NULL, &fi);
+}
+
+static void bench_open_release(struct bench_worker *w, unsigned long iterations)
+{
+	char path[64];
+	struct fuse_file_info fi;
+	unsigned long i;
+	int rc;
+
+	snprintf(path, sizeof(path), "/file%d", w->index);
+	for (i = 0; i < iterations; i++)
+	{
+		memset(&fi, 0, sizeof(fi));
+		fi.flags = O_RDONLY;
+		if ((rc = unsharedfs_open(path, &fi)) != 0)
+			bench_fail("open", rc);
+		unsharedfs_release(NULL, &fi);
+	}
+}
+
+static void bench_create_unlink(struct bench_worker *w, unsigned long iterations)
+{
+	char path[64];
+	struct fuse_file_info fi;
+	unsigned long i;
+	int rc;
+
+	snprintf(path, sizeof(path), "/new%d", w->index);
+	for (i = 0; i < iterations; i++)
+	{
+		memset(&fi, 0, sizeof(fi));
+		fi.flags = O_CREAT | O_WRONLY;
+		if ((rc = unsharedfs_create(path, 0644, &fi)) != 0)
+			bench_fail("create", rc);
+		unsharedfs_release(NULL, &fi);
+		if ((rc = unsharedfs_unlink(path)) != 0)
+			bench_fail("unlink", rc);
+	}
+}
+
+static void bench_mkdir_rmdir(struct bench_worker *w, unsigned long iterations)
+{
+	char path[64];
+	unsigned long i;
+	int rc;
+
+	snprintf(path, sizeof(path), "/newdir%d", w->index);
+	for (i = 0; i < iterations; i++)
+	{
+		if ((rc = unsharedfs_mkdir(path, 0755)) != 0)
+			bench_fail("mkdir", rc);
+		if ((rc = unsharedfs_rmdir(path)) != 0)
+			bench_fail("rmdir", rc);
+	}
+}
+
+static int bench_filler(void *buf, const char *name, const struct stat *stbuf, off_t off)
+{
+	(*(unsigned long *) buf)++;
+	return 0;
+}
+
+static void bench_readdir(struct bench_worker *w, unsigned long iterations)
+{
+	char path[64];
+	struct fuse_file_info fi;
+	unsigned long i, entries;
+	int rc;
+
+	snprintf(path, sizeof(path), "/dir%d", w->index);
+	for (i = 0; i < iterations; i++)
+	{
+		memset(&fi, 0, sizeof(fi));
+		if ((rc = unsharedfs_opendir(path, &fi)) != 0)
+			bench_fail("opendir", rc);
+		entries = 0;
+		if ((rc = unsharedfs_readdir(path, &entries, bench_filler, 0, &fi)) != 0)
+			bench_fail("readdir", rc);
+		unsharedfs_releasedir(path, &fi);
+	}
+}
+
+static const struct bench_case bench_cases[] = {
+	{ "getattr", bench_prepare_file, bench_getattr },
+	{ "getattr-missing", NULL, bench_getattr_missing },
+	{ "open-release", bench_prepare_file, bench_open_release },
+	{ "read-4k", bench_prepare_file, bench_read },
+	{ "create-unlink", NULL, bench_create_unlink },
+	{ "mkdir-rmdir", NULL, bench_mkdir_rmdir },
+	{ "readdir-100", bench_prepare_dir, bench_readdir },
+};
+
+#define BENCH_CASES (sizeof(bench_cases) / sizeof(bench_cases[0]))
+
+static void bench_usage()
+{
+	size_t i;
+
+	printf( "Benchmark the unsharedfs operations without a mount.\n"
+			"\n"
+			"Usage: unsharedfs-bench [OPTIONS] [BENCHMARK...]\n"
+			"\n"
+			"Options:\n"
+			"  -t N[,N...]               Numbers of threads to run with (default: 1).\n"
+			"  -n N                      Operations per thread (default: 100000).\n"
+			"  -r N                      Repeat every benchmark N times (default: 1).\n"
+			"  -b N                      Take the latency percentiles from batches of N\n"
+			"                            operations (default: 100).\n"
+			"  -o FILE                   Write the results as JSON to FILE (- for stdout).\n"
+			"  -h, --help                Print help.\n"
+			"\n"
+			"Benchmarks:\n");
+	for (i = 0; i < BENCH_CASES; i++)
+		printf("  %s\n", bench_cases[i].name);
+}
+
+static bool bench_selected(const struct bench_case *c, int argc, char *argv[], int first)
+{
+	int i;
+
+	if (first == argc)
+		return true;
+	for (i = first; i < argc; i++)
+		if (strcmp(argv[i], c->name) == 0)
+			return true;
+	return false;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *threads_arg = "1";
+	const char *json_file = NULL;
+	unsigned long iterations = 100000;
+	unsigned long batch = 100;
+	unsigned int runs = 1, r;
+	struct bench_series *results;
+	size_t max_results = BENCH_CASES * 32;
+	size_t nresults = 0;
+	struct bench_env env;
+	struct bench_result result;
+	FILE *table;
+	size_t c;
+	int i;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++)
+	{
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			threads_arg = argv[++i];
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			iterations = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			runs = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+			batch = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+			json_file = argv[++i];
+		else
+		{
+			bench_usage();
+			return strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0 ? 0 : 1;
+		}
+	}
+	if (iterations == 0 || batch == 0 || runs == 0 || runs > BENCH_MAX_RUNS)
+	{
+		fprintf(stderr, "unsharedfs-bench: invalid number of operations or runs\n");
+		return 1;
+	}
+
+	results = calloc(max_results, sizeof(*results));
+	if (results == NULL)
+		return 1;
+
+	// keep stdout clean for the JSON output:
+	table = json_file && strcmp(json_file, "-") == 0 ? stderr : stdout;
+	fprintf(table, "%-18s %8s %14s %14s %12s %10s %10s\n", "benchmark", "threads", "ns/op", "ops/s", "syscalls/op", "p50 ns", "p99 ns");
+	for (c = 0; c < BENCH_CASES; c++)
+	{
+		const char *p = threads_arg;
+
+		if (!bench_selected(&bench_cases[c], argc, argv, i))
+			continue;
+		while (*p)
+		{
+			char *end;
+			long nthreads = strtol(p, &end, 10);
+			struct bench_series *s;
+
+			if (end == p || nthreads <= 0 || (*end != ',' && *end != '\0') || nresults == max_results)
+			{
+				fprintf(stderr, "unsharedfs-bench: invalid thread count: %s\n", threads_arg);
+				return 1;
+			}
+			p = *end == ',' ? end + 1 : end;
+			s = &results[nresults++];
+			s->name = bench_cases[c].name;
+			s->runs = 0;
+			for (r = 0; r < runs; r++)
+			{
+				// a fresh BASEDIR for every run:
+				if (!bench_env_setup(&env, nthreads, UID_ONLY, NULL, false)
+						|| !bench_run_batched(&env, nthreads, iterations, batch, bench_cases[c].prepare, bench_cases[c].fn, NULL, &result))
+				{
+					fprintf(stderr, "unsharedfs-bench: cannot set up %s: %s\n", env.basedir, strerror(errno));
+					return 1;
+				}
+				bench_env_teardown(&env);
+				bench_series_add(s, &result, nthreads, iterations);
+			}
+			fprintf(table, "%-18s %8ld %14.1f %14.0f %12.2f %10.0f %10.0f\n"
+					, s->name
+					, s->threads
+					, bench_series_mean(s, BENCH_NS_PER_OP)
+					, bench_series_mean(s, BENCH_OPS_PER_SEC)
+					, bench_series_mean(s, BENCH_SYSCALLS_PER_OP)
+					, bench_series_mean(s, BENCH_P50_NS)
+					, bench_series_mean(s, BENCH_P99_NS));
+			fflush(table);
+		}
+	}
+
+	if (json_file && !bench_write_json(json_file, "unsharedfs-bench", iterations, results, nresults))
+	{
+		fprintf(stderr, "unsharedfs-bench: cannot write %s: %s\n", json_file, strerror(errno));
+		return 1;
+	}
+	free(results);
+	return 0;
+}
@@ -0,0 +1,458 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ *
+ * unsharedfs-compare compares the JSON results of unsharedfs-bench or
+ * unsharedfs-microbench with a baseline.  Every benchmark is run several
+ * times, and a change only counts if it is statistically significant (by
+ * Welch's t-test at 95% confidence) and larger than a threshold, so that the
+ * noise of a single run is not reported as a regression.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the metrics that are compared, and whether more is better:
+static const struct {
+	const char *name;
+	const char *label;
+	bool higher_is_better;
+} compare_metrics[] = {
+	{ "ops_per_sec", "ops/s", true },
+	{ "p50_ns", "p50", false },
+	{ "p90_ns", "p90", false },
+	{ "p99_ns", "p99", false },
+	{ "syscalls_per_op", "syscalls/op", false },
+};
+
+#define COMPARE_METRICS (sizeof(compare_metrics) / sizeof(compare_metrics[0]))
+
+/*
+ * A minimal JSON reader, for the files that bench_write_json() writes.
+ */
+
+enum json_type { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT };
+
+struct json {
+	enum json_type type;
+	double number;
+	char *string;
+	size_t count;
+	char **keys;           /* JSON_OBJECT */
+	struct json **items;   /* JSON_ARRAY and JSON_OBJECT */
+};
+
+static void json_skip(const char **p)
+{
+	while (**p == ' ' || **p == '\t' || **p == '\n' || **p == '\r')
+		(*p)++;
+}
+
+static char *json_parse_string(const char **p)
+{
+	const char *start;
+	char *s, *d;
+
+	if (**p != '"')
+		return NULL;
+	start = ++*p;
+	while (**p && **p != '"')
+		*p += **p == '\\' && (*p)[1] ? 2 : 1;
+	if (**p != '"')
+		return NULL;
+	s = d = malloc(*p - start + 1);
+	if (s == NULL)
+		return NULL;
+	// the names are plain ASCII; escapes are kept as the escaped character:
+	for (; start < *p; start++)
+	{
+		if (*start == '\\')
+			start++;
+		*d++ = *start;
+	}
+	*d = '\0';
+	(*p)++;
+	return s;
+}
+
+static struct json *json_parse(const char **p)
+{
+	struct json *j = calloc(1, sizeof(*j));
+	char *end;
+
+	if (j == NULL)
+		return NULL;
+	json_skip(p);
+	if (**p == '{' || **p == '[')
+	{
+		bool object = **p == '{';
+		char close = object ? '}' : ']';
+
+		j->type = object ? JSON_OBJECT : JSON_ARRAY;
+		(*p)++;
+		json_skip(p);
+		while (**p != close)
+		{
+			char *key = NULL;
+			struct json *item;
+
+			if (j->count && *(*p)++ != ',')
+				return NULL;
+			json_skip(p);
+			if (object)
+			{
+				if ((key = json_parse_string(p)) == NULL)
+					return NULL;
+				json_skip(p);
+				if (*(*p)++ != ':')
+					return NULL;
+			}
+			if ((item = json_parse(p)) == NULL)
+				return NULL;
+			j->items = realloc(j->items, (j->count + 1) * sizeof(*j->items));
+			j->keys = realloc(j->keys, (j->count + 1) * sizeof(*j->keys));
+			if (j->items == NULL || j->keys == NULL)
+				return NULL;
+			j->items[j->count] = item;
+			j->keys[j->count] = key;
+			j->count++;
+			json_skip(p);
+		}
+		(*p)++;
+	}
+	else if (**p == '"')
+	{
+		j->type = JSON_STRING;
+		if ((j->string = json_parse_string(p)) == NULL)
+			return NULL;
+	}
+	else if (strncmp(*p, "true", 4) == 0 || strncmp(*p, "false", 5) == 0)
+	{
+		j->type = JSON_BOOL;
+		j->number = **p == 't';
+		*p += **p == 't' ? 4 : 5;
+	}
+	else if (strncmp(*p, "null", 4) == 0)
+		*p += 4;
+	else
+	{
+		j->type = JSON_NUMBER;
+		j->number = strtod(*p, &end);
+		if (end == *p)
+			return NULL;
+		*p = end;
+	}
+	return j;
+}
+
+static const struct json *json_get(const struct json *j, const char *key, enum json_type type)
+{
+	size_t i;
+
+	if (j == NULL || j->type != JSON_OBJECT)
+		return NULL;
+	for (i = 0; i < j->count; i++)
+		if (strcmp(j->keys[i], key) == 0)
+			return j->items[i]->type == type ? j->items[i] : NULL;
+	return NULL;
+}
+
+static struct json *json_load(const char *file)
+{
+	struct json *j = NULL;
+	const char *p;
+	char *buf;
+	long size;
+	FILE *fp;
+
+	fp = fopen(file, "r");
+	if (fp == NULL)
+		return NULL;
+	if (fseek(fp, 0, SEEK_END) == 0 && (size = ftell(fp)) >= 0 && fseek(fp, 0, SEEK_SET) == 0
+			&& (buf = malloc(size + 1)) != NULL)
+	{
+		if (fread(buf, 1, size, fp) == (size_t) size)
+		{
+			buf[size] = '\0';
+			p = buf;
+			j = json_parse(&p);
+			if (j == NULL || j->type != JSON_OBJECT || json_get(j, "results", JSON_ARRAY) == NULL)
+			{
+				j = NULL;
+				errno = EINVAL;
+			}
+		}
+		// the parsed values are kept until the program ends
+		free(buf);
+	}
+	fclose(fp);
+	return j;
+}
+
+/*
+ * Statistics.
+ */
+
+struct compare_stats {
+	size_t n;
+	double mean;
+	double var;            /* sample variance */
+};
+
+static void compare_stats(const struct json *samples, struct compare_stats *st)
+{
+	size_t i;
+
+	memset(st, 0, sizeof(*st));
+	if (samples == NULL)
+		return;
+	for (i = 0; i < samples->count; i++)
+		if (samples->items[i]->type == JSON_NUMBER)
+		{
+			st->n++;
+			st->mean += samples->items[i]->number;
+		}
+	if (st->n == 0)
+		return;
+	st->mean /= st->n;
+	for (i = 0; i < samples->count; i++)
+		if (samples->items[i]->type == JSON_NUMBER)
+			st->var += (samples->items[i]->number - st->mean) * (samples->items[i]->number - st->mean);
+	if (st->n > 1)
+		st->var /= st->n - 1;
+}
+
+/* the two-sided 95% quantile of Student's t distribution */
+static double compare_t95(double df)
+{
+	static const double table[] = {
+		12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+		2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+		2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+	};
+
+	if (df < 1)
+		return table[0];
+	if (df <= 30)
+		return table[(int) df - 1];
+	// the rest of the table, close enough:
+	return 1.960 + 2.5 / df;
+}
+
+enum compare_verdict { SAME, BETTER, WORSE, UNKNOWN };
+
+struct compare_delta {
+	double base;
+	double current;
+	double delta;          /* relative change of the mean */
+	double ci;             /* half-width of its 95% confidence interval (relative) */
+	enum compare_verdict verdict;
+};
+
+/*
+ * A change is significant if the confidence interval of the difference of the
+ * means (Welch's t-test) does not include zero, and it is larger than the
+ * threshold.
+ */
+static void compare_metric(const struct compare_stats *b, const struct compare_stats *c, bool higher_is_better
+		, double threshold, struct compare_delta *d)
+{
+	double se, df, diff, num, den;
+
+	memset(d, 0, sizeof(*d));
+	d->base = b->mean;
+	d->current = c->mean;
+	d->verdict = UNKNOWN;
+	if (b->n == 0 || c->n == 0 || b->mean == 0)
+		return;
+	diff = c->mean - b->mean;
+	d->delta = diff / b->mean;
+	se = sqrt(b->var / b->n + c->var / c->n);
+	if (se > 0)
+	{
+		// one run on either side gives no variance to test with:
+		if (b->n < 2 || c->n < 2)
+			return;
+		num = (b->var / b->n + c->var / c->n) * (b->var / b->n + c->var / c->n);
+		den = (b->var / b->n) * (b->var / b->n) / (b->n - 1) + (c->var / c->n) * (c->var / c->n) / (c->n - 1);
+		df = den > 0 ? num / den : b->n + c->n - 2;
+		d->ci = compare_t95(df) * se / fabs(b->mean);
+	}
+	if (fabs(d->delta) <= d->ci || fabs(d->delta) < threshold)
+		d->verdict = SAME;
+	else
+		d->verdict = (diff > 0) == higher_is_better ? BETTER : WORSE;
+}
+
+/*
+ * Comparison and report.
+ */
+
+static const struct json *compare_find(const struct json *results, const char *name, double threads)
+{
+	const struct json *n, *t;
+	size_t i;
+
+	for (i = 0; i < results->count; i++)
+	{
+		n = json_get(results->items[i], "name", JSON_STRING);
+		t = json_get(results->items[i], "threads", JSON_NUMBER);
+		if (n && t && strcmp(n->string, name) == 0 && t->number == threads)
+			return results->items[i];
+	}
+	return NULL;
+}
+
+static void compare_check_same(const struct json *base, const struct json *current, const char *key)
+{
+	const struct json *b = json_get(base, key, JSON_NUMBER), *c = json_get(current, key, JSON_NUMBER);
+	const struct json *bs = json_get(base, key, JSON_STRING), *cs = json_get(current, key, JSON_STRING);
+
+	if ((b && c && b->number != c->number) || (bs && cs && strcmp(bs->string, cs->string) != 0))
+		printf("warning: the %s of the baseline and the current run differ; the numbers may not be comparable\n", key);
+}
+
+/* compare one pair of files; returns the number of regressions */
+static int compare_files(const char *base_file, const char *current_file, double threshold)
+{
+	const struct json *base = json_load(base_file), *current, *bres, *cres, *name;
+	char regressions[8192];
+	size_t i, m, len = 0;
+	int count = 0;
+
+	if (base == NULL)
+	{
+		fprintf(stderr, "unsharedfs-compare: cannot read %s: %s\n", base_file, strerror(errno));
+		exit(2);
+	}
+	current = json_load(current_file);
+	if (current == NULL)
+	{
+		fprintf(stderr, "unsharedfs-compare: cannot read %s: %s\n", current_file, strerror(errno));
+		exit(2);
+	}
+	bres = json_get(base, "results", JSON_ARRAY);
+	cres = json_get(current, "results", JSON_ARRAY);
+	name = json_get(current, "benchmark", JSON_STRING);
+
+	printf("%s: %s (baseline) vs. %s\n", name ? name->string : current_file, base_file, current_file);
+	compare_check_same(base, current, "benchmark");
+	compare_check_same(base, current, "iterations");
+	compare_check_same(base, current, "cpus");
+	compare_check_same(base, current, "machine");
+	compare_check_same(base, current, "root");
+	printf("%-20s %7s", "benchmark", "threads");
+	for (m = 0; m < COMPARE_METRICS; m++)
+		printf(" %15s", compare_metrics[m].label);
+	printf("\n");
+
+	regressions[0] = '\0';
+	for (i = 0; i < cres->count; i++)
+	{
+		const struct json *c = cres->items[i], *b;
+		const struct json *n = json_get(c, "name", JSON_STRING), *t = json_get(c, "threads", JSON_NUMBER);
+
+		if (n == NULL || t == NULL)
+			continue;
+		printf("%-20s %7.0f", n->string, t->number);
+		b = compare_find(bres, n->string, t->number);
+		if (b == NULL)
+		{
+			printf(" (not in the baseline)\n");
+			continue;
+		}
+		for (m = 0; m < COMPARE_METRICS; m++)
+		{
+			struct compare_stats bs, cs;
+			struct compare_delta d;
+			char cell[32];
+
+			compare_stats(json_get(json_get(b, "samples", JSON_OBJECT), compare_metrics[m].name, JSON_ARRAY), &bs);
+			compare_stats(json_get(json_get(c, "samples", JSON_OBJECT), compare_metrics[m].name, JSON_ARRAY), &cs);
+			compare_metric(&bs, &cs, compare_metrics[m].higher_is_better, threshold, &d);
+			if (d.verdict == UNKNOWN && (bs.n == 0 || cs.n == 0))
+				snprintf(cell, sizeof(cell), "-");
+			else
+				// ! marks a significant regression, + a significant improvement:
+				snprintf(cell, sizeof(cell), "%+.1f%%\302\261%.1f%s", d.delta * 100, d.ci * 100
+						, d.verdict == WORSE ? "!" : d.verdict == BETTER ? "+" : " ");
+			// the column is 15 characters wide, and the ± takes two bytes:
+			printf(" %*s", strchr(cell, '\302') ? 16 : 15, cell);
+			if (d.verdict == WORSE)
+			{
+				count++;
+				if (len < sizeof(regressions))
+					len += snprintf(regressions + len, sizeof(regressions) - len
+							, "  %s (%.0f threads) %s: %.2f -> %.2f (%+.1f%% \302\261 %.1f%%)\n"
+							, n->string, t->number, compare_metrics[m].label
+							, d.base, d.current, d.delta * 100, d.ci * 100);
+			}
+		}
+		printf("\n");
+	}
+	for (i = 0; i < bres->count; i++)
+	{
+		const struct json *n = json_get(bres->items[i], "name", JSON_STRING);
+		const struct json *t = json_get(bres->items[i], "threads", JSON_NUMBER);
+		if (n && t && compare_find(cres, n->string, t->number) == NULL)
+			printf("%-20s %7.0f (not in the current run)\n", n->string, t->number);
+	}
+	if (count)
+		printf("\n%d significant regression(s):\n%s", count, regressions);
+	else
+		printf("\nno significant regressions\n");
+	printf("\n");
+	return count;
+}
+
+static void compare_usage()
+{
+	printf( "Compare benchmark results with a baseline.\n"
+			"\n"
+			"Usage: unsharedfs-compare [OPTIONS] BASELINE CURRENT [BASELINE CURRENT...]\n"
+			"\n"
+			"BASELINE and CURRENT are JSON files written by unsharedfs-bench -o or\n"
+			"unsharedfs-microbench -o, preferably with several runs (-r).\n"
+			"\n"
+			"Options:\n"
+			"  -t PERCENT                Ignore changes smaller than this (default: 5).\n"
+			"  -h, --help                Print help.\n"
+			"\n"
+			"Every cell shows the change of the mean and the 95%% confidence interval;\n"
+			"! marks a significant regression, + a significant improvement.  The exit\n"
+			"status is 1 if there are regressions, and 2 on errors.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	double threshold = 0.05;
+	int i = 1, regressions = 0;
+
+	if (argc > 1 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0))
+	{
+		compare_usage();
+		return 0;
+	}
+	if (argc > 2 && strcmp(argv[1], "-t") == 0)
+	{
+		threshold = strtod(argv[2], NULL) / 100;
+		i = 3;
+	}
+	if (argc - i < 2 || (argc - i) % 2 != 0 || threshold < 0)
+	{
+		compare_usage();
+		return 2;
+	}
+	for (; i < argc; i += 2)
+		regressions += compare_files(argv[i], argv[i + 1], threshold);
+	return regressions ? 1 : 0;
+}
@@ -0,0 +1,764 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ *
+ * libunsharedfs-faults.so is an LD_PRELOAD shim that makes the backing file
+ * system slow or unreliable: it adds latency, occasional stalls and errors
+ * to the file system calls of the process, per call type and path pattern.
+ * Preloaded into unsharedfs, it simulates a slow BASEDIR (or a slow
+ * directory of one user) on any machine:
+ *
+ *   UNSHAREDFS_FAULTS='ops=stat|open,path=/unshared/1001/?*,delay=exp:5ms' \
+ *   LD_PRELOAD=bench/libunsharedfs-faults.so unsharedfs -o allow_other /unshared /my-directory
+ *
+ * The rules are separated by ';', and consist of KEY=VALUE pairs separated
+ * by ',':
+ *   ops=OP[|OP...]   the calls the rule applies to (default: all, see
+ *                    fault_op_names)
+ *   path=GLOB        the paths it applies to (fnmatch(3) pattern, * also
+ *                    matches /; default: all).  Calls on file descriptors
+ *                    use the path they were opened with.
+ *   delay=DIST       added latency: DURATION, fixed:DURATION,
+ *                    uniform:MIN:MAX, exp:MEAN or pareto:MIN:ALPHA
+ *   stall=DURATION   an additional stall, with probability stall_p=P
+ *   errno=ERRNO      fail the call (name like EIO, or number), with
+ *                    probability p=P (default: 1)
+ * Durations are given in ns, us, ms or s (default: ms).  All matching rules
+ * apply: the delays add up, and the first error wins.  The call is delayed
+ * before it is made (or fails).
+ *
+ * With UNSHAREDFS_FAULTS_FILE, the rules are read from a file instead, which
+ * is checked for changes every second, so that a path can be made slow in
+ * the middle of a run.  A summary of the injected faults is printed to
+ * stderr when the process exits.
+ *
+ * The shim is built without _FILE_OFFSET_BITS, and defines both the plain
+ * and the 64-bit variants of every call (and the __xstat family of older
+ * glibc versions).  Structures are passed through as void pointers.
+ */
+
+// for RTLD_NEXT
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FAULT_MAX_RULES 64
+// file descriptors whose path is remembered:
+#define FAULT_MAX_FDS 65536
+// how often UNSHAREDFS_FAULTS_FILE is checked for changes:
+#define FAULT_RELOAD_NS 1000000000ULL
+
+enum fault_op {
+	FOP_STAT
+	,FOP_OPEN
+	,FOP_READ
+	,FOP_WRITE
+	,FOP_CLOSE
+	,FOP_FSYNC
+	,FOP_READDIR
+	,FOP_MKDIR
+	,FOP_RMDIR
+	,FOP_UNLINK
+	,FOP_RENAME
+	,FOP_LINK
+	,FOP_READLINK
+	,FOP_CHMOD
+	,FOP_CHOWN
+	,FOP_TRUNCATE
+	,FOP_UTIMENS
+	,FOP_ACCESS
+	,FOP_STATFS
+	,FOP_XATTR
+	,FOP_MKNOD
+	,FOP_COUNT
+};
+
+static const char *const fault_op_names[FOP_COUNT] = {
+	[FOP_STAT] = "stat",
+	[FOP_OPEN] = "open",
+	[FOP_READ] = "read",
+	[FOP_WRITE] = "write",
+	[FOP_CLOSE] = "close",
+	[FOP_FSYNC] = "fsync",
+	[FOP_READDIR] = "readdir",
+	[FOP_MKDIR] = "mkdir",
+	[FOP_RMDIR] = "rmdir",
+	[FOP_UNLINK] = "unlink",
+	[FOP_RENAME] = "rename",
+	[FOP_LINK] = "link",
+	[FOP_READLINK] = "readlink",
+	[FOP_CHMOD] = "chmod",
+	[FOP_CHOWN] = "chown",
+	[FOP_TRUNCATE] = "truncate",
+	[FOP_UTIMENS] = "utimens",
+	[FOP_ACCESS] = "access",
+	[FOP_STATFS] = "statfs",
+	[FOP_XATTR] = "xattr",
+	[FOP_MKNOD] = "mknod",
+};
+
+enum fault_dist { DIST_NONE, DIST_FIXED, DIST_UNIFORM, DIST_EXP, DIST_PARETO };
+
+struct fault_rule {
+	uint32_t ops;              /* bit mask of enum fault_op */
+	char *path;                /* NULL: every path */
+	enum fault_dist dist;
+	double a, b;               /* parameters of the delay distribution (ns) */
+	double stall_ns;
+	double stall_p;
+	int error;
+	double error_p;
+	// what the rule did:
+	_Atomic uint64_t matched;
+	_Atomic uint64_t delay_ns;
+	_Atomic uint64_t stalls;
+	_Atomic uint64_t errors;
+};
+
+struct fault_rules {
+	struct fault_rule rules[FAULT_MAX_RULES];
+	int count;
+	char *text;
+};
+
+// replaced rule sets are not freed: other threads may still be using them
+static _Atomic(struct fault_rules *) fault_rules = NULL;
+static _Atomic(char *) fault_fdpath[FAULT_MAX_FDS];
+static const char *fault_file = NULL;
+static _Atomic uint64_t fault_next_check = 0;
+static pthread_mutex_t fault_reload_lock = PTHREAD_MUTEX_INITIALIZER;
+// set while the shim itself runs, so that its own calls pass through:
+static __thread bool fault_busy = false;
+static __thread uint64_t fault_random_state = 0;
+
+/*
+ * The real calls.
+ */
+
+#define FAULT_REAL(name) \
+	static __typeof__(name) *real_##name = NULL; \
+	if (real_##name == NULL) \
+		real_##name = (__typeof__(name) *) dlsym(RTLD_NEXT, #name); \
+	if (real_##name == NULL) \
+	{ \
+		errno = ENOSYS; \
+		return -1; \
+	}
+
+static uint64_t fault_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* a uniformly distributed number in (0, 1] */
+static double fault_random(void)
+{
+	uint64_t x = fault_random_state;
+
+	if (x == 0)
+		x = fault_now_ns() ^ ((uint64_t) (uintptr_t) &fault_random_state << 16) ^ 0x9E3779B97F4A7C15ULL;
+	// xorshift64*
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	fault_random_state = x;
+	return ((x * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0) + (1.0 / 9007199254740992.0);
+}
+
+/*
+ * Parsing the rules.
+ */
+
+static int fault_parse_duration(const char *s, double *ns)
+{
+	char *end;
+	double v = strtod(s, &end);
+
+	if (end == s || v < 0)
+		return 0;
+	if (*end == '\0' || strcmp(end, "ms") == 0)
+		v *= 1e6;
+	else if (strcmp(end, "us") == 0)
+		v *= 1e3;
+	else if (strcmp(end, "s") == 0)
+		v *= 1e9;
+	else if (strcmp(end, "ns") != 0)
+		return 0;
+	*ns = v;
+	return 1;
+}
+
+static int fault_parse_probability(const char *s, double *p)
+{
+	char *end;
+
+	*p = strtod(s, &end);
+	return end != s && *end == '\0' && *p >= 0 && *p <= 1;
+}
+
+static int fault_parse_errno(const char *s, int *error)
+{
+	static const struct { const char *name; int value; } names[] = {
+		{ "EIO", EIO }, { "ENOENT", ENOENT }, { "EACCES", EACCES }, { "EPERM", EPERM },
+		{ "ENOSPC", ENOSPC }, { "EDQUOT", EDQUOT }, { "EROFS", EROFS }, { "EAGAIN", EAGAIN },
+		{ "EINTR", EINTR }, { "ETIMEDOUT", ETIMEDOUT }, { "ESTALE", ESTALE }, { "ENOMEM", ENOMEM },
+		{ "EMFILE", EMFILE }, { "ENFILE", ENFILE }, { "EBUSY", EBUSY }, { "ENOTCONN", ENOTCONN },
+	};
+	char *end;
+	size_t i;
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+		if (strcmp(s, names[i].name) == 0)
+		{
+			*error = names[i].value;
+			return 1;
+		}
+	*error = strtol(s, &end, 10);
+	return end != s && *end == '\0' && *error > 0;
+}
+
+/* "DIST[:A[:B]]" */
+static int fault_parse_delay(char *s, struct fault_rule *r)
+{
+	char *a = strchr(s, ':'), *b = NULL;
+
+	if (a == NULL)
+	{
+		r->dist = DIST_FIXED;
+		return fault_parse_duration(s, &r->a);
+	}
+	*a++ = '\0';
+	if ((b = strchr(a, ':')) != NULL)
+		*b++ = '\0';
+	if (strcmp(s, "fixed") == 0 && b == NULL)
+		r->dist = DIST_FIXED;
+	else if (strcmp(s, "exp") == 0 && b == NULL)
+		r->dist = DIST_EXP;
+	else if (strcmp(s, "uniform") == 0 && b != NULL)
+		r->dist = DIST_UNIFORM;
+	else if (strcmp(s, "pareto") == 0 && b != NULL)
+		r->dist = DIST_PARETO;
+	else
+		return 0;
+	if (!fault_parse_duration(a, &r->a))
+		return 0;
+	if (r->dist == DIST_UNIFORM)
+		return fault_parse_duration(b, &r->b) && r->b >= r->a;
+	if (r->dist == DIST_PARETO)
+	{
+		// the shape: the smaller, the heavier the tail
+		r->b = strtod(b, &a);
+		return a != b && *a == '\0' && r->b > 0;
+	}
+	return 1;
+}
+
+static int fault_parse_ops(char *s, uint32_t *ops)
+{
+	char *saveptr = NULL, *tok;
+	int op;
+
+	*ops = 0;
+	for (tok = strtok_r(s, "|", &saveptr); tok != NULL; tok = strtok_r(NULL, "|", &saveptr))
+	{
+		for (op = 0; op < FOP_COUNT; op++)
+			if (strcmp(tok, fault_op_names[op]) == 0)
+				break;
+		if (op == FOP_COUNT)
+			return 0;
+		*ops |= 1u << op;
+	}
+	return *ops != 0;
+}
+
+static int fault_parse_rule(char *s, struct fault_rule *r)
+{
+	char *saveptr = NULL, *tok, *value;
+	int ok = 1;
+
+	memset(r, 0, sizeof(*r));
+	r->ops = (1u << FOP_COUNT) - 1;
+	r->error_p = 1;
+	for (tok = strtok_r(s, ",", &saveptr); ok && tok != NULL; tok = strtok_r(NULL, ",", &saveptr))
+	{
+		value = strchr(tok, '=');
+		if (value == NULL)
+			return 0;
+		*value++ = '\0';
+		if (strcmp(tok, "ops") == 0)
+			ok = fault_parse_ops(value, &r->ops);
+		else if (strcmp(tok, "path") == 0)
+			ok = (r->path = strdup(value)) != NULL;
+		else if (strcmp(tok, "delay") == 0)
+			ok = fault_parse_delay(value, r);
+		else if (strcmp(tok, "stall") == 0)
+			ok = fault_parse_duration(value, &r->stall_ns);
+		else if (strcmp(tok, "stall_p") == 0)
+			ok = fault_parse_probability(value, &r->stall_p);
+		else if (strcmp(tok, "errno") == 0)
+			ok = fault_parse_errno(value, &r->error);
+		else if (strcmp(tok, "p") == 0)
+			ok = fault_parse_probability(value, &r->error_p);
+		else
+			ok = 0;
+	}
+	// a stall without a probability always happens:
+	if (r->stall_ns > 0 && r->stall_p == 0)
+		r->stall_p = 1;
+	return ok;
+}
+
+/* returns NULL on errors (which are printed) */
+static struct fault_rules *fault_parse(const char *text)
+{
+	struct fault_rules *rules = calloc(1, sizeof(*rules));
+	char *copy = strdup(text), *saveptr = NULL, *tok, *line;
+
+	if (rules == NULL || copy == NULL || (rules->text = strdup(text)) == NULL)
+		return NULL;
+	// newlines separate rules as well, for UNSHAREDFS_FAULTS_FILE:
+	for (line = copy; *line; line++)
+		if (*line == '\n')
+			*line = ';';
+	for (tok = strtok_r(copy, ";", &saveptr); tok != NULL; tok = strtok_r(NULL, ";", &saveptr))
+	{
+		while (*tok == ' ' || *tok == '\t')
+			tok++;
+		if (*tok == '\0' || *tok == '#')
+			continue;
+		if (rules->count == FAULT_MAX_RULES)
+		{
+			fprintf(stderr, "unsharedfs-faults: too many rules (at most %d)\n", FAULT_MAX_RULES);
+			return NULL;
+		}
+		line = strdup(tok);
+		if (line == NULL || !fault_parse_rule(tok, &rules->rules[rules->count]))
+		{
+			fprintf(stderr, "unsharedfs-faults: invalid rule: %s\n", line ? line : tok);
+			return NULL;
+		}
+		free(line);
+		rules->count++;
+	}
+	free(copy);
+	return rules;
+}
+
+static void fault_reload(void)
+{
+	struct fault_rules *rules, *old;
+	char *text;
+	long size;
+	FILE *fp;
+
+	pthread_mutex_lock(&fault_reload_lock);
+	fp = fopen(fault_file, "r");
+	if (fp != NULL)
+	{
+		if (fseek(fp, 0, SEEK_END) == 0 && (size = ftell(fp)) >= 0 && fseek(fp, 0, SEEK_SET) == 0
+				&& (text = calloc(1, size + 1)) != NULL)
+		{
+			old = atomic_load(&fault_rules);
+			if (fread(text, 1, size, fp) == (size_t) size && (old == NULL || strcmp(old->text, text) != 0))
+			{
+				// an invalid file keeps the rules that were in effect:
+				rules = fault_parse(text);
+				if (rules != NULL)
+				{
+					atomic_store(&fault_rules, rules);
+					fprintf(stderr, "unsharedfs-faults: %d rule(s) from %s\n", rules->count, fault_file);
+				}
+			}
+			free(text);
+		}
+		fclose(fp);
+	}
+	pthread_mutex_unlock(&fault_reload_lock);
+}
+
+/*
+ * Injecting the faults.
+ */
+
+static double fault_delay_ns(const struct fault_rule *r)
+{
+	switch (r->dist)
+	{
+	case DIST_FIXED:
+		return r->a;
+	case DIST_UNIFORM:
+		return r->a + (r->b - r->a) * fault_random();
+	case DIST_EXP:
+		return -r->a * log(fault_random());
+	case DIST_PARETO:
+		return r->a / pow(fault_random(), 1 / r->b);
+	default:
+		return 0;
+	}
+}
+
+/* apply the rules to a call; returns the errno to fail it with, or 0 */
+static int fault_apply(enum fault_op op, const char *path, int fd)
+{
+	struct fault_rules *rules;
+	double delay = 0;
+	uint64_t now;
+	int i, error = 0;
+
+	if (fault_busy)
+		return 0;
+	if (fault_file != NULL)
+	{
+		now = fault_now_ns();
+		if (now >= atomic_load_explicit(&fault_next_check, memory_order_relaxed))
+		{
+			atomic_store(&fault_next_check, now + FAULT_RELOAD_NS);
+			fault_busy = true;
+			fault_reload();
+			fault_busy = false;
+		}
+	}
+	rules = atomic_load_explicit(&fault_rules, memory_order_acquire);
+	if (rules == NULL || rules->count == 0)
+		return 0;
+	if (path == NULL && fd >= 0 && fd < FAULT_MAX_FDS)
+		path = atomic_load_explicit(&fault_fdpath[fd], memory_order_acquire);
+
+	for (i = 0; i < rules->count; i++)
+	{
+		struct fault_rule *r = &rules->rules[i];
+		double d;
+
+		if (!(r->ops & (1u << op)))
+			continue;
+		if (r->path != NULL && (path == NULL || fnmatch(r->path, path, 0) != 0))
+			continue;
+		atomic_fetch_add_explicit(&r->matched, 1, memory_order_relaxed);
+		d = fault_delay_ns(r);
+		if (r->stall_p > 0 && fault_random() <= r->stall_p)
+		{
+			d += r->stall_ns;
+			atomic_fetch_add_explicit(&r->stalls, 1, memory_order_relaxed);
+		}
+		atomic_fetch_add_explicit(&r->delay_ns, (uint64_t) d, memory_order_relaxed);
+		delay += d;
+		if (r->error && error == 0 && fault_random() <= r->error_p)
+		{
+			error = r->error;
+			atomic_fetch_add_explicit(&r->errors, 1, memory_order_relaxed);
+		}
+	}
+	if (delay >= 1)
+	{
+		struct timespec ts;
+		ts.tv_sec = (time_t) (delay / 1e9);
+		ts.tv_nsec = (long) (delay - ts.tv_sec * 1e9);
+		while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+			;
+	}
+	return error;
+}
+
+static void fault_remember_fd(int fd, const char *path)
+{
+	char *old, *copy;
+
+	// without rules (now or later), nobody asks for the path:
+	if (fd < 0 || fd >= FAULT_MAX_FDS || (fault_file == NULL && atomic_load_explicit(&fault_rules, memory_order_relaxed) == NULL))
+		return;
+	copy = path ? strdup(path) : NULL;
+	old = atomic_exchange(&fault_fdpath[fd], copy);
+	free(old);
+}
+
+static void fault_forget_fd(int fd)
+{
+	if (fd >= 0 && fd < FAULT_MAX_FDS)
+		free(atomic_exchange(&fault_fdpath[fd], NULL));
+}
+
+__attribute__((constructor))
+static void fault_init(void)
+{
+	const char *text = getenv("UNSHAREDFS_FAULTS");
+	struct fault_rules *rules;
+
+	fault_busy = true;
+	fault_file = getenv("UNSHAREDFS_FAULTS_FILE");
+	if (fault_file != NULL)
+		fault_reload();
+	else if (text != NULL)
+	{
+		rules = fault_parse(text);
+		if (rules == NULL)
+		{
+			// running without the faults would give misleading results:
+			fprintf(stderr, "unsharedfs-faults: invalid UNSHAREDFS_FAULTS\n");
+			_exit(1);
+		}
+		atomic_store(&fault_rules, rules);
+	}
+	fault_busy = false;
+}
+
+__attribute__((destructor))
+static void fault_summary(void)
+{
+	struct fault_rules *rules = atomic_load(&fault_rules);
+	int i;
+
+	if (rules == NULL || rules->count == 0)
+		return;
+	fault_busy = true;
+	fprintf(stderr, "unsharedfs-faults: %-4s %12s %14s %10s %10s\n", "rule", "matched", "delay ms", "stalls", "errors");
+	for (i = 0; i < rules->count; i++)
+		fprintf(stderr, "unsharedfs-faults: %-4d %12llu %14.1f %10llu %10llu\n"
+				, i + 1
+				, (unsigned long long) rules->rules[i].matched
+				, rules->rules[i].delay_ns / 1e6
+				, (unsigned long long) rules->rules[i].stalls
+				, (unsigned long long) rules->rules[i].errors);
+}
+
+/*
+ * The intercepted calls: FAULT_PATH for calls on a path, FAULT_FD for calls
+ * on a file descriptor.
+ */
+
+#define FAULT_PATH(ret, name, op, params, path, args) \
+	ret name params \
+	{ \
+		int error; \
+		FAULT_REAL(name) \
+		if ((error = fault_apply(op, path, -1)) != 0) \
+		{ \
+			errno = error; \
+			return -1; \
+		} \
+		return real_##name args; \
+	}
+
+#define FAULT_FD(ret, name, op, params, fd, args) \
+	ret name params \
+	{ \
+		int error; \
+		FAULT_REAL(name) \
+		if ((error = fault_apply(op, NULL, fd)) != 0) \
+		{ \
+			errno = error; \
+			return -1; \
+		} \
+		return real_##name args; \
+	}
+
+// not declared by the headers (or only with other structure types):
+int stat(const char *path, void *buf);
+int stat64(const char *path, void *buf);
+int lstat(const char *path, void *buf);
+int lstat64(const char *path, void *buf);
+int fstat(int fd, void *buf);
+int fstat64(int fd, void *buf);
+int fstatat(int dirfd, const char *path, void *buf, int flags);
+int fstatat64(int dirfd, const char *path, void *buf, int flags);
+int statx(int dirfd, const char *path, int flags, unsigned int mask, void *buf);
+int __xstat(int ver, const char *path, void *buf);
+int __xstat64(int ver, const char *path, void *buf);
+int __lxstat(int ver, const char *path, void *buf);
+int __lxstat64(int ver, const char *path, void *buf);
+int __fxstat(int ver, int fd, void *buf);
+int __fxstat64(int ver, int fd, void *buf);
+int statvfs(const char *path, void *buf);
+int statvfs64(const char *path, void *buf);
+int mkdir(const char *path, unsigned int mode);
+int chmod(const char *path, unsigned int mode);
+int mknod(const char *path, unsigned int mode, unsigned long dev);
+int mkfifo(const char *path, unsigned int mode);
+int utimensat(int dirfd, const char *path, const void *times, int flags);
+ssize_t lgetxattr(const char *path, const char *name, void *value, size_t size);
+int lsetxattr(const char *path, const char *name, const void *value, size_t size, int flags);
+ssize_t llistxattr(const char *path, char *list, size_t size);
+int lremovexattr(const char *path, const char *name);
+ssize_t getxattr(const char *path, const char *name, void *value, size_t size);
+int setxattr(const char *path, const char *name, const void *value, size_t size, int flags);
+ssize_t listxattr(const char *path, char *list, size_t size);
+int removexattr(const char *path, const char *name);
+
+FAULT_PATH(int, stat, FOP_STAT, (const char *path, void *buf), path, (path, buf))
+FAULT_PATH(int, stat64, FOP_STAT, (const char *path, void *buf), path, (path, buf))
+FAULT_PATH(int, lstat, FOP_STAT, (const char *path, void *buf), path, (path, buf))
+FAULT_PATH(int, lstat64, FOP_STAT, (const char *path, void *buf), path, (path, buf))
+FAULT_FD(int, fstat, FOP_STAT, (int fd, void *buf), fd, (fd, buf))
+FAULT_FD(int, fstat64, FOP_STAT, (int fd, void *buf), fd, (fd, buf))
+FAULT_PATH(int, fstatat, FOP_STAT, (int dirfd, const char *path, void *buf, int flags), path, (dirfd, path, buf, flags))
+FAULT_PATH(int, fstatat64, FOP_STAT, (int dirfd, const char *path, void *buf, int flags), path, (dirfd, path, buf, flags))
+FAULT_PATH(int, statx, FOP_STAT, (int dirfd, const char *path, int flags, unsigned int mask, void *buf), path, (dirfd, path, flags, mask, buf))
+// glibc before 2.33 implements the stat calls with these:
+FAULT_PATH(int, __xstat, FOP_STAT, (int ver, const char *path, void *buf), path, (ver, path, buf))
+FAULT_PATH(int, __xstat64, FOP_STAT, (int ver, const char *path, void *buf), path, (ver, path, buf))
+FAULT_PATH(int, __lxstat, FOP_STAT, (int ver, const char *path, void *buf), path, (ver, path, buf))
+FAULT_PATH(int, __lxstat64, FOP_STAT, (int ver, const char *path, void *buf), path, (ver, path, buf))
+FAULT_FD(int, __fxstat, FOP_STAT, (int ver, int fd, void *buf), fd, (ver, fd, buf))
+FAULT_FD(int, __fxstat64, FOP_STAT, (int ver, int fd, void *buf), fd, (ver, fd, buf))
+FAULT_PATH(int, statvfs, FOP_STATFS, (const char *path, void *buf), path, (path, buf))
+FAULT_PATH(int, statvfs64, FOP_STATFS, (const char *path, void *buf), path, (path, buf))
+FAULT_PATH(int, access, FOP_ACCESS, (const char *path, int mode), path, (path, mode))
+FAULT_FD(ssize_t, read, FOP_READ, (int fd, void *buf, size_t size), fd, (fd, buf, size))
+FAULT_FD(ssize_t, pread, FOP_READ, (int fd, void *buf, size_t size, off_t offset), fd, (fd, buf, size, offset))
+FAULT_FD(ssize_t, pread64, FOP_READ, (int fd, void *buf, size_t size, off64_t offset), fd, (fd, buf, size, offset))
+FAULT_FD(ssize_t, write, FOP_WRITE, (int fd, const void *buf, size_t size), fd, (fd, buf, size))
+FAULT_FD(ssize_t, pwrite, FOP_WRITE, (int fd, const void *buf, size_t size, off_t offset), fd, (fd, buf, size, offset))
+FAULT_FD(ssize_t, pwrite64, FOP_WRITE, (int fd, const void *buf, size_t size, off64_t offset), fd, (fd, buf, size, offset))
+FAULT_FD(int, fsync, FOP_FSYNC, (int fd), fd, (fd))
+FAULT_FD(int, fdatasync, FOP_FSYNC, (int fd), fd, (fd))
+FAULT_PATH(int, truncate, FOP_TRUNCATE, (const char *path, off_t length), path, (path, length))
+FAULT_PATH(int, truncate64, FOP_TRUNCATE, (const char *path, off64_t length), path, (path, length))
+FAULT_FD(int, ftruncate, FOP_TRUNCATE, (int fd, off_t length), fd, (fd, length))
+FAULT_FD(int, ftruncate64, FOP_TRUNCATE, (int fd, off64_t length), fd, (fd, length))
+FAULT_PATH(int, mkdir, FOP_MKDIR, (const char *path, unsigned int mode), path, (path, mode))
+FAULT_PATH(int, rmdir, FOP_RMDIR, (const char *path), path, (path))
+FAULT_PATH(int, unlink, FOP_UNLINK, (const char *path), path, (path))
+FAULT_PATH(int, rename, FOP_RENAME, (const char *from, const char *to), from, (from, to))
+FAULT_PATH(int, link, FOP_LINK, (const char *from, const char *to), to, (from, to))
+FAULT_PATH(int, symlink, FOP_LINK, (const char *from, const char *to), to, (from, to))
+FAULT_PATH(ssize_t, readlink, FOP_READLINK, (const char *path, char *buf, size_t size), path, (path, buf, size))
+FAULT_PATH(int, chmod, FOP_CHMOD, (const char *path, unsigned int mode), path, (path, mode))
+FAULT_PATH(int, chown, FOP_CHOWN, (const char *path, uid_t uid, gid_t gid), path, (path, uid, gid))
+FAULT_PATH(int, lchown, FOP_CHOWN, (const char *path, uid_t uid, gid_t gid), path, (path, uid, gid))
+FAULT_PATH(int, mknod, FOP_MKNOD, (const char *path, unsigned int mode, unsigned long dev), path, (path, mode, dev))
+FAULT_PATH(int, mkfifo, FOP_MKNOD, (const char *path, unsigned int mode), path, (path, mode))
+FAULT_PATH(int, utimensat, FOP_UTIMENS, (int dirfd, const char *path, const void *times, int flags), path, (dirfd, path, times, flags))
+FAULT_PATH(ssize_t, lgetxattr, FOP_XATTR, (const char *path, const char *name, void *value, size_t size), path, (path, name, value, size))
+FAULT_PATH(int, lsetxattr, FOP_XATTR, (const char *path, const char *name, const void *value, size_t size, int flags), path, (path, name, value, size, flags))
+FAULT_PATH(ssize_t, llistxattr, FOP_XATTR, (const char *path, char *list, size_t size), path, (path, list, size))
+FAULT_PATH(int, lremovexattr, FOP_XATTR, (const char *path, const char *name), path, (path, name))
+FAULT_PATH(ssize_t, getxattr, FOP_XATTR, (const char *path, const char *name, void *value, size_t size), path, (path, name, value, size))
+FAULT_PATH(int, setxattr, FOP_XATTR, (const char *path, const char *name, const void *value, size_t size, int flags), path, (path, name, value, size, flags))
+FAULT_PATH(ssize_t, listxattr, FOP_XATTR, (const char *path, char *list, size_t size), path, (path, list, size))
+FAULT_PATH(int, removexattr, FOP_XATTR, (const char *path, const char *name), path, (path, name))
+
+int close(int fd)
+{
+	int error;
+	FAULT_REAL(close)
+
+	error = fault_apply(FOP_CLOSE, NULL, fd);
+	// the descriptor is gone even if close() fails:
+	fault_forget_fd(fd);
+	if (error)
+	{
+		real_close(fd);
+		errno = error;
+		return -1;
+	}
+	return real_close(fd);
+}
+
+/*
+ * The open calls remember the path of the new descriptor, for the rules on
+ * the calls that use it.
+ */
+#define FAULT_OPEN(name, params, path, args) \
+	int name params \
+	{ \
+		mode_t mode = 0; \
+		int error, fd; \
+		FAULT_REAL(name) \
+		if (flags & (O_CREAT | O_TMPFILE)) \
+		{ \
+			va_list ap; \
+			va_start(ap, flags); \
+			mode = va_arg(ap, int); \
+			va_end(ap); \
+		} \
+		if ((error = fault_apply(FOP_OPEN, path, -1)) != 0) \
+		{ \
+			errno = error; \
+			return -1; \
+		} \
+		fd = real_##name args; \
+		fault_remember_fd(fd, path); \
+		return fd; \
+	}
+
+FAULT_OPEN(open, (const char *path, int flags, ...), path, (path, flags, mode))
+FAULT_OPEN(open64, (const char *path, int flags, ...), path, (path, flags, mode))
+FAULT_OPEN(openat, (int dirfd, const char *path, int flags, ...), path, (dirfd, path, flags, mode))
+FAULT_OPEN(openat64, (int dirfd, const char *path, int flags, ...), path, (dirfd, path, flags, mode))
+
+/* opening a directory counts as an open */
+DIR *opendir(const char *path)
+{
+	static __typeof__(opendir) *real_opendir = NULL;
+	int error;
+	DIR *dir;
+
+	if (real_opendir == NULL)
+		real_opendir = (__typeof__(opendir) *) dlsym(RTLD_NEXT, "opendir");
+	if (real_opendir == NULL)
+	{
+		errno = ENOSYS;
+		return NULL;
+	}
+	if ((error = fault_apply(FOP_OPEN, path, -1)) != 0)
+	{
+		errno = error;
+		return NULL;
+	}
+	dir = real_opendir(path);
+	if (dir != NULL)
+		fault_remember_fd(dirfd(dir), path);
+	return dir;
+}
+
+/* reading a directory is delayed (or fails) once, at its start, not for every entry */
+#define FAULT_READDIR(type, name) \
+	type *name(DIR *dir) \
+	{ \
+		static __typeof__(name) *real_##name = NULL; \
+		int error; \
+		if (real_##name == NULL) \
+			real_##name = (__typeof__(name) *) dlsym(RTLD_NEXT, #name); \
+		if (real_##name == NULL) \
+		{ \
+			errno = ENOSYS; \
+			return NULL; \
+		} \
+		if (telldir(dir) == 0 && (error = fault_apply(FOP_READDIR, NULL, dirfd(dir))) != 0) \
+		{ \
+			errno = error; \
+			return NULL; \
+		} \
+		return real_##name(dir); \
+	}
+
+FAULT_READDIR(struct dirent, readdir)
+FAULT_READDIR(struct dirent64, readdir64)
+
+int closedir(DIR *dir)
+{
+	FAULT_REAL(closedir)
+	fault_forget_fd(dirfd(dir));
+	return real_closedir(dir);
+}
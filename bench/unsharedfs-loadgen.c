@@ -0,0 +1,802 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ *
+ * unsharedfs-loadgen drives a mounted unsharedfs from many uids at once.
+ * Every worker is a process of its own that switches to one of the uids,
+ * and runs a weighted mix of workloads in its own directory below the
+ * mountpoint.  The workers' statistics live in a shared mapping, and are
+ * reported per uid and per workload when the run is over.
+ */
+
+// for setresuid, setresgid and nftw
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <grp.h>
+#include <limits.h>
+#include <math.h>
+#include <pwd.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define LOADGEN_MAX_UIDS 1024
+// latency histogram: 8 linear sub-buckets per power of two nanoseconds
+#define LOADGEN_SUB_BITS 3
+#define LOADGEN_SUB (1 << LOADGEN_SUB_BITS)
+#define LOADGEN_BUCKETS ((64 - LOADGEN_SUB_BITS + 1) * LOADGEN_SUB)
+// size of the files of the smallfile workload:
+#define LOADGEN_SMALLFILE_SIZE 4096
+
+enum loadgen_workload {
+	WL_STAT          /* stat a random entry of the large directory */
+	,WL_SMALLFILE    /* create, write, read back and delete a small file */
+	,WL_STREAM       /* read the next block of a large file */
+	,WL_READDIR      /* list the large directory */
+	,WL_RENAME       /* rename a file back and forth */
+	,WL_COUNT
+};
+
+static const char *const loadgen_workload_names[WL_COUNT] = {
+	[WL_STAT] = "stat",
+	[WL_SMALLFILE] = "smallfile",
+	[WL_STREAM] = "stream",
+	[WL_READDIR] = "readdir",
+	[WL_RENAME] = "rename",
+};
+
+struct loadgen_wlstats {
+	uint64_t ops;
+	uint64_t errors;
+	uint64_t timeouts;  /* operations slower than the -T timeout */
+	uint64_t bytes;
+	uint64_t latency[LOADGEN_BUCKETS];
+};
+
+/* one per worker, in the shared mapping */
+struct loadgen_worker {
+	uid_t uid;
+	gid_t gid;
+	pid_t pid;
+	int setup_errno;  /* errno of a failed setup, 0 otherwise */
+	uint64_t run_ns;  /* time the worker ran its workload */
+	struct loadgen_wlstats wl[WL_COUNT];
+};
+
+struct loadgen_shared {
+	_Atomic int ready;   /* workers that finished their setup */
+	_Atomic int go;      /* set once all workers are ready */
+	struct loadgen_worker workers[];
+};
+
+struct loadgen_config {
+	const char *mountpoint;
+	uid_t uids[LOADGEN_MAX_UIDS];
+	int nuids;
+	int per_uid;
+	unsigned int weights[WL_COUNT];
+	unsigned int weight_total;
+	unsigned int seconds;
+	unsigned int entries;      /* size of the large directory */
+	size_t stream_size;
+	size_t block_size;
+	uint64_t timeout_ns;
+};
+
+static uint64_t loadgen_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static unsigned int loadgen_bucket(uint64_t ns)
+{
+	unsigned int e;
+
+	if (ns < LOADGEN_SUB)
+		return ns;
+	e = 63 - __builtin_clzll(ns);
+	return (e - LOADGEN_SUB_BITS + 1) * LOADGEN_SUB + ((ns >> (e - LOADGEN_SUB_BITS)) & (LOADGEN_SUB - 1));
+}
+
+/* the smallest latency that falls into a bucket */
+static uint64_t loadgen_bucket_ns(unsigned int bucket)
+{
+	unsigned int e;
+
+	if (bucket < LOADGEN_SUB)
+		return bucket;
+	e = bucket / LOADGEN_SUB + LOADGEN_SUB_BITS - 1;
+	return (uint64_t) (LOADGEN_SUB + bucket % LOADGEN_SUB) << (e - LOADGEN_SUB_BITS);
+}
+
+static double loadgen_percentile(const uint64_t latency[LOADGEN_BUCKETS], uint64_t ops, double p)
+{
+	uint64_t rank = (uint64_t) ceil(ops * p), seen = 0;
+	unsigned int i;
+
+	if (ops == 0)
+		return 0;
+	for (i = 0; i < LOADGEN_BUCKETS; i++)
+	{
+		seen += latency[i];
+		if (seen >= rank)
+			return loadgen_bucket_ns(i);
+	}
+	return loadgen_bucket_ns(LOADGEN_BUCKETS - 1);
+}
+
+/* xorshift64*: every worker gets its own sequence */
+static uint64_t loadgen_random(uint64_t *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 2685821657736338717ULL;
+}
+
+/*
+ * Worker side.
+ */
+
+struct loadgen_ctx {
+	const struct loadgen_config *cfg;
+	struct loadgen_worker *w;
+	char dir[PATH_MAX];        /* the worker's directory */
+	char *block;
+	uint64_t rnd;
+	unsigned long smallfile_seq;
+	off_t stream_offset;
+	int rename_state;
+};
+
+static int loadgen_path(char path[PATH_MAX], const struct loadgen_ctx *ctx, const char *fmt, unsigned long n)
+{
+	int len = snprintf(path, PATH_MAX, "%s/", ctx->dir);
+
+	if (len >= PATH_MAX || snprintf(path + len, PATH_MAX - len, fmt, n) >= PATH_MAX - len)
+	{
+		errno = ENAMETOOLONG;
+		return 0;
+	}
+	return 1;
+}
+
+static int loadgen_write_file(const char *path, const char *buf, size_t size, size_t block)
+{
+	int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+	size_t done;
+
+	if (fd < 0)
+		return 0;
+	for (done = 0; done < size; done += block)
+	{
+		size_t n = size - done < block ? size - done : block;
+		if (write(fd, buf, n) != (ssize_t) n)
+		{
+			close(fd);
+			return 0;
+		}
+	}
+	return close(fd) == 0;
+}
+
+static int loadgen_setup(struct loadgen_ctx *ctx)
+{
+	const struct loadgen_config *cfg = ctx->cfg;
+	char path[PATH_MAX];
+	unsigned int i;
+
+	if (mkdir(ctx->dir, 0755) != 0)
+		return 0;
+	if (cfg->weights[WL_STAT] || cfg->weights[WL_READDIR])
+	{
+		if (!loadgen_path(path, ctx, "dir", 0) || mkdir(path, 0755) != 0)
+			return 0;
+		for (i = 0; i < cfg->entries; i++)
+		{
+			int fd;
+			if (!loadgen_path(path, ctx, "dir/entry%lu", i))
+				return 0;
+			fd = open(path, O_CREAT | O_WRONLY, 0644);
+			if (fd < 0)
+				return 0;
+			close(fd);
+		}
+	}
+	if (cfg->weights[WL_STREAM])
+	{
+		if (!loadgen_path(path, ctx, "stream", 0)
+				|| !loadgen_write_file(path, ctx->block, cfg->stream_size, cfg->block_size))
+			return 0;
+	}
+	if (cfg->weights[WL_RENAME])
+	{
+		if (!loadgen_path(path, ctx, "rename%lu", 0)
+				|| !loadgen_write_file(path, ctx->block, 0, cfg->block_size))
+			return 0;
+	}
+	return 1;
+}
+
+/* run one operation of a workload; returns the bytes transferred, or -1 */
+static ssize_t loadgen_op(struct loadgen_ctx *ctx, enum loadgen_workload wl)
+{
+	const struct loadgen_config *cfg = ctx->cfg;
+	char path[PATH_MAX], path2[PATH_MAX];
+	struct stat st;
+	ssize_t n = 0;
+	int fd;
+
+	switch (wl)
+	{
+	case WL_STAT:
+		if (!loadgen_path(path, ctx, "dir/entry%lu", loadgen_random(&ctx->rnd) % cfg->entries))
+			return -1;
+		return stat(path, &st) == 0 ? 0 : -1;
+
+	case WL_SMALLFILE:
+		if (!loadgen_path(path, ctx, "small%lu", ctx->smallfile_seq++))
+			return -1;
+		fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0644);
+		if (fd < 0)
+			return -1;
+		n = write(fd, ctx->block, LOADGEN_SMALLFILE_SIZE);
+		if (close(fd) != 0 || n != LOADGEN_SMALLFILE_SIZE)
+		{
+			unlink(path);
+			return -1;
+		}
+		fd = open(path, O_RDONLY);
+		if (fd >= 0)
+		{
+			n += read(fd, ctx->block, LOADGEN_SMALLFILE_SIZE);
+			close(fd);
+		}
+		if (unlink(path) != 0 || fd < 0 || n != 2 * LOADGEN_SMALLFILE_SIZE)
+			return -1;
+		return n;
+
+	case WL_STREAM:
+		if (!loadgen_path(path, ctx, "stream", 0))
+			return -1;
+		// open once per block: every request the kernel sends is part of the measurement
+		fd = open(path, O_RDONLY);
+		if (fd < 0)
+			return -1;
+		if (ctx->stream_offset + (off_t) cfg->block_size > (off_t) cfg->stream_size)
+			ctx->stream_offset = 0;
+		n = pread(fd, ctx->block, cfg->block_size, ctx->stream_offset);
+		close(fd);
+		if (n <= 0)
+			return -1;
+		ctx->stream_offset += n;
+		return n;
+
+	case WL_READDIR:
+	{
+		DIR *dir;
+		if (!loadgen_path(path, ctx, "dir", 0) || (dir = opendir(path)) == NULL)
+			return -1;
+		errno = 0;
+		while (readdir(dir) != NULL)
+			;
+		n = errno != 0 ? -1 : 0;
+		closedir(dir);
+		return n;
+	}
+
+	case WL_RENAME:
+		if (!loadgen_path(path, ctx, "rename%lu", ctx->rename_state)
+				|| !loadgen_path(path2, ctx, "rename%lu", !ctx->rename_state)
+				|| rename(path, path2) != 0)
+			return -1;
+		ctx->rename_state = !ctx->rename_state;
+		return 0;
+
+	case WL_COUNT:
+		break;
+	}
+	return -1;
+}
+
+static enum loadgen_workload loadgen_pick(struct loadgen_ctx *ctx)
+{
+	unsigned int r = loadgen_random(&ctx->rnd) % ctx->cfg->weight_total;
+	int wl;
+
+	for (wl = 0; wl < WL_COUNT - 1; wl++)
+	{
+		if (r < ctx->cfg->weights[wl])
+			break;
+		r -= ctx->cfg->weights[wl];
+	}
+	return wl;
+}
+
+static int loadgen_remove(const char *path, const struct stat *sb, int type, struct FTW *ftw)
+{
+	return remove(path);
+}
+
+static int loadgen_switch_user(uid_t uid, gid_t gid)
+{
+	if (geteuid() != 0)
+		return uid == geteuid() ? 1 : (errno = EPERM, 0);
+	return setgroups(1, &gid) == 0 && setresgid(gid, gid, gid) == 0 && setresuid(uid, uid, uid) == 0;
+}
+
+static void loadgen_worker_main(const struct loadgen_config *cfg, struct loadgen_shared *shared, int index)
+{
+	struct loadgen_worker *w = &shared->workers[index];
+	struct loadgen_ctx ctx;
+	uint64_t deadline, start, t0, t1;
+	size_t block_size;
+	ssize_t n;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.cfg = cfg;
+	ctx.w = w;
+	ctx.rnd = 0x9E3779B97F4A7C15ULL * (index + 1);
+	block_size = cfg->block_size > LOADGEN_SMALLFILE_SIZE ? cfg->block_size : LOADGEN_SMALLFILE_SIZE;
+	ctx.block = malloc(block_size);
+	if (ctx.block)
+		memset(ctx.block, 'x', block_size);
+	errno = 0;
+	if (ctx.block == NULL || !loadgen_switch_user(w->uid, w->gid)
+			|| snprintf(ctx.dir, sizeof(ctx.dir), "%s/.unsharedfs-loadgen.%ld.%d", cfg->mountpoint, (long) getppid(), index) >= (int) sizeof(ctx.dir)
+			|| !loadgen_setup(&ctx))
+		w->setup_errno = errno ? errno : EIO;
+
+	atomic_fetch_add(&shared->ready, 1);
+	while (!atomic_load(&shared->go))
+		usleep(1000);
+
+	if (w->setup_errno == 0)
+	{
+		start = t1 = loadgen_now_ns();
+		deadline = start + (uint64_t) cfg->seconds * 1000000000;
+		while (t1 < deadline)
+		{
+			enum loadgen_workload wl = loadgen_pick(&ctx);
+			struct loadgen_wlstats *s = &w->wl[wl];
+
+			t0 = t1;
+			n = loadgen_op(&ctx, wl);
+			t1 = loadgen_now_ns();
+			s->ops++;
+			s->latency[loadgen_bucket(t1 - t0)]++;
+			if (t1 - t0 > cfg->timeout_ns)
+				s->timeouts++;
+			if (n < 0)
+				s->errors++;
+			else
+				s->bytes += n;
+		}
+		w->run_ns = t1 - start;
+	}
+	if (ctx.dir[0])
+		nftw(ctx.dir, loadgen_remove, 16, FTW_DEPTH | FTW_PHYS);
+	_exit(w->setup_errno ? 1 : 0);
+}
+
+/*
+ * Parent side: configuration and report.
+ */
+
+static gid_t loadgen_gid(uid_t uid)
+{
+	struct passwd *pw = getpwuid(uid);
+	return pw ? pw->pw_gid : (gid_t) uid;
+}
+
+/* parse "UID[-UID][,...]" */
+static int loadgen_parse_uids(struct loadgen_config *cfg, const char *arg)
+{
+	const char *p = arg;
+
+	while (*p)
+	{
+		char *end;
+		unsigned long first, last;
+
+		first = last = strtoul(p, &end, 10);
+		if (end == p)
+			return 0;
+		if (*end == '-')
+		{
+			p = end + 1;
+			last = strtoul(p, &end, 10);
+			if (end == p || last < first)
+				return 0;
+		}
+		if (*end != ',' && *end != '\0')
+			return 0;
+		for (; first <= last; first++)
+		{
+			if (cfg->nuids == LOADGEN_MAX_UIDS)
+				return 0;
+			cfg->uids[cfg->nuids++] = first;
+		}
+		p = *end == ',' ? end + 1 : end;
+	}
+	return cfg->nuids > 0;
+}
+
+/* parse "WORKLOAD[=WEIGHT][,...]" */
+static int loadgen_parse_mix(struct loadgen_config *cfg, const char *arg)
+{
+	char *copy = strdup(arg), *saveptr = NULL, *tok;
+	int ok = copy != NULL;
+	int wl;
+
+	memset(cfg->weights, 0, sizeof(cfg->weights));
+	for (tok = ok ? strtok_r(copy, ",", &saveptr) : NULL; tok != NULL; tok = strtok_r(NULL, ",", &saveptr))
+	{
+		char *eq = strchr(tok, '='), *end;
+		unsigned long weight = 1;
+
+		if (eq)
+		{
+			*eq = '\0';
+			weight = strtoul(eq + 1, &end, 10);
+			if (end == eq + 1 || *end != '\0' || weight > 1000000)
+				ok = 0;
+		}
+		for (wl = 0; wl < WL_COUNT; wl++)
+			if (strcmp(tok, loadgen_workload_names[wl]) == 0)
+				break;
+		if (wl == WL_COUNT)
+			ok = 0;
+		else
+			cfg->weights[wl] = weight;
+	}
+	free(copy);
+	cfg->weight_total = 0;
+	for (wl = 0; wl < WL_COUNT; wl++)
+		cfg->weight_total += cfg->weights[wl];
+	return ok && cfg->weight_total > 0;
+}
+
+static size_t loadgen_parse_size(const char *arg)
+{
+	char *end;
+	unsigned long long n = strtoull(arg, &end, 10);
+
+	switch (*end)
+	{
+	case 'k': case 'K': n <<= 10; end++; break;
+	case 'm': case 'M': n <<= 20; end++; break;
+	case 'g': case 'G': n <<= 30; end++; break;
+	}
+	return end == arg || *end != '\0' ? 0 : n;
+}
+
+/* Jain's fairness index: 1 if all values are equal, 1/n if one value has everything */
+static double loadgen_jain(const double *x, int n)
+{
+	double sum = 0, sumsq = 0;
+	int i;
+
+	for (i = 0; i < n; i++)
+	{
+		sum += x[i];
+		sumsq += x[i] * x[i];
+	}
+	return sumsq > 0 ? sum * sum / (n * sumsq) : 1;
+}
+
+static void loadgen_merge(struct loadgen_wlstats *dst, const struct loadgen_wlstats *src)
+{
+	unsigned int i;
+
+	dst->ops += src->ops;
+	dst->errors += src->errors;
+	dst->timeouts += src->timeouts;
+	dst->bytes += src->bytes;
+	for (i = 0; i < LOADGEN_BUCKETS; i++)
+		dst->latency[i] += src->latency[i];
+}
+
+static void loadgen_print_row(const char *label, const struct loadgen_wlstats *s, double seconds)
+{
+	printf("%-12s %10llu %10.0f %9.1f %9.1f %9.1f %9.1f %9.1f %8llu %8llu\n"
+			, label
+			, (unsigned long long) s->ops
+			, s->ops / seconds
+			, s->bytes / seconds / (1024 * 1024)
+			, loadgen_percentile(s->latency, s->ops, 0.50) / 1000
+			, loadgen_percentile(s->latency, s->ops, 0.90) / 1000
+			, loadgen_percentile(s->latency, s->ops, 0.99) / 1000
+			, loadgen_percentile(s->latency, s->ops, 0.999) / 1000
+			, (unsigned long long) s->errors
+			, (unsigned long long) s->timeouts);
+}
+
+static void loadgen_report(const struct loadgen_config *cfg, const struct loadgen_shared *shared, int nworkers)
+{
+	static const char header[] = "%-12s %10s %10s %9s %9s %9s %9s %9s %8s %8s\n";
+	struct loadgen_wlstats *per_uid, *per_wl, total;
+	double *uid_ops, *uid_wl_ops, *uid_p99;
+	double seconds = 0, p99_min = 0, p99_max = 0;
+	int u, i, wl;
+
+	per_uid = calloc(cfg->nuids, sizeof(*per_uid));
+	per_wl = calloc(WL_COUNT, sizeof(*per_wl));
+	uid_ops = calloc(cfg->nuids, sizeof(*uid_ops));
+	uid_wl_ops = calloc(cfg->nuids, sizeof(*uid_wl_ops));
+	uid_p99 = calloc(cfg->nuids, sizeof(*uid_p99));
+	if (!per_uid || !per_wl || !uid_ops || !uid_wl_ops || !uid_p99)
+	{
+		fprintf(stderr, "unsharedfs-loadgen: out of memory\n");
+		exit(1);
+	}
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < nworkers; i++)
+	{
+		const struct loadgen_worker *w = &shared->workers[i];
+		if (w->run_ns / 1e9 > seconds)
+			seconds = w->run_ns / 1e9;
+		for (wl = 0; wl < WL_COUNT; wl++)
+		{
+			loadgen_merge(&per_uid[i / cfg->per_uid], &w->wl[wl]);
+			loadgen_merge(&per_wl[wl], &w->wl[wl]);
+			loadgen_merge(&total, &w->wl[wl]);
+		}
+	}
+	if (seconds == 0)
+		seconds = cfg->seconds;
+
+	printf("%d uids, %d worker(s) per uid, %.1f seconds\n\n", cfg->nuids, cfg->per_uid, seconds);
+	printf(header, "uid", "ops", "ops/s", "MiB/s", "p50 us", "p90 us", "p99 us", "p99.9 us", "errors", "timeouts");
+	for (u = 0; u < cfg->nuids; u++)
+	{
+		char label[16];
+		snprintf(label, sizeof(label), "%lu", (unsigned long) cfg->uids[u]);
+		loadgen_print_row(label, &per_uid[u], seconds);
+		uid_ops[u] = per_uid[u].ops / seconds;
+		uid_p99[u] = loadgen_percentile(per_uid[u].latency, per_uid[u].ops, 0.99);
+		if (u == 0 || uid_p99[u] < p99_min)
+			p99_min = uid_p99[u];
+		if (u == 0 || uid_p99[u] > p99_max)
+			p99_max = uid_p99[u];
+	}
+	loadgen_print_row("all", &total, seconds);
+
+	printf("\n");
+	printf(header, "workload", "ops", "ops/s", "MiB/s", "p50 us", "p90 us", "p99 us", "p99.9 us", "errors", "timeouts");
+	for (wl = 0; wl < WL_COUNT; wl++)
+		if (cfg->weights[wl])
+			loadgen_print_row(loadgen_workload_names[wl], &per_wl[wl], seconds);
+
+	printf("\nfairness across uids (Jain's index, 1.0 = perfectly fair):\n");
+	printf("  %-12s %.3f", "all", loadgen_jain(uid_ops, cfg->nuids));
+	if (cfg->nuids > 1)
+	{
+		double min = uid_ops[0], max = uid_ops[0];
+		for (u = 1; u < cfg->nuids; u++)
+		{
+			if (uid_ops[u] < min)
+				min = uid_ops[u];
+			if (uid_ops[u] > max)
+				max = uid_ops[u];
+		}
+		printf("  (ops/s min %.0f, max %.0f; p99 min %.1fus, max %.1fus)", min, max, p99_min / 1000, p99_max / 1000);
+	}
+	printf("\n");
+	for (wl = 0; wl < WL_COUNT; wl++)
+	{
+		if (!cfg->weights[wl])
+			continue;
+		for (u = 0; u < cfg->nuids; u++)
+		{
+			uid_wl_ops[u] = 0;
+			for (i = u * cfg->per_uid; i < (u + 1) * cfg->per_uid; i++)
+				uid_wl_ops[u] += shared->workers[i].wl[wl].ops;
+		}
+		printf("  %-12s %.3f\n", loadgen_workload_names[wl], loadgen_jain(uid_wl_ops, cfg->nuids));
+	}
+
+	free(per_uid);
+	free(per_wl);
+	free(uid_ops);
+	free(uid_wl_ops);
+	free(uid_p99);
+}
+
+static void loadgen_usage()
+{
+	int wl;
+
+	printf( "Generate load on a mounted unsharedfs from many uids at once.\n"
+			"\n"
+			"Usage: unsharedfs-loadgen [OPTIONS] MOUNTPOINT\n"
+			"\n"
+			"Options:\n"
+			"  -u UID[-UID][,...]        The uids to run as (default: the current uid).\n"
+			"                            Switching to other uids requires root.\n"
+			"  -w N                      Workers per uid (default: 1).\n"
+			"  -m WORKLOAD[=WEIGHT],...  The workload mix (default: stat=60,smallfile=20,\n"
+			"                            readdir=10,rename=5,stream=5).\n"
+			"  -d SECONDS                Duration of the run (default: 10).\n"
+			"  -e N                      Entries in the directory used by stat and\n"
+			"                            readdir (default: 1000).\n"
+			"  -s SIZE                   Size of the file used by stream (default: 16M).\n"
+			"  -b SIZE                   Block size of stream (default: 1M).\n"
+			"  -T MS                     Count operations slower than this as timeouts\n"
+			"                            (default: 1000).\n"
+			"  -h, --help                Print help.\n"
+			"\n"
+			"Workloads:\n");
+	for (wl = 0; wl < WL_COUNT; wl++)
+		printf("  %s\n", loadgen_workload_names[wl]);
+	printf( "\n"
+			"Every worker uses a directory of its own below MOUNTPOINT, which is\n"
+			"removed at the end of the run.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct loadgen_config cfg;
+	struct loadgen_shared *shared;
+	size_t shared_size;
+	int nworkers, i, failed = 0;
+	int opt;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.per_uid = 1;
+	cfg.seconds = 10;
+	cfg.entries = 1000;
+	cfg.stream_size = 16 << 20;
+	cfg.block_size = 1 << 20;
+	cfg.timeout_ns = 1000000000;
+	loadgen_parse_mix(&cfg, "stat=60,smallfile=20,readdir=10,rename=5,stream=5");
+
+	if (argc > 1 && strcmp(argv[1], "--help") == 0)
+	{
+		loadgen_usage();
+		return 0;
+	}
+	while ((opt = getopt(argc, argv, "u:w:m:d:e:s:b:T:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'u':
+			cfg.nuids = 0;
+			if (!loadgen_parse_uids(&cfg, optarg))
+			{
+				fprintf(stderr, "unsharedfs-loadgen: invalid uid list: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'w':
+			cfg.per_uid = atoi(optarg);
+			break;
+		case 'm':
+			if (!loadgen_parse_mix(&cfg, optarg))
+			{
+				fprintf(stderr, "unsharedfs-loadgen: invalid workload mix: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'd':
+			cfg.seconds = strtoul(optarg, NULL, 10);
+			break;
+		case 'e':
+			cfg.entries = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			cfg.stream_size = loadgen_parse_size(optarg);
+			break;
+		case 'b':
+			cfg.block_size = loadgen_parse_size(optarg);
+			break;
+		case 'T':
+			cfg.timeout_ns = strtoull(optarg, NULL, 10) * 1000000;
+			break;
+		case 'h':
+			loadgen_usage();
+			return 0;
+		default:
+			loadgen_usage();
+			return 1;
+		}
+	}
+	if (optind + 1 != argc)
+	{
+		loadgen_usage();
+		return 1;
+	}
+	cfg.mountpoint = argv[optind];
+	if (cfg.nuids == 0)
+		cfg.uids[cfg.nuids++] = geteuid();
+	if (cfg.per_uid <= 0 || cfg.seconds == 0 || cfg.entries == 0 || cfg.block_size == 0 || cfg.timeout_ns == 0
+			|| cfg.stream_size < cfg.block_size)
+	{
+		fprintf(stderr, "unsharedfs-loadgen: invalid option value\n");
+		return 1;
+	}
+	if (geteuid() != 0)
+		for (i = 0; i < cfg.nuids; i++)
+			if (cfg.uids[i] != geteuid())
+			{
+				fprintf(stderr, "unsharedfs-loadgen: running as uid %lu requires root\n", (unsigned long) cfg.uids[i]);
+				return 1;
+			}
+
+	nworkers = cfg.nuids * cfg.per_uid;
+	shared_size = sizeof(*shared) + nworkers * sizeof(shared->workers[0]);
+	shared = mmap(NULL, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED)
+	{
+		fprintf(stderr, "unsharedfs-loadgen: cannot allocate the statistics: %s\n", strerror(errno));
+		return 1;
+	}
+	for (i = 0; i < nworkers; i++)
+	{
+		struct loadgen_worker *w = &shared->workers[i];
+		w->uid = cfg.uids[i / cfg.per_uid];
+		w->gid = loadgen_gid(w->uid);
+	}
+
+	fflush(stdout);
+	for (i = 0; i < nworkers; i++)
+	{
+		pid_t pid = fork();
+		if (pid < 0)
+		{
+			fprintf(stderr, "unsharedfs-loadgen: cannot start worker: %s\n", strerror(errno));
+			// the workers that are running get to finish:
+			nworkers = i;
+			break;
+		}
+		if (pid == 0)
+			loadgen_worker_main(&cfg, shared, i);
+		shared->workers[i].pid = pid;
+	}
+
+	while (atomic_load(&shared->ready) < nworkers)
+		usleep(1000);
+	fprintf(stderr, "unsharedfs-loadgen: %d workers ready, running for %u seconds\n", nworkers, cfg.seconds);
+	atomic_store(&shared->go, 1);
+
+	for (i = 0; i < nworkers; i++)
+	{
+		struct loadgen_worker *w = &shared->workers[i];
+		int status;
+
+		if (waitpid(w->pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		{
+			if (w->setup_errno)
+				fprintf(stderr, "unsharedfs-loadgen: worker %d (uid %lu) failed to set up: %s\n"
+						, i, (unsigned long) w->uid, strerror(w->setup_errno));
+			else
+				fprintf(stderr, "unsharedfs-loadgen: worker %d (uid %lu) failed\n", i, (unsigned long) w->uid);
+			failed = 1;
+		}
+	}
+
+	loadgen_report(&cfg, shared, nworkers);
+	munmap(shared, shared_size);
+	return failed;
+}
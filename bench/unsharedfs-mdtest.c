@@ -0,0 +1,477 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ *
+ * unsharedfs-mdtest measures metadata operations on a mounted unsharedfs,
+ * in the manner of mdtest: every thread creates its files across a number
+ * of directories, and then all threads stat, list, rename and unlink them,
+ * one phase after the other.  Each phase is timed separately.  Run against
+ * the BASEDIR of the mount as well, the same phases give the overhead of
+ * unsharedfs per operation.
+ *
+ * The threads switch their fsuid and fsgid to the uid they work for, which
+ * is what the kernel passes on to unsharedfs.
+ */
+
+// for setfsuid and setfsgid
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/fsuid.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define MDTEST_MAX_UIDS 1024
+
+enum mdtest_phase {
+	PHASE_CREATE      /* create (and close) every file */
+	,PHASE_STAT       /* stat every file */
+	,PHASE_READDIR    /* list every directory */
+	,PHASE_RENAME     /* rename every file within its directory */
+	,PHASE_UNLINK     /* remove every file */
+	,PHASE_COUNT
+};
+
+static const char *const mdtest_phase_names[PHASE_COUNT] = {
+	[PHASE_CREATE] = "create",
+	[PHASE_STAT] = "stat",
+	[PHASE_READDIR] = "readdir",
+	[PHASE_RENAME] = "rename",
+	[PHASE_UNLINK] = "unlink",
+};
+
+struct mdtest_config {
+	uid_t uids[MDTEST_MAX_UIDS];
+	int nuids;
+	int per_uid;              /* threads per uid */
+	unsigned long files;      /* files per thread */
+	unsigned long fanout;     /* directories per thread */
+	const char *mountpoint;
+	const char *basedir;      /* NULL: don't compare with the BASEDIR */
+	bool gid_dirs;            /* the BASEDIR has gid directories */
+};
+
+struct mdtest_result {
+	uint64_t ops[PHASE_COUNT];
+	uint64_t errors[PHASE_COUNT];
+	uint64_t ns[PHASE_COUNT];
+};
+
+struct mdtest_run;
+
+struct mdtest_thread {
+	pthread_t thread;
+	struct mdtest_run *run;
+	uid_t uid;
+	gid_t gid;
+	int index;
+	char dir[PATH_MAX];       /* the directory of this thread */
+	int setup_errno;
+	uint64_t ops[PHASE_COUNT];
+	uint64_t errors[PHASE_COUNT];
+	uint64_t start_ns[PHASE_COUNT];
+	uint64_t end_ns[PHASE_COUNT];
+};
+
+struct mdtest_run {
+	const struct mdtest_config *cfg;
+	pthread_barrier_t barrier;
+	struct mdtest_thread *threads;
+	int nthreads;
+	bool raw;                 /* run in the BASEDIR, not the mountpoint */
+};
+
+static uint64_t mdtest_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int mdtest_path(char path[PATH_MAX], const struct mdtest_thread *t, unsigned long dir, const char *name, unsigned long n)
+{
+	if (snprintf(path, PATH_MAX, "%s/d%lu/%s%lu", t->dir, dir, name, n) >= PATH_MAX)
+	{
+		errno = ENAMETOOLONG;
+		return 0;
+	}
+	return 1;
+}
+
+/* the thread's directory: below the mountpoint, or in the user's directory of the BASEDIR */
+static int mdtest_setup(struct mdtest_thread *t)
+{
+	const struct mdtest_config *cfg = t->run->cfg;
+	char path[PATH_MAX];
+	unsigned long d;
+	int n;
+
+	if (t->run->raw)
+		n = snprintf(t->dir, sizeof(t->dir), "%s/%lu/.unsharedfs-mdtest.%ld.%d", cfg->basedir
+				, (unsigned long) (cfg->gid_dirs ? t->gid : t->uid), (long) getpid(), t->index);
+	else
+		n = snprintf(t->dir, sizeof(t->dir), "%s/.unsharedfs-mdtest.%ld.%d", cfg->mountpoint, (long) getpid(), t->index);
+	if (n >= (int) sizeof(t->dir))
+	{
+		errno = ENAMETOOLONG;
+		return 0;
+	}
+	if (mkdir(t->dir, 0755) != 0)
+		return 0;
+	for (d = 0; d < cfg->fanout; d++)
+		if (snprintf(path, sizeof(path), "%s/d%lu", t->dir, d) >= (int) sizeof(path) || mkdir(path, 0755) != 0)
+			return 0;
+	return 1;
+}
+
+static void mdtest_cleanup(struct mdtest_thread *t)
+{
+	const struct mdtest_config *cfg = t->run->cfg;
+	char path[PATH_MAX];
+	unsigned long i, d;
+
+	if (!t->dir[0])
+		return;
+	// whatever a failed phase left behind:
+	for (i = 0; i < cfg->files; i++)
+	{
+		d = i % cfg->fanout;
+		if (mdtest_path(path, t, d, "f", i))
+			unlink(path);
+		if (mdtest_path(path, t, d, "r", i))
+			unlink(path);
+	}
+	for (d = 0; d < cfg->fanout; d++)
+		if (snprintf(path, sizeof(path), "%s/d%lu", t->dir, d) < (int) sizeof(path))
+			rmdir(path);
+	rmdir(t->dir);
+}
+
+static int mdtest_op(struct mdtest_thread *t, enum mdtest_phase phase, unsigned long i)
+{
+	const struct mdtest_config *cfg = t->run->cfg;
+	char path[PATH_MAX], path2[PATH_MAX];
+	unsigned long d = i % cfg->fanout;
+	struct dirent *de;
+	struct stat st;
+	DIR *dir;
+	int fd;
+
+	switch (phase)
+	{
+	case PHASE_CREATE:
+		if (!mdtest_path(path, t, d, "f", i))
+			return 0;
+		fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+		return fd >= 0 && close(fd) == 0;
+	case PHASE_STAT:
+		return mdtest_path(path, t, d, "f", i) && stat(path, &st) == 0;
+	case PHASE_READDIR:
+		// i is a directory here:
+		if (snprintf(path, sizeof(path), "%s/d%lu", t->dir, i) >= (int) sizeof(path))
+			return 0;
+		dir = opendir(path);
+		if (dir == NULL)
+			return 0;
+		errno = 0;
+		while ((de = readdir(dir)) != NULL)
+			;
+		fd = errno;
+		closedir(dir);
+		return fd == 0;
+	case PHASE_RENAME:
+		return mdtest_path(path, t, d, "f", i) && mdtest_path(path2, t, d, "r", i) && rename(path, path2) == 0;
+	case PHASE_UNLINK:
+		return mdtest_path(path, t, d, "r", i) && unlink(path) == 0;
+	default:
+		break;
+	}
+	return 0;
+}
+
+static void *mdtest_thread_main(void *arg)
+{
+	struct mdtest_thread *t = arg;
+	const struct mdtest_config *cfg = t->run->cfg;
+	int phase;
+
+	// the fsuid and fsgid are per thread; the gid first, while we may still change it:
+	if (geteuid() == 0)
+	{
+		setfsgid(t->gid);
+		setfsuid(t->uid);
+	}
+	errno = 0;
+	if (!mdtest_setup(t))
+		t->setup_errno = errno ? errno : EIO;
+	pthread_barrier_wait(&t->run->barrier);
+
+	for (phase = 0; phase < PHASE_COUNT; phase++)
+	{
+		unsigned long i, n = phase == PHASE_READDIR ? cfg->fanout : cfg->files;
+
+		pthread_barrier_wait(&t->run->barrier);
+		t->start_ns[phase] = mdtest_now_ns();
+		if (t->setup_errno == 0)
+			for (i = 0; i < n; i++)
+			{
+				t->ops[phase]++;
+				if (!mdtest_op(t, phase, i))
+					t->errors[phase]++;
+			}
+		t->end_ns[phase] = mdtest_now_ns();
+	}
+	mdtest_cleanup(t);
+	return NULL;
+}
+
+static gid_t mdtest_gid(uid_t uid)
+{
+	struct passwd *pw = getpwuid(uid);
+	return pw ? pw->pw_gid : (gid_t) uid;
+}
+
+/* run all phases in the mountpoint or the BASEDIR; returns 0 if a thread could not set up */
+static int mdtest_run(const struct mdtest_config *cfg, bool raw, struct mdtest_result *result)
+{
+	struct mdtest_run run;
+	int i, phase, rc, ok = 1;
+
+	memset(&run, 0, sizeof(run));
+	run.cfg = cfg;
+	run.raw = raw;
+	run.nthreads = cfg->nuids * cfg->per_uid;
+	run.threads = calloc(run.nthreads, sizeof(*run.threads));
+	if (run.threads == NULL)
+		return 0;
+	pthread_barrier_init(&run.barrier, NULL, run.nthreads);
+	for (i = 0; i < run.nthreads; i++)
+	{
+		struct mdtest_thread *t = &run.threads[i];
+		t->run = &run;
+		t->index = i;
+		t->uid = cfg->uids[i / cfg->per_uid];
+		t->gid = mdtest_gid(t->uid);
+		rc = pthread_create(&t->thread, NULL, mdtest_thread_main, t);
+		if (rc != 0)
+		{
+			fprintf(stderr, "unsharedfs-mdtest: cannot create a thread: %s\n", strerror(rc));
+			exit(1);
+		}
+	}
+	for (i = 0; i < run.nthreads; i++)
+		pthread_join(run.threads[i].thread, NULL);
+
+	memset(result, 0, sizeof(*result));
+	for (phase = 0; phase < PHASE_COUNT; phase++)
+	{
+		uint64_t start = UINT64_MAX, end = 0;
+
+		// a phase lasts from the first thread starting it to the last thread finishing it:
+		for (i = 0; i < run.nthreads; i++)
+		{
+			struct mdtest_thread *t = &run.threads[i];
+			if (t->start_ns[phase] < start)
+				start = t->start_ns[phase];
+			if (t->end_ns[phase] > end)
+				end = t->end_ns[phase];
+			result->ops[phase] += t->ops[phase];
+			result->errors[phase] += t->errors[phase];
+		}
+		result->ns[phase] = end > start ? end - start : 1;
+	}
+	for (i = 0; i < run.nthreads; i++)
+		if (run.threads[i].setup_errno)
+		{
+			fprintf(stderr, "unsharedfs-mdtest: thread %d (uid %lu) could not set up %s: %s\n"
+					, i, (unsigned long) run.threads[i].uid, run.threads[i].dir, strerror(run.threads[i].setup_errno));
+			ok = 0;
+		}
+	pthread_barrier_destroy(&run.barrier);
+	free(run.threads);
+	return ok;
+}
+
+static void mdtest_report(const struct mdtest_config *cfg, const struct mdtest_result *mount, const struct mdtest_result *raw)
+{
+	int phase;
+
+	printf("%d uids, %d thread(s) per uid, %lu files in %lu directories per thread\n\n"
+			, cfg->nuids, cfg->per_uid, cfg->files, cfg->fanout);
+	printf("%-10s %10s %12s %10s", "phase", "ops", "ops/s", "errors");
+	if (raw)
+		printf(" %12s %10s %10s", "raw ops/s", "raw errors", "overhead");
+	printf("\n");
+	for (phase = 0; phase < PHASE_COUNT; phase++)
+	{
+		double rate = mount->ops[phase] * 1e9 / mount->ns[phase];
+
+		printf("%-10s %10llu %12.0f %10llu"
+				, mdtest_phase_names[phase]
+				, (unsigned long long) mount->ops[phase]
+				, rate
+				, (unsigned long long) mount->errors[phase]);
+		if (raw)
+		{
+			double raw_rate = raw->ops[phase] * 1e9 / raw->ns[phase];
+			// how many times longer an operation takes through unsharedfs:
+			printf(" %12.0f %10llu %9.2fx"
+					, raw_rate
+					, (unsigned long long) raw->errors[phase]
+					, rate > 0 ? raw_rate / rate : 0);
+		}
+		printf("\n");
+	}
+}
+
+/* parse "UID[-UID][,...]" */
+static int mdtest_parse_uids(struct mdtest_config *cfg, const char *arg)
+{
+	const char *p = arg;
+
+	while (*p)
+	{
+		char *end;
+		unsigned long first, last;
+
+		first = last = strtoul(p, &end, 10);
+		if (end == p)
+			return 0;
+		if (*end == '-')
+		{
+			p = end + 1;
+			last = strtoul(p, &end, 10);
+			if (end == p || last < first)
+				return 0;
+		}
+		if (*end != ',' && *end != '\0')
+			return 0;
+		for (; first <= last; first++)
+		{
+			if (cfg->nuids == MDTEST_MAX_UIDS)
+				return 0;
+			cfg->uids[cfg->nuids++] = first;
+		}
+		p = *end == ',' ? end + 1 : end;
+	}
+	return cfg->nuids > 0;
+}
+
+static void mdtest_usage()
+{
+	printf( "Measure metadata operations on a mounted unsharedfs.\n"
+			"\n"
+			"Usage: unsharedfs-mdtest [OPTIONS] MOUNTPOINT\n"
+			"\n"
+			"Options:\n"
+			"  -u UID[-UID][,...]        The uids to run as (default: the current uid).\n"
+			"                            Switching to other uids requires root.\n"
+			"  -t N                      Threads per uid (default: 1).\n"
+			"  -n N                      Files per thread (default: 10000).\n"
+			"  -f N                      Directories per thread, across which the files\n"
+			"                            are spread (default: 10).\n"
+			"  -r BASEDIR                Run the same phases in BASEDIR/UID, and report the\n"
+			"                            overhead of the mount.\n"
+			"  -g                        BASEDIR has gid directories (mounted with -o gid).\n"
+			"  -h, --help                Print help.\n"
+			"\n"
+			"The phases are create, stat, readdir, rename and unlink.  Every thread uses a\n"
+			"directory of its own, which is removed at the end of the run.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct mdtest_config cfg;
+	struct mdtest_result mount, raw;
+	int opt, i;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.per_uid = 1;
+	cfg.files = 10000;
+	cfg.fanout = 10;
+
+	if (argc > 1 && strcmp(argv[1], "--help") == 0)
+	{
+		mdtest_usage();
+		return 0;
+	}
+	while ((opt = getopt(argc, argv, "u:t:n:f:r:gh")) != -1)
+	{
+		switch (opt)
+		{
+		case 'u':
+			cfg.nuids = 0;
+			if (!mdtest_parse_uids(&cfg, optarg))
+			{
+				fprintf(stderr, "unsharedfs-mdtest: invalid uid list: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 't':
+			cfg.per_uid = atoi(optarg);
+			break;
+		case 'n':
+			cfg.files = strtoul(optarg, NULL, 10);
+			break;
+		case 'f':
+			cfg.fanout = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			cfg.basedir = optarg;
+			break;
+		case 'g':
+			cfg.gid_dirs = true;
+			break;
+		case 'h':
+			mdtest_usage();
+			return 0;
+		default:
+			mdtest_usage();
+			return 1;
+		}
+	}
+	if (optind + 1 != argc)
+	{
+		mdtest_usage();
+		return 1;
+	}
+	cfg.mountpoint = argv[optind];
+	if (cfg.nuids == 0)
+		cfg.uids[cfg.nuids++] = geteuid();
+	if (cfg.per_uid <= 0 || cfg.files == 0 || cfg.fanout == 0)
+	{
+		fprintf(stderr, "unsharedfs-mdtest: invalid option value\n");
+		return 1;
+	}
+	if (geteuid() != 0)
+		for (i = 0; i < cfg.nuids; i++)
+			if (cfg.uids[i] != geteuid())
+			{
+				fprintf(stderr, "unsharedfs-mdtest: running as uid %lu requires root\n", (unsigned long) cfg.uids[i]);
+				return 1;
+			}
+
+	if (!mdtest_run(&cfg, false, &mount))
+		return 1;
+	if (cfg.basedir && !mdtest_run(&cfg, true, &raw))
+		return 1;
+	mdtest_report(&cfg, &mount, cfg.basedir ? &raw : NULL);
+	return 0;
+}
@@ -0,0 +1,294 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ *
+ * unsharedfs-microbench measures the internals that every operation goes
+ * through: path resolution, credential switching and logging.  The results
+ * are printed as a table, and optionally written as JSON for comparing runs
+ * (see unsharedfs-compare).
+ */
+
+#include "harness.h"
+#include "fs_internal.h"
+#include "log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// the path that is resolved by the fullpath benchmarks:
+#define MICROBENCH_PATH "/projects/unsharedfs/src/fs.c"
+// the fallback directory of the fullpath-fallback benchmark:
+#define MICROBENCH_DEFAULTDIR "default"
+
+struct microbench_case {
+	const char *name;
+	enum unsharedfs_fsmode fsmode;
+	const char *defaultdir;
+	bool check_ownership;
+	bench_prepare_fn prepare;
+	bench_fn fn;
+	bool quiet;                  /* discard the messages that the case logs */
+};
+
+/* send stderr to /dev/null; returns the saved stderr, or -1 */
+static int microbench_quiet(void)
+{
+	int saved, null;
+
+	fflush(stderr);
+	if ((saved = dup(STDERR_FILENO)) < 0)
+		return -1;
+	if ((null = open("/dev/null", O_WRONLY)) < 0 || dup2(null, STDERR_FILENO) < 0)
+	{
+		if (null >= 0)
+			close(null);
+		close(saved);
+		return -1;
+	}
+	close(null);
+	return saved;
+}
+
+static void microbench_unquiet(int saved)
+{
+	if (saved < 0)
+		return;
+	fflush(stderr);
+	dup2(saved, STDERR_FILENO);
+	close(saved);
+}
+
+static void microbench_fullpath(struct bench_worker *w, unsigned long iterations)
+{
+	char fpath[PATH_MAX];
+	unsigned long i;
+
+	for (i = 0; i < iterations; i++)
+		if (!unsharedfs_fullpath(fpath, MICROBENCH_PATH))
+		{
+			fprintf(stderr, "unsharedfs-microbench: unsharedfs_fullpath failed: %s\n", strerror(errno));
+			exit(1);
+		}
+}
+
+/* make the worker a user without a uid directory */
+static void microbench_prepare_fallback(struct bench_worker *w)
+{
+	bench_set_context(BENCH_FIRST_UID - 1 - w->index, w->gid, getpid(), w->env->pdata);
+}
+
+static void microbench_context_id(struct bench_worker *w, unsigned long iterations)
+{
+	unsigned long i;
+
+	for (i = 0; i < iterations; i++)
+	{
+		unsharedfs_take_context_id();
+		unsharedfs_drop_context_id();
+	}
+}
+
+/* a message below the log level: only the level check */
+static void microbench_logmsg_level(struct bench_worker *w, unsigned long iterations)
+{
+	unsigned long i;
+
+	for (i = 0; i < iterations; i++)
+		logmsg(LOG_DEBUG, "microbench: suppressed message %lu for %s", i, MICROBENCH_PATH);
+}
+
+/* a message above the log level: formatted, and dropped by the rate limit */
+static void microbench_logmsg_ratelimit(struct bench_worker *w, unsigned long iterations)
+{
+	unsigned long i;
+
+	for (i = 0; i < iterations; i++)
+		logmsg(LOG_WARNING, "microbench: rate limited message for %s", MICROBENCH_PATH);
+}
+
+static const struct microbench_case microbench_cases[] = {
+	{ "fullpath-uid", UID_ONLY, NULL, false, NULL, microbench_fullpath },
+	{ "fullpath-gid", GID_ONLY, NULL, false, NULL, microbench_fullpath },
+	{ "fullpath-fallback", UID_ONLY, MICROBENCH_DEFAULTDIR, false, microbench_prepare_fallback, microbench_fullpath },
+	{ "fullpath-ownership", UID_ONLY, NULL, true, NULL, microbench_fullpath },
+	{ "context-id", UID_ONLY, NULL, false, NULL, microbench_context_id },
+	{ "logmsg-level", UID_ONLY, NULL, false, NULL, microbench_logmsg_level },
+	// the logger prints a summary of the suppressed messages for every run:
+	{ "logmsg-ratelimit", UID_ONLY, NULL, false, NULL, microbench_logmsg_ratelimit, true },
+};
+
+#define MICROBENCH_CASES (sizeof(microbench_cases) / sizeof(microbench_cases[0]))
+
+static void microbench_usage()
+{
+	size_t i;
+
+	printf( "Benchmark the unsharedfs internals.\n"
+			"\n"
+			"Usage: unsharedfs-microbench [OPTIONS] [BENCHMARK...]\n"
+			"\n"
+			"Options:\n"
+			"  -t N[,N...]               Numbers of threads to run with\n"
+			"                            (default: 1, 2, 4, ... up to the number of CPUs).\n"
+			"  -n N                      Operations per thread (default: 1000000).\n"
+			"  -r N                      Repeat every benchmark N times (default: 1).\n"
+			"  -b N                      Take the latency percentiles from batches of N\n"
+			"                            operations (default: 100).\n"
+			"  -o FILE                   Write the results as JSON to FILE (- for stdout).\n"
+			"  -h, --help                Print help.\n"
+			"\n"
+			"Benchmarks:\n");
+	for (i = 0; i < MICROBENCH_CASES; i++)
+		printf("  %s\n", microbench_cases[i].name);
+}
+
+static bool microbench_selected(const struct microbench_case *c, int argc, char *argv[], int first)
+{
+	int i;
+
+	if (first == argc)
+		return true;
+	for (i = first; i < argc; i++)
+		if (strcmp(argv[i], c->name) == 0)
+			return true;
+	return false;
+}
+
+/* parse a list of thread counts, or build the default list */
+static int microbench_threads(const char *arg, long threads[], int max)
+{
+	long cpus, n;
+	int count = 0;
+
+	if (arg == NULL)
+	{
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		if (cpus < 1)
+			cpus = 1;
+		for (n = 1; n < cpus && count < max - 1; n *= 2)
+			threads[count++] = n;
+		threads[count++] = cpus;
+		return count;
+	}
+	while (*arg && count < max)
+	{
+		char *end;
+		n = strtol(arg, &end, 10);
+		if (end == arg || n <= 0 || (*end != ',' && *end != '\0'))
+			return 0;
+		threads[count++] = n;
+		arg = *end == ',' ? end + 1 : end;
+	}
+	return *arg ? 0 : count;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *threads_arg = NULL;
+	const char *json_file = NULL;
+	unsigned long iterations = 1000000;
+	unsigned long batch = 100;
+	unsigned int runs = 1, r;
+	long threads[32];
+	int nthreads_runs;
+	struct bench_series *results;
+	size_t nresults = 0;
+	struct bench_env env;
+	struct bench_result result;
+	FILE *table;
+	size_t c;
+	int i, t;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++)
+	{
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			threads_arg = argv[++i];
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			iterations = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			runs = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+			batch = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+			json_file = argv[++i];
+		else
+		{
+			microbench_usage();
+			return strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0 ? 0 : 1;
+		}
+	}
+	if (iterations == 0 || batch == 0 || runs == 0 || runs > BENCH_MAX_RUNS)
+	{
+		fprintf(stderr, "unsharedfs-microbench: invalid number of operations or runs\n");
+		return 1;
+	}
+	nthreads_runs = microbench_threads(threads_arg, threads, sizeof(threads) / sizeof(threads[0]));
+	if (nthreads_runs == 0)
+	{
+		fprintf(stderr, "unsharedfs-microbench: invalid thread count: %s\n", threads_arg);
+		return 1;
+	}
+	results = calloc(MICROBENCH_CASES * nthreads_runs, sizeof(*results));
+	if (results == NULL)
+		return 1;
+
+	// keep stdout clean for the JSON output:
+	table = json_file && strcmp(json_file, "-") == 0 ? stderr : stdout;
+	fprintf(table, "%-20s %8s %12s %14s %12s %10s %10s\n", "benchmark", "threads", "ns/op", "ops/s", "syscalls/op", "p50 ns", "p99 ns");
+	for (c = 0; c < MICROBENCH_CASES; c++)
+	{
+		const struct microbench_case *mc = &microbench_cases[c];
+
+		if (!microbench_selected(mc, argc, argv, i))
+			continue;
+		for (t = 0; t < nthreads_runs; t++)
+		{
+			struct bench_series *s = &results[nresults++];
+
+			s->name = mc->name;
+			for (r = 0; r < runs; r++)
+			{
+				// the logger flushes its summaries in the teardown:
+				int saved_stderr = mc->quiet ? microbench_quiet() : -1;
+
+				if (!bench_env_setup(&env, threads[t], mc->fsmode, mc->defaultdir, mc->check_ownership)
+						|| !bench_run_batched(&env, threads[t], iterations, batch, mc->prepare, mc->fn, NULL, &result))
+				{
+					int saved_errno = errno;
+					microbench_unquiet(saved_stderr);
+					fprintf(stderr, "unsharedfs-microbench: cannot set up %s: %s\n", env.basedir, strerror(saved_errno));
+					return 1;
+				}
+				bench_env_teardown(&env);
+				microbench_unquiet(saved_stderr);
+				bench_series_add(s, &result, threads[t], iterations);
+			}
+			fprintf(table, "%-20s %8ld %12.2f %14.0f %12.2f %10.0f %10.0f\n"
+					, s->name
+					, s->threads
+					, bench_series_mean(s, BENCH_NS_PER_OP)
+					, bench_series_mean(s, BENCH_OPS_PER_SEC)
+					, bench_series_mean(s, BENCH_SYSCALLS_PER_OP)
+					, bench_series_mean(s, BENCH_P50_NS)
+					, bench_series_mean(s, BENCH_P99_NS));
+			fflush(table);
+		}
+	}
+
+	if (json_file && !bench_write_json(json_file, "unsharedfs-microbench", iterations, results, nresults))
+	{
+		fprintf(stderr, "unsharedfs-microbench: cannot write %s: %s\n", json_file, strerror(errno));
+		return 1;
+	}
+	free(results);
+	return 0;
+}
@@ -0,0 +1,987 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ *
+ * unsharedfs-replay re-executes the operations recorded with
+ * unsharedfs --record, either against a mounted unsharedfs or directly
+ * against the file system operations (like unsharedfs-bench), with the
+ * original timing or faster.
+ *
+ * Every recorded thread is replayed by one replay thread, in the order of
+ * the recording.  Before the replay, the files and directories that the
+ * recording uses without creating them are created (with the size that its
+ * reads need), so that a recording from a production system can be replayed
+ * on an empty file system.
+ */
+
+// for clock_nanosleep, setfsuid and faccessat
+#define _GNU_SOURCE
+
+#include "harness.h"
+#include "fdtab.h"
+#include "log.h"
+#include "opctx.h"
+#include "record.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/fsuid.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/xattr.h>
+
+#define REPLAY_MAX_THREADS 256
+#define REPLAY_HASH_SIZE 4096
+// largest read/write/xattr buffer that is replayed:
+#define REPLAY_BUF_MAX (64 * 1024 * 1024)
+
+struct replay_op {
+	struct unsharedfs_record_op rec;
+	int op;            /* local enum unsharedfs_op, or -1 if unknown */
+	char *path;
+	char *path2;
+	int thread;
+};
+
+/* maps the recorded file handles to the replayed ones */
+struct replay_handle {
+	uint64_t recorded;
+	uint64_t replayed;
+	struct replay_handle *next;
+};
+
+/* paths that the recording uses (for preparing the file system) */
+struct replay_path {
+	char *path;
+	bool needed;       /* used before it was created: create it before the replay */
+	bool dir;
+	uint64_t size;
+	uid_t uid;
+	gid_t gid;
+	struct replay_path *next;
+	struct replay_path *next_needed;
+};
+
+struct replay_opstats {
+	uint64_t count;
+	uint64_t recorded_ns;
+	uint64_t replayed_ns;
+	uint64_t mismatches;
+};
+
+struct replay_thread {
+	pthread_t thread;
+	struct replay_op **ops;
+	size_t nops, maxops;
+	char *buf;
+	size_t bufsize;
+	uid_t fsuid;
+	gid_t fsgid;
+	uint64_t max_lag_ns;
+	struct replay_opstats stats[OP_COUNT];
+};
+
+static struct {
+	const char *mountpoint;    /* NULL: replay through the library */
+	double speed;              /* 0: as fast as possible */
+	bool verbose;
+	struct bench_env env;
+	uint64_t start_ns;
+	bool root;
+} replay;
+
+static struct replay_handle *handles[REPLAY_HASH_SIZE];
+static pthread_mutex_t handles_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void replay_fail(const char *fmt, const char *arg)
+{
+	fprintf(stderr, "unsharedfs-replay: ");
+	fprintf(stderr, fmt, arg, strerror(errno));
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+static void replay_handle_set(uint64_t recorded, uint64_t replayed)
+{
+	struct replay_handle *h;
+	size_t bucket = recorded % REPLAY_HASH_SIZE;
+
+	pthread_mutex_lock(&handles_lock);
+	for (h = handles[bucket]; h != NULL; h = h->next)
+		if (h->recorded == recorded)
+			break;
+	if (h == NULL)
+	{
+		h = malloc(sizeof(*h));
+		if (h == NULL)
+			abort();
+		h->recorded = recorded;
+		h->next = handles[bucket];
+		handles[bucket] = h;
+	}
+	h->replayed = replayed;
+	pthread_mutex_unlock(&handles_lock);
+}
+
+/* look up (and, if remove is set, forget) a handle; returns 0 if it is unknown */
+static int replay_handle_get(uint64_t recorded, uint64_t *replayed, bool remove)
+{
+	struct replay_handle **p, *h;
+	size_t bucket = recorded % REPLAY_HASH_SIZE;
+	int found = 0;
+
+	pthread_mutex_lock(&handles_lock);
+	for (p = &handles[bucket]; (h = *p) != NULL; p = &h->next)
+		if (h->recorded == recorded)
+		{
+			*replayed = h->replayed;
+			found = 1;
+			if (remove)
+			{
+				*p = h->next;
+				free(h);
+			}
+			break;
+		}
+	pthread_mutex_unlock(&handles_lock);
+	return found;
+}
+
+static char *replay_buf(struct replay_thread *t, size_t size)
+{
+	if (size > REPLAY_BUF_MAX)
+		size = REPLAY_BUF_MAX;
+	if (size > t->bufsize)
+	{
+		char *buf = realloc(t->buf, size);
+		if (buf == NULL)
+			return NULL;
+		memset(buf + t->bufsize, 'x', size - t->bufsize);
+		t->buf = buf;
+		t->bufsize = size;
+	}
+	return t->buf;
+}
+
+/*
+ * Replay through a mounted file system.
+ */
+
+static int replay_mount_path(char fpath[PATH_MAX], const char *path)
+{
+	if (snprintf(fpath, PATH_MAX, "%s%s", replay.mountpoint, path ? path : "") >= PATH_MAX)
+	{
+		errno = ENAMETOOLONG;
+		return 0;
+	}
+	return 1;
+}
+
+static void replay_mount_creds(struct replay_thread *t, uid_t uid, gid_t gid)
+{
+	// the fsuid is per thread, and only root may change it:
+	if (!replay.root)
+		return;
+	if (t->fsgid != gid)
+	{
+		setfsgid(gid);
+		t->fsgid = gid;
+	}
+	if (t->fsuid != uid)
+	{
+		setfsuid(uid);
+		t->fsuid = uid;
+	}
+}
+
+#define REPLAY_RESULT(call) ((call) < 0 ? -errno : 0)
+
+static int replay_mount_op(struct replay_thread *t, const struct replay_op *o)
+{
+	const struct unsharedfs_record_op *r = &o->rec;
+	char fpath[PATH_MAX], fpath2[PATH_MAX];
+	struct stat st;
+	struct statvfs stv;
+	uint64_t h;
+	ssize_t n;
+	char *buf;
+	DIR *dir;
+	int fd;
+
+	if (!replay_mount_path(fpath, o->path) || !replay_mount_path(fpath2, o->path2))
+		return -errno;
+	replay_mount_creds(t, r->uid, r->gid);
+	switch (o->op)
+	{
+	case OP_GETATTR:
+		return REPLAY_RESULT(lstat(fpath, &st));
+	case OP_FGETATTR:
+		if (!replay_handle_get(r->fh, &h, false))
+			return -EBADF;
+		return REPLAY_RESULT(fstat(h, &st));
+	case OP_READLINK:
+		if ((buf = replay_buf(t, r->size)) == NULL)
+			return -ENOMEM;
+		return REPLAY_RESULT(readlink(fpath, buf, r->size > 1 ? r->size - 1 : 1));
+	case OP_MKNOD:
+		return REPLAY_RESULT(mknod(fpath, r->mode, 0));
+	case OP_MKDIR:
+		return REPLAY_RESULT(mkdir(fpath, r->mode));
+	case OP_UNLINK:
+		return REPLAY_RESULT(unlink(fpath));
+	case OP_RMDIR:
+		return REPLAY_RESULT(rmdir(fpath));
+	case OP_SYMLINK:
+		// the target is not relative to the mountpoint:
+		return REPLAY_RESULT(symlink(o->path2, fpath));
+	case OP_RENAME:
+		return REPLAY_RESULT(rename(fpath, fpath2));
+	case OP_LINK:
+		return REPLAY_RESULT(link(fpath, fpath2));
+	case OP_CHMOD:
+		return REPLAY_RESULT(chmod(fpath, r->mode));
+	case OP_CHOWN:
+		return REPLAY_RESULT(chown(fpath, r->offset, r->size));
+	case OP_TRUNCATE:
+		return REPLAY_RESULT(truncate(fpath, r->offset));
+	case OP_FTRUNCATE:
+		if (!replay_handle_get(r->fh, &h, false))
+			return -EBADF;
+		return REPLAY_RESULT(ftruncate(h, r->offset));
+	case OP_UTIMENS:
+		return REPLAY_RESULT(utimensat(AT_FDCWD, fpath, NULL, 0));
+	case OP_OPEN:
+	case OP_CREATE:
+		if (o->op == OP_CREATE)
+			fd = open(fpath, r->flags | O_CREAT, r->mode);
+		else
+			fd = open(fpath, r->flags);
+		if (fd < 0)
+			return -errno;
+		replay_handle_set(r->fh, fd);
+		return 0;
+	case OP_READ:
+	case OP_WRITE:
+		if (!replay_handle_get(r->fh, &h, false))
+			return -EBADF;
+		if ((buf = replay_buf(t, r->size)) == NULL)
+			return -ENOMEM;
+		if (o->op == OP_READ)
+			n = pread(h, buf, r->size, r->offset);
+		else
+			n = pwrite(h, buf, r->size, r->offset);
+		return n < 0 ? -errno : n;
+	case OP_STATFS:
+		return REPLAY_RESULT(statvfs(fpath, &stv));
+	case OP_RELEASE:
+		if (!replay_handle_get(r->fh, &h, true))
+			return -EBADF;
+		return REPLAY_RESULT(close(h));
+	case OP_FSYNC:
+		if (!replay_handle_get(r->fh, &h, false))
+			return -EBADF;
+		return REPLAY_RESULT(r->flags ? fdatasync(h) : fsync(h));
+	case OP_SETXATTR:
+		if ((buf = replay_buf(t, r->size)) == NULL)
+			return -ENOMEM;
+		return REPLAY_RESULT(lsetxattr(fpath, o->path2, buf, r->size, r->flags));
+	case OP_GETXATTR:
+		if ((buf = replay_buf(t, r->size)) == NULL)
+			return -ENOMEM;
+		n = lgetxattr(fpath, o->path2, buf, r->size);
+		return n < 0 ? -errno : n;
+	case OP_LISTXATTR:
+		if ((buf = replay_buf(t, r->size)) == NULL)
+			return -ENOMEM;
+		n = llistxattr(fpath, buf, r->size);
+		return n < 0 ? -errno : n;
+	case OP_REMOVEXATTR:
+		return REPLAY_RESULT(lremovexattr(fpath, o->path2));
+	case OP_OPENDIR:
+		dir = opendir(fpath);
+		if (dir == NULL)
+			return -errno;
+		replay_handle_set(r->fh, (uintptr_t) dir);
+		return 0;
+	case OP_READDIR:
+		if (!replay_handle_get(r->fh, &h, false))
+			return -EBADF;
+		dir = (DIR *) (uintptr_t) h;
+		// the recorded readdir read the whole directory:
+		rewinddir(dir);
+		errno = 0;
+		while (readdir(dir) != NULL)
+			;
+		return -errno;
+	case OP_RELEASEDIR:
+		if (!replay_handle_get(r->fh, &h, true))
+			return -EBADF;
+		return REPLAY_RESULT(closedir((DIR *) (uintptr_t) h));
+	case OP_ACCESS:
+		// AT_EACCESS: check with the fsuid, not the real uid
+		return REPLAY_RESULT(faccessat(AT_FDCWD, fpath, r->flags, AT_EACCESS));
+	}
+	return -ENOSYS;
+}
+
+/*
+ * Replay through the file system operations (without a mount).
+ */
+
+static int replay_filler(void *buf, const char *name, const struct stat *stbuf, off_t off)
+{
+	return 0;
+}
+
+static int replay_lib_op(struct replay_thread *t, const struct replay_op *o)
+{
+	const struct unsharedfs_record_op *r = &o->rec;
+	struct fuse_file_info fi;
+	struct stat st;
+	struct statvfs stv;
+	struct timespec tv[2];
+	uint64_t h;
+	char *buf;
+	int rc;
+
+	bench_set_context(r->uid, r->gid, getpid(), replay.env.pdata);
+	memset(&fi, 0, sizeof(fi));
+	fi.flags = r->flags;
+	switch (o->op)
+	{
+	case OP_GETATTR:
+		return unsharedfs_getattr(o->path, &st);
+	case OP_READLINK:
+		if ((buf = replay_buf(t, r->size)) == NULL)
+			return -ENOMEM;
+		return unsharedfs_readlink(o->path, buf, r->size);
+	case OP_MKNOD:
+		return unsharedfs_mknod(o->path, r->mode, 0);
+	case OP_MKDIR:
+		return unsharedfs_mkdir(o->path, r->mode);
+	case OP_UNLINK:
+		return unsharedfs_unlink(o->path);
+	case OP_RMDIR:
+		return unsharedfs_rmdir(o->path);
+	case OP_SYMLINK:
+		return unsharedfs_symlink(o->path2, o->path);
+	case OP_RENAME:
+		return unsharedfs_rename(o->path, o->path2);
+	case OP_LINK:
+		return unsharedfs_link(o->path, o->path2);
+	case OP_CHMOD:
+		return unsharedfs_chmod(o->path, r->mode);
+	case OP_CHOWN:
+		return unsharedfs_chown(o->path, r->offset, r->size);
+	case OP_TRUNCATE:
+		return unsharedfs_truncate(o->path, r->offset);
+	case OP_UTIMENS:
+		tv[0].tv_sec = tv[1].tv_sec = 0;
+		tv[0].tv_nsec = tv[1].tv_nsec = UTIME_NOW;
+		return unsharedfs_utimens(o->path, tv);
+	case OP_STATFS:
+		return unsharedfs_statfs(o->path, &stv);
+	case OP_SETXATTR:
+		if ((buf = replay_buf(t, r->size)) == NULL)
+			return -ENOMEM;
+		return unsharedfs_setxattr(o->path, o->path2, buf, r->size, r->flags);
+	case OP_GETXATTR:
+		if ((buf = replay_buf(t, r->size)) == NULL)
+			return -ENOMEM;
+		return unsharedfs_getxattr(o->path, o->path2, buf, r->size);
+	case OP_LISTXATTR:
+		if ((buf = replay_buf(t, r->size)) == NULL)
+			return -ENOMEM;
+		return unsharedfs_listxattr(o->path, buf, r->size);
+	case OP_REMOVEXATTR:
+		return unsharedfs_removexattr(o->path, o->path2);
+	case OP_ACCESS:
+		return unsharedfs_access(o->path, r->flags);
+	case OP_OPEN:
+	case OP_CREATE:
+	case OP_OPENDIR:
+		if (o->op == OP_OPEN)
+			rc = unsharedfs_open(o->path, &fi);
+		else if (o->op == OP_CREATE)
+			rc = unsharedfs_create(o->path, r->mode, &fi);
+		else
+			rc = unsharedfs_opendir(o->path, &fi);
+		if (rc == 0)
+			replay_handle_set(r->fh, fi.fh);
+		return rc;
+	}
+
+	// the remaining operations work on a file handle:
+	if (!replay_handle_get(r->fh, &h, o->op == OP_RELEASE || o->op == OP_RELEASEDIR))
+		return -EBADF;
+	fi.fh = h;
+	switch (o->op)
+	{
+	case OP_FGETATTR:
+		return unsharedfs_fgetattr(o->path, &st, &fi);
+	case OP_FTRUNCATE:
+		return unsharedfs_ftruncate(o->path, r->offset, &fi);
+	case OP_READ:
+	case OP_WRITE:
+		if ((buf = replay_buf(t, r->size)) == NULL)
+			return -ENOMEM;
+		if (o->op == OP_READ)
+			return unsharedfs_read(o->path, buf, r->size, r->offset, &fi);
+		return unsharedfs_write(o->path, buf, r->size, r->offset, &fi);
+	case OP_RELEASE:
+		return unsharedfs_release(o->path, &fi);
+	case OP_FSYNC:
+		return unsharedfs_fsync(o->path, r->flags, &fi);
+	case OP_READDIR:
+		return unsharedfs_readdir(o->path, NULL, replay_filler, r->offset, &fi);
+	case OP_RELEASEDIR:
+		return unsharedfs_releasedir(o->path, &fi);
+	}
+	return -ENOSYS;
+}
+
+/*
+ * Preparation: create what the recording expects to exist.
+ */
+
+static struct replay_path *paths[REPLAY_HASH_SIZE];
+static struct replay_path *needed_first = NULL, **needed_last = &needed_first;
+
+static struct replay_path *replay_path_lookup(const char *path, bool *created)
+{
+	struct replay_path *p;
+	size_t bucket = unsharedfs_path_hash(path) % REPLAY_HASH_SIZE;
+
+	*created = false;
+	for (p = paths[bucket]; p != NULL; p = p->next)
+		if (strcmp(p->path, path) == 0)
+			return p;
+	p = calloc(1, sizeof(*p));
+	if (p == NULL || (p->path = strdup(path)) == NULL)
+		abort();
+	p->next = paths[bucket];
+	paths[bucket] = p;
+	*created = true;
+	return p;
+}
+
+/* remember that the recording expects path to exist (unless it was seen before) */
+static struct replay_path *replay_path_need(const char *path, bool dir, const struct unsharedfs_record_op *r)
+{
+	char parent[PATH_MAX];
+	struct replay_path *p;
+	bool created;
+	char *slash;
+
+	if (path == NULL || strcmp(path, "/") == 0)
+		return NULL;
+	// parents first, so that they are created first:
+	snprintf(parent, sizeof(parent), "%s", path);
+	slash = strrchr(parent, '/');
+	if (slash != NULL && slash != parent)
+	{
+		*slash = '\0';
+		replay_path_need(parent, true, r);
+	}
+	p = replay_path_lookup(path, &created);
+	if (created)
+	{
+		p->needed = true;
+		p->dir = dir;
+		p->uid = r->uid;
+		p->gid = r->gid;
+		*needed_last = p;
+		needed_last = &p->next_needed;
+	}
+	return p;
+}
+
+/* remember that the recording creates (or removes) path itself */
+static void replay_path_known(const char *path, const struct unsharedfs_record_op *r)
+{
+	char parent[PATH_MAX];
+	bool created;
+	char *slash;
+
+	snprintf(parent, sizeof(parent), "%s", path);
+	slash = strrchr(parent, '/');
+	if (slash != NULL && slash != parent)
+	{
+		*slash = '\0';
+		replay_path_need(parent, true, r);
+	}
+	replay_path_lookup(path, &created);
+}
+
+static void replay_plan(struct replay_op *ops, size_t nops)
+{
+	struct replay_path **fhpaths = calloc(REPLAY_HASH_SIZE, sizeof(*fhpaths));
+	size_t i;
+
+	if (fhpaths == NULL)
+		abort();
+	for (i = 0; i < nops; i++)
+	{
+		const struct unsharedfs_record_op *r = &ops[i].rec;
+		const char *path = ops[i].path;
+		struct replay_path *p;
+
+		switch (ops[i].op)
+		{
+		case OP_CREATE:
+		case OP_MKDIR:
+		case OP_MKNOD:
+		case OP_SYMLINK:
+			replay_path_known(path, r);
+			if (ops[i].op == OP_CREATE && r->result == 0)
+				fhpaths[r->fh % REPLAY_HASH_SIZE] = NULL;
+			break;
+		case OP_RENAME:
+		case OP_LINK:
+			if (r->result == 0)
+				replay_path_need(path, false, r);
+			else
+				replay_path_known(path, r);
+			replay_path_known(ops[i].path2, r);
+			break;
+		case OP_READ:
+			// reads need the file to be large enough:
+			p = fhpaths[r->fh % REPLAY_HASH_SIZE];
+			if (p && p->needed && !p->dir && r->result > 0 && r->offset + r->result > p->size)
+				p->size = r->offset + r->result;
+			break;
+		case -1:
+			break;
+		default:
+			if (path == NULL)
+				break;
+			// the first access decides: if it failed, the path did not exist
+			if (r->result < 0)
+				replay_path_known(path, r);
+			else
+			{
+				p = replay_path_need(path, ops[i].op == OP_OPENDIR || ops[i].op == OP_RMDIR, r);
+				if (ops[i].op == OP_OPEN)
+					fhpaths[r->fh % REPLAY_HASH_SIZE] = p;
+			}
+			break;
+		}
+	}
+	free(fhpaths);
+}
+
+static int replay_prepare_path(struct replay_thread *t, const struct replay_path *p)
+{
+	struct replay_op o;
+	uint64_t fh = UINT64_MAX;
+	int rc;
+
+	// the operations that create it, as the user that first used it:
+	memset(&o, 0, sizeof(o));
+	o.path = p->path;
+	o.rec.uid = p->uid;
+	o.rec.gid = p->gid;
+	o.rec.fh = fh;
+	if (p->dir)
+	{
+		o.op = OP_MKDIR;
+		o.rec.mode = 0755;
+		rc = replay.mountpoint ? replay_mount_op(t, &o) : replay_lib_op(t, &o);
+		return rc == -EEXIST ? 0 : rc;
+	}
+	o.op = OP_CREATE;
+	o.rec.mode = 0644;
+	o.rec.flags = O_RDWR;
+	rc = replay.mountpoint ? replay_mount_op(t, &o) : replay_lib_op(t, &o);
+	if (rc == -EEXIST)
+		return 0;
+	if (rc != 0)
+		return rc;
+	if (p->size)
+	{
+		o.op = OP_FTRUNCATE;
+		o.rec.offset = p->size;
+		rc = replay.mountpoint ? replay_mount_op(t, &o) : replay_lib_op(t, &o);
+	}
+	o.op = OP_RELEASE;
+	if (replay.mountpoint)
+		replay_mount_op(t, &o);
+	else
+		replay_lib_op(t, &o);
+	return rc;
+}
+
+static void replay_prepare(struct replay_thread *t)
+{
+	const struct replay_path *p;
+	unsigned long count = 0, failed = 0;
+
+	for (p = needed_first; p != NULL; p = p->next_needed)
+	{
+		int rc = replay_prepare_path(t, p);
+		count++;
+		if (rc < 0)
+		{
+			failed++;
+			if (replay.verbose)
+				fprintf(stderr, "unsharedfs-replay: cannot create %s: %s\n", p->path, strerror(-rc));
+		}
+	}
+	fprintf(stderr, "unsharedfs-replay: created %lu files and directories used by the recording (%lu failed)\n", count, failed);
+}
+
+/*
+ * Loading and replaying.
+ */
+
+static struct replay_op *replay_load(const char *file, size_t *nops, struct unsharedfs_record_header *hdr)
+{
+	char (*names)[UNSHAREDFS_RECORD_NAME_LEN];
+	struct replay_op *ops = NULL;
+	size_t count = 0, max = 0;
+	int *opmap;
+	FILE *fp;
+	uint32_t i;
+
+	fp = fopen(file, "r");
+	if (fp == NULL)
+		replay_fail("cannot open %s: %s", file);
+	if (fread(hdr, sizeof(*hdr), 1, fp) != 1
+			|| memcmp(hdr->magic, UNSHAREDFS_RECORD_MAGIC, sizeof(UNSHAREDFS_RECORD_MAGIC)) != 0
+			|| hdr->version != UNSHAREDFS_RECORD_VERSION
+			|| hdr->header_size != sizeof(*hdr)
+			|| hdr->record_size != sizeof(struct unsharedfs_record_op)
+			|| hdr->op_count == 0 || hdr->op_count > 1024)
+	{
+		errno = EINVAL;
+		replay_fail("%s is not an unsharedfs record file (of this version): %s", file);
+	}
+	names = calloc(hdr->op_count, sizeof(*names));
+	opmap = calloc(hdr->op_count, sizeof(*opmap));
+	if (names == NULL || opmap == NULL)
+		abort();
+	if (fread(names, sizeof(*names), hdr->op_count, fp) != hdr->op_count)
+		replay_fail("cannot read %s: %s", file);
+	// map the operations by name, in case the numbering changed:
+	for (i = 0; i < hdr->op_count; i++)
+	{
+		int op;
+		names[i][UNSHAREDFS_RECORD_NAME_LEN - 1] = '\0';
+		opmap[i] = -1;
+		for (op = 0; op < OP_COUNT; op++)
+			if (strcmp(names[i], unsharedfs_op_names[op]) == 0)
+				opmap[i] = op;
+	}
+
+	for (;;)
+	{
+		struct replay_op *o;
+
+		if (count == max)
+		{
+			max = max ? 2 * max : 65536;
+			ops = realloc(ops, max * sizeof(*ops));
+			if (ops == NULL)
+				abort();
+		}
+		o = &ops[count];
+		if (fread(&o->rec, sizeof(o->rec), 1, fp) != 1)
+			break;
+		o->path = malloc(o->rec.pathlen + 1);
+		o->path2 = malloc(o->rec.path2len + 1);
+		if (o->path == NULL || o->path2 == NULL)
+			abort();
+		if (fread(o->path, 1, o->rec.pathlen, fp) != o->rec.pathlen
+				|| fread(o->path2, 1, o->rec.path2len, fp) != o->rec.path2len)
+			break;
+		o->path[o->rec.pathlen] = '\0';
+		o->path2[o->rec.path2len] = '\0';
+		if (o->rec.pathlen == 0)
+		{
+			free(o->path);
+			o->path = NULL;
+		}
+		o->op = o->rec.op < hdr->op_count ? opmap[o->rec.op] : -1;
+		count++;
+	}
+	fclose(fp);
+	free(names);
+	free(opmap);
+	*nops = count;
+	return ops;
+}
+
+static int replay_compare_start(const void *a, const void *b)
+{
+	const struct replay_op *x = a, *y = b;
+
+	if (x->rec.start_ns != y->rec.start_ns)
+		return x->rec.start_ns < y->rec.start_ns ? -1 : 1;
+	return x->rec.tid < y->rec.tid ? -1 : x->rec.tid > y->rec.tid;
+}
+
+static void *replay_thread_main(void *arg)
+{
+	struct replay_thread *t = arg;
+	size_t i;
+
+	t->fsuid = (uid_t) -1;
+	t->fsgid = (gid_t) -1;
+	for (i = 0; i < t->nops; i++)
+	{
+		struct replay_op *o = t->ops[i];
+		uint64_t due = 0, t0, t1;
+		int rc;
+
+		if (o->op < 0)
+			continue;
+		if (replay.speed > 0)
+		{
+			struct timespec ts;
+			due = replay.start_ns + (uint64_t) (o->rec.start_ns / replay.speed);
+			ts.tv_sec = due / 1000000000;
+			ts.tv_nsec = due % 1000000000;
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+				;
+		}
+		t0 = bench_now_ns();
+		if (replay.speed > 0 && t0 > due && t0 - due > t->max_lag_ns)
+			t->max_lag_ns = t0 - due;
+		rc = replay.mountpoint ? replay_mount_op(t, o) : replay_lib_op(t, o);
+		t1 = bench_now_ns();
+
+		t->stats[o->op].count++;
+		t->stats[o->op].recorded_ns += o->rec.duration_ns;
+		t->stats[o->op].replayed_ns += t1 - t0;
+		// reads may return less data, but success and errors should match:
+		if ((rc < 0) != (o->rec.result < 0) || (rc < 0 && rc != o->rec.result))
+		{
+			t->stats[o->op].mismatches++;
+			if (replay.verbose)
+				fprintf(stderr, "unsharedfs-replay: %s %s%s%s: recorded %d, replayed %d\n"
+						, unsharedfs_op_names[o->op]
+						, o->path ? o->path : "-"
+						, o->rec.path2len ? " " : ""
+						, o->path2
+						, o->rec.result, rc);
+		}
+	}
+	return NULL;
+}
+
+static void replay_report(const struct unsharedfs_record_header *hdr, struct replay_thread *threads, int nthreads
+		, size_t nops, size_t skipped, uint64_t recorded_ns, uint64_t replayed_ns)
+{
+	struct replay_opstats total[OP_COUNT], sum;
+	uint64_t max_lag = 0;
+	int i, op;
+
+	memset(total, 0, sizeof(total));
+	memset(&sum, 0, sizeof(sum));
+	for (i = 0; i < nthreads; i++)
+	{
+		if (threads[i].max_lag_ns > max_lag)
+			max_lag = threads[i].max_lag_ns;
+		for (op = 0; op < OP_COUNT; op++)
+		{
+			total[op].count += threads[i].stats[op].count;
+			total[op].recorded_ns += threads[i].stats[op].recorded_ns;
+			total[op].replayed_ns += threads[i].stats[op].replayed_ns;
+			total[op].mismatches += threads[i].stats[op].mismatches;
+		}
+	}
+	printf("replayed %zu operations on %d threads against %s in %.3fs (recorded: %.3fs"
+			, nops - skipped
+			, nthreads
+			, replay.mountpoint ? replay.mountpoint : "the library"
+			, replayed_ns / 1e9
+			, recorded_ns / 1e9);
+	if (replay.speed > 0)
+		printf(", speed %gx, max lag %.3fms", replay.speed, max_lag / 1e6);
+	printf(")\n");
+	if (skipped)
+		printf("skipped %zu operations of unknown type\n", skipped);
+	if (hdr->dropped)
+		printf("the recording lost %llu operations to full buffers\n", (unsigned long long) hdr->dropped);
+	printf("\n%-12s %10s %14s %14s %8s %11s\n", "operation", "count", "recorded us", "replayed us", "ratio", "mismatches");
+	for (op = 0; op < OP_COUNT; op++)
+	{
+		if (total[op].count == 0)
+			continue;
+		printf("%-12s %10llu %14.1f %14.1f %8.2f %11llu\n"
+				, unsharedfs_op_names[op]
+				, (unsigned long long) total[op].count
+				, total[op].recorded_ns / 1e3 / total[op].count
+				, total[op].replayed_ns / 1e3 / total[op].count
+				, total[op].recorded_ns ? (double) total[op].replayed_ns / total[op].recorded_ns : 0
+				, (unsigned long long) total[op].mismatches);
+		sum.count += total[op].count;
+		sum.recorded_ns += total[op].recorded_ns;
+		sum.replayed_ns += total[op].replayed_ns;
+		sum.mismatches += total[op].mismatches;
+	}
+	if (sum.count)
+		printf("%-12s %10llu %14.1f %14.1f %8.2f %11llu\n"
+				, "all"
+				, (unsigned long long) sum.count
+				, sum.recorded_ns / 1e3 / sum.count
+				, sum.replayed_ns / 1e3 / sum.count
+				, sum.recorded_ns ? (double) sum.replayed_ns / sum.recorded_ns : 0
+				, (unsigned long long) sum.mismatches);
+}
+
+static void replay_usage()
+{
+	printf( "Replay operations recorded with unsharedfs --record.\n"
+			"\n"
+			"Usage: unsharedfs-replay [OPTIONS] RECORD\n"
+			"\n"
+			"Options:\n"
+			"  -m MOUNTPOINT             Replay against a mounted unsharedfs.  Replaying the\n"
+			"                            operations of other uids requires root.\n"
+			"                            Default: call the operations directly, on a\n"
+			"                            temporary BASEDIR (like unsharedfs-bench).\n"
+			"  -s SPEED                  Replay SPEED times faster than recorded (default: 1),\n"
+			"                            or as fast as possible with 0.\n"
+			"  -n                        Don't create the files the recording uses without\n"
+			"                            creating them.\n"
+			"  -v                        Print every operation whose result differs.\n"
+			"  -h, --help                Print help.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct unsharedfs_record_header hdr;
+	struct replay_op *ops;
+	struct replay_thread *threads;
+	uint32_t tids[REPLAY_MAX_THREADS];
+	size_t nops, skipped = 0, i;
+	uint64_t recorded_ns = 0, t0;
+	bool prepare = true;
+	int nthreads = 0, opt, rc, j;
+
+	replay.speed = 1;
+	if (argc > 1 && strcmp(argv[1], "--help") == 0)
+	{
+		replay_usage();
+		return 0;
+	}
+	while ((opt = getopt(argc, argv, "m:s:nvh")) != -1)
+	{
+		switch (opt)
+		{
+		case 'm':
+			replay.mountpoint = optarg;
+			break;
+		case 's':
+			replay.speed = strtod(optarg, NULL);
+			break;
+		case 'n':
+			prepare = false;
+			break;
+		case 'v':
+			replay.verbose = true;
+			break;
+		case 'h':
+			replay_usage();
+			return 0;
+		default:
+			replay_usage();
+			return 1;
+		}
+	}
+	if (optind + 1 != argc || replay.speed < 0)
+	{
+		replay_usage();
+		return 1;
+	}
+	replay.root = geteuid() == 0;
+
+	ops = replay_load(argv[optind], &nops, &hdr);
+	qsort(ops, nops, sizeof(*ops), replay_compare_start);
+
+	// one replay thread per recorded thread:
+	for (i = 0; i < nops; i++)
+	{
+		if (ops[i].op < 0)
+			skipped++;
+		if (ops[i].rec.start_ns + ops[i].rec.duration_ns > recorded_ns)
+			recorded_ns = ops[i].rec.start_ns + ops[i].rec.duration_ns;
+		for (j = 0; j < nthreads; j++)
+			if (tids[j] == ops[i].rec.tid)
+				break;
+		if (j == nthreads)
+		{
+			if (nthreads == REPLAY_MAX_THREADS)
+				j = ops[i].rec.tid % REPLAY_MAX_THREADS;
+			else
+				tids[nthreads++] = ops[i].rec.tid;
+		}
+		ops[i].thread = j;
+	}
+	threads = calloc(nthreads ? nthreads : 1, sizeof(*threads));
+	if (threads == NULL)
+		abort();
+	for (i = 0; i < nops; i++)
+	{
+		struct replay_thread *t = &threads[ops[i].thread];
+		if (t->nops == t->maxops)
+		{
+			t->maxops = t->maxops ? 2 * t->maxops : 1024;
+			t->ops = realloc(t->ops, t->maxops * sizeof(*t->ops));
+			if (t->ops == NULL)
+				abort();
+		}
+		t->ops[t->nops++] = &ops[i];
+	}
+
+	if (replay.mountpoint == NULL)
+	{
+		if (!bench_env_setup(&replay.env, 1, UID_ONLY, NULL, false))
+			replay_fail("cannot set up %s: %s", replay.env.basedir);
+		// as non-root, switching the fsuid fails for every operation:
+		unsharedfs_loglevel = LOG_ERR;
+		for (i = 0; i < nops; i++)
+			if (!bench_env_add_user(&replay.env, ops[i].rec.uid, ops[i].rec.gid))
+				replay_fail("cannot set up %s: %s", replay.env.basedir);
+	}
+	if (prepare)
+	{
+		replay_plan(ops, nops);
+		threads[0].fsuid = (uid_t) -1;
+		threads[0].fsgid = (gid_t) -1;
+		replay_prepare(&threads[0]);
+		replay_mount_creds(&threads[0], geteuid(), getegid());
+	}
+
+	replay.start_ns = t0 = bench_now_ns();
+	for (j = 0; j < nthreads; j++)
+	{
+		rc = pthread_create(&threads[j].thread, NULL, replay_thread_main, &threads[j]);
+		if (rc != 0)
+		{
+			errno = rc;
+			replay_fail("cannot create a thread%s: %s", "");
+		}
+	}
+	for (j = 0; j < nthreads; j++)
+		pthread_join(threads[j].thread, NULL);
+	t0 = bench_now_ns() - t0;
+
+	replay_report(&hdr, threads, nthreads, nops, skipped, recorded_ns, t0);
+	if (replay.mountpoint == NULL)
+		bench_env_teardown(&replay.env);
+	return 0;
+}
@@ -0,0 +1,497 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#include "audit.h"
+#include "basedir.h"
+#include "batch.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// metadata calls per batch while walking the views (--audit-sizes):
+#define AUDIT_BATCH_DEPTH 64
+// subdirectories opened at once; every level of the walk keeps them open:
+#define AUDIT_OPEN_BATCH 8
+
+enum audit_problem {
+	AUDIT_OWNER_MISMATCH,
+	AUDIT_NOT_DIRECTORY,
+	AUDIT_SYMLINK,
+	AUDIT_ORPHANED,
+	AUDIT_OVERSIZED,
+	AUDIT_UNEXPECTED,
+	AUDIT_ERROR,
+	AUDIT_PROBLEMS
+};
+
+static const char *const audit_problem_names[AUDIT_PROBLEMS] = {
+	[AUDIT_OWNER_MISMATCH] = "owner-mismatch",
+	[AUDIT_NOT_DIRECTORY] = "not-directory",
+	[AUDIT_SYMLINK] = "symlink",
+	[AUDIT_ORPHANED] = "orphaned",
+	[AUDIT_OVERSIZED] = "oversized",
+	[AUDIT_UNEXPECTED] = "unexpected",
+	[AUDIT_ERROR] = "error",
+};
+
+struct audit_entry {
+	char *name;
+	unsigned long id;
+	bool is_id;          /* the name is a uid (gid) */
+	bool is_fallback;    /* the name is the fallback directory */
+	unsigned int problems;  /* bit mask of enum audit_problem */
+	int error;           /* first errno while checking the entry */
+	mode_t mode;
+	uid_t uid;
+	gid_t gid;
+	uint64_t bytes;      /* allocated size of the view (with --audit-sizes) */
+	uint64_t files;
+};
+
+struct audit_state {
+	const struct unsharedfs_state *pdata;
+	int basefd;
+	size_t fallback_len;    /* length of the first component of defaultdir */
+	struct unsharedfs_idset ids;  /* ids in the password database */
+	struct audit_entry *entries;
+	size_t count;
+	size_t capacity;
+	_Atomic size_t next;    /* next entry for a worker */
+};
+
+/* collect the entries of the base directory */
+static int audit_scan_entry(const char *name, unsigned char type, void *arg)
+{
+	struct audit_state *a = arg;
+	struct audit_entry *e;
+
+	if (a->count == a->capacity)
+	{
+		size_t capacity = a->capacity ? a->capacity * 2 : 1024;
+		struct audit_entry *entries = realloc(a->entries, capacity * sizeof(*entries));
+
+		if (entries == NULL)
+			return 0;
+		a->entries = entries;
+		a->capacity = capacity;
+	}
+	e = &a->entries[a->count];
+	memset(e, 0, sizeof(*e));
+	e->name = strdup(name);
+	if (e->name == NULL)
+		return 0;
+	e->is_id = unsharedfs_basedir_parse_id(name, &e->id);
+	e->is_fallback = a->pdata->defaultdir != NULL && strlen(name) == a->fallback_len
+		&& strncmp(name, a->pdata->defaultdir, a->fallback_len) == 0;
+	a->count++;
+	return 1;
+}
+
+/* the ids that may own a directory: all uids, or all primary and other gids */
+static int audit_load_ids(struct audit_state *a)
+{
+	struct passwd *pw;
+	struct group *gr;
+
+	setpwent();
+	for (errno = 0; (pw = getpwent()) != NULL; errno = 0)
+	{
+		unsigned long id = a->pdata->fsmode == GID_ONLY ? pw->pw_gid : pw->pw_uid;
+
+		if (!unsharedfs_idset_add(&a->ids, id, false) && errno != 0)
+			break;
+	}
+	endpwent();
+	if (errno != 0 && errno != ENOENT)
+		return 0;
+	if (a->pdata->fsmode != GID_ONLY)
+		return 1;
+	setgrent();
+	for (errno = 0; (gr = getgrent()) != NULL; errno = 0)
+		if (!unsharedfs_idset_add(&a->ids, gr->gr_gid, false) && errno != 0)
+			break;
+	endgrent();
+	return errno == 0 || errno == ENOENT;
+}
+
+/* the names in a directory, for audit_walk() */
+struct audit_dir {
+	char *names;         /* one after the other, with their NUL */
+	size_t len;
+	size_t capacity;
+	size_t count;
+};
+
+static int audit_dir_add(const char *name, unsigned char type, void *arg)
+{
+	struct audit_dir *d = arg;
+	size_t size = strlen(name) + 1;
+	(void) type;
+
+	if (d->len + size > d->capacity)
+	{
+		size_t capacity = d->capacity ? d->capacity * 2 : 4096;
+		char *names;
+
+		while (capacity < d->len + size)
+			capacity *= 2;
+		names = realloc(d->names, capacity);
+		if (names == NULL)
+			return 0;
+		d->names = names;
+		d->capacity = capacity;
+	}
+	memcpy(d->names + d->len, name, size);
+	d->len += size;
+	d->count++;
+	return 1;
+}
+
+/* the buffers of a worker for audit_walk(); only used before it recurses */
+struct audit_walker {
+	struct unsharedfs_batch *batch;
+	const char *names[AUDIT_BATCH_DEPTH];
+	struct stat sb[AUDIT_BATCH_DEPTH];
+	int rc[AUDIT_BATCH_DEPTH];
+};
+
+static void audit_error(struct audit_entry *e, int err)
+{
+	if (e->error == 0)
+		e->error = err;
+}
+
+/* add up the allocated size of a directory tree; closes fd */
+static void audit_walk(struct audit_walker *w, int fd, struct audit_entry *e)
+{
+	struct audit_dir d = { NULL, 0, 0, 0 };
+	const char **subdirs = NULL;
+	size_t nsubdirs = 0;
+	size_t pos = 0;
+
+	if (!unsharedfs_basedir_scan(fd, audit_dir_add, &d)
+			|| (d.count > 0 && (subdirs = malloc(d.count * sizeof(*subdirs))) == NULL))
+	{
+		audit_error(e, errno);
+		free(d.names);
+		close(fd);
+		return;
+	}
+	// stat the entries a batch at a time:
+	while (pos < d.len)
+	{
+		int i, n;
+
+		for (n = 0; n < AUDIT_BATCH_DEPTH && pos < d.len; n++, pos += strlen(d.names + pos) + 1)
+		{
+			w->names[n] = d.names + pos;
+			unsharedfs_batch_stat(w->batch, fd, w->names[n], AT_SYMLINK_NOFOLLOW, &w->sb[n], &w->rc[n]);
+		}
+		unsharedfs_batch_run(w->batch);
+		for (i = 0; i < n; i++)
+		{
+			if (w->rc[i] != 0)
+			{
+				audit_error(e, -w->rc[i]);
+				continue;
+			}
+			e->bytes += (uint64_t)w->sb[i].st_blocks * 512;
+			e->files++;
+			if (S_ISDIR(w->sb[i].st_mode))
+				subdirs[nsubdirs++] = w->names[i];
+		}
+	}
+	// and walk the subdirectories, opening a few at a time:
+	for (pos = 0; pos < nsubdirs; pos += AUDIT_OPEN_BATCH)
+	{
+		int subfd[AUDIT_OPEN_BATCH];
+		size_t i, n = nsubdirs - pos < AUDIT_OPEN_BATCH ? nsubdirs - pos : AUDIT_OPEN_BATCH;
+
+		for (i = 0; i < n; i++)
+			unsharedfs_batch_open(w->batch, fd, subdirs[pos + i], O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC,
+					&subfd[i]);
+		unsharedfs_batch_run(w->batch);
+		for (i = 0; i < n; i++)
+			if (subfd[i] < 0)
+				audit_error(e, -subfd[i]);
+			else
+				audit_walk(w, subfd[i], e);
+	}
+	free(subdirs);
+	free(d.names);
+	close(fd);
+}
+
+static void audit_check(struct audit_state *a, struct audit_entry *e, struct audit_walker *w)
+{
+	const struct unsharedfs_state *pdata = a->pdata;
+	struct stat sb;
+
+	if (fstatat(a->basefd, e->name, &sb, AT_SYMLINK_NOFOLLOW) != 0)
+	{
+		e->error = errno;
+		e->problems |= 1u << AUDIT_ERROR;
+		return;
+	}
+	if (S_ISLNK(sb.st_mode))
+	{
+		// the file system follows the link, so check its target:
+		e->problems |= 1u << AUDIT_SYMLINK;
+		if (fstatat(a->basefd, e->name, &sb, 0) != 0)
+		{
+			e->error = errno;
+			e->problems |= 1u << AUDIT_ERROR;
+			return;
+		}
+	}
+	e->mode = sb.st_mode;
+	e->uid = sb.st_uid;
+	e->gid = sb.st_gid;
+
+	if (e->is_id || e->is_fallback)
+	{
+		if (!S_ISDIR(sb.st_mode))
+			e->problems |= 1u << AUDIT_NOT_DIRECTORY;
+	}
+	else
+		e->problems |= 1u << AUDIT_UNEXPECTED;
+	if (e->is_id)
+	{
+		unsigned long owner = pdata->fsmode == GID_ONLY ? sb.st_gid : sb.st_uid;
+
+		if (owner != e->id)
+			e->problems |= 1u << AUDIT_OWNER_MISMATCH;
+		if (!unsharedfs_idset_contains(&a->ids, e->id))
+			e->problems |= 1u << AUDIT_ORPHANED;
+	}
+
+	if (pdata->audit_sizes && S_ISDIR(sb.st_mode) && !(e->problems & (1u << AUDIT_SYMLINK)))
+	{
+		int fd = openat(a->basefd, e->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+		e->bytes = (uint64_t)sb.st_blocks * 512;
+		if (fd < 0)
+			e->error = errno;
+		else if (w == NULL)
+		{
+			e->error = ENOMEM;
+			close(fd);
+		}
+		else
+			audit_walk(w, fd, e);
+		if (e->error != 0)
+			e->problems |= 1u << AUDIT_ERROR;
+		if (pdata->audit_max_size_mb != 0 && e->bytes > (uint64_t)pdata->audit_max_size_mb << 20)
+			e->problems |= 1u << AUDIT_OVERSIZED;
+	}
+}
+
+static void *audit_worker(void *arg)
+{
+	struct audit_state *a = arg;
+	struct audit_walker *w = NULL;
+	size_t i;
+
+	if (a->pdata->audit_sizes && (w = malloc(sizeof(*w))) != NULL
+			&& (w->batch = unsharedfs_batch_new(AUDIT_BATCH_DEPTH, a->pdata->rootdir, a->pdata->io_uring)) == NULL)
+	{
+		free(w);
+		w = NULL;
+	}
+	while ((i = atomic_fetch_add_explicit(&a->next, 1, memory_order_relaxed)) < a->count)
+		audit_check(a, &a->entries[i], w);
+	if (w != NULL)
+	{
+		unsharedfs_batch_free(w->batch);
+		free(w);
+	}
+	return NULL;
+}
+
+/* ids in numeric order first, then the other names */
+static int audit_compare(const void *p1, const void *p2)
+{
+	const struct audit_entry *e1 = p1, *e2 = p2;
+
+	if (e1->is_id != e2->is_id)
+		return e1->is_id ? -1 : 1;
+	if (e1->is_id)
+		return e1->id < e2->id ? -1 : e1->id > e2->id;
+	return strcmp(e1->name, e2->name);
+}
+
+/* print a string as a JSON string */
+static void audit_print_string(const char *s)
+{
+	putchar('"');
+	for (; *s != '\0'; s++)
+	{
+		unsigned char c = *s;
+
+		if (c == '"' || c == '\\')
+			printf("\\%c", c);
+		else if (c < 0x20)
+			printf("\\u%04x", c);
+		else
+			putchar(c);
+	}
+	putchar('"');
+}
+
+static const char *audit_type(mode_t mode)
+{
+	if (S_ISDIR(mode))
+		return "directory";
+	if (S_ISREG(mode))
+		return "file";
+	if (S_ISLNK(mode))
+		return "symlink";
+	return "other";
+}
+
+static void audit_print_entry(const struct unsharedfs_state *pdata, const struct audit_entry *e)
+{
+	const char *sep = "";
+	int p;
+
+	printf("{\"name\":");
+	audit_print_string(e->name);
+	if (e->is_id)
+		printf(",\"id\":%lu", e->id);
+	if (e->mode != 0)
+		printf(",\"type\":\"%s\",\"uid\":%lu,\"gid\":%lu,\"mode\":\"%04o\"", audit_type(e->mode),
+				(unsigned long)e->uid, (unsigned long)e->gid, (unsigned int)(e->mode & 07777));
+	if (pdata->audit_sizes && S_ISDIR(e->mode))
+		printf(",\"bytes\":%llu,\"files\":%llu", (unsigned long long)e->bytes, (unsigned long long)e->files);
+	if (e->error != 0)
+	{
+		printf(",\"error\":");
+		audit_print_string(strerror(e->error));
+	}
+	printf(",\"problems\":[");
+	for (p = 0; p < AUDIT_PROBLEMS; p++)
+		if (e->problems & (1u << p))
+		{
+			printf("%s\"%s\"", sep, audit_problem_names[p]);
+			sep = ",";
+		}
+	printf("]}\n");
+}
+
+int unsharedfs_audit(const struct unsharedfs_state *pdata, unsigned long *problems)
+{
+	struct audit_state a;
+	unsigned long counts[AUDIT_PROBLEMS] = { 0 };
+	unsigned long views = 0, found = 0, missing;
+	uint64_t bytes = 0, files = 0;
+	pthread_t *workers;
+	unsigned long nworkers, i;
+	struct timespec start, end;
+	int p;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	memset(&a, 0, sizeof(a));
+	a.pdata = pdata;
+	if (pdata->defaultdir != NULL)
+		a.fallback_len = strcspn(pdata->defaultdir, "/");
+	a.basefd = open(pdata->rootdir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (a.basefd < 0)
+	{
+		fprintf(stderr, "Cannot open %s: %s\n", pdata->rootdir, strerror(errno));
+		return 0;
+	}
+	if (!unsharedfs_basedir_scan(a.basefd, audit_scan_entry, &a))
+	{
+		fprintf(stderr, "Cannot read %s: %s\n", pdata->rootdir, strerror(errno));
+		goto error;
+	}
+	if (!audit_load_ids(&a))
+	{
+		fprintf(stderr, "Cannot enumerate users: %s\n", strerror(errno));
+		goto error;
+	}
+
+	workers = calloc(pdata->audit_threads, sizeof(*workers));
+	if (workers == NULL)
+	{
+		perror("unsharedfs audit");
+		goto error;
+	}
+	for (nworkers = 0; nworkers < pdata->audit_threads; nworkers++)
+		if (pthread_create(&workers[nworkers], NULL, audit_worker, &a) != 0)
+			break;
+	// check whatever the workers leave (all entries if none could be started):
+	audit_worker(&a);
+	for (i = 0; i < nworkers; i++)
+		pthread_join(workers[i], NULL);
+	free(workers);
+
+	qsort(a.entries, a.count, sizeof(*a.entries), audit_compare);
+	*problems = 0;
+	for (i = 0; i < a.count; i++)
+	{
+		const struct audit_entry *e = &a.entries[i];
+
+		if (e->is_id && S_ISDIR(e->mode))
+		{
+			views++;
+			if (unsharedfs_idset_mark(&a.ids, e->id, true) == 0)
+				found++;
+		}
+		bytes += e->bytes;
+		files += e->files;
+		for (p = 0; p < AUDIT_PROBLEMS; p++)
+			if (e->problems & (1u << p))
+				counts[p]++;
+		if (e->problems != 0)
+			(*problems)++;
+		if (e->problems != 0 || pdata->audit_sizes)
+			audit_print_entry(pdata, e);
+	}
+	// ids in the password database without a directory:
+	missing = a.ids.count - found;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("{\"summary\":{\"basedir\":");
+	audit_print_string(pdata->rootdir);
+	printf(",\"mode\":\"%s\",\"entries\":%zu,\"views\":%lu,\"without-directory\":%lu",
+			pdata->fsmode == GID_ONLY ? "gid" : "uid", a.count, views, missing);
+	for (p = 0; p < AUDIT_PROBLEMS; p++)
+		printf(",\"%s\":%lu", audit_problem_names[p], counts[p]);
+	if (pdata->audit_sizes)
+		printf(",\"bytes\":%llu,\"files\":%llu", (unsigned long long)bytes, (unsigned long long)files);
+	printf(",\"seconds\":%.3f}}\n", (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+	for (i = 0; i < a.count; i++)
+		free(a.entries[i].name);
+	free(a.entries);
+	unsharedfs_idset_free(&a.ids);
+	close(a.basefd);
+	return 1;
+
+error:
+	for (i = 0; i < a.count; i++)
+		free(a.entries[i].name);
+	free(a.entries);
+	unsharedfs_idset_free(&a.ids);
+	close(a.basefd);
+	return 0;
+}
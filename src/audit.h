@@ -0,0 +1,39 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_AUDIT_H_
+#define UNSHAREDFS_AUDIT_H_
+
+#include "fs.h"
+
+/*
+ * The audit checks every entry of the base directory with a pool of
+ * threads and reports the entries that would divert or fail requests:
+ *   owner-mismatch  the owner (group with --use-gid) is not the id in the name
+ *   not-directory   a uid directory or the fallback directory is not a directory
+ *   symlink         the entry is a symbolic link
+ *   orphaned        no user (group) in the password database has the id
+ *   oversized       the view is larger than --audit-max-size
+ *   unexpected      the name is neither an id nor the fallback directory
+ *   error           the entry or part of the view could not be read
+ * The output has one JSON object per line: one per reported entry, and a
+ * final summary object.
+ */
+
+/**
+ * Audit pdata->rootdir and print the report to stdout.
+ * @param pdata the file system configuration (rootdir, defaultdir, fsmode and
+ *        the audit_* options are used)
+ * @param problems set to the number of entries with problems
+ * @return 1 if the audit ran, 0 on error (a message is printed to stderr).
+ */
+int unsharedfs_audit(const struct unsharedfs_state *pdata, unsigned long *problems);
+
+#endif
@@ -0,0 +1,135 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#include "basedir.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// buffer for reading a directory:
+#define BASEDIR_DENTS_SIZE (1024 * 1024)
+
+/* the layout of the records returned by getdents64 */
+struct basedir_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+static uint64_t *unsharedfs_idset_slot(const struct unsharedfs_idset *set, unsigned long id)
+{
+	uint64_t key = ((uint64_t)id + 1) << 1;
+	size_t i = (size_t)((key * 0x9e3779b97f4a7c15ULL) >> 32) & (set->size - 1);
+
+	while (set->slots[i] != 0 && (set->slots[i] & ~(uint64_t)1) != key)
+		i = (i + 1) & (set->size - 1);
+	return &set->slots[i];
+}
+
+int unsharedfs_idset_add(struct unsharedfs_idset *set, unsigned long id, bool mark)
+{
+	uint64_t *slot;
+
+	if ((set->count + 1) * 2 > set->size)
+	{
+		struct unsharedfs_idset grown = { NULL, set->size ? set->size * 2 : 1024, 0 };
+		size_t i;
+
+		grown.slots = calloc(grown.size, sizeof(*grown.slots));
+		if (grown.slots == NULL)
+			return 0;
+		for (i = 0; i < set->size; i++)
+			if (set->slots[i] != 0)
+				*unsharedfs_idset_slot(&grown, (set->slots[i] >> 1) - 1) = set->slots[i];
+		grown.count = set->count;
+		free(set->slots);
+		*set = grown;
+	}
+	slot = unsharedfs_idset_slot(set, id);
+	if (*slot != 0)
+	{
+		errno = 0;
+		return 0;
+	}
+	*slot = (((uint64_t)id + 1) << 1) | (mark ? 1 : 0);
+	set->count++;
+	return 1;
+}
+
+bool unsharedfs_idset_contains(const struct unsharedfs_idset *set, unsigned long id)
+{
+	return set->size != 0 && *unsharedfs_idset_slot(set, id) != 0;
+}
+
+int unsharedfs_idset_mark(struct unsharedfs_idset *set, unsigned long id, bool mark)
+{
+	uint64_t *slot;
+	int old;
+
+	if (set->size == 0)
+		return -1;
+	slot = unsharedfs_idset_slot(set, id);
+	if (*slot == 0)
+		return -1;
+	old = *slot & 1;
+	*slot = (*slot & ~(uint64_t)1) | (mark ? 1 : 0);
+	return old;
+}
+
+void unsharedfs_idset_free(struct unsharedfs_idset *set)
+{
+	free(set->slots);
+	set->slots = NULL;
+	set->size = set->count = 0;
+}
+
+bool unsharedfs_basedir_parse_id(const char *name, unsigned long *id)
+{
+	char *end;
+
+	if (name[0] < '0' || name[0] > '9' || (name[0] == '0' && name[1] != '\0'))
+		return false;
+	errno = 0;
+	*id = strtoul(name, &end, 10);
+	return errno == 0 && *end == '\0';
+}
+
+int unsharedfs_basedir_scan(int fd, int (*fn)(const char *name, unsigned char type, void *arg), void *arg)
+{
+	char *buf = malloc(BASEDIR_DENTS_SIZE);
+	long n;
+
+	if (buf == NULL)
+		return 0;
+	while ((n = syscall(SYS_getdents64, fd, buf, BASEDIR_DENTS_SIZE)) > 0)
+	{
+		long pos;
+
+		for (pos = 0; pos < n; pos += ((struct basedir_dirent64 *)(buf + pos))->d_reclen)
+		{
+			struct basedir_dirent64 *d = (struct basedir_dirent64 *)(buf + pos);
+
+			if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+				continue;
+			if (!fn(d->d_name, d->d_type, arg))
+			{
+				free(buf);
+				return 0;
+			}
+		}
+	}
+	free(buf);
+	return n == 0;
+}
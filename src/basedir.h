@@ -0,0 +1,76 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_BASEDIR_H_
+#define UNSHAREDFS_BASEDIR_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Helpers for the modes that work on BASEDIR as a whole (--provision and
+ * --audit): reading a large directory in one pass, and a set of uids/gids.
+ * The directory index uses them for huge directories below BASEDIR, too.
+ */
+
+/*
+ * Open addressing hash set of ids.  A slot holds (id + 1) << 1, so that 0
+ * marks an empty slot; the low bit is a mark that callers can set per id.
+ * Not thread-safe: lookups may run concurrently, changes may not.
+ */
+struct unsharedfs_idset {
+	uint64_t *slots;
+	size_t size;     /* power of two */
+	size_t count;
+};
+
+/**
+ * Add an id to the set.
+ * @param mark initial value of the mark of the id
+ * @return 1 if the id was added, 0 if it was in the set already (errno is 0)
+ *         or on error (errno is set).
+ */
+int unsharedfs_idset_add(struct unsharedfs_idset *set, unsigned long id, bool mark);
+
+/**
+ * @return true if the id is in the set.
+ */
+bool unsharedfs_idset_contains(const struct unsharedfs_idset *set, unsigned long id);
+
+/**
+ * Change the mark of an id in the set.
+ * @return the previous mark (0 or 1), or -1 if the id is not in the set.
+ */
+int unsharedfs_idset_mark(struct unsharedfs_idset *set, unsigned long id, bool mark);
+
+/**
+ * Release the memory of the set.
+ */
+void unsharedfs_idset_free(struct unsharedfs_idset *set);
+
+/**
+ * Parse a directory name that is a uid or gid directory, i.e. a decimal
+ * number without leading zeros.
+ * @return true if the name is an id.
+ */
+bool unsharedfs_basedir_parse_id(const char *name, unsigned long *id);
+
+/**
+ * Call fn for every entry of a directory (except "." and ".."), reading
+ * the directory with large getdents64 calls.
+ * @param fd an open directory; its position is advanced to the end
+ * @param fn called with the entry name and d_type (DT_UNKNOWN if the file
+ *        system does not report it); a return value of 0 stops the scan
+ * @return 1 on success, 0 on error or if fn stopped the scan (errno is set).
+ */
+int unsharedfs_basedir_scan(int fd, int (*fn)(const char *name, unsigned char type, void *arg), void *arg);
+
+#endif
@@ -0,0 +1,422 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+// struct statx:
+#define _GNU_SOURCE
+
+#include "batch.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(SYS_io_uring_setup)
+#define HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+// the file systems that BATCH_AUTO uses io_uring for:
+static const unsigned long batch_network_fs[] = {
+	0x6969,       /* NFS */
+	0xff534d42,   /* CIFS */
+	0xfe534d42,   /* SMB2 */
+	0x00c36400,   /* Ceph */
+	0x0bd00bd0,   /* Lustre */
+	0x47504653,   /* GPFS */
+	0x5346414f,   /* AFS */
+	0x65735546,   /* FUSE (GlusterFS, CephFS, sshfs, ...) */
+};
+#endif
+
+enum batch_op {
+	BATCH_STAT,
+	BATCH_OPEN
+};
+
+struct batch_call {
+	enum batch_op op;
+	int dirfd;
+	const char *path;
+	int flags;
+	struct stat *sb;
+	int *result;
+};
+
+struct unsharedfs_batch {
+	struct batch_call *calls;
+	unsigned int count;
+	unsigned int depth;
+	int ring_fd;                 /* -1: the calls are made one by one */
+#ifdef HAVE_IO_URING
+	struct statx *stx;           /* the results of the stat calls, by call */
+	void *sq_map;
+	size_t sq_map_size;
+	void *cq_map;                /* may be sq_map */
+	size_t cq_map_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+#endif
+};
+
+static void batch_call_sync(const struct batch_call *c)
+{
+	int rc;
+
+	if (c->op == BATCH_STAT)
+		rc = fstatat(c->dirfd, c->path, c->sb, c->flags);
+	else
+		rc = openat(c->dirfd, c->path, c->flags);
+	*c->result = rc < 0 ? -errno : rc;
+}
+
+#ifdef HAVE_IO_URING
+
+static void batch_from_statx(const struct statx *stx, struct stat *sb)
+{
+	memset(sb, 0, sizeof(*sb));
+	sb->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+	sb->st_ino = stx->stx_ino;
+	sb->st_mode = stx->stx_mode;
+	sb->st_nlink = stx->stx_nlink;
+	sb->st_uid = stx->stx_uid;
+	sb->st_gid = stx->stx_gid;
+	sb->st_rdev = makedev(stx->stx_rdev_major, stx->stx_rdev_minor);
+	sb->st_size = stx->stx_size;
+	sb->st_blksize = stx->stx_blksize;
+	sb->st_blocks = stx->stx_blocks;
+	sb->st_atim.tv_sec = stx->stx_atime.tv_sec;
+	sb->st_atim.tv_nsec = stx->stx_atime.tv_nsec;
+	sb->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+	sb->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+	sb->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+	sb->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+}
+
+static int batch_enter(int fd, unsigned int to_submit, unsigned int min_complete)
+{
+	return syscall(SYS_io_uring_enter, fd, to_submit, min_complete, IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+/* true if the kernel supports the operations of a batch (stat: 5.6) */
+static bool batch_probe(int fd)
+{
+	size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *probe = calloc(1, size);
+	bool ok;
+
+	if (probe == NULL)
+		return false;
+	ok = syscall(SYS_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0
+		&& probe->last_op >= IORING_OP_STATX && probe->last_op >= IORING_OP_OPENAT
+		&& (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED)
+		&& (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED);
+	free(probe);
+	return ok;
+}
+
+static void batch_unmap(struct unsharedfs_batch *b)
+{
+	if (b->sqes != NULL && b->sqes != MAP_FAILED)
+		munmap(b->sqes, b->sqes_size);
+	if (b->cq_map != NULL && b->cq_map != MAP_FAILED && b->cq_map != b->sq_map)
+		munmap(b->cq_map, b->cq_map_size);
+	if (b->sq_map != NULL && b->sq_map != MAP_FAILED)
+		munmap(b->sq_map, b->sq_map_size);
+	close(b->ring_fd);
+	b->ring_fd = -1;
+}
+
+/* set up the ring; on error, b->ring_fd is -1 */
+static void batch_setup(struct unsharedfs_batch *b)
+{
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	b->ring_fd = syscall(SYS_io_uring_setup, b->depth, &p);
+	if (b->ring_fd < 0)
+	{
+		b->ring_fd = -1;
+		return;
+	}
+	if (p.sq_entries < b->depth || !batch_probe(b->ring_fd))
+	{
+		close(b->ring_fd);
+		b->ring_fd = -1;
+		return;
+	}
+	b->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	b->cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (b->cq_map_size > b->sq_map_size)
+			b->sq_map_size = b->cq_map_size;
+		b->cq_map_size = b->sq_map_size;
+	}
+	b->sq_map = mmap(NULL, b->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			b->ring_fd, IORING_OFF_SQ_RING);
+	if (b->sq_map == MAP_FAILED)
+	{
+		batch_unmap(b);
+		return;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		b->cq_map = b->sq_map;
+	else
+		b->cq_map = mmap(NULL, b->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				b->ring_fd, IORING_OFF_CQ_RING);
+	b->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	if (b->cq_map != MAP_FAILED)
+		b->sqes = mmap(NULL, b->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				b->ring_fd, IORING_OFF_SQES);
+	if (b->cq_map == MAP_FAILED || b->sqes == MAP_FAILED)
+	{
+		batch_unmap(b);
+		return;
+	}
+	sq = b->sq_map;
+	cq = b->cq_map;
+	b->sq_head = (unsigned int *)(sq + p.sq_off.head);
+	b->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	b->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	b->sq_array = (unsigned int *)(sq + p.sq_off.array);
+	b->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	b->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	b->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	b->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+}
+
+/* fill the submission queue with all calls */
+static void batch_prepare(struct unsharedfs_batch *b)
+{
+	unsigned int tail = *b->sq_tail;
+	unsigned int i;
+
+	for (i = 0; i < b->count; i++, tail++)
+	{
+		const struct batch_call *c = &b->calls[i];
+		unsigned int index = tail & *b->sq_mask;
+		struct io_uring_sqe *sqe = &b->sqes[index];
+
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->fd = c->dirfd;
+		sqe->addr = (uintptr_t)c->path;
+		sqe->user_data = i;
+		if (c->op == BATCH_STAT)
+		{
+			sqe->opcode = IORING_OP_STATX;
+			sqe->len = STATX_BASIC_STATS;
+			sqe->off = (uintptr_t)&b->stx[i];
+			sqe->statx_flags = c->flags;
+		}
+		else
+		{
+			sqe->opcode = IORING_OP_OPENAT;
+			sqe->open_flags = c->flags;
+		}
+		b->sq_array[index] = index;
+	}
+	__atomic_store_n(b->sq_tail, tail, __ATOMIC_RELEASE);
+}
+
+/* @return the number of completions that were consumed */
+static unsigned int batch_reap(struct unsharedfs_batch *b)
+{
+	unsigned int head = *b->cq_head;
+	unsigned int tail = __atomic_load_n(b->cq_tail, __ATOMIC_ACQUIRE);
+	unsigned int n = 0;
+
+	for (; head != tail; head++, n++)
+	{
+		const struct io_uring_cqe *cqe = &b->cqes[head & *b->cq_mask];
+		const struct batch_call *c = &b->calls[cqe->user_data];
+
+		*c->result = cqe->res;
+		if (c->op == BATCH_STAT && cqe->res == 0)
+			batch_from_statx(&b->stx[cqe->user_data], c->sb);
+	}
+	__atomic_store_n(b->cq_head, head, __ATOMIC_RELEASE);
+	return n;
+}
+
+/* @return 1 if all calls were made, 0 if none were submitted */
+static int batch_run_ring(struct unsharedfs_batch *b)
+{
+	unsigned int submitted = 0, done = 0;
+
+	batch_prepare(b);
+	while (done < b->count)
+	{
+		int n = batch_enter(b->ring_fd, b->count - submitted, 1);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (submitted == done && errno != EAGAIN && errno != EBUSY)
+			{
+				// nothing in flight: take the calls back from the queue
+				__atomic_store_n(b->sq_tail, *b->sq_tail - (b->count - submitted), __ATOMIC_RELEASE);
+				if (submitted == 0)
+					return 0;
+				break;
+			}
+			if (submitted == done)
+				sched_yield();
+		}
+		else
+			submitted += n;
+		done += batch_reap(b);
+	}
+	// calls that could not be submitted after all:
+	for (; submitted < b->count; submitted++)
+		batch_call_sync(&b->calls[submitted]);
+	return 1;
+}
+
+#endif
+
+int unsharedfs_batch_parse_mode(const char *value)
+{
+	if (strcmp(value, "auto") == 0)
+		return BATCH_AUTO;
+	if (strcmp(value, "yes") == 0)
+		return BATCH_ALWAYS;
+	if (strcmp(value, "no") == 0)
+		return BATCH_NEVER;
+	return -1;
+}
+
+#ifdef HAVE_IO_URING
+/* true if path is on a network file system */
+static bool batch_network(const char *path)
+{
+	struct statfs sfs;
+	size_t i;
+
+	if (statfs(path, &sfs) != 0)
+		return false;
+	for (i = 0; i < sizeof(batch_network_fs) / sizeof(batch_network_fs[0]); i++)
+		if ((unsigned long)(unsigned int)sfs.f_type == batch_network_fs[i])
+			return true;
+	return false;
+}
+#endif
+
+struct unsharedfs_batch *unsharedfs_batch_new(unsigned int depth, const char *path, enum unsharedfs_batch_mode mode)
+{
+	struct unsharedfs_batch *b = calloc(1, sizeof(*b));
+
+	if (b == NULL)
+		return NULL;
+	b->depth = depth;
+	b->ring_fd = -1;
+	b->calls = calloc(depth, sizeof(*b->calls));
+	if (b->calls == NULL)
+	{
+		free(b);
+		return NULL;
+	}
+#ifdef HAVE_IO_URING
+	b->stx = calloc(depth, sizeof(*b->stx));
+	if (b->stx == NULL)
+	{
+		free(b->calls);
+		free(b);
+		return NULL;
+	}
+	if (mode == BATCH_ALWAYS || (mode == BATCH_AUTO && batch_network(path)))
+		batch_setup(b);
+#else
+	(void) path;
+	(void) mode;
+#endif
+	return b;
+}
+
+void unsharedfs_batch_free(struct unsharedfs_batch *b)
+{
+	if (b == NULL)
+		return;
+	unsharedfs_batch_run(b);
+#ifdef HAVE_IO_URING
+	if (b->ring_fd >= 0)
+		batch_unmap(b);
+	free(b->stx);
+#endif
+	free(b->calls);
+	free(b);
+}
+
+bool unsharedfs_batch_async(const struct unsharedfs_batch *b)
+{
+	return b->ring_fd >= 0;
+}
+
+static void batch_queue(struct unsharedfs_batch *b, const struct batch_call *c)
+{
+	if (b->count == b->depth)
+		unsharedfs_batch_run(b);
+	b->calls[b->count++] = *c;
+}
+
+void unsharedfs_batch_stat(struct unsharedfs_batch *b, int dirfd, const char *path, int flags,
+		struct stat *sb, int *result)
+{
+	struct batch_call c = { BATCH_STAT, dirfd, path, flags, sb, result };
+
+	batch_queue(b, &c);
+}
+
+void unsharedfs_batch_open(struct unsharedfs_batch *b, int dirfd, const char *path, int flags,
+		int *result)
+{
+	struct batch_call c = { BATCH_OPEN, dirfd, path, flags, NULL, result };
+
+	batch_queue(b, &c);
+}
+
+void unsharedfs_batch_run(struct unsharedfs_batch *b)
+{
+	unsigned int i;
+
+#ifdef HAVE_IO_URING
+	// a single call is cheaper without the detour through the kernel's workers:
+	if (b->ring_fd >= 0 && b->count > 1)
+	{
+		if (!batch_run_ring(b))
+			batch_unmap(b);
+		else
+			b->count = 0;
+	}
+#endif
+	for (i = 0; i < b->count; i++)
+		batch_call_sync(&b->calls[i]);
+	b->count = 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_BATCH_H_
+#define UNSHAREDFS_BATCH_H_
+
+#include <stdbool.h>
+#include <sys/stat.h>
+
+/*
+ * Batches of metadata calls (stat and open) for the walks over many
+ * directory entries.  The calls of a batch are submitted together through
+ * io_uring, and the kernel runs them in parallel, which hides most of the
+ * latency of a slow backing file system (NFS, network block devices).
+ * On a local file system with the metadata in the cache, handing the calls
+ * to the kernel's workers costs more than it saves, so by default io_uring
+ * is only used on network file systems (see enum unsharedfs_batch_mode).
+ * If io_uring is not available (old kernel, disabled by the
+ * kernel.io_uring_disabled sysctl or a seccomp filter), the calls are made
+ * one after the other.
+ *
+ * A batch is used by one thread at a time.  The calls run with the
+ * credentials of the thread that created the batch, so a batch must not be
+ * used between unsharedfs_take_context_id() and
+ * unsharedfs_drop_context_id().
+ */
+
+struct unsharedfs_batch;
+
+/* when to use io_uring (--io-uring) */
+enum unsharedfs_batch_mode {
+	BATCH_AUTO,       /* for directories on network file systems */
+	BATCH_ALWAYS,
+	BATCH_NEVER
+};
+
+/**
+ * Parse the value of --io-uring (auto, yes or no).
+ * @return the mode, or -1 if the value is invalid.
+ */
+int unsharedfs_batch_parse_mode(const char *value);
+
+/**
+ * Create a batch.
+ * @param depth the number of calls that are submitted together
+ * @param path the directory tree that the calls are for (for BATCH_AUTO)
+ * @param mode whether to use io_uring
+ * @return the batch, or NULL on error (errno is set).
+ */
+struct unsharedfs_batch *unsharedfs_batch_new(unsigned int depth, const char *path, enum unsharedfs_batch_mode mode);
+
+/**
+ * Release a batch; the queued calls are made first.
+ */
+void unsharedfs_batch_free(struct unsharedfs_batch *b);
+
+/**
+ * @return true if the batch uses io_uring.
+ */
+bool unsharedfs_batch_async(const struct unsharedfs_batch *b);
+
+/**
+ * Queue a call of fstatat().  If the batch is full, the queued calls are
+ * made first.
+ * @param dirfd, path, flags the arguments of fstatat()
+ * @param sb receives the attributes
+ * @param result receives 0, or -errno on error
+ * The arguments have to stay valid until unsharedfs_batch_run() returns.
+ */
+void unsharedfs_batch_stat(struct unsharedfs_batch *b, int dirfd, const char *path, int flags,
+		struct stat *sb, int *result);
+
+/**
+ * Queue a call of openat() (like unsharedfs_batch_stat()).
+ * @param result receives the new file descriptor, or -errno on error
+ */
+void unsharedfs_batch_open(struct unsharedfs_batch *b, int dirfd, const char *path, int flags,
+		int *result);
+
+/**
+ * Make the queued calls, and wait until all of them are done.
+ */
+void unsharedfs_batch_run(struct unsharedfs_batch *b);
+
+#endif
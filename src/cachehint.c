@@ -0,0 +1,198 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+// for posix_fadvise
+#define _XOPEN_SOURCE 700
+
+#include "cachehint.h"
+#include "fdtab.h"
+#include "opctx.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/xattr.h>
+
+// number of cached paths (a path replaces the one in its slot):
+#define CACHEHINT_SLOTS 4096
+#define CACHEHINT_LOCKS 64
+// changes to the backing file system itself are noticed after this long:
+#define CACHEHINT_TTL_NS (60 * 1000000000ULL)
+
+struct cachehint_slot {
+	uint64_t key;          /* unsharedfs_path_hash() of the path (0: unused) */
+	uint64_t gen;          /* cachehint_gen when the hint was read */
+	uint64_t expires_ns;
+	enum unsharedfs_cache_hint hint;
+};
+
+const char *const unsharedfs_cache_hint_names[CACHE_HINT_COUNT] = {
+	[CACHE_HINT_DEFAULT] = "default",
+	[CACHE_HINT_IMMUTABLE] = "immutable",
+	[CACHE_HINT_NOCACHE] = "nocache",
+	[CACHE_HINT_STREAM] = "stream",
+	[CACHE_HINT_COLD] = "cold",
+};
+
+bool unsharedfs_cachehint_enabled = false;
+
+static struct cachehint_slot *cachehint_slots;
+static pthread_mutex_t cachehint_locks[CACHEHINT_LOCKS];
+// incremented when a hint is changed through the mount; 0 is never valid:
+static _Atomic uint64_t cachehint_gen = 1;
+
+int unsharedfs_cachehint_init(void)
+{
+	int i;
+
+	cachehint_slots = calloc(CACHEHINT_SLOTS, sizeof(*cachehint_slots));
+	if (cachehint_slots == NULL)
+		return 0;
+	for (i = 0; i < CACHEHINT_LOCKS; i++)
+		pthread_mutex_init(&cachehint_locks[i], NULL);
+	unsharedfs_cachehint_enabled = true;
+	return 1;
+}
+
+void unsharedfs_cachehint_destroy(void)
+{
+	int i;
+
+	if (!unsharedfs_cachehint_enabled)
+		return;
+	unsharedfs_cachehint_enabled = false;
+	for (i = 0; i < CACHEHINT_LOCKS; i++)
+		pthread_mutex_destroy(&cachehint_locks[i]);
+	free(cachehint_slots);
+	cachehint_slots = NULL;
+}
+
+bool unsharedfs_cachehint_parse(const char *value, size_t size, enum unsharedfs_cache_hint *hint)
+{
+	int i;
+
+	// "echo" and some tools include the newline or the NUL:
+	while (size > 0 && (value[size - 1] == '\n' || value[size - 1] == '\0'))
+		size--;
+	// "default" is what an unset attribute means, and is not accepted as a value:
+	for (i = CACHE_HINT_DEFAULT + 1; i < CACHE_HINT_COUNT; i++)
+		if (strlen(unsharedfs_cache_hint_names[i]) == size
+				&& memcmp(unsharedfs_cache_hint_names[i], value, size) == 0)
+		{
+			*hint = i;
+			return true;
+		}
+	return false;
+}
+
+static bool cachehint_cached(uint64_t key, enum unsharedfs_cache_hint *hint)
+{
+	struct cachehint_slot *slot = &cachehint_slots[key % CACHEHINT_SLOTS];
+	pthread_mutex_t *lock = &cachehint_locks[key % CACHEHINT_LOCKS];
+	bool found;
+
+	pthread_mutex_lock(lock);
+	found = slot->key == key
+		&& slot->gen == atomic_load_explicit(&cachehint_gen, memory_order_acquire)
+		&& slot->expires_ns > unsharedfs_now_ns();
+	if (found)
+		*hint = slot->hint;
+	pthread_mutex_unlock(lock);
+	return found;
+}
+
+static void cachehint_store(uint64_t key, uint64_t gen, enum unsharedfs_cache_hint hint)
+{
+	struct cachehint_slot *slot = &cachehint_slots[key % CACHEHINT_SLOTS];
+	pthread_mutex_t *lock = &cachehint_locks[key % CACHEHINT_LOCKS];
+
+	pthread_mutex_lock(lock);
+	slot->key = key;
+	slot->gen = gen;
+	slot->expires_ns = unsharedfs_now_ns() + CACHEHINT_TTL_NS;
+	slot->hint = hint;
+	pthread_mutex_unlock(lock);
+}
+
+/**
+ * Find the hint of path[0..len), falling back to the hint of its directory.
+ * @param path a modifiable copy of the backing path
+ */
+static enum unsharedfs_cache_hint cachehint_lookup(char *path, size_t len, size_t rootlen)
+{
+	enum unsharedfs_cache_hint hint = CACHE_HINT_DEFAULT;
+	uint64_t key, gen;
+	char value[32];
+	ssize_t size;
+
+	path[len] = '\0';
+	key = unsharedfs_path_hash(path);
+	if (cachehint_cached(key, &hint))
+		return hint;
+	// a hint changed meanwhile invalidates what is read now:
+	gen = atomic_load_explicit(&cachehint_gen, memory_order_acquire);
+
+	size = lgetxattr(path, UNSHAREDFS_XATTR_CACHE, value, sizeof(value));
+	if ((size <= 0 || !unsharedfs_cachehint_parse(value, size, &hint)) && len > rootlen)
+	{
+		size_t parentlen = strrchr(path, '/') - path;
+
+		hint = cachehint_lookup(path, parentlen > rootlen ? parentlen : rootlen, rootlen);
+	}
+	cachehint_store(key, gen, hint);
+	return hint;
+}
+
+enum unsharedfs_cache_hint unsharedfs_cachehint_get(const char *fpath, size_t rootlen)
+{
+	char path[PATH_MAX];
+	size_t len = strlen(fpath);
+
+	if (!unsharedfs_cachehint_enabled || len >= PATH_MAX || rootlen > len)
+		return CACHE_HINT_DEFAULT;
+	memcpy(path, fpath, len + 1);
+	// the uid directory itself is "BASEDIR/uid/":
+	while (len > rootlen && path[len - 1] == '/')
+		len--;
+	return cachehint_lookup(path, len, rootlen);
+}
+
+void unsharedfs_cachehint_apply(enum unsharedfs_cache_hint hint, int fd, struct fuse_file_info *fi)
+{
+	switch (hint)
+	{
+		case CACHE_HINT_IMMUTABLE:
+			// not keep_cache: the kernel caches a mount path once for all
+			// uids, so the pages of one user's file would be served to the
+			// next user opening the same path.  The backing file is per uid:
+			posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+		break;
+		case CACHE_HINT_NOCACHE:
+			fi->direct_io = 1;
+		break;
+		case CACHE_HINT_STREAM:
+			posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		break;
+		// the compressor reads the hint itself, cold files are cached as usual:
+		case CACHE_HINT_COLD:
+		default:
+		break;
+	}
+}
+
+void unsharedfs_cachehint_invalidate(void)
+{
+	atomic_fetch_add_explicit(&cachehint_gen, 1, memory_order_release);
+}
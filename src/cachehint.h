@@ -0,0 +1,90 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_CACHEHINT_H_
+#define UNSHAREDFS_CACHEHINT_H_
+
+#include "fs.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Caching hints: users set UNSHAREDFS_XATTR_CACHE on a file or directory, and
+ * files inherit the hint of the closest directory above them that has one
+ * (up to the uid directory).  open and create apply the hint:
+ *   immutable  the backing file is read into the page cache (POSIX_FADV_WILLNEED)
+ *   nocache    the file is opened with direct_io, bypassing the page cache
+ *   stream     the backing file is read ahead aggressively (POSIX_FADV_SEQUENTIAL)
+ *   cold       the files of the tree are compressed when idle (see compress.h)
+ * The effective hints are cached for CACHEHINT_TTL seconds; changes made
+ * through the mount take effect immediately.
+ */
+
+enum unsharedfs_cache_hint {
+	CACHE_HINT_DEFAULT
+	,CACHE_HINT_IMMUTABLE
+	,CACHE_HINT_NOCACHE
+	,CACHE_HINT_STREAM
+	,CACHE_HINT_COLD
+	,CACHE_HINT_COUNT
+};
+
+extern const char *const unsharedfs_cache_hint_names[CACHE_HINT_COUNT];
+
+/**
+ * True if caching hints are applied.
+ */
+extern bool unsharedfs_cachehint_enabled;
+
+/**
+ * Enable caching hints.
+ * @return 1 on success, 0 on error (errno is set).
+ */
+int unsharedfs_cachehint_init(void);
+
+/**
+ * Release the cache of hints.
+ */
+void unsharedfs_cachehint_destroy(void);
+
+/**
+ * Parse the value of UNSHAREDFS_XATTR_CACHE.
+ * @param value the value (not NUL-terminated)
+ * @param size the size of value
+ * @param hint set to the hint
+ * @return true if the value names a hint.
+ */
+bool unsharedfs_cachehint_parse(const char *value, size_t size, enum unsharedfs_cache_hint *hint);
+
+/**
+ * Find the effective hint of a backing path, reading the attribute of the
+ * path and its parent directories as needed.
+ * @param fpath the backing path
+ * @param rootlen the length of the uid (or fallback) directory part of fpath,
+ *        which is the last directory that is considered
+ * @return the hint.
+ */
+enum unsharedfs_cache_hint unsharedfs_cachehint_get(const char *fpath, size_t rootlen);
+
+/**
+ * Apply a hint to a file that is being opened.
+ * @param hint the hint
+ * @param fd the backing file
+ * @param fi the FUSE file info of the open
+ */
+void unsharedfs_cachehint_apply(enum unsharedfs_cache_hint hint, int fd, struct fuse_file_info *fi);
+
+/**
+ * Forget the cached hints after UNSHAREDFS_XATTR_CACHE was changed.
+ */
+void unsharedfs_cachehint_invalidate(void);
+
+#endif
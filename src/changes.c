@@ -0,0 +1,718 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+// accept4:
+#define _GNU_SOURCE
+
+#include "fs.h"
+#include "changes.h"
+#include "log.h"
+#include "thread.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// per-thread event buffer; the monitor empties it every MONITOR_TICK_MS:
+#define CHANGES_RING_SIZE (1024 * 1024)
+// paths are cut off at this length:
+#define CHANGES_PATH_MAX (PATH_MAX - 1)
+// a pending write range is reported by the monitor after this long:
+#define CHANGES_COALESCE_NS 1000000000ULL
+
+struct changes_rec {
+	uint64_t time_ns;      /* CLOCK_REALTIME */
+	uint64_t offset;       /* write: the offset; (f)truncate: the size */
+	uint64_t length;       /* write: the length */
+	uint32_t uid;
+	uint32_t gid;
+	uint16_t op;
+	uint16_t pathlen;
+	uint16_t path2len;
+	uint16_t reserved;
+};
+
+struct changes_buf {
+	struct changes_rec rec;
+	char paths[2 * CHANGES_PATH_MAX];
+};
+
+struct changes_client {
+	int fd;
+	char *buf;             /* events not yet sent */
+	size_t len;
+};
+
+/* a growing byte buffer */
+struct changes_bytes {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+_Atomic bool unsharedfs_changes_enabled = false;
+
+// serialises flushing and stopping (never taken by request threads):
+static pthread_mutex_t changes_lock = PTHREAD_MUTEX_INITIALIZER;
+static int changes_file_fd = -1;
+static int changes_listen_fd = -1;
+static char *changes_socket_path = NULL;
+static size_t changes_client_buffer;
+static struct changes_client *changes_clients = NULL;
+static size_t changes_client_count = 0;
+// the events of one flush, sorted by time before they are written:
+static struct changes_bytes changes_batch;
+static size_t *changes_order = NULL;
+static size_t changes_order_size = 0;
+static struct changes_bytes changes_out;
+// the file handles with a pending write range; taken before their locks:
+static pthread_mutex_t changes_pending_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct unsharedfs_fdinfo *changes_pending = NULL;
+
+/**
+ * Create the listening socket for the clients.
+ * @return 1 on success, 0 on error (errno is set).
+ */
+static int unsharedfs_changes_listen(const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	int rc;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		errno = ENAMETOOLONG;
+		return 0;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	// a socket left behind by a crashed instance:
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	changes_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (changes_listen_fd < 0)
+		return 0;
+	if (bind(changes_listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+		goto error_close;
+	// the feed shows the file names of all users:
+	if (chmod(path, S_IRUSR | S_IWUSR) != 0 || listen(changes_listen_fd, 8) != 0)
+		goto error_unlink;
+	changes_socket_path = strdup(path);
+	if (changes_socket_path == NULL)
+		goto error_unlink;
+	return 1;
+
+error_unlink:
+	rc = errno;
+	unlink(path);
+	errno = rc;
+error_close:
+	rc = errno;
+	close(changes_listen_fd);
+	changes_listen_fd = -1;
+	errno = rc;
+	return 0;
+}
+
+int unsharedfs_changes_start(const char *file, const char *socket, size_t client_buffer)
+{
+	int rc;
+
+	pthread_mutex_lock(&changes_lock);
+	if (changes_file_fd >= 0 || changes_listen_fd >= 0)
+	{
+		pthread_mutex_unlock(&changes_lock);
+		errno = EBUSY;
+		return 0;
+	}
+	if (file != NULL)
+	{
+		changes_file_fd = open(file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+		if (changes_file_fd < 0)
+		{
+			pthread_mutex_unlock(&changes_lock);
+			return 0;
+		}
+	}
+	if (socket != NULL && !unsharedfs_changes_listen(socket))
+	{
+		rc = errno;
+		if (changes_file_fd >= 0)
+			close(changes_file_fd);
+		changes_file_fd = -1;
+		pthread_mutex_unlock(&changes_lock);
+		errno = rc;
+		return 0;
+	}
+	changes_client_buffer = client_buffer;
+	atomic_store(&unsharedfs_changes_enabled, true);
+	pthread_mutex_unlock(&changes_lock);
+	return 1;
+}
+
+static size_t unsharedfs_changes_path(char *dst, const char *path, uint16_t *len)
+{
+	size_t n = path ? strlen(path) : 0;
+
+	if (n > CHANGES_PATH_MAX)
+		n = CHANGES_PATH_MAX;
+	memcpy(dst, path, n);
+	*len = n;
+	return n;
+}
+
+/* queue an event in the buffer of the calling thread */
+static void unsharedfs_changes_put(enum unsharedfs_op code, uid_t uid, gid_t gid
+		, const char *path, const char *path2, uint64_t offset, uint64_t length)
+{
+	struct unsharedfs_thread *t = unsharedfs_thread_self();
+	struct unsharedfs_ring *ring;
+	struct changes_buf buf;
+	struct changes_rec *rec = &buf.rec;
+	struct timespec now;
+	size_t len;
+
+	if (t == NULL || path == NULL)
+		return;
+	ring = atomic_load_explicit(&t->changes, memory_order_acquire);
+	if (ring == NULL)
+	{
+		// first event of this thread:
+		ring = malloc(sizeof(*ring));
+		if (ring == NULL)
+			return;
+		if (!unsharedfs_ring_init(ring, CHANGES_RING_SIZE))
+		{
+			free(ring);
+			return;
+		}
+		atomic_store_explicit(&t->changes, ring, memory_order_release);
+	}
+	clock_gettime(CLOCK_REALTIME, &now);
+	rec->time_ns = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+	rec->offset = offset;
+	rec->length = length;
+	rec->uid = uid;
+	rec->gid = gid;
+	rec->op = code;
+	rec->reserved = 0;
+	len = unsharedfs_changes_path(buf.paths, path, &rec->pathlen);
+	len += unsharedfs_changes_path(buf.paths + len, path2, &rec->path2len);
+	unsharedfs_ring_put(ring, &buf, sizeof(*rec) + len);
+}
+
+/* report and clear the pending write range of a file handle */
+static void unsharedfs_changes_put_writes(struct unsharedfs_fdinfo *info)
+{
+	uint64_t start, end;
+	uid_t uid;
+	gid_t gid;
+
+	pthread_mutex_lock(&info->lock);
+	start = info->write_start;
+	end = info->write_end;
+	uid = info->write_uid;
+	gid = info->write_gid;
+	info->write_start = info->write_end = 0;
+	pthread_mutex_unlock(&info->lock);
+	if (end > start)
+		unsharedfs_changes_put(OP_WRITE, uid, gid, info->path, NULL, start, end - start);
+}
+
+/* add a file handle to the list of pending ranges; changes_pending_lock must be held */
+static void unsharedfs_changes_list(struct unsharedfs_fdinfo *info)
+{
+	if (info->write_listed)
+		return;
+	info->write_listed = true;
+	info->write_prev = NULL;
+	info->write_next = changes_pending;
+	if (changes_pending != NULL)
+		changes_pending->write_prev = info;
+	changes_pending = info;
+}
+
+/* remove a file handle from the list of pending ranges; changes_pending_lock must be held */
+static void unsharedfs_changes_unlist(struct unsharedfs_fdinfo *info)
+{
+	if (!info->write_listed)
+		return;
+	if (info->write_prev != NULL)
+		info->write_prev->write_next = info->write_next;
+	else
+		changes_pending = info->write_next;
+	if (info->write_next != NULL)
+		info->write_next->write_prev = info->write_prev;
+	info->write_listed = false;
+}
+
+/**
+ * Report the pending ranges that were started at least CHANGES_COALESCE_NS
+ * ago, and forget the handles without a pending range.
+ * @param all report all pending ranges
+ */
+static void unsharedfs_changes_expire(bool all)
+{
+	struct unsharedfs_fdinfo *info, *next;
+	uint64_t now = unsharedfs_now_ns();
+
+	pthread_mutex_lock(&changes_pending_lock);
+	for (info = changes_pending; info != NULL; info = next)
+	{
+		bool empty, due;
+
+		next = info->write_next;
+		pthread_mutex_lock(&info->lock);
+		empty = info->write_end <= info->write_start;
+		due = all || now - info->write_ns >= CHANGES_COALESCE_NS;
+		pthread_mutex_unlock(&info->lock);
+		if (!empty && due)
+		{
+			unsharedfs_changes_put_writes(info);
+			empty = true;
+		}
+		if (empty)
+			unsharedfs_changes_unlist(info);
+	}
+	pthread_mutex_unlock(&changes_pending_lock);
+}
+
+/* add a write to the pending range of its file handle */
+static void unsharedfs_changes_write(const struct unsharedfs_opctx *op, size_t len)
+{
+	struct unsharedfs_fdinfo *info = unsharedfs_fdtab_get(op->args.fh);
+	struct fuse_context *ctx = fuse_get_context();
+	uint64_t start = op->args.offset, end = start + len;
+	uint64_t now = unsharedfs_now_ns();
+
+	if (info == NULL || info->path == NULL)
+		return;
+	pthread_mutex_lock(&info->lock);
+	if (info->write_end > info->write_start)
+	{
+		// extend the pending range if the write touches it:
+		if (start <= info->write_end && end >= info->write_start && info->write_uid == ctx->uid
+				&& now - info->write_ns < CHANGES_COALESCE_NS)
+		{
+			if (start < info->write_start)
+				info->write_start = start;
+			if (end > info->write_end)
+				info->write_end = end;
+			pthread_mutex_unlock(&info->lock);
+			return;
+		}
+		pthread_mutex_unlock(&info->lock);
+		unsharedfs_changes_put_writes(info);
+		pthread_mutex_lock(&info->lock);
+	}
+	info->write_start = start;
+	info->write_end = end;
+	info->write_ns = now;
+	info->write_uid = ctx->uid;
+	info->write_gid = ctx->gid;
+	pthread_mutex_unlock(&info->lock);
+	// a new range, for the monitor to report:
+	pthread_mutex_lock(&changes_pending_lock);
+	unsharedfs_changes_list(info);
+	pthread_mutex_unlock(&changes_pending_lock);
+}
+
+void unsharedfs_changes_op(const struct unsharedfs_opctx *op, int retstat)
+{
+	struct fuse_context *ctx;
+	struct unsharedfs_fdinfo *info;
+
+	if (retstat < 0)
+		return;
+	switch (op->op)
+	{
+		case OP_WRITE:
+			if (retstat > 0)
+				unsharedfs_changes_write(op, retstat);
+			return;
+		case OP_FSYNC:
+			info = unsharedfs_fdtab_get(op->args.fh);
+			if (info != NULL && info->path != NULL)
+				unsharedfs_changes_put_writes(info);
+			return;
+		case OP_FTRUNCATE:
+			info = unsharedfs_fdtab_get(op->args.fh);
+			if (info == NULL || info->path == NULL)
+				return;
+			// the writes happened before the truncation:
+			unsharedfs_changes_put_writes(info);
+			ctx = fuse_get_context();
+			unsharedfs_changes_put(op->op, ctx->uid, ctx->gid, info->path, NULL, op->args.offset, 0);
+			return;
+		case OP_CREATE:
+		case OP_MKDIR:
+		case OP_MKNOD:
+		case OP_SYMLINK:
+		case OP_UNLINK:
+		case OP_RMDIR:
+		case OP_TRUNCATE:
+		case OP_CHMOD:
+		case OP_CHOWN:
+		case OP_UTIMENS:
+			ctx = fuse_get_context();
+			unsharedfs_changes_put(op->op, ctx->uid, ctx->gid, op->path, NULL, op->args.offset, 0);
+			return;
+		case OP_RENAME:
+		case OP_LINK:
+		case OP_SETXATTR:
+		case OP_REMOVEXATTR:
+			ctx = fuse_get_context();
+			unsharedfs_changes_put(op->op, ctx->uid, ctx->gid, op->path, op->args.path2, 0, 0);
+			return;
+		default:
+			return;
+	}
+}
+
+void unsharedfs_changes_release(struct unsharedfs_fdinfo *info)
+{
+	if (info != NULL && info->path != NULL)
+		unsharedfs_changes_put_writes(info);
+}
+
+void unsharedfs_changes_forget(struct unsharedfs_fdinfo *info)
+{
+	pthread_mutex_lock(&changes_pending_lock);
+	unsharedfs_changes_unlist(info);
+	pthread_mutex_unlock(&changes_pending_lock);
+}
+
+/**
+ * Make room in a byte buffer.
+ * @return 1 on success, 0 on allocation failure.
+ */
+static int unsharedfs_changes_reserve(struct changes_bytes *b, size_t len)
+{
+	char *data;
+	size_t size;
+
+	if (b->len + len <= b->size)
+		return 1;
+	for (size = b->size ? b->size : 65536; size < b->len + len; size *= 2)
+		;
+	data = realloc(b->data, size);
+	if (data == NULL)
+		return 0;
+	b->data = data;
+	b->size = size;
+	return 1;
+}
+
+static void unsharedfs_changes_printf(const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	if (n < 0 || !unsharedfs_changes_reserve(&changes_out, n + 1))
+		return;
+	va_start(ap, fmt);
+	vsnprintf(changes_out.data + changes_out.len, n + 1, fmt, ap);
+	va_end(ap);
+	changes_out.len += n;
+}
+
+/* append a (not NUL-terminated) string as a JSON string */
+static void unsharedfs_changes_string(const char *s, size_t len)
+{
+	size_t i;
+
+	// every byte takes at most 6 characters:
+	if (!unsharedfs_changes_reserve(&changes_out, len * 6 + 2))
+		return;
+	changes_out.data[changes_out.len++] = '"';
+	for (i = 0; i < len; i++)
+	{
+		unsigned char c = s[i];
+
+		if (c == '"' || c == '\\')
+		{
+			changes_out.data[changes_out.len++] = '\\';
+			changes_out.data[changes_out.len++] = c;
+		}
+		else if (c < 0x20)
+			changes_out.len += sprintf(changes_out.data + changes_out.len, "\\u%04x", c);
+		else
+			changes_out.data[changes_out.len++] = c;
+	}
+	changes_out.data[changes_out.len++] = '"';
+}
+
+static void unsharedfs_changes_format(const struct changes_buf *buf)
+{
+	const struct changes_rec *rec = &buf->rec;
+
+	unsharedfs_changes_printf("{\"time\":%llu.%06llu,\"op\":\"%s\",\"uid\":%u,\"gid\":%u,\"path\":"
+			, (unsigned long long) rec->time_ns / 1000000000
+			, (unsigned long long) rec->time_ns % 1000000000 / 1000
+			, rec->op < OP_COUNT ? unsharedfs_op_names[rec->op] : "?"
+			, rec->uid, rec->gid);
+	unsharedfs_changes_string(buf->paths, rec->pathlen);
+	switch (rec->op)
+	{
+		case OP_WRITE:
+			unsharedfs_changes_printf(",\"offset\":%llu,\"length\":%llu"
+					, (unsigned long long) rec->offset, (unsigned long long) rec->length);
+			break;
+		case OP_TRUNCATE:
+		case OP_FTRUNCATE:
+			unsharedfs_changes_printf(",\"size\":%llu", (unsigned long long) rec->offset);
+			break;
+		case OP_RENAME:
+		case OP_LINK:
+			unsharedfs_changes_printf(",\"to\":");
+			unsharedfs_changes_string(buf->paths + rec->pathlen, rec->path2len);
+			break;
+		case OP_SETXATTR:
+		case OP_REMOVEXATTR:
+			unsharedfs_changes_printf(",\"attr\":");
+			unsharedfs_changes_string(buf->paths + rec->pathlen, rec->path2len);
+			break;
+	}
+	unsharedfs_changes_printf("}\n");
+}
+
+static int unsharedfs_changes_compare(const void *p1, const void *p2)
+{
+	const struct changes_rec *r1 = (const void *) (changes_batch.data + *(const size_t *) p1);
+	const struct changes_rec *r2 = (const void *) (changes_batch.data + *(const size_t *) p2);
+
+	if (r1->time_ns != r2->time_ns)
+		return r1->time_ns < r2->time_ns ? -1 : 1;
+	// keep the order of a thread's events:
+	return *(const size_t *) p1 < *(const size_t *) p2 ? -1 : *(const size_t *) p1 > *(const size_t *) p2;
+}
+
+/* move the buffered events to changes_out, in order of time; changes_lock must be held */
+static void unsharedfs_changes_drain(void)
+{
+	size_t i, n = unsharedfs_thread_count(), count = 0;
+	unsigned long lost = 0;
+
+	changes_batch.len = 0;
+	for (i = 0; i < n; i++)
+	{
+		struct unsharedfs_thread *t = unsharedfs_thread_get(i);
+		struct unsharedfs_ring *ring;
+		size_t len;
+
+		if (t == NULL)
+			continue;
+		ring = atomic_load_explicit(&t->changes, memory_order_acquire);
+		if (ring == NULL)
+			continue;
+		lost += atomic_exchange(&ring->dropped, 0);
+		for (;;)
+		{
+			// records are kept aligned, for the comparison:
+			changes_batch.len = (changes_batch.len + 7) & ~(size_t) 7;
+			if (!unsharedfs_changes_reserve(&changes_batch, sizeof(struct changes_buf)))
+				break;
+			len = unsharedfs_ring_get(ring, changes_batch.data + changes_batch.len, sizeof(struct changes_buf));
+			if (len == 0)
+				break;
+			if (count == changes_order_size)
+			{
+				size_t size = changes_order_size ? changes_order_size * 2 : 1024;
+				size_t *order = realloc(changes_order, size * sizeof(*order));
+
+				if (order == NULL)
+				{
+					lost++;
+					continue;
+				}
+				changes_order = order;
+				changes_order_size = size;
+			}
+			changes_order[count++] = changes_batch.len;
+			changes_batch.len += len;
+		}
+	}
+	qsort(changes_order, count, sizeof(*changes_order), unsharedfs_changes_compare);
+
+	changes_out.len = 0;
+	if (lost != 0)
+	{
+		struct timespec now;
+
+		clock_gettime(CLOCK_REALTIME, &now);
+		unsharedfs_changes_printf("{\"time\":%llu.%06llu,\"lost\":%lu}\n"
+				, (unsigned long long) now.tv_sec, (unsigned long long) now.tv_nsec / 1000, lost);
+	}
+	for (i = 0; i < count; i++)
+		unsharedfs_changes_format((const struct changes_buf *) (changes_batch.data + changes_order[i]));
+}
+
+static void unsharedfs_changes_drop_client(size_t i, const char *reason)
+{
+	logmsg(LOG_WARNING, "disconnecting change feed client: %s", reason);
+	close(changes_clients[i].fd);
+	free(changes_clients[i].buf);
+	changes_clients[i] = changes_clients[--changes_client_count];
+}
+
+/* accept new clients, and send them what has been queued; changes_lock must be held */
+static void unsharedfs_changes_serve(void)
+{
+	size_t i;
+	int fd;
+
+	while ((fd = accept4(changes_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+	{
+		struct changes_client *clients = realloc(changes_clients, (changes_client_count + 1) * sizeof(*clients));
+
+		if (clients == NULL)
+		{
+			close(fd);
+			break;
+		}
+		changes_clients = clients;
+		changes_clients[changes_client_count].fd = fd;
+		changes_clients[changes_client_count].buf = NULL;
+		changes_clients[changes_client_count].len = 0;
+		changes_client_count++;
+	}
+
+	for (i = 0; i < changes_client_count; )
+	{
+		struct changes_client *c = &changes_clients[i];
+		ssize_t n;
+
+		if (changes_out.len != 0)
+		{
+			char *buf;
+
+			if (c->len + changes_out.len > changes_client_buffer)
+			{
+				unsharedfs_changes_drop_client(i, "too far behind");
+				continue;
+			}
+			buf = realloc(c->buf, c->len + changes_out.len);
+			if (buf == NULL)
+			{
+				unsharedfs_changes_drop_client(i, strerror(errno));
+				continue;
+			}
+			memcpy(buf + c->len, changes_out.data, changes_out.len);
+			c->buf = buf;
+			c->len += changes_out.len;
+		}
+		while (c->len != 0 && (n = send(c->fd, c->buf, c->len, MSG_NOSIGNAL | MSG_DONTWAIT)) > 0)
+		{
+			memmove(c->buf, c->buf + n, c->len - n);
+			c->len -= n;
+		}
+		if (c->len != 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		{
+			unsharedfs_changes_drop_client(i, errno == EPIPE ? "connection closed" : strerror(errno));
+			continue;
+		}
+		i++;
+	}
+}
+
+/* write changes_out to the file; changes_lock must be held */
+static void unsharedfs_changes_write_file(void)
+{
+	size_t done = 0;
+
+	while (done < changes_out.len)
+	{
+		ssize_t n = write(changes_file_fd, changes_out.data + done, changes_out.len - done);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+		{
+			logmsg(LOG_ERR, "could not write the change feed: %s", strerror(errno));
+			return;
+		}
+		done += n;
+	}
+}
+
+void unsharedfs_changes_flush(void)
+{
+	pthread_mutex_lock(&changes_lock);
+	if (changes_file_fd >= 0 || changes_listen_fd >= 0)
+	{
+		unsharedfs_changes_expire(false);
+		unsharedfs_changes_drain();
+		if (changes_file_fd >= 0 && changes_out.len != 0)
+			unsharedfs_changes_write_file();
+		if (changes_listen_fd >= 0)
+			unsharedfs_changes_serve();
+	}
+	pthread_mutex_unlock(&changes_lock);
+}
+
+void unsharedfs_changes_stop(void)
+{
+	size_t i;
+
+	pthread_mutex_lock(&changes_lock);
+	if (changes_file_fd >= 0 || changes_listen_fd >= 0)
+	{
+		atomic_store(&unsharedfs_changes_enabled, false);
+		unsharedfs_changes_expire(true);
+		unsharedfs_changes_drain();
+		if (changes_file_fd >= 0)
+		{
+			unsharedfs_changes_write_file();
+			close(changes_file_fd);
+			changes_file_fd = -1;
+		}
+		if (changes_listen_fd >= 0)
+		{
+			unsharedfs_changes_serve();
+			for (i = 0; i < changes_client_count; i++)
+			{
+				close(changes_clients[i].fd);
+				free(changes_clients[i].buf);
+			}
+			free(changes_clients);
+			changes_clients = NULL;
+			changes_client_count = 0;
+			close(changes_listen_fd);
+			changes_listen_fd = -1;
+			unlink(changes_socket_path);
+			free(changes_socket_path);
+			changes_socket_path = NULL;
+		}
+		free(changes_batch.data);
+		free(changes_out.data);
+		free(changes_order);
+		memset(&changes_batch, 0, sizeof(changes_batch));
+		memset(&changes_out, 0, sizeof(changes_out));
+		changes_order = NULL;
+		changes_order_size = 0;
+	}
+	pthread_mutex_unlock(&changes_lock);
+}
@@ -0,0 +1,83 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_CHANGES_H_
+#define UNSHAREDFS_CHANGES_H_
+
+#include "fdtab.h"
+#include "opctx.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * The change feed reports every successful modification, so that backup and
+ * indexing tools can work incrementally instead of scanning BASEDIR.
+ * Events are queued in per-thread buffers and written by the monitor thread
+ * as JSON lines, to an append-only file and/or to the clients of a Unix
+ * socket:
+ *   {"time":1414141414.123456,"op":"write","uid":1000,"gid":100,"path":"/a","offset":0,"length":8192}
+ * Paths are relative to the mount point, i.e. to the directory of the user
+ * (or the fallback directory).  rename and link add "to", setxattr and
+ * removexattr add "attr", truncate and ftruncate add "size".
+ * Writes to a file handle are coalesced into ranges, which are reported when
+ * the handle is synced or closed, when a write does not continue the range, or
+ * by the monitor thread a second after the range was started.
+ * Events lost to full buffers are reported as {"time":...,"lost":n}; a client
+ * whose socket buffer exceeds the limit is disconnected.  In both cases the
+ * consumer has to fall back to a full scan.
+ */
+
+/**
+ * True while changes are reported.
+ */
+extern _Atomic bool unsharedfs_changes_enabled;
+
+/**
+ * Start the change feed.
+ * @param file the append-only log file (NULL: none)
+ * @param socket the path of the Unix socket for clients (NULL: none)
+ * @param client_buffer the maximum number of bytes queued for a client
+ * @return 1 on success, 0 on error (errno is set).
+ */
+int unsharedfs_changes_start(const char *file, const char *socket, size_t client_buffer);
+
+/**
+ * Report a finished operation if it modified something.
+ * Called on the request thread.
+ */
+void unsharedfs_changes_op(const struct unsharedfs_opctx *op, int retstat);
+
+/**
+ * Report the pending write range of a file handle that is being closed.
+ * Called on the request thread.
+ */
+void unsharedfs_changes_release(struct unsharedfs_fdinfo *info);
+
+/**
+ * Forget a file handle whose entry is freed, without reporting its pending
+ * write range.
+ */
+void unsharedfs_changes_forget(struct unsharedfs_fdinfo *info);
+
+/**
+ * Report the write ranges pending for a second, and move the queued events to
+ * the file and the socket clients.  Called periodically from the monitor
+ * thread.
+ */
+void unsharedfs_changes_flush(void);
+
+/**
+ * Stop the change feed, if any; the pending write ranges are reported first.
+ */
+void unsharedfs_changes_stop(void);
+
+#endif
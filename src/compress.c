@@ -0,0 +1,1106 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+// O_NOATIME, F_SETLEASE:
+#define _GNU_SOURCE
+
+#include "compress.h"
+
+bool unsharedfs_compress_enabled = false;
+
+#ifdef HAVE_ZSTD
+
+#include "basedir.h"
+#include "batch.h"
+#include "cachehint.h"
+#include "fdtab.h"
+#include "fs.h"
+#include "log.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/random.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/xattr.h>
+#include <zstd.h>
+
+// bytes of the file per frame; a read needs one or two frames:
+#define COMPRESS_CHUNK_SIZE (128 * 1024)
+// larger chunk sizes in a header mean that the file is damaged:
+#define COMPRESS_CHUNK_MAX (16 * 1024 * 1024)
+// smaller files would hardly use fewer blocks:
+#define COMPRESS_MIN_SIZE (16 * 1024)
+// the first pass starts this long after the mount, the others follow every hour:
+#define COMPRESS_FIRST_PASS_S 60
+#define COMPRESS_PASS_S 3600
+// names of the temporary files, which the walk skips:
+#define COMPRESS_TEMP_PREFIX ".unsharedfs-"
+// entries of a directory that are stat'ed together:
+#define COMPRESS_BATCH_DEPTH 64
+#define COMPRESS_LOCKS 256
+// cached sizes of compressed files, for getattr:
+#define COMPRESS_STAT_SLOTS 4096
+#define COMPRESS_STAT_LOCKS 64
+
+// not in glibc's headers:
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_IDLE (3 << 13)
+
+struct unsharedfs_compressed {
+	int fd;
+	struct unsharedfs_compress_header h;
+	uint64_t *offsets;     /* h.chunks + 1 */
+	pthread_mutex_t lock;  /* protects the rest */
+	char *frame;           /* the frame being decompressed */
+	char *chunk;           /* the last decompressed chunk (NULL until the first read) */
+	uint64_t chunk_index;  /* its index (UINT64_MAX: none) */
+	size_t chunk_len;
+};
+
+struct compress_stat_slot {
+	dev_t dev;             /* 0: unused */
+	ino_t ino;
+	struct timespec ctime;
+	bool compressed;
+	uint64_t size;
+};
+
+/* the state of a pass of the compressor */
+struct compress_walk {
+	char path[PATH_MAX];
+	time_t idle_before;    /* files used or changed later are not compressed */
+	ZSTD_CCtx *cctx;
+	char *buf;             /* a chunk of the file */
+	char *frame;           /* its compressed frame */
+	struct unsharedfs_batch *batch;
+	const char *names[COMPRESS_BATCH_DEPTH];  /* a batch of entries of a directory */
+	struct stat sb[COMPRESS_BATCH_DEPTH];
+	int rc[COMPRESS_BATCH_DEPTH];
+	unsigned long files;
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+};
+
+static char *compress_rootdir;
+static time_t compress_idle_s;
+static int compress_level;
+static enum unsharedfs_batch_mode compress_io_uring;
+static pthread_rwlock_t compress_locks[COMPRESS_LOCKS];
+static struct compress_stat_slot *compress_stat_slots;
+static pthread_mutex_t compress_stat_locks[COMPRESS_STAT_LOCKS];
+static pthread_key_t compress_dctx_key;
+// files that didn't compress well, by unsharedfs_path_hash() of device, inode and mtime:
+static struct unsharedfs_idset compress_skip;
+
+static pthread_t compress_thread;
+static bool compress_running = false;
+static _Atomic bool compress_stopping = false;
+static pthread_mutex_t compress_stop_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t compress_stop_cond = PTHREAD_COND_INITIALIZER;
+
+static pthread_rwlock_t *compress_lock_of(const char *fpath)
+{
+	return &compress_locks[unsharedfs_path_hash(fpath) % COMPRESS_LOCKS];
+}
+
+void unsharedfs_compress_lock(const char *fpath)
+{
+	pthread_rwlock_rdlock(compress_lock_of(fpath));
+}
+
+void unsharedfs_compress_unlock(const char *fpath)
+{
+	pthread_rwlock_unlock(compress_lock_of(fpath));
+}
+
+/* open a file (relative to dirfd) for reading without changing its access time */
+static int compress_openat(int dirfd, const char *name)
+{
+	int fd = openat(dirfd, name, O_RDONLY | O_NOFOLLOW | O_NOATIME | O_CLOEXEC);
+
+	// O_NOATIME needs the owner of the file or CAP_FOWNER:
+	if (fd < 0 && errno == EPERM)
+		fd = openat(dirfd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	return fd;
+}
+
+/**
+ * Open a subdirectory.  The directories of the users are entries of the
+ * root directory, which only root can change; below them, the owner of a
+ * directory can replace an entry by a symlink at any time, which is never
+ * followed.
+ * @param top set if dirfd is the root directory
+ * @return the descriptor, or -1 on error (errno is set).
+ */
+static int compress_opendir(int dirfd, const char *name, bool top)
+{
+	return openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | (top ? 0 : O_NOFOLLOW));
+}
+
+/**
+ * Open the directory of a backing file one component at a time, without
+ * following symlinks below the directories of the users.
+ * @param name set to the last component of fpath
+ * @return the descriptor, or -1 on error (errno is set).
+ */
+static int compress_open_parent(const char *fpath, const char **name)
+{
+	size_t len = strlen(compress_rootdir);
+	const char *p = fpath + len + 1, *slash;
+	char component[NAME_MAX + 1];
+	bool top = true;
+	int fd, next;
+
+	if (strncmp(fpath, compress_rootdir, len) != 0 || fpath[len] != '/')
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	fd = open(compress_rootdir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	while (fd >= 0 && (slash = strchr(p, '/')) != NULL)
+	{
+		if (slash - p > NAME_MAX)
+		{
+			close(fd);
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		if (slash > p)
+		{
+			memcpy(component, p, slash - p);
+			component[slash - p] = '\0';
+			next = compress_opendir(fd, component, top);
+			close(fd);
+			fd = next;
+			top = false;
+		}
+		p = slash + 1;
+	}
+	*name = p;
+	return fd;
+}
+
+static int compress_pread(int fd, void *buf, size_t size, uint64_t offset)
+{
+	ssize_t len = pread(fd, buf, size, offset);
+
+	if (len < 0)
+		return 0;
+	if ((size_t) len != size)
+	{
+		errno = EIO;
+		return 0;
+	}
+	return 1;
+}
+
+static int compress_pwrite(int fd, const void *buf, size_t size, uint64_t offset)
+{
+	ssize_t len = pwrite(fd, buf, size, offset);
+
+	if (len < 0)
+		return 0;
+	if ((size_t) len != size)
+	{
+		errno = ENOSPC;
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Read the header of a file.
+ * @param file_size the size of the backing file
+ * @return 1 if the file is compressed, 0 if it isn't (errno is 0) or on error
+ *         (errno is set).
+ */
+static int compress_read_header(int fd, struct unsharedfs_compress_header *h, uint64_t file_size)
+{
+	ssize_t len = pread(fd, h, sizeof(*h), 0);
+
+	if (len < 0)
+		return 0;
+	if ((size_t) len < sizeof(*h) || memcmp(h->magic, UNSHAREDFS_COMPRESS_MAGIC, sizeof(h->magic)) != 0)
+	{
+		errno = 0;
+		return 0;
+	}
+	// users can forge a header, so no field may make the arithmetic wrap around:
+	if (h->version != UNSHAREDFS_COMPRESS_VERSION
+			|| h->chunk_size == 0 || h->chunk_size > COMPRESS_CHUNK_MAX
+			|| h->size > INT64_MAX || h->index_offset > file_size
+			|| h->chunks != (h->size + h->chunk_size - 1) / h->chunk_size
+			|| h->chunks >= file_size / sizeof(uint64_t)
+			|| h->index_offset < sizeof(*h)
+			|| h->index_offset + (h->chunks + 1) * sizeof(uint64_t) != file_size)
+	{
+		errno = EIO;
+		return 0;
+	}
+	return 1;
+}
+
+struct unsharedfs_compressed *unsharedfs_compress_load(int fd)
+{
+	struct unsharedfs_compressed *z;
+	struct stat sb;
+	size_t bound;
+	uint64_t i;
+	int err;
+
+	z = calloc(1, sizeof(*z));
+	if (z == NULL)
+		return NULL;
+	if (fstat(fd, &sb) != 0 || !compress_read_header(fd, &z->h, sb.st_size))
+		goto fail;
+	z->fd = fd;
+	z->chunk_index = UINT64_MAX;
+	z->offsets = malloc((z->h.chunks + 1) * sizeof(uint64_t));
+	if (z->offsets == NULL
+			|| !compress_pread(fd, z->offsets, (z->h.chunks + 1) * sizeof(uint64_t), z->h.index_offset))
+		goto fail;
+	bound = ZSTD_compressBound(z->h.chunk_size);
+	errno = EIO;
+	if (z->offsets[0] != sizeof(z->h) || z->offsets[z->h.chunks] != z->h.index_offset)
+		goto fail;
+	for (i = 0; i < z->h.chunks; i++)
+		if (z->offsets[i + 1] < z->offsets[i] || z->offsets[i + 1] - z->offsets[i] > bound)
+			goto fail;
+	pthread_mutex_init(&z->lock, NULL);
+	return z;
+
+fail:
+	err = errno;
+	free(z->offsets);
+	free(z);
+	errno = err;
+	return NULL;
+}
+
+void unsharedfs_compress_close(struct unsharedfs_compressed *z)
+{
+	if (z == NULL)
+		return;
+	pthread_mutex_destroy(&z->lock);
+	free(z->offsets);
+	free(z->frame);
+	free(z->chunk);
+	free(z);
+}
+
+uint64_t unsharedfs_compress_size(const struct unsharedfs_compressed *z)
+{
+	return z->h.size;
+}
+
+static void compress_free_dctx(void *dctx)
+{
+	ZSTD_freeDCtx(dctx);
+}
+
+/* the decompression context of the calling thread */
+static ZSTD_DCtx *compress_dctx(void)
+{
+	ZSTD_DCtx *dctx = pthread_getspecific(compress_dctx_key);
+
+	if (dctx == NULL)
+	{
+		dctx = ZSTD_createDCtx();
+		if (dctx == NULL)
+		{
+			errno = ENOMEM;
+			return NULL;
+		}
+		pthread_setspecific(compress_dctx_key, dctx);
+	}
+	return dctx;
+}
+
+/* decompress chunk i into z->chunk; called with z->lock held */
+static int compress_load_chunk(struct unsharedfs_compressed *z, uint64_t i)
+{
+	uint64_t len = z->offsets[i + 1] - z->offsets[i];
+	uint64_t expected = z->h.size - i * z->h.chunk_size;
+	ZSTD_DCtx *dctx;
+	size_t n;
+
+	if (expected > z->h.chunk_size)
+		expected = z->h.chunk_size;
+	if (z->chunk == NULL)
+	{
+		z->chunk = malloc(z->h.chunk_size);
+		z->frame = malloc(ZSTD_compressBound(z->h.chunk_size));
+		if (z->chunk == NULL || z->frame == NULL)
+		{
+			free(z->chunk);
+			free(z->frame);
+			z->chunk = z->frame = NULL;
+			errno = ENOMEM;
+			return 0;
+		}
+	}
+	z->chunk_index = UINT64_MAX;
+	dctx = compress_dctx();
+	if (dctx == NULL || !compress_pread(z->fd, z->frame, len, z->offsets[i]))
+		return 0;
+	n = ZSTD_decompressDCtx(dctx, z->chunk, z->h.chunk_size, z->frame, len);
+	if (ZSTD_isError(n) || n != expected)
+	{
+		logmsg(LOG_ERR, "damaged compressed file (chunk %llu): %s"
+				, (unsigned long long) i
+				, ZSTD_isError(n) ? ZSTD_getErrorName(n) : "wrong size");
+		errno = EIO;
+		return 0;
+	}
+	z->chunk_index = i;
+	z->chunk_len = n;
+	return 1;
+}
+
+ssize_t unsharedfs_compress_read(struct unsharedfs_compressed *z, char *buf, size_t size, off_t offset)
+{
+	size_t done = 0;
+
+	if (offset < 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if ((uint64_t) offset >= z->h.size)
+		return 0;
+	if (size > z->h.size - offset)
+		size = z->h.size - offset;
+
+	pthread_mutex_lock(&z->lock);
+	while (done < size)
+	{
+		uint64_t pos = offset + done;
+		uint64_t i = pos / z->h.chunk_size;
+		size_t skip = pos % z->h.chunk_size;
+		size_t n;
+
+		if (i >= z->h.chunks)
+		{
+			pthread_mutex_unlock(&z->lock);
+			errno = EIO;
+			return -1;
+		}
+		if (i != z->chunk_index && !compress_load_chunk(z, i))
+		{
+			pthread_mutex_unlock(&z->lock);
+			return -1;
+		}
+		n = z->chunk_len - skip;
+		if (n > size - done)
+			n = size - done;
+		memcpy(buf + done, z->chunk + skip, n);
+		done += n;
+	}
+	pthread_mutex_unlock(&z->lock);
+	return done;
+}
+
+/**
+ * Check the header of a marked file, using the cache of recent checks.
+ * @param size set to the size of the contents of a compressed file
+ * @return true if the file is compressed, false if it isn't or on error.
+ */
+static bool compress_check(const char *fpath, const struct stat *sb, uint64_t *size)
+{
+	uint64_t key = (uint64_t) sb->st_ino ^ (uint64_t) sb->st_dev * 0x9e3779b97f4a7c15ULL;
+	struct compress_stat_slot *slot = &compress_stat_slots[key % COMPRESS_STAT_SLOTS];
+	pthread_mutex_t *lock = &compress_stat_locks[key % COMPRESS_STAT_LOCKS];
+	struct unsharedfs_compress_header h;
+	bool found, compressed = false;
+
+	// compressed files don't change, so a file is identified by its inode and ctime:
+	pthread_mutex_lock(lock);
+	found = slot->dev == sb->st_dev && slot->ino == sb->st_ino
+		&& slot->ctime.tv_sec == sb->st_ctim.tv_sec && slot->ctime.tv_nsec == sb->st_ctim.tv_nsec;
+	if (found)
+	{
+		compressed = slot->compressed;
+		*size = slot->size;
+	}
+	pthread_mutex_unlock(lock);
+
+	if (!found)
+	{
+		int fd = compress_openat(AT_FDCWD, fpath);
+
+		if (fd < 0)
+			return false;
+		compressed = compress_read_header(fd, &h, sb->st_size);
+		close(fd);
+		if (!compressed && errno != 0)
+			return false;
+		*size = h.size;
+		pthread_mutex_lock(lock);
+		slot->dev = sb->st_dev;
+		slot->ino = sb->st_ino;
+		slot->ctime = sb->st_ctim;
+		slot->compressed = compressed;
+		slot->size = *size;
+		pthread_mutex_unlock(lock);
+	}
+	return compressed;
+}
+
+void unsharedfs_compress_stat(const char *fpath, struct stat *sb)
+{
+	uint64_t size = 0;
+
+	if (compress_check(fpath, sb, &size))
+	{
+		sb->st_size = size;
+		sb->st_mode &= ~S_ISVTX;
+	}
+}
+
+bool unsharedfs_compress_is_compressed(const char *fpath, const struct stat *sb)
+{
+	uint64_t size;
+
+	return unsharedfs_compress_marked(sb) && compress_check(fpath, sb, &size);
+}
+
+/**
+ * Create a temporary file in a directory.
+ * @param tmp set to the name of the temporary file
+ * @return the descriptor, or -1 on error (errno is set).
+ */
+static int compress_tempfile(char tmp[NAME_MAX + 1], int dirfd, const char *purpose)
+{
+	static const char letters[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+	unsigned char random[6];
+	int len, tries, i, fd;
+
+	len = snprintf(tmp, NAME_MAX + 1, COMPRESS_TEMP_PREFIX "%s.", purpose);
+	// mkostemp() only takes a path, which could lead through a symlink:
+	for (tries = 0; tries < 100; tries++)
+	{
+		if (getrandom(random, sizeof(random), 0) != sizeof(random))
+			return -1;
+		for (i = 0; i < (int) sizeof(random); i++)
+			tmp[len + i] = letters[random[i] % (sizeof(letters) - 1)];
+		tmp[len + i] = '\0';
+		fd = openat(dirfd, tmp, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, S_IRUSR | S_IWUSR);
+		if (fd >= 0 || errno != EEXIST)
+			return fd;
+	}
+	return -1;
+}
+
+/**
+ * Give the copy of a file the owner, extended attributes, mode and times of
+ * the file.
+ * @param mode the mode of the copy
+ * @return 1 on success, 0 on error (errno is set).
+ */
+static int compress_copy_attrs(int fd, int copyfd, const struct stat *sb, mode_t mode)
+{
+	struct timespec times[2] = { sb->st_atim, sb->st_mtim };
+	char *names, *name, *value;
+	ssize_t len;
+	int ok = 1;
+
+	if (fchown(copyfd, sb->st_uid, sb->st_gid) != 0)
+		return 0;
+	len = flistxattr(fd, NULL, 0);
+	if (len < 0 && errno != ENOTSUP)
+		return 0;
+	if (len > 0)
+	{
+		names = malloc(len);
+		value = malloc(XATTR_SIZE_MAX);
+		if (names == NULL || value == NULL || (len = flistxattr(fd, names, len)) < 0)
+			ok = 0;
+		for (name = names; ok && name < names + len; name += strlen(name) + 1)
+		{
+			ssize_t size = fgetxattr(fd, name, value, XATTR_SIZE_MAX);
+
+			if (size < 0 || fsetxattr(copyfd, name, value, size, 0) != 0)
+				ok = 0;
+		}
+		free(names);
+		free(value);
+		if (!ok)
+			return 0;
+	}
+	// after fchown(), which clears the setuid and setgid bits:
+	return fchmod(copyfd, mode & 07777) == 0 && futimens(copyfd, times) == 0;
+}
+
+int unsharedfs_compress_thaw(const char *fpath, int callerfd)
+{
+	pthread_rwlock_t *lock = compress_lock_of(fpath);
+	struct unsharedfs_compressed *z = NULL;
+	const char *name;
+	char tmp[NAME_MAX + 1];
+	struct stat opened, sb;
+	int dirfd = -1, fd = -1, tmpfd = -1, ok = 0, err;
+	uint64_t i;
+
+	pthread_rwlock_wrlock(lock);
+	if (fstat(callerfd, &opened) != 0)
+		goto out;
+	// decompressed meanwhile, or never compressed:
+	if (!unsharedfs_compress_marked(&opened))
+	{
+		ok = 1;
+		goto out;
+	}
+	dirfd = compress_open_parent(fpath, &name);
+	if (dirfd >= 0)
+		fd = compress_openat(dirfd, name);
+	if (fd < 0)
+	{
+		// the operation that wants to change the file fails as well:
+		ok = errno == ENOENT;
+		goto out;
+	}
+	if (fstat(fd, &sb) != 0)
+		goto out;
+	// only the file that the caller could open is decompressed:
+	if (sb.st_dev != opened.st_dev || sb.st_ino != opened.st_ino)
+	{
+		errno = EAGAIN;
+		goto out;
+	}
+	z = unsharedfs_compress_load(fd);
+	if (z == NULL)
+	{
+		ok = errno == 0;
+		goto out;
+	}
+
+	tmpfd = compress_tempfile(tmp, dirfd, "thaw");
+	if (tmpfd < 0)
+		goto out;
+	for (i = 0; i < z->h.chunks; i++)
+	{
+		if (!compress_load_chunk(z, i)
+				|| !compress_pwrite(tmpfd, z->chunk, z->chunk_len, i * z->h.chunk_size))
+			goto out;
+	}
+	if (!compress_copy_attrs(fd, tmpfd, &sb, sb.st_mode & ~S_ISVTX) || fsync(tmpfd) != 0
+			|| renameat(dirfd, tmp, dirfd, name) != 0)
+		goto out;
+	ok = 1;
+	logmsg(LOG_DEBUG, "decompressed %s", fpath);
+
+out:
+	err = errno;
+	if (tmpfd >= 0)
+	{
+		if (!ok)
+			unlinkat(dirfd, tmp, 0);
+		close(tmpfd);
+	}
+	unsharedfs_compress_close(z);
+	if (fd >= 0)
+		close(fd);
+	if (dirfd >= 0)
+		close(dirfd);
+	pthread_rwlock_unlock(lock);
+	if (!ok)
+		logmsg(LOG_ERR, "could not decompress %s: %s", fpath, strerror(err));
+	errno = err;
+	return ok;
+}
+
+/* the key of a version of a file in compress_skip */
+static unsigned long compress_skip_key(const struct stat *sb)
+{
+	char key[64];
+
+	snprintf(key, sizeof(key), "%llu:%llu:%lld.%ld"
+			, (unsigned long long) sb->st_dev
+			, (unsigned long long) sb->st_ino
+			, (long long) sb->st_mtim.tv_sec
+			, sb->st_mtim.tv_nsec);
+	// unsharedfs_idset ids must leave room for the mark:
+	return unsharedfs_path_hash(key) >> 2;
+}
+
+/* true while the compressor holds the read lease of fd */
+static bool compress_leased(int fd)
+{
+	return fcntl(fd, F_GETLEASE) == F_RDLCK && !atomic_load(&compress_stopping);
+}
+
+/* update cold with the hint of a file or directory, if it has one */
+static void compress_hint(int fd, bool *cold)
+{
+	enum unsharedfs_cache_hint hint;
+	char value[32];
+	ssize_t size = fgetxattr(fd, UNSHAREDFS_XATTR_CACHE, value, sizeof(value));
+
+	if (size > 0 && unsharedfs_cachehint_parse(value, size, &hint))
+		*cold = hint == CACHE_HINT_COLD;
+}
+
+/**
+ * Replace a file by a compressed copy.  w->path is only used for the lock
+ * and the messages: the file is opened and replaced relative to dirfd.
+ * @param sb the attributes of name
+ * @return 1 if the file was compressed, 0 if not.
+ */
+static int compress_file(struct compress_walk *w, int dirfd, const char *name, const struct stat *sb)
+{
+	const char *fpath = w->path;
+	pthread_rwlock_t *lock = compress_lock_of(fpath);
+	struct unsharedfs_compress_header h;
+	struct stat now;
+	char tmp[NAME_MAX + 1];
+	uint64_t *offsets = NULL;
+	uint64_t i, end;
+	int fd, tmpfd = -1, ok = 0;
+	bool cold = true;
+
+	fd = compress_openat(dirfd, name);
+	if (fd < 0)
+		return 0;
+	// the file must still be the one that was found idle:
+	if (fstat(fd, &now) != 0 || now.st_dev != sb->st_dev || now.st_ino != sb->st_ino
+			|| now.st_ctim.tv_sec != sb->st_ctim.tv_sec || now.st_ctim.tv_nsec != sb->st_ctim.tv_nsec)
+	{
+		close(fd);
+		return 0;
+	}
+	// the file's own hint:
+	compress_hint(fd, &cold);
+	if (!cold)
+	{
+		close(fd);
+		return 0;
+	}
+	// fails if the file is open for writing, and is broken by opening it for writing:
+	if (fcntl(fd, F_SETLEASE, F_RDLCK) != 0)
+	{
+		if (errno != EAGAIN)
+			logmsg(LOG_WARNING, "not compressing %s, no lease: %s", fpath, strerror(errno));
+		close(fd);
+		return 0;
+	}
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, UNSHAREDFS_COMPRESS_MAGIC, sizeof(h.magic));
+	h.version = UNSHAREDFS_COMPRESS_VERSION;
+	h.chunk_size = COMPRESS_CHUNK_SIZE;
+	h.size = sb->st_size;
+	h.chunks = (h.size + h.chunk_size - 1) / h.chunk_size;
+	offsets = malloc((h.chunks + 1) * sizeof(uint64_t));
+	tmpfd = offsets ? compress_tempfile(tmp, dirfd, "compress") : -1;
+	if (tmpfd < 0)
+		goto out;
+
+	end = sizeof(h);
+	for (i = 0; i < h.chunks; i++)
+	{
+		size_t len = h.size - i * h.chunk_size < h.chunk_size ? h.size - i * h.chunk_size : h.chunk_size;
+		size_t n;
+
+		if (!compress_leased(fd) || !compress_pread(fd, w->buf, len, i * h.chunk_size))
+			goto out;
+		n = ZSTD_compressCCtx(w->cctx, w->frame, ZSTD_compressBound(h.chunk_size), w->buf, len, compress_level);
+		if (ZSTD_isError(n) || !compress_pwrite(tmpfd, w->frame, n, end))
+			goto out;
+		offsets[i] = end;
+		end += n;
+	}
+	offsets[h.chunks] = end;
+	h.index_offset = end;
+	if (!compress_pwrite(tmpfd, offsets, (h.chunks + 1) * sizeof(uint64_t), end)
+			|| !compress_pwrite(tmpfd, &h, sizeof(h), 0))
+		goto out;
+	end += (h.chunks + 1) * sizeof(uint64_t);
+	// not worth it, unless it saves an eighth:
+	if (end > h.size - h.size / 8)
+	{
+		unsharedfs_idset_add(&compress_skip, compress_skip_key(sb), false);
+		goto out;
+	}
+	if (!compress_copy_attrs(fd, tmpfd, &now, now.st_mode | S_ISVTX) || fsync(tmpfd) != 0)
+		goto out;
+
+	// replace the file, unless it was changed meanwhile; holders of the lock
+	// don't change it for long, except for an open that breaks the lease:
+	while (pthread_rwlock_trywrlock(lock) != 0)
+	{
+		struct timespec pause = { 0, 1000000 };
+
+		if (!compress_leased(fd))
+			goto out;
+		nanosleep(&pause, NULL);
+	}
+	{
+		struct stat after, named;
+
+		ok = compress_leased(fd)
+			&& fstat(fd, &after) == 0
+			&& after.st_ctim.tv_sec == now.st_ctim.tv_sec && after.st_ctim.tv_nsec == now.st_ctim.tv_nsec
+			&& fstatat(dirfd, name, &named, AT_SYMLINK_NOFOLLOW) == 0
+			&& named.st_dev == now.st_dev && named.st_ino == now.st_ino
+			&& renameat(dirfd, tmp, dirfd, name) == 0;
+	}
+	pthread_rwlock_unlock(lock);
+	if (ok)
+	{
+		w->files++;
+		w->bytes_in += h.size;
+		w->bytes_out += end;
+	}
+
+out:
+	if (tmpfd >= 0)
+	{
+		if (!ok)
+			unlinkat(dirfd, tmp, 0);
+		close(tmpfd);
+	}
+	free(offsets);
+	fcntl(fd, F_SETLEASE, F_UNLCK);
+	close(fd);
+	return ok;
+}
+
+static void compress_candidate(struct compress_walk *w, int dirfd, const char *name, const struct stat *sb)
+{
+	// a file that was just decompressed has a new ctime, and is left alone:
+	if (!S_ISREG(sb->st_mode) || unsharedfs_compress_marked(sb)
+			|| sb->st_nlink != 1 || sb->st_size < COMPRESS_MIN_SIZE
+			|| sb->st_atime > w->idle_before || sb->st_mtime > w->idle_before || sb->st_ctime > w->idle_before)
+		return;
+	if (!unsharedfs_idset_contains(&compress_skip, compress_skip_key(sb)))
+		compress_file(w, dirfd, name, sb);
+}
+
+/* the entries of a directory: d_type, name and NUL, one after the other */
+struct compress_dir {
+	char *entries;
+	size_t len;
+	size_t capacity;
+};
+
+static int compress_dir_add(const char *name, unsigned char type, void *arg)
+{
+	struct compress_dir *d = arg;
+	size_t size = strlen(name) + 2;
+
+	if (strncmp(name, COMPRESS_TEMP_PREFIX, strlen(COMPRESS_TEMP_PREFIX)) == 0)
+		return 1;
+	if (d->len + size > d->capacity)
+	{
+		size_t capacity = d->capacity ? d->capacity * 2 : 4096;
+		char *entries;
+
+		while (capacity < d->len + size)
+			capacity *= 2;
+		entries = realloc(d->entries, capacity);
+		if (entries == NULL)
+			return 0;
+		d->entries = entries;
+		d->capacity = capacity;
+	}
+	d->entries[d->len] = (char) type;
+	memcpy(d->entries + d->len + 1, name, size - 1);
+	d->len += size;
+	return 1;
+}
+
+/* append a name to w->path[0..len); false if the path is too long */
+static bool compress_path(struct compress_walk *w, size_t len, const char *name)
+{
+	size_t namelen = strlen(name);
+
+	if (len + 1 + namelen >= PATH_MAX)
+		return false;
+	w->path[len] = '/';
+	memcpy(w->path + len + 1, name, namelen + 1);
+	return true;
+}
+
+/**
+ * Compress the idle files below the directory fd, which is in a cold tree if
+ * cold is set.  w->path[0..len) is its path, which is never opened: a user
+ * could swap a directory on it for a symlink.
+ * @param top set if fd is the root directory
+ */
+static void compress_walk(struct compress_walk *w, int fd, size_t len, bool cold, bool top)
+{
+	struct compress_dir d = { NULL, 0, 0 };
+	size_t pos = 0, dirs = 0;
+
+	compress_hint(fd, &cold);
+	if (!unsharedfs_basedir_scan(fd, compress_dir_add, &d))
+		goto out;
+	// stat the files (and the entries of unknown type) a batch at a time;
+	// the types of the subdirectories are kept for the second loop:
+	while (pos < d.len && !atomic_load(&compress_stopping))
+	{
+		char *types[COMPRESS_BATCH_DEPTH];
+		int i, n;
+
+		for (n = 0; n < COMPRESS_BATCH_DEPTH && pos < d.len; n++, pos += strlen(d.entries + pos + 1) + 2)
+		{
+			types[n] = d.entries + pos;
+			w->names[n] = d.entries + pos + 1;
+			w->rc[n] = 1;
+			if (*types[n] == DT_UNKNOWN || (*types[n] == DT_REG && cold))
+				unsharedfs_batch_stat(w->batch, fd, w->names[n], AT_SYMLINK_NOFOLLOW, &w->sb[n], &w->rc[n]);
+		}
+		unsharedfs_batch_run(w->batch);
+		for (i = 0; i < n; i++)
+		{
+			if (w->rc[i] == 0 && *types[i] == DT_UNKNOWN)
+				*types[i] = S_ISDIR(w->sb[i].st_mode) ? DT_DIR : S_ISREG(w->sb[i].st_mode) ? DT_REG : DT_UNKNOWN;
+			if (*types[i] == DT_DIR)
+				dirs++;
+			else if (w->rc[i] == 0 && cold && !atomic_load(&compress_stopping)
+					&& compress_path(w, len, w->names[i]))
+			{
+				compress_candidate(w, fd, w->names[i], &w->sb[i]);
+				w->path[len] = '\0';
+			}
+		}
+	}
+	for (pos = 0; dirs > 0 && pos < d.len && !atomic_load(&compress_stopping); pos += strlen(d.entries + pos + 1) + 2)
+		if (d.entries[pos] == DT_DIR && compress_path(w, len, d.entries + pos + 1))
+		{
+			int subfd = compress_opendir(fd, d.entries + pos + 1, top);
+
+			if (subfd >= 0)
+			{
+				compress_walk(w, subfd, strlen(w->path), cold, false);
+				close(subfd);
+			}
+			w->path[len] = '\0';
+		}
+out:
+	free(d.entries);
+}
+
+unsigned long unsharedfs_compress_pass(void)
+{
+	struct compress_walk *w;
+	unsigned long files;
+	size_t len = strlen(compress_rootdir);
+	int fd;
+
+	if (compress_idle_s == 0 || len >= PATH_MAX)
+		return 0;
+	w = calloc(1, sizeof(*w));
+	if (w == NULL)
+		return 0;
+	w->idle_before = time(NULL) - compress_idle_s;
+	w->cctx = ZSTD_createCCtx();
+	w->buf = malloc(COMPRESS_CHUNK_SIZE);
+	w->frame = malloc(ZSTD_compressBound(COMPRESS_CHUNK_SIZE));
+	w->batch = unsharedfs_batch_new(COMPRESS_BATCH_DEPTH, compress_rootdir, compress_io_uring);
+	if (w->cctx != NULL && w->buf != NULL && w->frame != NULL && w->batch != NULL)
+	{
+		memcpy(w->path, compress_rootdir, len + 1);
+		fd = open(compress_rootdir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd >= 0)
+		{
+			compress_walk(w, fd, len, false, true);
+			close(fd);
+		}
+	}
+	else
+		logmsg(LOG_ERR, "not compressing cold files: %s", strerror(ENOMEM));
+	if (w->files > 0)
+		logmsg(LOG_INFO, "compressed %lu cold files from %llu to %llu MiB"
+				, w->files
+				, (unsigned long long) (w->bytes_in >> 20)
+				, (unsigned long long) (w->bytes_out >> 20));
+	files = w->files;
+	ZSTD_freeCCtx(w->cctx);
+	free(w->buf);
+	free(w->frame);
+	unsharedfs_batch_free(w->batch);
+	free(w);
+	return files;
+}
+
+static void *compress_main(void *arg)
+{
+	struct timespec deadline;
+
+	// stay out of the way of the requests (both only affect this thread):
+	setpriority(PRIO_PROCESS, 0, 19);
+	syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_IDLE);
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += COMPRESS_FIRST_PASS_S;
+	pthread_mutex_lock(&compress_stop_lock);
+	while (!atomic_load(&compress_stopping))
+	{
+		if (pthread_cond_timedwait(&compress_stop_cond, &compress_stop_lock, &deadline) != ETIMEDOUT)
+			continue;
+		pthread_mutex_unlock(&compress_stop_lock);
+		unsharedfs_compress_pass();
+		pthread_mutex_lock(&compress_stop_lock);
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += COMPRESS_PASS_S;
+	}
+	pthread_mutex_unlock(&compress_stop_lock);
+	return NULL;
+}
+
+int unsharedfs_compress_init(const char *rootdir, unsigned long idle_hours, int level, int io_uring)
+{
+	int i, rc;
+
+	compress_rootdir = strdup(rootdir);
+	compress_stat_slots = calloc(COMPRESS_STAT_SLOTS, sizeof(*compress_stat_slots));
+	if (compress_rootdir == NULL || compress_stat_slots == NULL)
+		goto fail;
+	rc = pthread_key_create(&compress_dctx_key, compress_free_dctx);
+	if (rc != 0)
+	{
+		errno = rc;
+		goto fail;
+	}
+	for (i = 0; i < COMPRESS_LOCKS; i++)
+		pthread_rwlock_init(&compress_locks[i], NULL);
+	for (i = 0; i < COMPRESS_STAT_LOCKS; i++)
+		pthread_mutex_init(&compress_stat_locks[i], NULL);
+	compress_idle_s = idle_hours * 3600;
+	compress_level = level;
+	compress_io_uring = io_uring;
+	atomic_store(&compress_stopping, false);
+	unsharedfs_compress_enabled = true;
+	if (idle_hours == 0)
+		return 1;
+
+	// a broken lease is signalled with SIGIO, which would terminate the daemon:
+	signal(SIGIO, SIG_IGN);
+	rc = pthread_create(&compress_thread, NULL, compress_main, NULL);
+	if (rc != 0)
+	{
+		// compressed files are still readable:
+		logmsg(LOG_ERR, "could not start the compressor thread: %s", strerror(rc));
+		return 1;
+	}
+	compress_running = true;
+	return 1;
+
+fail:
+	free(compress_rootdir);
+	free(compress_stat_slots);
+	compress_rootdir = NULL;
+	compress_stat_slots = NULL;
+	return 0;
+}
+
+void unsharedfs_compress_destroy(void)
+{
+	int i;
+
+	if (!unsharedfs_compress_enabled)
+		return;
+	if (compress_running)
+	{
+		pthread_mutex_lock(&compress_stop_lock);
+		atomic_store(&compress_stopping, true);
+		pthread_cond_signal(&compress_stop_cond);
+		pthread_mutex_unlock(&compress_stop_lock);
+		pthread_join(compress_thread, NULL);
+		compress_running = false;
+	}
+	unsharedfs_compress_enabled = false;
+	for (i = 0; i < COMPRESS_LOCKS; i++)
+		pthread_rwlock_destroy(&compress_locks[i]);
+	for (i = 0; i < COMPRESS_STAT_LOCKS; i++)
+		pthread_mutex_destroy(&compress_stat_locks[i]);
+	pthread_key_delete(compress_dctx_key);
+	unsharedfs_idset_free(&compress_skip);
+	free(compress_stat_slots);
+	free(compress_rootdir);
+	compress_stat_slots = NULL;
+	compress_rootdir = NULL;
+}
+
+#else /* !HAVE_ZSTD */
+
+#include <errno.h>
+
+int unsharedfs_compress_init(const char *rootdir, unsigned long idle_hours, int level, int io_uring)
+{
+	errno = ENOTSUP;
+	return 0;
+}
+
+void unsharedfs_compress_destroy(void)
+{
+}
+
+void unsharedfs_compress_lock(const char *fpath)
+{
+}
+
+void unsharedfs_compress_unlock(const char *fpath)
+{
+}
+
+void unsharedfs_compress_stat(const char *fpath, struct stat *sb)
+{
+}
+
+bool unsharedfs_compress_is_compressed(const char *fpath, const struct stat *sb)
+{
+	return false;
+}
+
+int unsharedfs_compress_thaw(const char *fpath, int callerfd)
+{
+	return 1;
+}
+
+struct unsharedfs_compressed *unsharedfs_compress_load(int fd)
+{
+	errno = 0;
+	return NULL;
+}
+
+void unsharedfs_compress_close(struct unsharedfs_compressed *z)
+{
+}
+
+uint64_t unsharedfs_compress_size(const struct unsharedfs_compressed *z)
+{
+	return 0;
+}
+
+ssize_t unsharedfs_compress_read(struct unsharedfs_compressed *z, char *buf, size_t size, off_t offset)
+{
+	errno = ENOTSUP;
+	return -1;
+}
+
+unsigned long unsharedfs_compress_pass(void)
+{
+	return 0;
+}
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_COMPRESS_H_
+#define UNSHAREDFS_COMPRESS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/*
+ * Transparent compression of cold files (needs libzstd, see HAVE_ZSTD).
+ * Users mark directory trees with the caching hint "cold" (see cachehint.h).
+ * A background thread walks BASEDIR once an hour and replaces the regular
+ * files in cold trees that have not been read, written or changed (ctime)
+ * for --compress-idle hours with a compressed copy.
+ *
+ * File layout (native byte order):
+ *   struct unsharedfs_compress_header
+ *   chunks zstd frames, each of chunk_size bytes of the file (the last one
+ *     may be shorter)
+ *   chunks + 1 offsets (uint64_t) of the frames at index_offset; the last
+ *     one is the end of the last frame
+ *
+ * Compressed files have the sticky bit set in BASEDIR, which has no meaning
+ * for regular files, so that getattr only reads the header of files that
+ * have it.  unsharedfs shows them with their logical size and without the
+ * sticky bit.  They are read-only: reads decompress the chunks they need,
+ * and a file that is opened for writing, truncated or linked is decompressed
+ * first.
+ *
+ * While compressing a file, the compressor holds a read lease on it: files
+ * that are open for writing are skipped, and the compressor gives up on a
+ * file that is opened for writing or truncated meanwhile.  Changes of files
+ * through unsharedfs hold the lock of the path (unsharedfs_compress_lock()),
+ * so that they don't race with the compressor replacing the file.  Changes
+ * made directly in BASEDIR can race with it; cold trees are meant to be
+ * changed through the mount only.
+ */
+
+#define UNSHAREDFS_COMPRESS_MAGIC "USFSZST"
+#define UNSHAREDFS_COMPRESS_VERSION 1
+
+struct unsharedfs_compress_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t chunk_size;   /* bytes of the file per frame */
+	uint64_t size;         /* the size of the file */
+	uint64_t chunks;       /* number of frames */
+	uint64_t index_offset; /* the offsets of the frames */
+};
+
+/* an open compressed file */
+struct unsharedfs_compressed;
+
+/**
+ * True if compressed files are handled (and cold files compressed).
+ */
+extern bool unsharedfs_compress_enabled;
+
+/**
+ * Enable compression, and start the compressor thread.
+ * @param rootdir the base directory
+ * @param idle_hours compress files that have not been used for this long
+ *        (0: only handle the files that are compressed already)
+ * @param level the zstd compression level
+ * @param io_uring how the compressor walks the directories (enum unsharedfs_batch_mode)
+ * @return 1 on success, 0 on error (errno is set).
+ */
+int unsharedfs_compress_init(const char *rootdir, unsigned long idle_hours, int level, int io_uring);
+
+/**
+ * Stop the compressor thread.
+ */
+void unsharedfs_compress_destroy(void);
+
+/**
+ * @return true if a file may be compressed (see above), and its header needs
+ *         to be checked.
+ */
+static inline bool unsharedfs_compress_marked(const struct stat *sb)
+{
+	return S_ISREG(sb->st_mode) && (sb->st_mode & S_ISVTX);
+}
+
+/**
+ * Keep the compressor from replacing a file while it is being changed.
+ * @param fpath the backing path
+ */
+void unsharedfs_compress_lock(const char *fpath);
+
+/**
+ * Release the lock taken by unsharedfs_compress_lock().
+ */
+void unsharedfs_compress_unlock(const char *fpath);
+
+/**
+ * Fix the attributes of a marked file: the size of a compressed file is
+ * the size of its contents, and the sticky bit is not shown.
+ * @param fpath the backing path
+ * @param sb the attributes of fpath
+ */
+void unsharedfs_compress_stat(const char *fpath, struct stat *sb);
+
+/**
+ * Check the header of a file.
+ * @param fpath the backing path
+ * @param sb the attributes of fpath
+ * @return true if the file is marked and compressed, false if it isn't or
+ *         on error.
+ */
+bool unsharedfs_compress_is_compressed(const char *fpath, const struct stat *sb);
+
+/**
+ * Decompress a file in place, if it is compressed.  The daemon runs as root,
+ * so the caller checks the permissions of the user first by opening the file
+ * with the uid/gid of the context; only that file is decompressed.
+ * @param fpath the backing path
+ * @param callerfd the file, opened by the caller
+ * @return 1 on success, 0 on error (errno is set; EAGAIN if fpath is no longer
+ *         the file of callerfd).
+ */
+int unsharedfs_compress_thaw(const char *fpath, int callerfd);
+
+/**
+ * Read the header and the index of a marked file that was opened for reading.
+ * @param fd the backing file
+ * @return the compressed file, or NULL if the file is not compressed (errno
+ *         is 0) or on error (errno is set).
+ */
+struct unsharedfs_compressed *unsharedfs_compress_load(int fd);
+
+/**
+ * Release a file returned by unsharedfs_compress_load() (but not its
+ * descriptor).
+ */
+void unsharedfs_compress_close(struct unsharedfs_compressed *z);
+
+/**
+ * @return the size of the contents of a compressed file.
+ */
+uint64_t unsharedfs_compress_size(const struct unsharedfs_compressed *z);
+
+/**
+ * Read from a compressed file, like pread().
+ * @return the number of bytes read, or -1 on error (errno is set).
+ */
+ssize_t unsharedfs_compress_read(struct unsharedfs_compressed *z, char *buf, size_t size, off_t offset);
+
+/**
+ * Compress the idle files of all cold trees.  Called by the compressor thread.
+ * @return the number of files that were compressed.
+ */
+unsigned long unsharedfs_compress_pass(void);
+
+#endif
@@ -0,0 +1,464 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+// for struct ucred
+#define _GNU_SOURCE
+
+#include "control.h"
+#include "flightrec.h"
+#include "fs.h"
+#include "log.h"
+#include "monitor.h"
+#include "opctx.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+// a client that does not send its command within this time is disconnected:
+#define CONTROL_TIMEOUT_S 5
+#define CONTROL_MAX_ARGS 4
+
+/* a setting that can be inspected and changed at runtime */
+struct unsharedfs_tunable {
+	const char *name;
+	const char *help;
+	void (*get)(char *buf, size_t len);
+	/* @return 1 on success, 0 on error (errno is set). */
+	int (*set)(const char *value);
+};
+
+static struct unsharedfs_state *control_pdata = NULL;
+static char *control_path = NULL;
+static int control_fd = -1;
+static pthread_t control_thread;
+static _Atomic bool control_stopping = false;
+
+static int unsharedfs_control_ulong(const char *value, unsigned long *result)
+{
+	char *end;
+
+	errno = 0;
+	*result = strtoul(value, &end, 10);
+	if (errno != 0 || end == value || *end != '\0' || value[0] == '-')
+	{
+		errno = EINVAL;
+		return 0;
+	}
+	return 1;
+}
+
+static void unsharedfs_get_log_level(char *buf, size_t len)
+{
+	snprintf(buf, len, "%s", unsharedfs_log_level_name(atomic_load(&unsharedfs_loglevel)));
+}
+
+static int unsharedfs_set_log_level(const char *value)
+{
+	int level = unsharedfs_log_parse_level(value);
+
+	if (level < 0)
+	{
+		errno = EINVAL;
+		return 0;
+	}
+	atomic_store(&unsharedfs_loglevel, level);
+	return 1;
+}
+
+static void unsharedfs_get_log_burst(char *buf, size_t len)
+{
+	unsigned long burst, interval;
+
+	unsharedfs_log_get_limit(&burst, &interval);
+	snprintf(buf, len, "%lu", burst);
+}
+
+static int unsharedfs_set_log_burst(const char *value)
+{
+	unsigned long burst, interval, val;
+
+	if (!unsharedfs_control_ulong(value, &val))
+		return 0;
+	unsharedfs_log_get_limit(&burst, &interval);
+	unsharedfs_log_set_limit(val, interval);
+	return 1;
+}
+
+static void unsharedfs_get_log_interval(char *buf, size_t len)
+{
+	unsigned long burst, interval;
+
+	unsharedfs_log_get_limit(&burst, &interval);
+	snprintf(buf, len, "%lu", interval);
+}
+
+static int unsharedfs_set_log_interval(const char *value)
+{
+	unsigned long burst, interval, val;
+
+	if (!unsharedfs_control_ulong(value, &val) || val == 0)
+	{
+		errno = EINVAL;
+		return 0;
+	}
+	unsharedfs_log_get_limit(&burst, &interval);
+	unsharedfs_log_set_limit(burst, val);
+	return 1;
+}
+
+static void unsharedfs_get_slowop_threshold(char *buf, size_t len)
+{
+	snprintf(buf, len, "%llu", (unsigned long long) atomic_load(&unsharedfs_slowop_threshold_ns) / 1000000);
+}
+
+static int unsharedfs_set_slowop_threshold(const char *value)
+{
+	unsigned long val;
+
+	if (!unsharedfs_control_ulong(value, &val))
+		return 0;
+	if (val != 0)
+	{
+		// operations that are already running are not checked:
+		atomic_store(&unsharedfs_op_phases, true);
+		atomic_store(&unsharedfs_op_instrumented, true);
+	}
+	atomic_store(&unsharedfs_slowop_threshold_ns, (uint64_t) val * 1000000);
+	return 1;
+}
+
+static void unsharedfs_get_flightrec_threshold(char *buf, size_t len)
+{
+	if (unsharedfs_flightrec_enabled())
+		snprintf(buf, len, "%lu", unsharedfs_flightrec_get_threshold());
+	else
+		snprintf(buf, len, "(disabled)");
+}
+
+static int unsharedfs_set_flightrec_threshold(const char *value)
+{
+	unsigned long val;
+
+	if (!unsharedfs_flightrec_enabled())
+	{
+		errno = ENOTSUP;
+		return 0;
+	}
+	if (!unsharedfs_control_ulong(value, &val))
+		return 0;
+	unsharedfs_flightrec_set_threshold(val);
+	return 1;
+}
+
+static const struct unsharedfs_tunable tunables[] = {
+	{ "log-level", "messages less important than this are not logged"
+		, unsharedfs_get_log_level, unsharedfs_set_log_level },
+	{ "log-burst", "identical messages logged per interval (0: unlimited)"
+		, unsharedfs_get_log_burst, unsharedfs_set_log_burst },
+	{ "log-interval", "length of the log rate limiting interval in seconds"
+		, unsharedfs_get_log_interval, unsharedfs_set_log_interval },
+	{ "slow-op-threshold", "log operations taking longer (ms, 0: disabled)"
+		, unsharedfs_get_slowop_threshold, unsharedfs_set_slowop_threshold },
+	{ "flight-recorder-threshold", "dump the flight recorder if an operation takes longer (ms, 0: disabled)"
+		, unsharedfs_get_flightrec_threshold, unsharedfs_set_flightrec_threshold },
+};
+
+#define TUNABLES_COUNT (sizeof(tunables) / sizeof(tunables[0]))
+
+static const struct unsharedfs_tunable *unsharedfs_control_tunable(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < TUNABLES_COUNT; i++)
+		if (strcmp(tunables[i].name, name) == 0)
+			return &tunables[i];
+	return NULL;
+}
+
+static void unsharedfs_control_help(FILE *out)
+{
+	size_t i;
+
+	fprintf(out, "commands:\n"
+			"  help                       show this text\n"
+			"  list                       show all tunables and their values\n"
+			"  get NAME                   show the value of a tunable\n"
+			"  set NAME VALUE             change a tunable\n"
+			"  stats                      show the statistics report\n"
+			"  dump flight-recorder|stats write the flight recorder or statistics file\n"
+			"  trace start FILE [SECONDS] capture a request trace\n"
+			"  trace stop                 finish the current trace\n"
+			"tunables:\n");
+	for (i = 0; i < TUNABLES_COUNT; i++)
+		fprintf(out, "  %-26s %s\n", tunables[i].name, tunables[i].help);
+}
+
+/**
+ * Execute a command.
+ * @param out the output stream of the client
+ * @param argc number of words in the command line
+ * @param argv the words of the command line
+ * @return NULL on success, or an error message.
+ */
+static const char *unsharedfs_control_exec(FILE *out, int argc, char *argv[])
+{
+	const struct unsharedfs_tunable *t;
+	char value[64];
+	size_t i;
+
+	if (argc == 0 || strcmp(argv[0], "help") == 0)
+	{
+		unsharedfs_control_help(out);
+		return NULL;
+	}
+	if (strcmp(argv[0], "list") == 0 && argc == 1)
+	{
+		for (i = 0; i < TUNABLES_COUNT; i++)
+		{
+			tunables[i].get(value, sizeof(value));
+			fprintf(out, "%s %s\n", tunables[i].name, value);
+		}
+		return NULL;
+	}
+	if (strcmp(argv[0], "get") == 0 && argc == 2)
+	{
+		if ((t = unsharedfs_control_tunable(argv[1])) == NULL)
+			return "unknown tunable";
+		t->get(value, sizeof(value));
+		fprintf(out, "%s\n", value);
+		return NULL;
+	}
+	if (strcmp(argv[0], "set") == 0 && argc == 3)
+	{
+		if ((t = unsharedfs_control_tunable(argv[1])) == NULL)
+			return "unknown tunable";
+		if (!t->set(argv[2]))
+			return errno == ENOTSUP ? "not enabled at startup" : "invalid value";
+		t->get(value, sizeof(value));
+		logmsg(LOG_NOTICE,"control: %s set to %s",t->name,value);
+		return NULL;
+	}
+	if (strcmp(argv[0], "stats") == 0 && argc == 1)
+	{
+		if (!unsharedfs_stats_enabled)
+			return "statistics are not enabled (see --stats, --heavy-hitters and --io-stats)";
+		unsharedfs_stats_report(out);
+		return NULL;
+	}
+	if (strcmp(argv[0], "dump") == 0 && argc == 2)
+	{
+		// the files are written by the monitor thread, which serialises them with the signal-triggered dumps:
+		if (strcmp(argv[1], "flight-recorder") == 0)
+		{
+			if (!unsharedfs_flightrec_enabled())
+				return "the flight recorder is not enabled (see --flight-recorder)";
+			unsharedfs_monitor_post(MONITOR_EVENT_FLIGHTREC_CONTROL);
+			fprintf(out, "appending to %s\n", control_pdata->flightrec_file);
+			return NULL;
+		}
+		if (strcmp(argv[1], "stats") == 0)
+		{
+			if (control_pdata->stats_file == NULL)
+				return "no statistics file (see --stats)";
+			unsharedfs_monitor_post(MONITOR_EVENT_STATS_CONTROL);
+			fprintf(out, "writing %s\n", control_pdata->stats_file);
+			return NULL;
+		}
+		return "unknown dump";
+	}
+	if (strcmp(argv[0], "trace") == 0 && argc >= 2)
+	{
+		if (strcmp(argv[1], "start") == 0 && (argc == 3 || argc == 4))
+		{
+			unsigned long seconds = control_pdata->trace_seconds;
+			if (argv[2][0] != '/')
+				return "the trace file must be an absolute path";
+			if (argc == 4 && (!unsharedfs_control_ulong(argv[3], &seconds) || seconds == 0))
+				return "invalid duration";
+			if (!unsharedfs_trace_start(argv[2], seconds))
+				return errno == EBUSY ? "a trace is already being captured" : strerror(errno);
+			atomic_store(&unsharedfs_op_phases, true);
+			atomic_store(&unsharedfs_op_instrumented, true);
+			logmsg(LOG_NOTICE,"control: tracing to %s for %lu seconds",argv[2],seconds);
+			return NULL;
+		}
+		if (strcmp(argv[1], "stop") == 0 && argc == 2)
+		{
+			unsharedfs_trace_stop();
+			return NULL;
+		}
+	}
+	return "unknown command (try \"help\")";
+}
+
+/* serve a single client connection */
+static void unsharedfs_control_client(int fd)
+{
+	char line[UNSHAREDFS_CONTROL_LINE_MAX];
+	char *argv[CONTROL_MAX_ARGS + 1];
+	char *saveptr, *word;
+	const char *err;
+	size_t len = 0;
+	ssize_t n;
+	int argc = 0;
+	struct ucred cred;
+	socklen_t credlen = sizeof(cred);
+	struct timeval timeout = { CONTROL_TIMEOUT_S, 0 };
+	FILE *out;
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credlen) != 0
+			|| (cred.uid != 0 && cred.uid != geteuid()))
+	{
+		logmsg(LOG_WARNING,"control: rejected connection from uid %d",credlen == sizeof(cred) ? (int) cred.uid : -1);
+		close(fd);
+		return;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	// read a single line:
+	while (len < sizeof(line) - 1 && memchr(line, '\n', len) == NULL)
+	{
+		n = read(fd, line + len, sizeof(line) - 1 - len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		len += n;
+	}
+	line[len] = '\0';
+	out = fdopen(fd, "w");
+	if (out == NULL)
+	{
+		close(fd);
+		return;
+	}
+	if (strchr(line, '\n') == NULL)
+		err = "incomplete command";
+	else
+	{
+		for (word = strtok_r(line, " \t\r\n", &saveptr); word != NULL; word = strtok_r(NULL, " \t\r\n", &saveptr))
+		{
+			if (argc == CONTROL_MAX_ARGS)
+				break;
+			argv[argc++] = word;
+		}
+		argv[argc] = NULL;
+		err = word != NULL ? "too many arguments" : unsharedfs_control_exec(out, argc, argv);
+	}
+	if (err == NULL)
+		fprintf(out, "OK\n");
+	else
+		fprintf(out, "ERR %s\n", err);
+	fclose(out);
+}
+
+static void *unsharedfs_control_main(void *arg)
+{
+	const struct timespec backoff = { 0, 100000000L };
+
+	while (!atomic_load(&control_stopping))
+	{
+		int fd = accept(control_fd, NULL, NULL);
+		if (fd >= 0)
+			unsharedfs_control_client(fd);
+		else if (errno != EINTR && !atomic_load(&control_stopping))
+		{
+			// e.g. out of file descriptors -- don't spin:
+			logmsg(LOG_WARNING,"control: accept failed: %s",strerror(errno));
+			nanosleep(&backoff, NULL);
+		}
+	}
+	return NULL;
+}
+
+int unsharedfs_control_start(struct unsharedfs_state *pdata, const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	int rc;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		errno = ENAMETOOLONG;
+		return 0;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	// a socket left behind by a crashed instance:
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	control_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (control_fd < 0)
+		return 0;
+	if (bind(control_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+	{
+		rc = errno;
+		close(control_fd);
+		control_fd = -1;
+		errno = rc;
+		return 0;
+	}
+	// connections are checked with SO_PEERCRED, the mode is just an additional barrier:
+	if (chmod(path, S_IRUSR | S_IWUSR) != 0 || listen(control_fd, 8) != 0)
+		goto error;
+
+	control_path = strdup(path);
+	if (control_path == NULL)
+		goto error;
+	control_pdata = pdata;
+	atomic_store(&control_stopping, false);
+	rc = pthread_create(&control_thread, NULL, unsharedfs_control_main, NULL);
+	if (rc != 0)
+	{
+		errno = rc;
+		goto error;
+	}
+	return 1;
+
+error:
+	rc = errno;
+	close(control_fd);
+	control_fd = -1;
+	unlink(path);
+	free(control_path);
+	control_path = NULL;
+	errno = rc;
+	return 0;
+}
+
+void unsharedfs_control_stop(void)
+{
+	if (control_fd < 0)
+		return;
+	atomic_store(&control_stopping, true);
+	// wakes up accept():
+	shutdown(control_fd, SHUT_RDWR);
+	pthread_join(control_thread, NULL);
+	close(control_fd);
+	control_fd = -1;
+	unlink(control_path);
+	free(control_path);
+	control_path = NULL;
+}
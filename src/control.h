@@ -0,0 +1,42 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_CONTROL_H_
+#define UNSHAREDFS_CONTROL_H_
+
+struct unsharedfs_state;
+
+/*
+ * The control socket lets unsharedfsctl inspect and change tunables, and
+ * request dumps, while the file system is running.
+ *
+ * The protocol is line based: the client sends a single command line, the
+ * server answers with any number of output lines, followed by a line that is
+ * either "OK" or "ERR <message>", and closes the connection.
+ * Only root and the user running unsharedfs may connect.
+ */
+
+// longest accepted command line, including the newline:
+#define UNSHAREDFS_CONTROL_LINE_MAX 1024
+
+/**
+ * Create the control socket and start serving it.
+ * @param pdata the file system state
+ * @param path the socket path (an existing socket at this path is replaced)
+ * @return 1 on success, 0 on error (errno is set).
+ */
+int unsharedfs_control_start(struct unsharedfs_state *pdata, const char *path);
+
+/**
+ * Stop serving the control socket and remove it.
+ */
+void unsharedfs_control_stop(void);
+
+#endif
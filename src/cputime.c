@@ -0,0 +1,266 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#include "cputime.h"
+#include "thread.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// slots probed for a uid before it is counted as "other":
+#define CPUTIME_PROBES 32
+// operations listed per uid in the report:
+#define CPUTIME_TOP_OPS 3
+
+/* the sums of one uid over all threads */
+struct cputime_row {
+	uint64_t key;
+	uint64_t ops;
+	uint64_t total;
+	uint64_t ns[OP_COUNT];
+};
+
+bool unsharedfs_cputime_enabled = false;
+
+int unsharedfs_cputime_init(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+		return 0;
+	unsharedfs_cputime_enabled = true;
+	return 1;
+}
+
+uint64_t unsharedfs_cputime_now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+		return 0;
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static struct unsharedfs_cputime *unsharedfs_cputime_stats(void)
+{
+	struct unsharedfs_thread *t = unsharedfs_thread_self();
+	struct unsharedfs_cputime *ct;
+
+	if (t == NULL)
+		return NULL;
+	ct = atomic_load_explicit(&t->cputime, memory_order_acquire);
+	if (ct == NULL)
+	{
+		// first use on this thread:
+		ct = calloc(1, sizeof(*ct));
+		if (ct == NULL)
+			return NULL;
+		atomic_store_explicit(&t->cputime, ct, memory_order_release);
+	}
+	return ct;
+}
+
+/* find (or claim) the slot of a uid in the table of the calling thread */
+static struct unsharedfs_cputime_uid *unsharedfs_cputime_slot(struct unsharedfs_cputime *ct, uid_t uid)
+{
+	uint64_t key = (uint64_t) uid + 1;
+	unsigned int i, slot = (uid * 2654435761U) % CPUTIME_UIDS;
+
+	for (i = 0; i < CPUTIME_PROBES; i++, slot = (slot + 1) % CPUTIME_UIDS)
+	{
+		struct unsharedfs_cputime_uid *u = &ct->uids[slot];
+		uint64_t k = atomic_load_explicit(&u->key, memory_order_relaxed);
+
+		if (k == key)
+			return u;
+		if (k == 0)
+		{
+			// the sums are still 0; readers see them once the key is set:
+			atomic_store_explicit(&u->key, key, memory_order_release);
+			return u;
+		}
+	}
+	return &ct->other;
+}
+
+void unsharedfs_cputime_account(enum unsharedfs_op op, uid_t uid, uint64_t ns)
+{
+	struct unsharedfs_cputime *ct = unsharedfs_cputime_stats();
+	struct unsharedfs_cputime_uid *u;
+
+	if (ct == NULL)
+		return;
+	unsharedfs_counter_add(&ct->calls[op], 1);
+	unsharedfs_counter_add(&ct->ns[op], ns);
+	u = unsharedfs_cputime_slot(ct, uid);
+	unsharedfs_counter_add(&u->ops, 1);
+	unsharedfs_counter_add(&u->ns[op], ns);
+}
+
+static void unsharedfs_cputime_add_row(struct cputime_row *row, uint64_t key, const struct unsharedfs_cputime_uid *u)
+{
+	int op;
+
+	row->key = key;
+	row->ops = atomic_load_explicit(&u->ops, memory_order_relaxed);
+	row->total = 0;
+	for (op = 0; op < OP_COUNT; op++)
+	{
+		row->ns[op] = atomic_load_explicit(&u->ns[op], memory_order_relaxed);
+		row->total += row->ns[op];
+	}
+}
+
+static int unsharedfs_cputime_by_key(const void *a, const void *b)
+{
+	const struct cputime_row *ra = a, *rb = b;
+
+	return ra->key < rb->key ? -1 : ra->key > rb->key;
+}
+
+static int unsharedfs_cputime_by_total(const void *a, const void *b)
+{
+	const struct cputime_row *ra = a, *rb = b;
+
+	return ra->total > rb->total ? -1 : ra->total < rb->total;
+}
+
+/**
+ * Collect the uid slots of all threads and merge the rows of the same uid.
+ * Row key 0 holds the uids that did not fit into the tables.
+ * @return the number of rows, sorted by descending CPU time.
+ */
+static size_t unsharedfs_cputime_rows(struct cputime_row **rows)
+{
+	size_t i, j, n = 0, nthreads = unsharedfs_thread_count();
+	int op;
+
+	*rows = malloc((nthreads * (CPUTIME_UIDS + 1) + 1) * sizeof(**rows));
+	if (*rows == NULL)
+		return 0;
+	for (i = 0; i < nthreads; i++)
+	{
+		struct unsharedfs_thread *t = unsharedfs_thread_get(i);
+		struct unsharedfs_cputime *ct = t ? atomic_load_explicit(&t->cputime, memory_order_acquire) : NULL;
+
+		if (ct == NULL)
+			continue;
+		for (j = 0; j < CPUTIME_UIDS; j++)
+		{
+			uint64_t key = atomic_load_explicit(&ct->uids[j].key, memory_order_acquire);
+
+			if (key != 0)
+				unsharedfs_cputime_add_row(&(*rows)[n++], key, &ct->uids[j]);
+		}
+		if (atomic_load_explicit(&ct->other.ops, memory_order_relaxed) != 0)
+			unsharedfs_cputime_add_row(&(*rows)[n++], 0, &ct->other);
+	}
+	if (n == 0)
+		return 0;
+
+	qsort(*rows, n, sizeof(**rows), unsharedfs_cputime_by_key);
+	for (i = 0, j = 1; j < n; j++)
+	{
+		struct cputime_row *row = &(*rows)[i];
+
+		if ((*rows)[j].key != row->key)
+		{
+			(*rows)[++i] = (*rows)[j];
+			continue;
+		}
+		row->ops += (*rows)[j].ops;
+		row->total += (*rows)[j].total;
+		for (op = 0; op < OP_COUNT; op++)
+			row->ns[op] += (*rows)[j].ns[op];
+	}
+	n = i + 1;
+	qsort(*rows, n, sizeof(**rows), unsharedfs_cputime_by_total);
+	return n;
+}
+
+/* the operations that took most of a uid's CPU time */
+static void unsharedfs_cputime_top_ops(FILE *fp, const struct cputime_row *row)
+{
+	bool used[OP_COUNT] = { false };
+	int k, op;
+
+	for (k = 0; k < CPUTIME_TOP_OPS; k++)
+	{
+		int best = -1;
+
+		for (op = 0; op < OP_COUNT; op++)
+			if (!used[op] && row->ns[op] > 0 && (best < 0 || row->ns[op] > row->ns[best]))
+				best = op;
+		if (best < 0)
+			break;
+		used[best] = true;
+		fprintf(fp, "%s%s %.0f%%", k ? ", " : " ", unsharedfs_op_names[best], 100.0 * row->ns[best] / row->total);
+	}
+	fprintf(fp, "\n");
+}
+
+void unsharedfs_cputime_report(FILE *fp)
+{
+	uint64_t calls[OP_COUNT] = { 0 }, ns[OP_COUNT] = { 0 }, total = 0;
+	size_t i, n, nthreads = unsharedfs_thread_count();
+	struct cputime_row *rows;
+	int op;
+
+	for (i = 0; i < nthreads; i++)
+	{
+		struct unsharedfs_thread *t = unsharedfs_thread_get(i);
+		struct unsharedfs_cputime *ct = t ? atomic_load_explicit(&t->cputime, memory_order_acquire) : NULL;
+
+		if (ct == NULL)
+			continue;
+		for (op = 0; op < OP_COUNT; op++)
+		{
+			calls[op] += atomic_load_explicit(&ct->calls[op], memory_order_relaxed);
+			ns[op] += atomic_load_explicit(&ct->ns[op], memory_order_relaxed);
+		}
+	}
+	for (op = 0; op < OP_COUNT; op++)
+		total += ns[op];
+
+	fprintf(fp, "\n## CPU time per operation\n%-12s %20s %14s %12s %7s\n", "op", "calls", "cpu.ms", "avg.us", "share");
+	for (op = 0; op < OP_COUNT; op++)
+	{
+		if (calls[op] == 0)
+			continue;
+		fprintf(fp, "%-12s %20llu %14.1f %12.2f %6.1f%%\n"
+				, unsharedfs_op_names[op]
+				, (unsigned long long) calls[op]
+				, ns[op] / 1e6
+				, ns[op] / 1e3 / calls[op]
+				, total ? 100.0 * ns[op] / total : 0.0);
+	}
+
+	n = unsharedfs_cputime_rows(&rows);
+	fprintf(fp, "\n## CPU time per uid\n%-12s %20s %14s %12s %7s  %s\n", "uid", "ops", "cpu.ms", "avg.us", "share", "mostly");
+	for (i = 0; i < n; i++)
+	{
+		char uid[24];
+
+		if (rows[i].key == 0)
+			snprintf(uid, sizeof(uid), "other");
+		else
+			snprintf(uid, sizeof(uid), "%llu", (unsigned long long) (rows[i].key - 1));
+		fprintf(fp, "%-12s %20llu %14.1f %12.2f %6.1f%% "
+				, uid
+				, (unsigned long long) rows[i].ops
+				, rows[i].total / 1e6
+				, rows[i].ops ? rows[i].total / 1e3 / rows[i].ops : 0.0
+				, total ? 100.0 * rows[i].total / total : 0.0);
+		unsharedfs_cputime_top_ops(fp, &rows[i]);
+	}
+	free(rows);
+}
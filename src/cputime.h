@@ -0,0 +1,79 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_CPUTIME_H_
+#define UNSHAREDFS_CPUTIME_H_
+
+#include "opctx.h"
+
+#include <sys/types.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * CPU time of the daemon per operation and per uid.
+ *
+ * Every operation reads the thread CPU time (CLOCK_THREAD_CPUTIME_ID) when it
+ * starts and ends, and adds the difference to the sums of the calling thread,
+ * so the CPU the daemon spends on behalf of each user can be billed.  Time
+ * spent waiting for the backing file system is not CPU time of the daemon,
+ * but the kernel's work inside the backing syscalls is.
+ */
+
+// uids tracked per thread; further uids are summed up as "other":
+#define CPUTIME_UIDS 256
+
+/* the CPU time of one uid on one thread */
+struct unsharedfs_cputime_uid {
+	_Atomic uint64_t key;           /* uid + 1 (0: unused slot) */
+	_Atomic uint64_t ops;
+	_Atomic uint64_t ns[OP_COUNT];
+};
+
+/* per-thread sums; only ever written by the owning thread */
+struct unsharedfs_cputime {
+	_Atomic uint64_t calls[OP_COUNT];
+	_Atomic uint64_t ns[OP_COUNT];
+	struct unsharedfs_cputime_uid uids[CPUTIME_UIDS];
+	struct unsharedfs_cputime_uid other;
+};
+
+/**
+ * True if the CPU time is tracked.
+ */
+extern bool unsharedfs_cputime_enabled;
+
+/**
+ * Check that the thread CPU time clock is available, and enable tracking.
+ * @return 1 on success, 0 on error (errno is set).
+ */
+int unsharedfs_cputime_init(void);
+
+/**
+ * Return the CPU time of the calling thread in nanoseconds.
+ */
+uint64_t unsharedfs_cputime_now(void);
+
+/**
+ * Attribute the CPU time of a finished operation.
+ * @param op the operation
+ * @param uid the uid of the caller
+ * @param ns the CPU time of the operation
+ */
+void unsharedfs_cputime_account(enum unsharedfs_op op, uid_t uid, uint64_t ns);
+
+/**
+ * Write the CPU time per operation and per uid.
+ */
+void unsharedfs_cputime_report(FILE *fp);
+
+#endif
@@ -0,0 +1,1088 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+// qsort_r:
+#define _GNU_SOURCE
+
+#include "dirindex.h"
+#include "basedir.h"
+#include "fdtab.h"
+#include "log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DIRINDEX_BUCKETS 256
+// scanning is retried this often when the directory changes meanwhile:
+#define DIRINDEX_SCAN_TRIES 3
+// lookups are not answered this soon after the directory changed, because
+// another change within the timestamp granularity would go unnoticed:
+#define DIRINDEX_RACY_NS 20000000LL
+// names added or removed through unsharedfs are remembered up to this many;
+// after that the index is considered out of date and rebuilt:
+#define DIRINDEX_ADDED_MAX 65536
+
+struct unsharedfs_dirindex_snap {
+	atomic_ulong refs;
+	void *map;
+	size_t size;
+	const struct unsharedfs_dirindex_header *header;
+	const struct unsharedfs_dirindex_entry *entries;
+	const char *names;
+};
+
+// a name added or removed since the index was built
+struct dirindex_change {
+	char *name;                            /* NULL: free slot */
+	uint64_t hash;                         /* unsharedfs_path_hash(name) */
+	int64_t pos;                           /* the name's position in the index, or -1 */
+	bool exists;                           /* the name exists now */
+};
+
+// a name changed while the index was being rebuilt
+struct dirindex_journal_entry {
+	char *name;
+	bool exists;
+};
+
+// the names of a listing: the index without the removed names, and the added ones
+struct unsharedfs_dirindex_list {
+	struct unsharedfs_dirindex_snap *snap;
+	size_t count;                          /* names in the index */
+	int64_t *removed;                      /* sorted positions of the removed names */
+	size_t removed_count;
+	char **added;
+	size_t added_count;
+};
+
+// an indexed directory
+struct unsharedfs_dirindex {
+	struct unsharedfs_dirindex *next;
+	uint64_t key;                          /* unsharedfs_path_hash(fpath) */
+	char *fpath;
+	pthread_mutex_t lock;                  /* protects the rest */
+	struct unsharedfs_dirindex_snap *snap; /* NULL: not loaded or built */
+	bool loaded;                           /* the index file was tried */
+	bool stale;                            /* the directory was changed by others */
+	dev_t dev;                             /* the directory as the index expects it */
+	ino_t ino;
+	struct timespec mtime;
+	struct timespec ctime;
+	struct dirindex_change *changes;       /* names added or removed since the build (hash table) */
+	size_t changes_size;                   /* power of two */
+	size_t changes_count;
+	struct unsharedfs_idset added;         /* hashes of the added names */
+	bool building;                         /* a rebuild is scanning the directory */
+	struct dirindex_journal_entry *journal; /* the names changed meanwhile */
+	size_t journal_count;
+	size_t journal_size;
+	bool journal_failed;                   /* the journal is incomplete */
+};
+
+// the names of a directory while it is being scanned
+struct dirindex_scan {
+	struct unsharedfs_dirindex_entry *entries;
+	size_t count;
+	size_t size;
+	char *names;
+	size_t names_size;
+	size_t names_alloc;
+};
+
+bool unsharedfs_dirindex_enabled = false;
+
+static char *dirindex_dir;
+static unsigned long dirindex_min;
+static pthread_rwlock_t dirindex_table_lock = PTHREAD_RWLOCK_INITIALIZER;
+static struct unsharedfs_dirindex *dirindex_table[DIRINDEX_BUCKETS];
+// keys of the index files in dirindex_dir (protected by dirindex_table_lock):
+static struct unsharedfs_idset dirindex_files;
+
+/**
+ * The idset stores ids up to ULONG_MAX / 4.
+ */
+static unsigned long dirindex_hash_id(uint64_t hash)
+{
+	return (unsigned long) (hash >> 2);
+}
+
+static void dirindex_filename(char file[PATH_MAX], uint64_t key)
+{
+	snprintf(file, PATH_MAX, "%s/%016" PRIx64 ".idx", dirindex_dir, key);
+}
+
+static int dirindex_file_key(const char *name, unsigned char type, void *arg)
+{
+	uint64_t key;
+	char *end;
+	(void) type;
+
+	if (strlen(name) != 20 || strcmp(name + 16, ".idx") != 0)
+		return 1;
+	errno = 0;
+	key = strtoull(name, &end, 16);
+	if (errno != 0 || end != name + 16)
+		return 1;
+	if (!unsharedfs_idset_add(arg, dirindex_hash_id(key), false) && errno != 0)
+		return 0;
+	return 1;
+}
+
+int unsharedfs_dirindex_init(const char *dir, unsigned long min_entries)
+{
+	int fd;
+	int ok;
+
+	dirindex_dir = strdup(dir);
+	if (dirindex_dir == NULL)
+		return 0;
+	dirindex_min = min_entries;
+	// the index files of an earlier mount are used again:
+	fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		free(dirindex_dir);
+		dirindex_dir = NULL;
+		return 0;
+	}
+	ok = unsharedfs_basedir_scan(fd, dirindex_file_key, &dirindex_files);
+	close(fd);
+	if (!ok)
+	{
+		int err = errno;
+
+		unsharedfs_idset_free(&dirindex_files);
+		free(dirindex_dir);
+		dirindex_dir = NULL;
+		errno = err;
+		return 0;
+	}
+	unsharedfs_dirindex_enabled = true;
+	return 1;
+}
+
+static void dirindex_put(struct unsharedfs_dirindex_snap *snap)
+{
+	if (snap == NULL || atomic_fetch_sub(&snap->refs, 1) != 1)
+		return;
+	munmap(snap->map, snap->size);
+	free(snap);
+}
+
+static struct unsharedfs_dirindex_snap *dirindex_get(struct unsharedfs_dirindex_snap *snap)
+{
+	atomic_fetch_add(&snap->refs, 1);
+	return snap;
+}
+
+/* forget the names changed since the build */
+static void dirindex_changes_free(struct unsharedfs_dirindex *idx)
+{
+	size_t i;
+
+	for (i = 0; i < idx->changes_size; i++)
+		free(idx->changes[i].name);
+	free(idx->changes);
+	idx->changes = NULL;
+	idx->changes_size = 0;
+	idx->changes_count = 0;
+	unsharedfs_idset_free(&idx->added);
+}
+
+static void dirindex_journal_free(struct unsharedfs_dirindex *idx)
+{
+	size_t i;
+
+	for (i = 0; i < idx->journal_count; i++)
+		free(idx->journal[i].name);
+	free(idx->journal);
+	idx->journal = NULL;
+	idx->journal_count = 0;
+	idx->journal_size = 0;
+	idx->journal_failed = false;
+}
+
+void unsharedfs_dirindex_destroy(void)
+{
+	size_t i;
+
+	if (!unsharedfs_dirindex_enabled)
+		return;
+	unsharedfs_dirindex_enabled = false;
+	pthread_rwlock_wrlock(&dirindex_table_lock);
+	for (i = 0; i < DIRINDEX_BUCKETS; i++)
+	{
+		while (dirindex_table[i] != NULL)
+		{
+			struct unsharedfs_dirindex *idx = dirindex_table[i];
+
+			dirindex_table[i] = idx->next;
+			// open directory handles keep their own reference:
+			dirindex_put(idx->snap);
+			dirindex_changes_free(idx);
+			dirindex_journal_free(idx);
+			pthread_mutex_destroy(&idx->lock);
+			free(idx->fpath);
+			free(idx);
+		}
+	}
+	unsharedfs_idset_free(&dirindex_files);
+	free(dirindex_dir);
+	dirindex_dir = NULL;
+	pthread_rwlock_unlock(&dirindex_table_lock);
+}
+
+static const char *dirindex_snap_name(const struct unsharedfs_dirindex_snap *snap, size_t i)
+{
+	return snap->names + snap->entries[i].name_offset;
+}
+
+/**
+ * Find a name in an index with a binary search.
+ * @return its position, or -1.
+ */
+static int64_t dirindex_position(const struct unsharedfs_dirindex_snap *snap, const char *name)
+{
+	size_t lo = 0;
+	size_t hi = snap->header->count;
+
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		int cmp = strcmp(name, dirindex_snap_name(snap, mid));
+
+		if (cmp == 0)
+			return mid;
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return -1;
+}
+
+static bool dirindex_contains(const struct unsharedfs_dirindex_snap *snap, const char *name)
+{
+	return dirindex_position(snap, name) >= 0;
+}
+
+static int dirindex_compare_pos(const void *a, const void *b)
+{
+	int64_t pa = *(const int64_t *) a;
+	int64_t pb = *(const int64_t *) b;
+
+	return pa < pb ? -1 : pa > pb;
+}
+
+/**
+ * Remember that a name was added or removed.  Called with idx->lock held,
+ * and idx->snap set.
+ * @param exists whether the name exists now
+ * @return 1 on success, 0 on error (errno is set).
+ */
+static int dirindex_note(struct unsharedfs_dirindex *idx, const char *name, bool exists)
+{
+	uint64_t hash = unsharedfs_path_hash(name);
+	struct dirindex_change *c;
+	size_t i;
+
+	if ((idx->changes_count + 1) * 2 > idx->changes_size)
+	{
+		size_t size = idx->changes_size ? 2 * idx->changes_size : 64;
+		struct dirindex_change *changes = calloc(size, sizeof(*changes));
+
+		if (changes == NULL)
+			return 0;
+		for (i = 0; i < idx->changes_size; i++)
+		{
+			size_t j;
+
+			if (idx->changes[i].name == NULL)
+				continue;
+			for (j = idx->changes[i].hash & (size - 1); changes[j].name != NULL; j = (j + 1) & (size - 1))
+				;
+			changes[j] = idx->changes[i];
+		}
+		free(idx->changes);
+		idx->changes = changes;
+		idx->changes_size = size;
+	}
+	for (i = hash & (idx->changes_size - 1); idx->changes[i].name != NULL; i = (i + 1) & (idx->changes_size - 1))
+		if (idx->changes[i].hash == hash && strcmp(idx->changes[i].name, name) == 0)
+			break;
+	c = &idx->changes[i];
+	if (c->name == NULL)
+	{
+		c->name = strdup(name);
+		if (c->name == NULL)
+			return 0;
+		c->hash = hash;
+		c->pos = dirindex_position(idx->snap, name);
+		idx->changes_count++;
+	}
+	c->exists = exists;
+	if (exists && !unsharedfs_idset_add(&idx->added, dirindex_hash_id(hash), false) && errno != 0)
+		return 0;
+	return 1;
+}
+
+/**
+ * Make the listing of an index and the names changed since it was built.
+ * Called with idx->lock held.
+ * @return the listing, or NULL (errno is set).
+ */
+static struct unsharedfs_dirindex_list *dirindex_list(const struct unsharedfs_dirindex *idx)
+{
+	struct unsharedfs_dirindex_list *list;
+	size_t removed = 0, added = 0, names_size = 0;
+	char *names;
+	size_t i;
+
+	for (i = 0; i < idx->changes_size; i++)
+	{
+		const struct dirindex_change *c = &idx->changes[i];
+
+		if (c->name == NULL || c->exists == (c->pos >= 0))
+			continue;
+		if (c->pos >= 0)
+			removed++;
+		else
+		{
+			added++;
+			names_size += strlen(c->name) + 1;
+		}
+	}
+	// one allocation for the list, the positions, the names and their pointers:
+	list = malloc(sizeof(*list) + removed * sizeof(*list->removed) + added * sizeof(*list->added) + names_size);
+	if (list == NULL)
+		return NULL;
+	list->snap = dirindex_get(idx->snap);
+	list->count = idx->snap->header->count;
+	list->removed = (int64_t *) (list + 1);
+	list->removed_count = 0;
+	list->added = (char **) (list->removed + removed);
+	list->added_count = 0;
+	names = (char *) (list->added + added);
+	for (i = 0; i < idx->changes_size; i++)
+	{
+		const struct dirindex_change *c = &idx->changes[i];
+
+		if (c->name == NULL || c->exists == (c->pos >= 0))
+			continue;
+		if (c->pos >= 0)
+			list->removed[list->removed_count++] = c->pos;
+		else
+		{
+			size_t len = strlen(c->name) + 1;
+
+			memcpy(names, c->name, len);
+			list->added[list->added_count++] = names;
+			names += len;
+		}
+	}
+	qsort(list->removed, list->removed_count, sizeof(*list->removed), dirindex_compare_pos);
+	return list;
+}
+
+size_t unsharedfs_dirindex_count(const struct unsharedfs_dirindex_list *list)
+{
+	return list->count + list->added_count;
+}
+
+const char *unsharedfs_dirindex_name(const struct unsharedfs_dirindex_list *list, size_t i)
+{
+	int64_t pos = i;
+
+	if (i >= list->count)
+		return list->added[i - list->count];
+	if (list->removed_count > 0
+			&& bsearch(&pos, list->removed, list->removed_count, sizeof(*list->removed), dirindex_compare_pos) != NULL)
+		return NULL;
+	return dirindex_snap_name(list->snap, i);
+}
+
+void unsharedfs_dirindex_close(struct unsharedfs_dirindex_list *list)
+{
+	if (list == NULL)
+		return;
+	dirindex_put(list->snap);
+	free(list);
+}
+
+/**
+ * Look up the index of a directory.
+ * @param create add an entry if there is none
+ * @return the entry, or NULL.
+ */
+static struct unsharedfs_dirindex *dirindex_find(const char *fpath, bool create)
+{
+	uint64_t key = unsharedfs_path_hash(fpath);
+	struct unsharedfs_dirindex **bucket = &dirindex_table[key % DIRINDEX_BUCKETS];
+	struct unsharedfs_dirindex *idx;
+
+	pthread_rwlock_rdlock(&dirindex_table_lock);
+	for (idx = *bucket; idx != NULL; idx = idx->next)
+		if (idx->key == key && strcmp(idx->fpath, fpath) == 0)
+			break;
+	// the index file of an earlier mount is loaded on demand:
+	if (idx == NULL && create == false
+			&& unsharedfs_idset_contains(&dirindex_files, dirindex_hash_id(key)))
+		create = true;
+	pthread_rwlock_unlock(&dirindex_table_lock);
+	if (idx != NULL || !create)
+		return idx;
+
+	pthread_rwlock_wrlock(&dirindex_table_lock);
+	for (idx = *bucket; idx != NULL; idx = idx->next)
+		if (idx->key == key && strcmp(idx->fpath, fpath) == 0)
+			break;
+	if (idx == NULL && (idx = calloc(1, sizeof(*idx))) != NULL)
+	{
+		idx->key = key;
+		idx->fpath = strdup(fpath);
+		if (idx->fpath == NULL)
+		{
+			free(idx);
+			idx = NULL;
+		}
+		else
+		{
+			pthread_mutex_init(&idx->lock, NULL);
+			idx->next = *bucket;
+			*bucket = idx;
+		}
+	}
+	pthread_rwlock_unlock(&dirindex_table_lock);
+	return idx;
+}
+
+/**
+ * Look up the index of the directory of a path.
+ * @param name set to the last path component
+ */
+static struct unsharedfs_dirindex *dirindex_find_parent(const char *fpath, const char **name)
+{
+	char parent[PATH_MAX];
+	const char *slash = strrchr(fpath, '/');
+	size_t len;
+
+	if (slash == NULL || slash == fpath || slash[1] == '\0')
+		return NULL;
+	len = slash - fpath;
+	memcpy(parent, fpath, len);
+	parent[len] = '\0';
+	*name = slash + 1;
+	return dirindex_find(parent, false);
+}
+
+static bool dirindex_timespec_equal(struct timespec a, struct timespec b)
+{
+	return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+/**
+ * @return true if the directory is in the state the index expects.
+ */
+static bool dirindex_matches(const struct unsharedfs_dirindex *idx, const struct stat *st)
+{
+	return idx->dev == st->st_dev && idx->ino == st->st_ino
+		&& dirindex_timespec_equal(idx->mtime, st->st_mtim)
+		&& dirindex_timespec_equal(idx->ctime, st->st_ctim);
+}
+
+static void dirindex_expect(struct unsharedfs_dirindex *idx, const struct stat *st)
+{
+	idx->dev = st->st_dev;
+	idx->ino = st->st_ino;
+	idx->mtime = st->st_mtim;
+	idx->ctime = st->st_ctim;
+}
+
+/**
+ * Map an index file and check its layout.
+ * @return the index with one reference, or NULL (errno is set).
+ */
+static struct unsharedfs_dirindex_snap *dirindex_map(int fd)
+{
+	struct unsharedfs_dirindex_snap *snap;
+	const struct unsharedfs_dirindex_header *header;
+	struct stat st;
+	void *map;
+	size_t entries_size;
+	uint64_t i;
+
+	if (fstat(fd, &st) != 0)
+		return NULL;
+	if ((size_t) st.st_size < sizeof(*header))
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+	header = map;
+	entries_size = header->count * sizeof(struct unsharedfs_dirindex_entry);
+	if (memcmp(header->magic, UNSHAREDFS_DIRINDEX_MAGIC, sizeof(header->magic)) != 0
+			|| header->version != UNSHAREDFS_DIRINDEX_VERSION
+			|| header->entry_size != sizeof(struct unsharedfs_dirindex_entry)
+			|| header->count > ((size_t) st.st_size - sizeof(*header)) / sizeof(struct unsharedfs_dirindex_entry)
+			|| sizeof(*header) + entries_size + header->names_size != (size_t) st.st_size
+			|| (header->names_size > 0 && ((const char *) map)[st.st_size - 1] != '\0'))
+		goto invalid;
+	snap = malloc(sizeof(*snap));
+	if (snap == NULL)
+	{
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	atomic_init(&snap->refs, 1);
+	snap->map = map;
+	snap->size = st.st_size;
+	snap->header = header;
+	snap->entries = (const void *) (header + 1);
+	snap->names = (const char *) snap->entries + entries_size;
+	for (i = 0; i < header->count; i++)
+	{
+		const struct unsharedfs_dirindex_entry *e = &snap->entries[i];
+
+		if (e->name_offset + (uint64_t) e->name_len >= header->names_size
+				|| snap->names[e->name_offset + e->name_len] != '\0')
+		{
+			free(snap);
+			goto invalid;
+		}
+	}
+	return snap;
+
+invalid:
+	munmap(map, st.st_size);
+	errno = EINVAL;
+	return NULL;
+}
+
+/**
+ * Load the index file of a directory.
+ * @return the index, or NULL if there is no (valid) index file.
+ */
+static struct unsharedfs_dirindex_snap *dirindex_load(const struct unsharedfs_dirindex *idx)
+{
+	char file[PATH_MAX];
+	struct unsharedfs_dirindex_snap *snap;
+	int fd;
+
+	dirindex_filename(file, idx->key);
+	fd = open(file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	snap = dirindex_map(fd);
+	if (snap == NULL)
+		logmsg(LOG_WARNING,"ignoring the invalid directory index %s: %s",file,strerror(errno));
+	close(fd);
+	return snap;
+}
+
+static int dirindex_scan_add(const char *name, unsigned char type, void *arg)
+{
+	struct dirindex_scan *scan = arg;
+	size_t len = strlen(name);
+
+	if (scan->count == scan->size)
+	{
+		size_t size = scan->size ? 2 * scan->size : 1024;
+		struct unsharedfs_dirindex_entry *entries = realloc(scan->entries, size * sizeof(*entries));
+
+		if (entries == NULL)
+			return 0;
+		scan->entries = entries;
+		scan->size = size;
+	}
+	if (scan->names_size + len + 1 > scan->names_alloc)
+	{
+		size_t alloc = scan->names_alloc ? 2 * scan->names_alloc : 16384;
+		char *names;
+
+		while (alloc < scan->names_size + len + 1)
+			alloc *= 2;
+		names = realloc(scan->names, alloc);
+		if (names == NULL)
+			return 0;
+		scan->names = names;
+		scan->names_alloc = alloc;
+	}
+	if (scan->names_size + len + 1 > UINT32_MAX)
+	{
+		errno = EOVERFLOW;
+		return 0;
+	}
+	scan->entries[scan->count].name_offset = scan->names_size;
+	scan->entries[scan->count].name_len = len;
+	scan->entries[scan->count].type = type;
+	scan->entries[scan->count].reserved = 0;
+	scan->count++;
+	memcpy(scan->names + scan->names_size, name, len + 1);
+	scan->names_size += len + 1;
+	return 1;
+}
+
+static int dirindex_compare(const void *a, const void *b, void *names)
+{
+	const struct unsharedfs_dirindex_entry *ea = a;
+	const struct unsharedfs_dirindex_entry *eb = b;
+
+	return strcmp((const char *) names + ea->name_offset, (const char *) names + eb->name_offset);
+}
+
+static int dirindex_write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while (len > 0)
+	{
+		ssize_t n = write(fd, p, len);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return 0;
+		}
+		p += n;
+		len -= n;
+	}
+	return 1;
+}
+
+/**
+ * Write an index file and map it.
+ * @param st the directory at the start of the scan
+ * @return the index, or NULL (errno is set).
+ */
+static struct unsharedfs_dirindex_snap *dirindex_write(const struct unsharedfs_dirindex *idx,
+		const struct dirindex_scan *scan, const struct stat *st)
+{
+	struct unsharedfs_dirindex_header header;
+	struct unsharedfs_dirindex_snap *snap = NULL;
+	char file[PATH_MAX];
+	char tmp[PATH_MAX];
+	int fd;
+	int err;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, UNSHAREDFS_DIRINDEX_MAGIC, sizeof(header.magic));
+	header.version = UNSHAREDFS_DIRINDEX_VERSION;
+	header.entry_size = sizeof(struct unsharedfs_dirindex_entry);
+	header.dev = st->st_dev;
+	header.ino = st->st_ino;
+	header.mtime_sec = st->st_mtim.tv_sec;
+	header.mtime_nsec = st->st_mtim.tv_nsec;
+	header.ctime_sec = st->st_ctim.tv_sec;
+	header.ctime_nsec = st->st_ctim.tv_nsec;
+	header.count = scan->count;
+	header.names_size = scan->names_size;
+
+	dirindex_filename(file, idx->key);
+	if (PATH_MAX <= snprintf(tmp, PATH_MAX, "%s.XXXXXX", file))
+	{
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	// the index file replaces the old one in one step; handles still listing
+	// the old one keep their mapping:
+	fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	if (dirindex_write_all(fd, &header, sizeof(header))
+			&& dirindex_write_all(fd, scan->entries, scan->count * sizeof(*scan->entries))
+			&& dirindex_write_all(fd, scan->names, scan->names_size)
+			&& (snap = dirindex_map(fd)) != NULL
+			&& rename(tmp, file) != 0)
+	{
+		dirindex_put(snap);
+		snap = NULL;
+	}
+	err = errno;
+	if (snap == NULL)
+		unlink(tmp);
+	close(fd);
+	errno = err;
+	if (snap != NULL)
+	{
+		pthread_rwlock_wrlock(&dirindex_table_lock);
+		unsharedfs_idset_add(&dirindex_files, dirindex_hash_id(idx->key), false);
+		pthread_rwlock_unlock(&dirindex_table_lock);
+	}
+	return snap;
+}
+
+/**
+ * Scan a directory and write its index file.  Called without idx->lock, while
+ * idx->building is set.
+ * @param fd an open descriptor of the directory
+ * @param st set to the directory at the start of the scan
+ * @return the index, or NULL (errno is set).
+ */
+static struct unsharedfs_dirindex_snap *dirindex_scan(struct unsharedfs_dirindex *idx, int fd, struct stat *st)
+{
+	struct dirindex_scan scan;
+	struct unsharedfs_dirindex_snap *snap = NULL;
+	struct stat after;
+	size_t journaled;
+	int tries;
+	int err;
+
+	memset(&scan, 0, sizeof(scan));
+	for (tries = 0; tries < DIRINDEX_SCAN_TRIES && snap == NULL; tries++)
+	{
+		// a descriptor of its own, which starts at the beginning:
+		int dfd = openat(fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		int ok;
+
+		if (dfd < 0)
+			break;
+		pthread_mutex_lock(&idx->lock);
+		journaled = idx->journal_count;
+		pthread_mutex_unlock(&idx->lock);
+		scan.count = 0;
+		scan.names_size = 0;
+		ok = fstat(dfd, st) == 0
+			&& unsharedfs_basedir_scan(dfd, dirindex_scan_add, &scan)
+			&& fstat(dfd, &after) == 0;
+		close(dfd);
+		if (!ok)
+			break;
+		// changes made through unsharedfs meanwhile are in the journal:
+		if (!dirindex_timespec_equal(st->st_mtim, after.st_mtim)
+				|| !dirindex_timespec_equal(st->st_ctim, after.st_ctim))
+		{
+			bool journaled_more;
+
+			pthread_mutex_lock(&idx->lock);
+			journaled_more = idx->journal_count > journaled;
+			pthread_mutex_unlock(&idx->lock);
+			if (!journaled_more)
+			{
+				errno = EAGAIN;
+				continue;
+			}
+		}
+		qsort_r(scan.entries, scan.count, sizeof(*scan.entries), dirindex_compare, scan.names);
+		snap = dirindex_write(idx, &scan, st);
+		if (snap == NULL)
+			break;
+	}
+	err = errno;
+	free(scan.entries);
+	free(scan.names);
+	if (snap == NULL)
+	{
+		logmsg(LOG_WARNING,"could not index the directory %s: %s",idx->fpath,strerror(err));
+		errno = err;
+		return NULL;
+	}
+	logmsg(LOG_DEBUG,"indexed %zu entries of %s",scan.count,idx->fpath);
+	return snap;
+}
+
+/**
+ * Rebuild the index of a directory.  The directory is scanned without
+ * idx->lock, so lookups and changes of the directory go on meanwhile; the
+ * names changed meanwhile are journaled and applied to the new index.
+ * Returns at once if another thread is rebuilding the index.
+ * @param fd an open descriptor of the directory
+ */
+static void dirindex_rebuild(struct unsharedfs_dirindex *idx, int fd)
+{
+	struct unsharedfs_dirindex_snap *snap;
+	struct stat st;
+	size_t i;
+
+	pthread_mutex_lock(&idx->lock);
+	if (idx->building)
+	{
+		pthread_mutex_unlock(&idx->lock);
+		return;
+	}
+	idx->building = true;
+	pthread_mutex_unlock(&idx->lock);
+
+	snap = dirindex_scan(idx, fd, &st);
+
+	pthread_mutex_lock(&idx->lock);
+	if (snap != NULL && !idx->journal_failed)
+	{
+		dirindex_put(idx->snap);
+		idx->snap = snap;
+		idx->loaded = true;
+		idx->stale = false;
+		dirindex_changes_free(idx);
+		// a journaled name may or may not be in the scan:
+		for (i = 0; i < idx->journal_count && !idx->stale; i++)
+			if (!dirindex_note(idx, idx->journal[i].name, idx->journal[i].exists))
+				idx->stale = true;
+		// the journaled changes moved the times on:
+		if (idx->journal_count > 0 && stat(idx->fpath, &st) != 0)
+			idx->stale = true;
+		dirindex_expect(idx, &st);
+	}
+	else
+		dirindex_put(snap);
+	dirindex_journal_free(idx);
+	idx->building = false;
+	pthread_mutex_unlock(&idx->lock);
+}
+
+/**
+ * Load the index file of an entry, if that was not tried yet.  Called with
+ * idx->lock held.
+ */
+static void dirindex_load_once(struct unsharedfs_dirindex *idx)
+{
+	struct unsharedfs_dirindex_snap *snap;
+
+	if (idx->loaded)
+		return;
+	idx->loaded = true;
+	snap = dirindex_load(idx);
+	if (snap == NULL)
+		return;
+	idx->snap = snap;
+	idx->dev = snap->header->dev;
+	idx->ino = snap->header->ino;
+	idx->mtime.tv_sec = snap->header->mtime_sec;
+	idx->mtime.tv_nsec = snap->header->mtime_nsec;
+	idx->ctime.tv_sec = snap->header->ctime_sec;
+	idx->ctime.tv_nsec = snap->header->ctime_nsec;
+}
+
+/**
+ * @return true if the index of a directory can be listed.  Called with
+ *         idx->lock held.
+ */
+static bool dirindex_usable(struct unsharedfs_dirindex *idx, int fd)
+{
+	struct stat st;
+
+	dirindex_load_once(idx);
+	if (idx->snap == NULL || idx->stale || fstat(fd, &st) != 0)
+		return false;
+	if (!dirindex_matches(idx, &st))
+	{
+		idx->stale = true;
+		return false;
+	}
+	return true;
+}
+
+struct unsharedfs_dirindex_list *unsharedfs_dirindex_open(const char *fpath, int fd)
+{
+	struct unsharedfs_dirindex *idx;
+	struct unsharedfs_dirindex_list *list = NULL;
+	bool usable;
+
+	if (!unsharedfs_dirindex_enabled)
+		return NULL;
+	idx = dirindex_find(fpath, false);
+	if (idx == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&idx->lock);
+	usable = dirindex_usable(idx, fd);
+	pthread_mutex_unlock(&idx->lock);
+	// while another thread rebuilds it, the directory is listed without the index:
+	if (!usable)
+		dirindex_rebuild(idx, fd);
+
+	pthread_mutex_lock(&idx->lock);
+	// the names changed since the build are merged into the listing:
+	if (dirindex_usable(idx, fd))
+		list = dirindex_list(idx);
+	pthread_mutex_unlock(&idx->lock);
+	return list;
+}
+
+void unsharedfs_dirindex_listed(const char *fpath, unsigned long entries)
+{
+	struct unsharedfs_dirindex *idx;
+	bool usable;
+	int fd;
+
+	if (!unsharedfs_dirindex_enabled || entries < dirindex_min)
+		return;
+	idx = dirindex_find(fpath, true);
+	if (idx == NULL)
+		return;
+	fd = open(fpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	pthread_mutex_lock(&idx->lock);
+	// another handle may have indexed it meanwhile:
+	usable = dirindex_usable(idx, fd);
+	pthread_mutex_unlock(&idx->lock);
+	if (!usable)
+		dirindex_rebuild(idx, fd);
+	close(fd);
+}
+
+/**
+ * @return true if the directory's permissions let the user look up names.
+ */
+static bool dirindex_searchable(const struct stat *st, uid_t uid, gid_t gid)
+{
+	// without the supplementary groups, only the plain cases are answered:
+	if (uid == 0 || (st->st_mode & S_IXOTH))
+		return true;
+	if (st->st_uid == uid)
+		return (st->st_mode & S_IXUSR) != 0;
+	return st->st_gid == gid && (st->st_mode & S_IXGRP) != 0;
+}
+
+bool unsharedfs_dirindex_absent(const char *fpath, uid_t uid, gid_t gid)
+{
+	struct unsharedfs_dirindex *idx;
+	const char *name;
+	struct stat st;
+	struct timespec now;
+	bool absent = false;
+
+	if (!unsharedfs_dirindex_enabled)
+		return false;
+	idx = dirindex_find_parent(fpath, &name);
+	if (idx == NULL)
+		return false;
+
+	// with the user's credentials, the index file is not loaded here:
+	pthread_mutex_lock(&idx->lock);
+	if (idx->snap == NULL || idx->stale || stat(idx->fpath, &st) != 0)
+		goto out;
+	if (!dirindex_matches(idx, &st))
+	{
+		idx->stale = true;
+		goto out;
+	}
+	clock_gettime(CLOCK_REALTIME, &now);
+	if ((now.tv_sec - st.st_ctim.tv_sec) * 1000000000LL + (now.tv_nsec - st.st_ctim.tv_nsec) < DIRINDEX_RACY_NS)
+		goto out;
+	if (!dirindex_searchable(&st, uid, gid))
+		goto out;
+	absent = !dirindex_contains(idx->snap, name)
+		&& !unsharedfs_idset_contains(&idx->added, dirindex_hash_id(unsharedfs_path_hash(name)));
+out:
+	pthread_mutex_unlock(&idx->lock);
+	return absent;
+}
+
+/**
+ * @return true if the index of a directory can be kept up to date.
+ */
+static bool dirindex_fresh(struct unsharedfs_dirindex *idx)
+{
+	struct stat st;
+
+	dirindex_load_once(idx);
+	if (idx->snap == NULL || idx->stale)
+		return false;
+	if (stat(idx->fpath, &st) != 0 || !dirindex_matches(idx, &st))
+	{
+		idx->stale = true;
+		return false;
+	}
+	return true;
+}
+
+void unsharedfs_dirindex_begin(struct unsharedfs_dirindex_op *op, const char *removed, const char *added)
+{
+	memset(op, 0, sizeof(*op));
+	if (!unsharedfs_dirindex_enabled)
+		return;
+	if (removed != NULL)
+		op->idx[0] = dirindex_find_parent(removed, &op->name[0]);
+	if (added != NULL)
+		op->idx[1] = dirindex_find_parent(added, &op->name[1]);
+
+	// two directories are locked in a fixed order:
+	if (op->idx[0] != NULL && op->idx[1] != NULL && op->idx[0] != op->idx[1]
+			&& (uintptr_t) op->idx[1] < (uintptr_t) op->idx[0])
+	{
+		pthread_mutex_lock(&op->idx[1]->lock);
+		pthread_mutex_lock(&op->idx[0]->lock);
+	}
+	else
+	{
+		if (op->idx[0] != NULL)
+			pthread_mutex_lock(&op->idx[0]->lock);
+		if (op->idx[1] != NULL && op->idx[1] != op->idx[0])
+			pthread_mutex_lock(&op->idx[1]->lock);
+	}
+	if (op->idx[0] != NULL)
+		op->fresh[0] = dirindex_fresh(op->idx[0]);
+	if (op->idx[1] != NULL)
+		op->fresh[1] = op->idx[1] == op->idx[0] ? op->fresh[0] : dirindex_fresh(op->idx[1]);
+}
+
+void unsharedfs_dirindex_end(struct unsharedfs_dirindex_op *op, int result)
+{
+	int i;
+
+	for (i = 0; i < 2; i++)
+	{
+		struct unsharedfs_dirindex *idx = op->idx[i];
+		struct stat st;
+
+		if (idx == NULL || result != 0)
+			continue;
+		// a rebuild in progress applies the change to the new index:
+		if (idx->building && !idx->journal_failed)
+		{
+			if (idx->journal_count == idx->journal_size)
+			{
+				size_t size = idx->journal_size ? 2 * idx->journal_size : 64;
+				struct dirindex_journal_entry *journal = realloc(idx->journal, size * sizeof(*journal));
+
+				if (journal != NULL)
+				{
+					idx->journal = journal;
+					idx->journal_size = size;
+				}
+			}
+			if (idx->journal_count < idx->journal_size
+					&& (idx->journal[idx->journal_count].name = strdup(op->name[i])) != NULL)
+				idx->journal[idx->journal_count++].exists = i == 1;
+			else
+				idx->journal_failed = true;
+		}
+		if (!op->fresh[i])
+			continue;
+		if (!dirindex_note(idx, op->name[i], i == 1) || idx->changes_count > DIRINDEX_ADDED_MAX)
+			idx->stale = true;
+		// a rename within the directory takes the times after both names:
+		if (i == 0 && idx == op->idx[1])
+			continue;
+		if (stat(idx->fpath, &st) == 0)
+			dirindex_expect(idx, &st);
+		else
+			idx->stale = true;
+	}
+	if (op->idx[1] != NULL && op->idx[1] != op->idx[0])
+		pthread_mutex_unlock(&op->idx[1]->lock);
+	if (op->idx[0] != NULL)
+		pthread_mutex_unlock(&op->idx[0]->lock);
+}
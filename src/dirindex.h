@@ -0,0 +1,160 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_DIRINDEX_H_
+#define UNSHAREDFS_DIRINDEX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * The directory index keeps a sorted list of the names in a huge backing
+ * directory in a file (one per directory, in the --dir-index directory), so
+ * that listings are served from the mmap'ed file without reading the backing
+ * directory, and lookups of names that do not exist are answered with a
+ * binary search.
+ *
+ * A directory is indexed when a listing returns at least --dir-index-min
+ * entries.  The index remembers the directory's device, inode, mtime and
+ * ctime; when they don't match the backing directory anymore, the index is
+ * not used and is rebuilt when the directory is opened the next time.  Names
+ * added and removed through unsharedfs are tracked in memory (and the
+ * remembered times updated), so that the daemon's own mutations don't
+ * invalidate the index: listings merge them into the names of the index file,
+ * until there are too many of them and the index is rebuilt.  A rebuild scans
+ * the directory without blocking lookups and changes.  Changes made
+ * directly in the backing directory are only noticed by its timestamps, so
+ * a change that races with one made through unsharedfs may be missed; the
+ * index is meant for directories that are only changed through the mount.
+ *
+ * File layout (native byte order):
+ *   struct unsharedfs_dirindex_header
+ *   count entries (struct unsharedfs_dirindex_entry), sorted by name (strcmp)
+ *   names_size bytes of NUL-terminated names
+ * "." and ".." are not included.
+ */
+
+#define UNSHAREDFS_DIRINDEX_MAGIC "USFSIDX"
+#define UNSHAREDFS_DIRINDEX_VERSION 1
+
+struct unsharedfs_dirindex_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t entry_size;   /* sizeof(struct unsharedfs_dirindex_entry) */
+	uint64_t dev;          /* the backing directory */
+	uint64_t ino;
+	int64_t mtime_sec;     /* its times when the index was built */
+	int64_t mtime_nsec;
+	int64_t ctime_sec;
+	int64_t ctime_nsec;
+	uint64_t count;
+	uint64_t names_size;
+};
+
+struct unsharedfs_dirindex_entry {
+	uint32_t name_offset;  /* in the names */
+	uint16_t name_len;
+	uint8_t type;          /* d_type */
+	uint8_t reserved;
+};
+
+/* an immutable index file, shared by the handles listing it */
+struct unsharedfs_dirindex_snap;
+
+/* the names of a listing: an index file and the names changed since it was built */
+struct unsharedfs_dirindex_list;
+
+/* book-keeping for an operation that adds or removes names */
+struct unsharedfs_dirindex_op {
+	struct unsharedfs_dirindex *idx[2];  /* of the removed and the added name */
+	const char *name[2];
+	bool fresh[2];                       /* the index was up to date before */
+};
+
+/**
+ * True if huge directories are indexed.
+ */
+extern bool unsharedfs_dirindex_enabled;
+
+/**
+ * Enable the index.
+ * @param dir the directory for the index files
+ * @param min_entries index directories with at least this many entries
+ * @return 1 on success, 0 on error (errno is set).
+ */
+int unsharedfs_dirindex_init(const char *dir, unsigned long min_entries);
+
+/**
+ * Release all indexes (the files are kept).
+ */
+void unsharedfs_dirindex_destroy(void);
+
+/**
+ * List a directory that is being opened from its index.  Loads the index
+ * file, or rebuilds it if it is out of date.
+ * @param fpath the backing directory
+ * @param fd an open descriptor of the directory
+ * @return the listing, or NULL if the directory is not indexed.
+ */
+struct unsharedfs_dirindex_list *unsharedfs_dirindex_open(const char *fpath, int fd);
+
+/**
+ * Release a listing returned by unsharedfs_dirindex_open().
+ */
+void unsharedfs_dirindex_close(struct unsharedfs_dirindex_list *list);
+
+/**
+ * @return the number of positions in a listing.
+ */
+size_t unsharedfs_dirindex_count(const struct unsharedfs_dirindex_list *list);
+
+/**
+ * @return the name at a position of a listing, or NULL if the name was
+ *         removed.
+ */
+const char *unsharedfs_dirindex_name(const struct unsharedfs_dirindex_list *list, size_t i);
+
+/**
+ * Note that a directory was listed completely; it is indexed if it has
+ * enough entries.
+ * @param fpath the backing directory
+ * @param entries the number of entries of the listing
+ */
+void unsharedfs_dirindex_listed(const char *fpath, unsigned long entries);
+
+/**
+ * Check whether a path is known not to exist.  Called with the credentials
+ * of the user; only answers if the user may look up names in the directory,
+ * and if its index was loaded by a listing or a change of the directory.
+ * @param fpath the backing path
+ * @param uid the user
+ * @param gid the user's (primary) group
+ * @return true if the name is not in the (up to date) index of its directory.
+ */
+bool unsharedfs_dirindex_absent(const char *fpath, uid_t uid, gid_t gid);
+
+/**
+ * Lock the indexes of the directories an operation changes, before the
+ * operation.
+ * @param op book-keeping for unsharedfs_dirindex_end()
+ * @param removed the backing path of a removed name (or NULL)
+ * @param added the backing path of an added name (or NULL)
+ */
+void unsharedfs_dirindex_begin(struct unsharedfs_dirindex_op *op, const char *removed, const char *added);
+
+/**
+ * Update and unlock the indexes after the operation.
+ * @param result the result of the operation (0 or -errno)
+ */
+void unsharedfs_dirindex_end(struct unsharedfs_dirindex_op *op, int result);
+
+#endif
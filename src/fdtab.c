@@ -0,0 +1,135 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#include "fdtab.h"
+#include "changes.h"
+#include "compress.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+// upper bound for the table size, regardless of RLIMIT_NOFILE:
+#define FDTAB_MAX (1024 * 1024)
+
+bool unsharedfs_fdtab_enabled = false;
+bool unsharedfs_fdtab_paths = false;
+
+static struct unsharedfs_fdinfo **fdtab = NULL;
+static size_t fdtab_size = 0;
+
+int unsharedfs_fdtab_init(void)
+{
+	struct rlimit rl;
+
+	if (fdtab != NULL)
+		return 1;
+	if (getrlimit(RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > FDTAB_MAX)
+		fdtab_size = FDTAB_MAX;
+	else
+		fdtab_size = rl.rlim_cur;
+	fdtab = calloc(fdtab_size, sizeof(*fdtab));
+	if (fdtab == NULL)
+		return 0;
+	unsharedfs_fdtab_enabled = true;
+	return 1;
+}
+
+static void unsharedfs_fdinfo_free(struct unsharedfs_fdinfo *info)
+{
+	if (info == NULL)
+		return;
+	if (info->path != NULL)
+		unsharedfs_changes_forget(info);
+	pthread_mutex_destroy(&info->lock);
+	unsharedfs_compress_close(info->compressed);
+	free(info->path);
+	free(info);
+}
+
+void unsharedfs_fdtab_destroy(void)
+{
+	size_t i;
+
+	unsharedfs_fdtab_enabled = false;
+	if (fdtab == NULL)
+		return;
+	for (i = 0; i < fdtab_size; i++)
+		unsharedfs_fdinfo_free(fdtab[i]);
+	free(fdtab);
+	fdtab = NULL;
+}
+
+uint64_t unsharedfs_path_hash(const char *path)
+{
+	// 64 bit FNV-1a
+	uint64_t h = 14695981039346656037ULL;
+
+	for (; *path; path++)
+	{
+		h ^= (unsigned char) *path;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+void unsharedfs_path_label(char label[UNSHAREDFS_LABEL_LEN], const char *fpath, const char *rootdir)
+{
+	size_t rootlen = strlen(rootdir);
+	size_t len;
+
+	if (strncmp(fpath, rootdir, rootlen) == 0 && fpath[rootlen] == '/')
+		fpath += rootlen + 1;
+	len = strlen(fpath);
+	if (len < UNSHAREDFS_LABEL_LEN)
+		memcpy(label, fpath, len + 1);
+	else
+	{
+		// keep the tail of the path -- it's the more interesting part:
+		memcpy(label, "...", 3);
+		memcpy(label + 3, fpath + len - (UNSHAREDFS_LABEL_LEN - 4), UNSHAREDFS_LABEL_LEN - 3);
+	}
+}
+
+struct unsharedfs_fdinfo *unsharedfs_fdtab_open(int fd, const char *path, const char *fpath, const char *rootdir)
+{
+	struct unsharedfs_fdinfo *info;
+
+	if (fd < 0 || (size_t) fd >= fdtab_size)
+		return NULL;
+	info = calloc(1, sizeof(*info));
+	if (info == NULL)
+		return NULL;
+	info->path_hash = unsharedfs_path_hash(fpath);
+	unsharedfs_path_label(info->label, fpath, rootdir);
+	pthread_mutex_init(&info->lock, NULL);
+	if (unsharedfs_fdtab_paths && path != NULL)
+		info->path = strdup(path);
+	// an entry left over by a failed release is replaced:
+	unsharedfs_fdinfo_free(fdtab[fd]);
+	fdtab[fd] = info;
+	return info;
+}
+
+struct unsharedfs_fdinfo *unsharedfs_fdtab_get(int fd)
+{
+	if (fd < 0 || (size_t) fd >= fdtab_size)
+		return NULL;
+	return fdtab[fd];
+}
+
+void unsharedfs_fdtab_close(int fd)
+{
+	if (fd < 0 || (size_t) fd >= fdtab_size)
+		return;
+	unsharedfs_fdinfo_free(fdtab[fd]);
+	fdtab[fd] = NULL;
+}
@@ -0,0 +1,100 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_FDTAB_H_
+#define UNSHAREDFS_FDTAB_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct unsharedfs_compressed;
+
+// length of a path label, including the terminating null:
+#define UNSHAREDFS_LABEL_LEN 56
+
+/*
+ * Per-file-handle state, indexed by the backing file descriptor.
+ * With flag_nopath, read/write and friends only get the file handle, so
+ * anything that needs to know the file of such an operation looks it up here.
+ */
+struct unsharedfs_fdinfo {
+	uint64_t path_hash;                /* hash of the backing path */
+	char label[UNSHAREDFS_LABEL_LEN];  /* (tail of) the path relative to BASEDIR */
+	_Atomic int64_t next_offset[2];    /* where the next sequential read/write would start */
+	// for the change feed (see changes.h), only set with unsharedfs_fdtab_paths:
+	char *path;                        /* the path in the mount */
+	pthread_mutex_t lock;              /* protects the pending write range */
+	uint64_t write_start;              /* written range not yet reported */
+	uint64_t write_end;                /*   (none if write_end == write_start) */
+	uint64_t write_ns;                 /* when the pending range was started */
+	uid_t write_uid;                   /* the writer of the pending range */
+	gid_t write_gid;
+	bool write_listed;                 /* in the list of pending ranges (protected by its lock) */
+	struct unsharedfs_fdinfo *write_prev, *write_next;
+	struct unsharedfs_compressed *compressed;  /* a compressed file (see compress.h) */
+};
+
+/**
+ * True if file handles are tracked.
+ */
+extern bool unsharedfs_fdtab_enabled;
+
+/**
+ * True if the entries keep the path in the mount (for the change feed).
+ */
+extern bool unsharedfs_fdtab_paths;
+
+/**
+ * Allocate the table.
+ * @return 1 on success, 0 on error (errno is set).
+ */
+int unsharedfs_fdtab_init(void);
+
+/**
+ * Free the table and all entries.
+ */
+void unsharedfs_fdtab_destroy(void);
+
+/**
+ * Create the entry for a newly opened file.
+ * @param fd the backing file descriptor
+ * @param path the path in the mount (only kept with unsharedfs_fdtab_paths)
+ * @param fpath the backing path
+ * @param rootdir the base directory
+ * @return the new entry, or NULL if fd is out of range or on allocation failure.
+ */
+struct unsharedfs_fdinfo *unsharedfs_fdtab_open(int fd, const char *path, const char *fpath, const char *rootdir);
+
+/**
+ * Look up the entry of an open file.
+ * @return the entry, or NULL if there is none.
+ */
+struct unsharedfs_fdinfo *unsharedfs_fdtab_get(int fd);
+
+/**
+ * Remove the entry of a file.  Must be called before the descriptor is closed.
+ */
+void unsharedfs_fdtab_close(int fd);
+
+/**
+ * Compute the hash of a path.
+ */
+uint64_t unsharedfs_path_hash(const char *path);
+
+/**
+ * Make a label for a backing path: the path relative to rootdir, or its tail
+ * if it is too long.
+ */
+void unsharedfs_path_label(char label[UNSHAREDFS_LABEL_LEN], const char *fpath, const char *rootdir);
+
+#endif
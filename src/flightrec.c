@@ -0,0 +1,219 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+// for localtime_r
+#define _XOPEN_SOURCE 700
+
+#include "flightrec.h"
+#include "monitor.h"
+#include "opctx.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// minimum time between two automatic dumps:
+#define FLIGHTREC_AUTODUMP_INTERVAL_NS (10ULL * 1000000000)
+#define FLIGHTREC_PATH_LEN 27
+
+/*
+ * Every entry occupies exactly one cache line.
+ * seq is 0 while the entry is being written, and the (1-based) sequence
+ * number of the operation otherwise.
+ */
+struct unsharedfs_flightrec_entry {
+	_Atomic uint64_t seq;
+	uint64_t start_ns;
+	uint64_t duration_ns;
+	uint32_t tid;
+	uint32_t uid;
+	uint16_t op;
+	uint16_t err;
+	uint8_t truncated;
+	char path[FLIGHTREC_PATH_LEN];
+} __attribute__((aligned(64)));
+
+_Static_assert(sizeof(struct unsharedfs_flightrec_entry) == 64, "flight recorder entries must fill exactly one cache line");
+
+static struct unsharedfs_flightrec_entry *ring = NULL;
+static size_t ring_mask;
+static _Atomic uint64_t ring_next = 0;
+static char *dump_file = NULL;
+static _Atomic uint64_t threshold_ns;
+static _Atomic uint64_t last_autodump_ns = 0;
+
+int unsharedfs_flightrec_init(size_t entries, const char *file, unsigned long threshold_ms)
+{
+	size_t size = 1;
+
+	while (size < entries)
+		size <<= 1;
+	if (posix_memalign((void **) &ring, 64, size * sizeof(*ring)) != 0)
+	{
+		errno = ENOMEM;
+		return 0;
+	}
+	memset(ring, 0, size * sizeof(*ring));
+	ring_mask = size - 1;
+	dump_file = strdup(file);
+	if (dump_file == NULL)
+	{
+		free(ring);
+		ring = NULL;
+		return 0;
+	}
+	unsharedfs_flightrec_set_threshold(threshold_ms);
+	return 1;
+}
+
+void unsharedfs_flightrec_destroy(void)
+{
+	free(ring);
+	ring = NULL;
+	free(dump_file);
+	dump_file = NULL;
+}
+
+bool unsharedfs_flightrec_enabled(void)
+{
+	return ring != NULL;
+}
+
+void unsharedfs_flightrec_set_threshold(unsigned long threshold_ms)
+{
+	atomic_store(&threshold_ns, (uint64_t) threshold_ms * 1000000);
+}
+
+unsigned long unsharedfs_flightrec_get_threshold(void)
+{
+	return atomic_load(&threshold_ns) / 1000000;
+}
+
+void unsharedfs_flightrec_record(const struct unsharedfs_opctx *op, uint64_t duration_ns, int retstat)
+{
+	struct unsharedfs_flightrec_entry *e;
+	uint64_t seq, threshold;
+	size_t pathlen;
+
+	seq = atomic_fetch_add_explicit(&ring_next, 1, memory_order_relaxed) + 1;
+	e = &ring[seq & ring_mask];
+
+	atomic_store_explicit(&e->seq, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	e->start_ns = op->start_ns;
+	e->duration_ns = duration_ns;
+	e->tid = unsharedfs_gettid();
+	e->uid = op->uid;
+	e->op = op->op;
+	e->err = retstat < 0 ? -retstat : 0;
+	e->truncated = 0;
+	if (op->path == NULL)
+		e->path[0] = '\0';
+	else
+	{
+		// keep the tail of the path -- it's the more interesting part:
+		pathlen = strlen(op->path);
+		if (pathlen >= FLIGHTREC_PATH_LEN)
+		{
+			memcpy(e->path, op->path + pathlen - (FLIGHTREC_PATH_LEN - 1), FLIGHTREC_PATH_LEN);
+			e->truncated = 1;
+		}
+		else
+			memcpy(e->path, op->path, pathlen + 1);
+	}
+	atomic_store_explicit(&e->seq, seq, memory_order_release);
+
+	threshold = atomic_load_explicit(&threshold_ns, memory_order_relaxed);
+	if (threshold != 0 && duration_ns >= threshold)
+	{
+		uint64_t last = atomic_load_explicit(&last_autodump_ns, memory_order_relaxed);
+		uint64_t now = op->start_ns + duration_ns;
+		// only one thread gets to trigger the dump:
+		if (now - last >= FLIGHTREC_AUTODUMP_INTERVAL_NS
+				&& atomic_compare_exchange_strong(&last_autodump_ns, &last, now))
+			unsharedfs_monitor_post(MONITOR_EVENT_FLIGHTREC_SLOW);
+	}
+}
+
+void unsharedfs_flightrec_dump(const char *reason)
+{
+	FILE *fp;
+	uint64_t first, last, seq;
+	int fd;
+	struct timespec mono, real;
+	int64_t mono_to_real_ns;
+	char timebuf[32];
+
+	if (ring == NULL)
+		return;
+
+	// the dump holds the operations of all users:
+	fd = open(dump_file, O_WRONLY | O_APPEND | O_CREAT | O_NOFOLLOW | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	if (fd < 0)
+		return;
+	fp = fdopen(fd, "a");
+	if (fp == NULL)
+	{
+		close(fd);
+		return;
+	}
+
+	// ring timestamps are monotonic; convert them to wall-clock time:
+	clock_gettime(CLOCK_REALTIME, &real);
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	mono_to_real_ns = ((int64_t) real.tv_sec - mono.tv_sec) * 1000000000 + (real.tv_nsec - mono.tv_nsec);
+
+	last = atomic_load_explicit(&ring_next, memory_order_acquire);
+	first = last > ring_mask ? last - ring_mask : 1;
+	fprintf(fp, "# unsharedfs flight recorder dump (%s): %llu operations\n"
+			, reason
+			, (unsigned long long) (last - first + 1));
+
+	for (seq = first; seq <= last; seq++)
+	{
+		struct unsharedfs_flightrec_entry copy;
+		struct unsharedfs_flightrec_entry *e = &ring[seq & ring_mask];
+		uint64_t s = atomic_load_explicit(&e->seq, memory_order_acquire);
+		time_t secs;
+		struct tm tm;
+		uint64_t wall_ns;
+
+		if (s != seq)
+			continue;
+		memcpy(&copy, e, sizeof(copy));
+		atomic_thread_fence(memory_order_acquire);
+		// skip entries that were overwritten while we copied them:
+		if (atomic_load_explicit(&e->seq, memory_order_relaxed) != seq)
+			continue;
+
+		wall_ns = copy.start_ns + mono_to_real_ns;
+		secs = wall_ns / 1000000000;
+		localtime_r(&secs, &tm);
+		strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S", &tm);
+		fprintf(fp, "%s.%06llu tid=%u uid=%u op=%s duration=%llu.%06llus errno=%u path=%s%s\n"
+				, timebuf
+				, (unsigned long long) (wall_ns % 1000000000) / 1000
+				, copy.tid
+				, copy.uid
+				, copy.op < OP_COUNT ? unsharedfs_op_names[copy.op] : "?"
+				, (unsigned long long) copy.duration_ns / 1000000000
+				, (unsigned long long) (copy.duration_ns % 1000000000) / 1000
+				, copy.err
+				, copy.truncated ? "..." : ""
+				, copy.path[0] ? copy.path : "-");
+	}
+	fclose(fp);
+}
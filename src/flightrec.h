@@ -0,0 +1,73 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_FLIGHTREC_H_
+#define UNSHAREDFS_FLIGHTREC_H_
+
+#include "opctx.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The flight recorder keeps the most recent operations in a fixed-size ring
+ * buffer.  Recording an operation claims a slot with a single atomic
+ * increment and fills one cache line; no locks are taken.
+ * The ring is written to a file on SIGUSR1 and whenever an operation takes
+ * longer than a configurable threshold.
+ */
+
+/**
+ * Allocate the ring buffer.
+ * @param entries number of entries (rounded up to a power of two)
+ * @param file the dump file
+ * @param threshold_ms dump automatically if an operation takes longer (0 to disable)
+ * @return 1 on success, 0 on error (errno is set).
+ */
+int unsharedfs_flightrec_init(size_t entries, const char *file, unsigned long threshold_ms);
+
+/**
+ * Release the ring buffer.
+ */
+void unsharedfs_flightrec_destroy(void);
+
+/**
+ * True if unsharedfs_flightrec_init() has been called successfully.
+ */
+bool unsharedfs_flightrec_enabled(void);
+
+/**
+ * Change the automatic dump threshold.
+ * @param threshold_ms dump automatically if an operation takes longer (0 to disable)
+ */
+void unsharedfs_flightrec_set_threshold(unsigned long threshold_ms);
+
+/**
+ * Return the automatic dump threshold in milliseconds.
+ */
+unsigned long unsharedfs_flightrec_get_threshold(void);
+
+/**
+ * Record a finished operation.
+ * @param op the operation context
+ * @param duration_ns the duration of the operation
+ * @param retstat the return value of the operation
+ */
+void unsharedfs_flightrec_record(const struct unsharedfs_opctx *op, uint64_t duration_ns, int retstat);
+
+/**
+ * Append the contents of the ring buffer to the dump file.
+ * This must not be called from a signal handler.
+ * @param reason a short description why the dump was triggered
+ */
+void unsharedfs_flightrec_dump(const char *reason);
+
+#endif
@@ -23,10 +23,28 @@
 
 // for utimensat
 #define _XOPEN_SOURCE 700
-// for vsyslog
-#define _BSD_SOURCE
 
 #include "fs.h"
+#include "fs_internal.h"
+#include "cachehint.h"
+#include "compress.h"
+#include "control.h"
+#include "cputime.h"
+#include "dirindex.h"
+#include "fdtab.h"
+#include "flightrec.h"
+#include "hot.h"
+#include "iostats.h"
+#include "log.h"
+#include "monitor.h"
+#include "opctx.h"
+#include "perf.h"
+#include "record.h"
+#include "changes.h"
+#include "shmstats.h"
+#include "stats.h"
+#include "thread.h"
+#include "trace.h"
 
 #include <ctype.h>
 #include <dirent.h>
@@ -41,39 +59,13 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/fsuid.h>
+#include <sys/sysmacros.h>
 #include <sys/types.h>
 #include <sys/xattr.h>
 #include <sys/stat.h>
-#include <stdarg.h>
-#ifdef HAVE_SYSLOG
-#include <syslog.h>
-#endif
 
 #define PRIVATE_DATA ((struct unsharedfs_state *) fuse_get_context()->private_data)
 
-#ifndef HAVE_SYSLOG
-#	define LOG_ERR     0
-#	define LOG_WARNING 1
-#	define LOG_NOTICE  2
-#	define LOG_INFO    3
-#	define LOG_DEBUG   4
-#endif
-
-void logmsg(int prio, const char *fmt, ...)
-{
-	va_list args;
-	va_start( args, fmt);
-
-#ifdef HAVE_SYSLOG
-	if (prio < LOG_DEBUG && PRIVATE_DATA->use_syslog)
-		vsyslog(prio,fmt,args);
-#endif
-	// when in foreground-mode, this gets printed:
-	vfprintf(stderr,fmt,args);
-	va_end(args);
-	fprintf(stderr,"\n");
-}
-
 // the buffer size used for error messages
 #define ERRMSG_MAX 512
 
@@ -89,10 +81,11 @@ void logmsg(int prio, const char *fmt, ...)
  * @param path the relative path to the mountpoint
  * @return 1 on success, 0 on error.
  */
-static int unsharedfs_fullpath(char fpath[PATH_MAX], const char *path)
+static int unsharedfs_fullpath_resolve(char fpath[PATH_MAX], const char *path)
 {
 	struct stat sb;
 	size_t pathlen;
+	int rc;
 	struct unsharedfs_state *pdata = PRIVATE_DATA;
 	// size_t is big enough for either uid_t or gid_t:
 	size_t ugid;
@@ -112,7 +105,10 @@ static int unsharedfs_fullpath(char fpath[PATH_MAX], const char *path)
 	}
 
 	// does base directory exist?
-	if ( stat(fpath,&sb) != 0 )
+	unsharedfs_op_phase(PHASE_RESOLVE_STAT);
+	rc = stat(fpath,&sb);
+	unsharedfs_op_phase(PHASE_RESOLVE);
+	if ( rc != 0 )
 	{
 		// is a fallback directory defined?
 		if (pdata->defaultdir)
@@ -159,14 +155,33 @@ static int unsharedfs_fullpath(char fpath[PATH_MAX], const char *path)
 	return 1;
 }
 
+/**
+ * Compute the diverted full path for a relative path.
+ * See unsharedfs_fullpath_resolve(); this wrapper accounts the time spent to
+ * the PHASE_RESOLVE phase of the current operation.
+ */
+int unsharedfs_fullpath(char fpath[PATH_MAX], const char *path)
+{
+	int ok;
+
+	unsharedfs_op_phase(PHASE_RESOLVE);
+	ok = unsharedfs_fullpath_resolve(fpath, path);
+	unsharedfs_op_phase(PHASE_DAEMON);
+	return ok;
+}
+
 /**
  * Take the uid/gid of the current context.
  */
-static void unsharedfs_take_context_id()
+void unsharedfs_take_context_id(void)
 {
+	unsharedfs_op_phase(PHASE_CREDS);
 	// some internal fuse calls have an empty context:
 	if ( fuse_get_context()->pid == 0 )
+	{
+		unsharedfs_op_phase(PHASE_BACKING);
 		return;
+	}
 
 	// from the manpage:
 	// On success, the previous value of fsgid is returned.  On error, the current value of fsgid is returned.
@@ -194,15 +209,21 @@ static void unsharedfs_take_context_id()
 				,errmsg
 		   );
 	}
+	// everything up to unsharedfs_drop_context_id() is backing file system time:
+	unsharedfs_op_phase(PHASE_BACKING);
 }
 /**
  * Drop the uid/gid of the current context.
  */
-static void unsharedfs_drop_context_id()
+void unsharedfs_drop_context_id(void)
 {
+	unsharedfs_op_phase(PHASE_CREDS);
 	// some internal fuse calls have an empty context:
 	if ( fuse_get_context()->pid == 0 )
+	{
+		unsharedfs_op_phase(PHASE_DAEMON);
 		return;
+	}
 
 	if ( setfsuid(PRIVATE_DATA->base_uid) != fuse_get_context()->uid )
 	{
@@ -226,6 +247,90 @@ static void unsharedfs_drop_context_id()
 				,errmsg
 		   );
 	}
+	unsharedfs_op_phase(PHASE_DAEMON);
+}
+
+/**
+ * Open a backing file with the uid/gid of the current context.
+ * @return the descriptor, or -1 on error (errno is set).
+ */
+static int unsharedfs_open_as_context(const char *fpath, int flags)
+{
+	int fd, err;
+
+	unsharedfs_take_context_id();
+	fd = open(fpath, flags);
+	err = errno;
+	unsharedfs_drop_context_id();
+	errno = err;
+	return fd;
+}
+
+/**
+ * Keep the compressor from replacing a file while an operation changes it
+ * (see compress.h).
+ * @param fpath the backing path
+ */
+static void unsharedfs_change_begin(const char *fpath)
+{
+	if (unsharedfs_compress_enabled)
+		unsharedfs_compress_lock(fpath);
+}
+
+/**
+ * Start an operation that changes a file with unsharedfs_change_begin(),
+ * after decompressing the file if it is compressed.  A file is only
+ * decompressed for a caller who can open it with flags.
+ * @param fpath the backing path
+ * @return 0 on success, or -errno if the file could not be opened or
+ *         decompressed.
+ */
+static int unsharedfs_change_begin_thaw(const char *fpath, int flags)
+{
+	struct stat sb;
+	int fd, ok, rc, err;
+
+	if (!unsharedfs_compress_enabled)
+		return 0;
+	unsharedfs_take_context_id();
+	rc = lstat(fpath, &sb);
+	unsharedfs_drop_context_id();
+	if (rc == 0 && unsharedfs_compress_marked(&sb))
+	{
+		fd = unsharedfs_open_as_context(fpath, flags | O_NOFOLLOW | O_CLOEXEC);
+		if (fd < 0)
+			return -errno;
+		ok = unsharedfs_compress_thaw(fpath, fd);
+		err = errno;
+		close(fd);
+		if (!ok)
+			return -err;
+	}
+	unsharedfs_change_begin(fpath);
+	return 0;
+}
+
+/**
+ * End an operation started with unsharedfs_change_begin().
+ */
+static void unsharedfs_change_end(const char *fpath)
+{
+	if (unsharedfs_compress_enabled)
+		unsharedfs_compress_unlock(fpath);
+}
+
+/**
+ * Look up the compressed file of a file handle.
+ * @return the compressed file, or NULL if the file is not compressed.
+ */
+static struct unsharedfs_compressed *unsharedfs_compressed_of(uint64_t fh)
+{
+	struct unsharedfs_fdinfo *info;
+
+	if (!unsharedfs_compress_enabled)
+		return NULL;
+	info = unsharedfs_fdtab_get(fh);
+	return info ? info->compressed : NULL;
 }
 
 /** Get file attributes.
@@ -238,17 +343,27 @@ int unsharedfs_getattr(const char *path, struct stat *statbuf)
 {
 	int retstat = 0;
 	char fpath[PATH_MAX];
+	struct unsharedfs_opctx op;
 
+	unsharedfs_op_begin(&op, OP_GETATTR, path);
 	if (!unsharedfs_fullpath(fpath, path))
-		return -errno;
+		return unsharedfs_op_end(&op, -errno);
 
 	unsharedfs_take_context_id();
-	retstat = lstat(fpath, statbuf);
-	unsharedfs_drop_context_id();
-	if (retstat != 0)
+	// the index of a huge directory knows the names that don't exist:
+	if (unsharedfs_dirindex_enabled
+			&& unsharedfs_dirindex_absent(fpath, fuse_get_context()->uid, fuse_get_context()->gid))
+		retstat = -ENOENT;
+	else if (lstat(fpath, statbuf) != 0)
 		retstat = -errno;
+	unsharedfs_drop_context_id();
+	// a compressed file has the size of its contents:
+	if (retstat == 0 && unsharedfs_compress_enabled && unsharedfs_compress_marked(statbuf))
+		unsharedfs_compress_stat(fpath, statbuf);
+	if (unsharedfs_hot_enabled)
+		unsharedfs_hot_record_path(fpath, PRIVATE_DATA->rootdir, fuse_get_context()->uid, 0);
 
-	return retstat;
+	return unsharedfs_op_end(&op, retstat);
 }
 
 /** Read the target of a symbolic link
@@ -267,9 +382,12 @@ int unsharedfs_readlink(const char *path, char *link, size_t size)
 {
 	int retstat = 0;
 	char fpath[PATH_MAX];
+	struct unsharedfs_opctx op;
 
+	unsharedfs_op_begin(&op, OP_READLINK, path);
+	op.args.size = size;
 	if (!unsharedfs_fullpath(fpath, path))
-		return -errno;
+		return unsharedfs_op_end(&op, -errno);
 
 	unsharedfs_take_context_id();
 	retstat = readlink(fpath, link, size - 1);
@@ -281,7 +399,7 @@ int unsharedfs_readlink(const char *path, char *link, size_t size)
 		retstat = 0;
 	}
 
-	return retstat;
+	return unsharedfs_op_end(&op, retstat);
 }
 
 /** Create a file node
@@ -293,10 +411,15 @@ int unsharedfs_mknod(const char *path, mode_t mode, dev_t dev)
 {
 	int retstat = 0;
 	char fpath[PATH_MAX];
+	struct unsharedfs_opctx op;
+	struct unsharedfs_dirindex_op dop;
 
+	unsharedfs_op_begin(&op, OP_MKNOD, path);
+	op.args.mode = mode;
 	if (!unsharedfs_fullpath(fpath, path))
-		return -errno;
+		return unsharedfs_op_end(&op, -errno);
 
+	unsharedfs_dirindex_begin(&dop, NULL, fpath);
 	unsharedfs_take_context_id();
 	// On Linux this could just be 'mknod(path, mode, rdev)' but this
 	//  is more portable
@@ -321,7 +444,8 @@ int unsharedfs_mknod(const char *path, mode_t mode, dev_t dev)
 		}
 	unsharedfs_drop_context_id();
 
-	return retstat;
+	unsharedfs_dirindex_end(&dop, retstat);
+	return unsharedfs_op_end(&op, retstat);
 }
 
 /** Create a directory */
@@ -329,17 +453,23 @@ int unsharedfs_mkdir(const char *path, mode_t mode)
 {
 	int retstat = 0;
 	char fpath[PATH_MAX];
+	struct unsharedfs_opctx op;
+	struct unsharedfs_dirindex_op dop;
 
+	unsharedfs_op_begin(&op, OP_MKDIR, path);
+	op.args.mode = mode;
 	if (!unsharedfs_fullpath(fpath, path))
-		return -errno;
+		return unsharedfs_op_end(&op, -errno);
 
+	unsharedfs_dirindex_begin(&dop, NULL, fpath);
 	unsharedfs_take_context_id();
 	retstat = mkdir(fpath, mode);
 	unsharedfs_drop_context_id();
 	if (retstat < 0)
 		retstat = -errno;
 
-	return retstat;
+	unsharedfs_dirindex_end(&dop, retstat);
+	return unsharedfs_op_end(&op, retstat);
 }
 
 /** Remove a file */
@@ -347,17 +477,24 @@ int unsharedfs_unlink(const char *path)
 {
 	int retstat = 0;
 	char fpath[PATH_MAX];
+	struct unsharedfs_opctx op;
+	struct unsharedfs_dirindex_op dop;
 
+	unsharedfs_op_begin(&op, OP_UNLINK, path);
 	if (!unsharedfs_fullpath(fpath, path))
-		return -errno;
+		return unsharedfs_op_end(&op, -errno);
 
+	unsharedfs_dirindex_begin(&dop, fpath, NULL);
+	unsharedfs_change_begin(fpath);
 	unsharedfs_take_context_id();
 	retstat = unlink(fpath);
 	unsharedfs_drop_context_id();
 	if (retstat < 0)
 		retstat = -errno;
+	unsharedfs_change_end(fpath);
 
-	return retstat;
+	unsharedfs_dirindex_end(&dop, retstat);
+	return unsharedfs_op_end(&op, retstat);
 }
 
 /** Remove a directory */
@@ -365,17 +502,22 @@ int unsharedfs_rmdir(const char *path)
 {
 	int retstat = 0;
 	char fpath[PATH_MAX];
+	struct unsharedfs_opctx op;
+	struct unsharedfs_dirindex_op dop;
 
+	unsharedfs_op_begin(&op, OP_RMDIR, path);
 	if (!unsharedfs_fullpath(fpath, path))
-		return -errno;
+		return unsharedfs_op_end(&op, -errno);
 
+	unsharedfs_dirindex_begin(&dop, fpath, NULL);
 	unsharedfs_take_context_id();
 	retstat = rmdir(fpath);
 	unsharedfs_drop_context_id();
 	if (retstat < 0)
 		retstat = -errno;
 
-	return retstat;
+	unsharedfs_dirindex_end(&dop, retstat);
+	return unsharedfs_op_end(&op, retstat);
 }
 
 /** Create a symbolic link */
@@ -387,17 +529,23 @@ int unsharedfs_symlink(const char *path, const char *link)
 {
 	int retstat = 0;
 	char flink[PATH_MAX];
+	struct unsharedfs_opctx op;
+	struct unsharedfs_dirindex_op dop;
 
+	unsharedfs_op_begin(&op, OP_SYMLINK, link);
+	op.args.path2 = path;
 	if (!unsharedfs_fullpath(flink, link))
-		return -errno;
+		return unsharedfs_op_end(&op, -errno);
 
+	unsharedfs_dirindex_begin(&dop, NULL, flink);
 	unsharedfs_take_context_id();
 	retstat = symlink(path, flink);
 	unsharedfs_drop_context_id();
 	if (retstat < 0)
 		retstat = -errno;
 
-	return retstat;
+	unsharedfs_dirindex_end(&dop, retstat);
+	return unsharedfs_op_end(&op, retstat);
 }
 
 /** Rename a file */
@@ -407,19 +555,29 @@ int unsharedfs_rename(const char *path, const char *newpath)
 	int retstat = 0;
 	char fpath[PATH_MAX];
 	char fnewpath[PATH_MAX];
+	struct unsharedfs_opctx op;
+	struct unsharedfs_dirindex_op dop;
 
+	unsharedfs_op_begin(&op, OP_RENAME, path);
+	op.args.path2 = newpath;
 	if (!unsharedfs_fullpath(fpath, path))
-		return -errno;
+		return unsharedfs_op_end(&op, -errno);
 	if (!unsharedfs_fullpath(fnewpath, newpath))
-		return -errno;
+		return unsharedfs_op_end(&op, -errno);
 
+	unsharedfs_dirindex_begin(&dop, fpath, fnewpath);
+	unsharedfs_change_begin(fpath);
+	unsharedfs_change_begin(fnewpath);
 	unsharedfs_take_context_id();
 	retstat = rename(fpath, fnewpath);
 	unsharedfs_drop_context_id();
 	if (retstat < 0)
 		retstat = -errno;
+	unsharedfs_change_end(fnewpath);
+	unsharedfs_change_end(fpath);
 
-	return retstat;
+	unsharedfs_dirindex_end(&dop, retstat);
+	return unsharedfs_op_end(&op, retstat);
 }
 
 /** Create a hard link to a file */
@@ -427,19 +585,31 @@ int unsharedfs_link(const char *path, const char *newpath)
 {
 	int retstat = 0;
 	char fpath[PATH_MAX], fnewpath[PATH_MAX];
+	struct unsharedfs_opctx op;
+	struct unsharedfs_dirindex_op dop;
 
+	unsharedfs_op_begin(&op, OP_LINK, path);
+	op.args.path2 = newpath;
 	if (!unsharedfs_fullpath(fpath, path))
-		return -errno;
+		return unsharedfs_op_end(&op, -errno);
 	if (!unsharedfs_fullpath(fnewpath, newpath))
-		return -errno;
+		return unsharedfs_op_end(&op, -errno);
 
+	// a compressed file is decompressed in place, which would break the link;
+	// like protected_hardlinks, linking needs read and write access:
+	retstat = unsharedfs_change_begin_thaw(fpath, O_RDWR);
+	if (retstat < 0)
+		return unsharedfs_op_end(&op, retstat);
+	unsharedfs_dirindex_begin(&dop, NULL, fnewpath);
 	unsharedfs_take_context_id();
 	retstat = link(fpath, fnewpath);
 	unsharedfs_drop_context_id();
 	if (retstat < 0)
 		retstat = -errno;
+	unsharedfs_change_end(fpath);
 
-	return retstat;
+	unsharedfs_dirindex_end(&dop, retstat);
+	return unsharedfs_op_end(&op, retstat);
 }
 
 /** Change the permission bits of a file */
@@ -447,17 +617,26 @@ int unsharedfs_chmod(const char *path, mode_t mode)
 {
 	int retstat = 0;
 	char fpath[PATH_MAX];
+	struct stat sb;
+	struct unsharedfs_opctx op;
 
+	unsharedfs_op_begin(&op, OP_CHMOD, path);
+	op.args.mode = mode;
 	if (!unsharedfs_fullpath(fpath, path))
-		return -errno;
+		return unsharedfs_op_end(&op, -errno);
 
+	unsharedfs_change_begin(fpath);
 	unsharedfs_take_context_id();
+	// the sticky bit marks a compressed file (and isn't shown), so it is kept:
+	if (unsharedfs_compress_enabled && lstat(fpath, &sb) == 0 && unsharedfs_compress_is_compressed(fpath, &sb))
+		mode |= S_ISVTX;
 	retstat = chmod(fpath, mode);
 	unsharedfs_drop_context_id();
 	if (retstat < 0)
 		retstat = -errno;
+	unsharedfs_change_end(fpath);
 
-	return retstat;
+	return unsharedfs_op_end(&op, retstat);
 }
 
 /** Change the owner and group of a file */
@@ -466,17 +645,23 @@ int unsharedfs_chown(const char *path, uid_t uid, gid_t gid)
 {
 	int retstat = 0;
 	char fpath[PATH_MAX];
+	struct unsharedfs_opctx op;
 
+	unsharedfs_op_begin(&op, OP_CHOWN, path);
+	op.args.offset = uid;
+	op.args.size = gid;
 	if (!unsharedfs_fullpath(fpath, path))
-		return -errno;
+		return unsharedfs_op_end(&op, -errno);
 
+	unsharedfs_change_begin(fpath);
 	unsharedfs_take_context_id();
 	retstat = chown(fpath, uid, gid);
 	unsharedfs_drop_context_id();
 	if (retstat < 0)
 		retstat = -errno;
+	unsharedfs_change_end(fpath);
 
-	return retstat;
+	return unsharedfs_op_end(&op, retstat);
 }
 
 /** Change the size of a file */
@@ -484,17 +669,24 @@ int unsharedfs_truncate(const char *path, off_t newsize)
 {
 	int retstat = 0;
 	char fpath[PATH_MAX];
+	struct unsharedfs_opctx op;
 
+	unsharedfs_op_begin(&op, OP_TRUNCATE, path);
+	op.args.offset = newsize;
 	if (!unsharedfs_fullpath(fpath, path))
-		return -errno;
+		return unsharedfs_op_end(&op, -errno);
 
+	retstat = unsharedfs_change_begin_thaw(fpath, O_WRONLY);
+	if (retstat < 0)
+		return unsharedfs_op_end(&op, retstat);
 	unsharedfs_take_context_id();
 	retstat = truncate(fpath, newsize);
 	unsharedfs_drop_context_id();
 	if (retstat < 0)
 		retstat = -errno;
+	unsharedfs_change_end(fpath);
 
-	return retstat;
+	return unsharedfs_op_end(&op, retstat);
 }
 
 /**
@@ -509,18 +701,77 @@ int unsharedfs_utimens(const char *path, const struct timespec tv[2])
 {
 	int retstat = 0;
 	char fpath[PATH_MAX];
+	struct unsharedfs_opctx op;
 
+	unsharedfs_op_begin(&op, OP_UTIMENS, path);
 	if (!unsharedfs_fullpath(fpath, path))
-		return -errno;
+		return unsharedfs_op_end(&op, -errno);
 
+	unsharedfs_change_begin(fpath);
 	unsharedfs_take_context_id();
 	// fpath is absolute -> dirfd parameter (AT_FDCWD) is ignored
 	retstat = utimensat(AT_FDCWD, fpath, tv, 0);
 	unsharedfs_drop_context_id();
 	if (retstat < 0)
 		retstat = -errno;
+	unsharedfs_change_end(fpath);
 
-	return retstat;
+	return unsharedfs_op_end(&op, retstat);
+}
+
+/**
+ * Open the backing file of unsharedfs_open().  A compressed file is
+ * decompressed first if it is opened for writing.
+ * @param z set to the compressed file if it is opened for reading
+ * @return the descriptor, or -1 on error (errno is set).
+ */
+static int unsharedfs_open_backing(const char *fpath, int flags, struct unsharedfs_compressed **z)
+{
+	bool writing = (flags & O_ACCMODE) != O_RDONLY;
+	struct stat sb;
+	int fd, err;
+
+	*z = NULL;
+	if (!unsharedfs_compress_enabled)
+		return unsharedfs_open_as_context(fpath, flags);
+
+	if (writing)
+		unsharedfs_compress_lock(fpath);
+	fd = unsharedfs_open_as_context(fpath, flags);
+	if (fd >= 0 && fstat(fd, &sb) == 0 && unsharedfs_compress_marked(&sb))
+	{
+		if (!writing)
+		{
+			*z = unsharedfs_compress_load(fd);
+			if (*z == NULL && errno != 0)
+			{
+				err = errno;
+				close(fd);
+				errno = err;
+				return -1;
+			}
+			return fd;
+		}
+		unsharedfs_compress_unlock(fpath);
+		// fd was opened with the permissions of the caller:
+		if (!unsharedfs_compress_thaw(fpath, fd))
+		{
+			err = errno;
+			close(fd);
+			errno = err;
+			return -1;
+		}
+		close(fd);
+		unsharedfs_compress_lock(fpath);
+		fd = unsharedfs_open_as_context(fpath, flags);
+	}
+	if (writing)
+	{
+		err = errno;
+		unsharedfs_compress_unlock(fpath);
+		errno = err;
+	}
+	return fd;
 }
 
 /** File open operation
@@ -538,18 +789,39 @@ int unsharedfs_open(const char *path, struct fuse_file_info *fi)
 	int retstat = 0;
 	int fd;
 	char fpath[PATH_MAX];
+	struct unsharedfs_opctx op;
+	struct unsharedfs_fdinfo *info = NULL;
+	struct unsharedfs_compressed *z;
 
+	unsharedfs_op_begin(&op, OP_OPEN, path);
+	op.args.flags = fi->flags;
 	if (!unsharedfs_fullpath(fpath, path))
-		return -errno;
+		return unsharedfs_op_end(&op, -errno);
 
-	unsharedfs_take_context_id();
-	fd = open(fpath, fi->flags);
-	unsharedfs_drop_context_id();
+	fd = unsharedfs_open_backing(fpath, fi->flags, &z);
 	if (fd < 0)
 		retstat = -errno;
+	else
+	{
+		if (unsharedfs_fdtab_enabled)
+			info = unsharedfs_fdtab_open(fd, path, fpath, PRIVATE_DATA->rootdir);
+		// reads of a compressed file find it in the table:
+		if (z != NULL && info == NULL)
+		{
+			unsharedfs_compress_close(z);
+			close(fd);
+			fd = -1;
+			retstat = -ENOMEM;
+		}
+		else if (z != NULL)
+			info->compressed = z;
+		if (fd >= 0 && unsharedfs_cachehint_enabled)
+			unsharedfs_cachehint_apply(unsharedfs_cachehint_get(fpath, strlen(fpath) - strlen(path)), fd, fi);
+	}
 
 	fi->fh = fd;
-	return retstat;
+	op.args.fh = fi->fh;
+	return unsharedfs_op_end(&op, retstat);
 }
 
 /** Read data from an open file
@@ -566,16 +838,34 @@ int unsharedfs_open(const char *path, struct fuse_file_info *fi)
 int unsharedfs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
 {
 	int retstat = 0;
-
+	struct unsharedfs_opctx op;
+	struct unsharedfs_compressed *z;
+
+	unsharedfs_op_begin(&op, OP_READ, path);
+	op.args.fh = fi->fh;
+	op.args.offset = offset;
+	op.args.size = size;
+	z = unsharedfs_compressed_of(fi->fh);
 	unsharedfs_take_context_id();
 	// unsharedfs_open() already put the file handle into fi->fh.
 	// with flag_nopath, path is not even set!
-	retstat = pread(fi->fh, buf, size, offset);
+	if (z != NULL)
+		retstat = unsharedfs_compress_read(z, buf, size, offset);
+	else
+		retstat = pread(fi->fh, buf, size, offset);
 	unsharedfs_drop_context_id();
 	if (retstat < 0)
 		retstat = -errno;
+	if (unsharedfs_hot_enabled || unsharedfs_iostats_enabled)
+	{
+		struct unsharedfs_fdinfo *info = unsharedfs_fdtab_get(fi->fh);
+		if (unsharedfs_iostats_enabled)
+			unsharedfs_iostats_record(info, IO_READ, offset, size, retstat);
+		if (info && unsharedfs_hot_enabled)
+			unsharedfs_hot_record_fd(info, fuse_get_context()->uid, retstat > 0 ? retstat : 0);
+	}
 
-	return retstat;
+	return unsharedfs_op_end(&op, retstat);
 }
 
 /** Write data to an open file
@@ -592,7 +882,12 @@ int unsharedfs_write(const char *path, const char *buf, size_t size, off_t offse
 		struct fuse_file_info *fi)
 {
 	int retstat = 0;
+	struct unsharedfs_opctx op;
 
+	unsharedfs_op_begin(&op, OP_WRITE, path);
+	op.args.fh = fi->fh;
+	op.args.offset = offset;
+	op.args.size = size;
 	unsharedfs_take_context_id();
 	// unsharedfs_open() already put the file handle into fi->fh.
 	// with flag_nopath, path is not even set!
@@ -600,8 +895,16 @@ int unsharedfs_write(const char *path, const char *buf, size_t size, off_t offse
 	unsharedfs_drop_context_id();
 	if (retstat < 0)
 		retstat = -errno;
+	if (unsharedfs_hot_enabled || unsharedfs_iostats_enabled)
+	{
+		struct unsharedfs_fdinfo *info = unsharedfs_fdtab_get(fi->fh);
+		if (unsharedfs_iostats_enabled)
+			unsharedfs_iostats_record(info, IO_WRITE, offset, size, retstat);
+		if (info && unsharedfs_hot_enabled)
+			unsharedfs_hot_record_fd(info, fuse_get_context()->uid, retstat > 0 ? retstat : 0);
+	}
 
-	return retstat;
+	return unsharedfs_op_end(&op, retstat);
 }
 
 /** Get file system statistics
@@ -615,9 +918,11 @@ int unsharedfs_statfs(const char *path, struct statvfs *statv)
 {
 	int retstat = 0;
 	char fpath[PATH_MAX];
+	struct unsharedfs_opctx op;
 
+	unsharedfs_op_begin(&op, OP_STATFS, path);
 	if (!unsharedfs_fullpath(fpath, path))
-		return -errno;
+		return unsharedfs_op_end(&op, -errno);
 
 	unsharedfs_take_context_id();
 	// get stats for underlying filesystem
@@ -626,7 +931,7 @@ int unsharedfs_statfs(const char *path, struct statvfs *statv)
 	if (retstat < 0)
 		retstat = -errno;
 
-	return retstat;
+	return unsharedfs_op_end(&op, retstat);
 }
 
 /** Release an open file
@@ -646,16 +951,25 @@ int unsharedfs_statfs(const char *path, struct statvfs *statv)
 int unsharedfs_release(const char *path, struct fuse_file_info *fi)
 {
 	int retstat = 0;
+	struct unsharedfs_opctx op;
 
+	unsharedfs_op_begin(&op, OP_RELEASE, path);
+	op.args.fh = fi->fh;
 	unsharedfs_take_context_id();
 	// We need to close the file.  Had we allocated any resources
 	// (buffers etc) we'd need to free them here as well.
 	// unsharedfs_open() already put the file handle into fi->fh.
 	// with flag_nopath, path is not even set!
+	if (unsharedfs_fdtab_enabled)
+	{
+		if (unsharedfs_changes_enabled)
+			unsharedfs_changes_release(unsharedfs_fdtab_get(fi->fh));
+		unsharedfs_fdtab_close(fi->fh);
+	}
 	retstat = close(fi->fh);
 	unsharedfs_drop_context_id();
 
-	return retstat;
+	return unsharedfs_op_end(&op, retstat);
 }
 
 /** Synchronize file contents
@@ -668,7 +982,11 @@ int unsharedfs_release(const char *path, struct fuse_file_info *fi)
 int unsharedfs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
 {
 	int retstat = 0;
+	struct unsharedfs_opctx op;
 
+	unsharedfs_op_begin(&op, OP_FSYNC, path);
+	op.args.fh = fi->fh;
+	op.args.flags = datasync;
 	// unsharedfs_open() already put the file handle into fi->fh.
 	// with flag_nopath, path is not even set!
 	unsharedfs_take_context_id();
@@ -681,7 +999,7 @@ int unsharedfs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
 		retstat = -errno;
 	unsharedfs_drop_context_id();
 
-	return retstat;
+	return unsharedfs_op_end(&op, retstat);
 }
 
 /** Set extended attributes */
@@ -689,17 +1007,112 @@ int unsharedfs_setxattr(const char *path, const char *name, const char *value, s
 {
 	int retstat = 0;
 	char fpath[PATH_MAX];
+	struct unsharedfs_opctx op;
+
+	unsharedfs_op_begin(&op, OP_SETXATTR, path);
+	op.args.path2 = name;
+	op.args.size = size;
+	op.args.flags = flags;
+	if (strcmp(name, UNSHAREDFS_XATTR_INFO) == 0)
+		return unsharedfs_op_end(&op, -EPERM);
+	if (strcmp(name, UNSHAREDFS_XATTR_CACHE) == 0)
+	{
+		enum unsharedfs_cache_hint hint;
 
+		if (!unsharedfs_cachehint_parse(value, size, &hint))
+			return unsharedfs_op_end(&op, -EINVAL);
+	}
 	if (!unsharedfs_fullpath(fpath, path))
-		return -errno;
+		return unsharedfs_op_end(&op, -errno);
 
+	unsharedfs_change_begin(fpath);
 	unsharedfs_take_context_id();
 	retstat = lsetxattr(fpath, name, value, size, flags);
 	unsharedfs_drop_context_id();
 	if (retstat < 0)
 		retstat = -errno;
+	else if (unsharedfs_cachehint_enabled && strcmp(name, UNSHAREDFS_XATTR_CACHE) == 0)
+		unsharedfs_cachehint_invalidate();
+	unsharedfs_change_end(fpath);
+
+	return unsharedfs_op_end(&op, retstat);
+}
 
-	return retstat;
+/**
+ * Produce the value of the UNSHAREDFS_XATTR_INFO attribute: how path is
+ * resolved for the caller, and what unsharedfs knows about the backing file.
+ * @param path the relative path to the mountpoint
+ * @param value the return buffer
+ * @param size the size of value (0 to query the size)
+ * @return the length of the value, or -errno.
+ */
+static int unsharedfs_info_xattr(const char *path, char *value, size_t size)
+{
+	struct unsharedfs_state *pdata = PRIVATE_DATA;
+	struct fuse_context *ctx = fuse_get_context();
+	char fpath[PATH_MAX];
+	char uiddir[PATH_MAX];
+	char info[2 * PATH_MAX + 512];
+	struct stat sb;
+	size_t ugid = pdata->fsmode == UID_ONLY ? ctx->uid : ctx->gid;
+	int len, rc;
+
+	// the backing path reveals the layout of BASEDIR:
+	if (ctx->uid != 0 && ctx->uid != pdata->base_uid)
+		return -EACCES;
+	if (!unsharedfs_fullpath(fpath, path))
+		return -errno;
+
+	unsharedfs_take_context_id();
+	rc = lstat(fpath, &sb);
+	unsharedfs_drop_context_id();
+
+	snprintf(uiddir, sizeof(uiddir), "%s/%ld/", pdata->rootdir, (long) ugid);
+	len = snprintf(info, sizeof(info), "path=%s\nbacking=%s\nmapping=%s %ld\nfallback=%s\n"
+			, path
+			, fpath
+			, pdata->fsmode == UID_ONLY ? "uid" : "gid"
+			, (long) ugid
+			, strncmp(fpath, uiddir, strlen(uiddir)) == 0 ? "no" : "yes");
+	if (rc == 0)
+		len += snprintf(info + len, sizeof(info) - len, "device=%u:%u\ninode=%llu\n"
+				, major(sb.st_dev)
+				, minor(sb.st_dev)
+				, (unsigned long long) sb.st_ino);
+	else
+		len += snprintf(info + len, sizeof(info) - len, "device=-\ninode=- (%s)\n", strerror(errno));
+	if (unsharedfs_cachehint_enabled)
+		len += snprintf(info + len, sizeof(info) - len, "cache=%s\n"
+				, unsharedfs_cache_hint_names[unsharedfs_cachehint_get(fpath, strlen(fpath) - strlen(path))]);
+	else
+		len += snprintf(info + len, sizeof(info) - len, "cache=- (see --cache-hints)\n");
+	if (unsharedfs_compress_enabled && rc == 0 && unsharedfs_compress_marked(&sb))
+	{
+		off_t stored = sb.st_size;
+
+		unsharedfs_compress_stat(fpath, &sb);
+		if (sb.st_mode & S_ISVTX)
+			len += snprintf(info + len, sizeof(info) - len, "compressed=no\n");
+		else
+			len += snprintf(info + len, sizeof(info) - len, "compressed=yes (%lld bytes stored)\n"
+					, (long long) stored);
+	}
+	else if (unsharedfs_compress_enabled)
+		len += snprintf(info + len, sizeof(info) - len, "compressed=no\n");
+	else
+		len += snprintf(info + len, sizeof(info) - len, "compressed=- (see --compress-idle)\n");
+	if (unsharedfs_hot_enabled)
+		len += snprintf(info + len, sizeof(info) - len, "ops=%llu (0 if not among the heavy hitters)\n"
+				, (unsigned long long) unsharedfs_hot_estimate(fpath));
+	else
+		len += snprintf(info + len, sizeof(info) - len, "ops=- (see --heavy-hitters)\n");
+
+	if (size == 0)
+		return len;
+	if ((size_t) len > size)
+		return -ERANGE;
+	memcpy(value, info, len);
+	return len;
 }
 
 /** Get extended attributes */
@@ -707,9 +1120,15 @@ int unsharedfs_getxattr(const char *path, const char *name, char *value, size_t
 {
 	int retstat = 0;
 	char fpath[PATH_MAX];
+	struct unsharedfs_opctx op;
 
+	unsharedfs_op_begin(&op, OP_GETXATTR, path);
+	op.args.path2 = name;
+	op.args.size = size;
+	if (strcmp(name, UNSHAREDFS_XATTR_INFO) == 0)
+		return unsharedfs_op_end(&op, unsharedfs_info_xattr(path, value, size));
 	if (!unsharedfs_fullpath(fpath, path))
-		return -errno;
+		return unsharedfs_op_end(&op, -errno);
 
 	unsharedfs_take_context_id();
 	retstat = lgetxattr(fpath, name, value, size);
@@ -717,7 +1136,35 @@ int unsharedfs_getxattr(const char *path, const char *name, char *value, size_t
 	if (retstat < 0)
 		retstat = -errno;
 
-	return retstat;
+	return unsharedfs_op_end(&op, retstat);
+}
+
+/**
+ * Remove the names in the reserved namespace from a list of extended
+ * attributes.
+ * @param list the list returned by llistxattr()
+ * @param size the size of list (0 if only the length was queried)
+ * @param len the length of the list
+ * @return the length of the filtered list.
+ */
+static int unsharedfs_filter_xattr_list(char *list, size_t size, int len)
+{
+	const size_t prefixlen = strlen(UNSHAREDFS_XATTR_PREFIX);
+	char *in, *out;
+
+	// the answer to a length query may be larger than the filtered list:
+	if (size == 0)
+		return len;
+
+	for (in = out = list; in < list + len; in += strlen(in) + 1)
+	{
+		size_t namelen = strlen(in) + 1;
+		if (strncmp(in, UNSHAREDFS_XATTR_PREFIX, prefixlen) == 0)
+			continue;
+		memmove(out, in, namelen);
+		out += namelen;
+	}
+	return out - list;
 }
 
 /** List extended attributes */
@@ -725,17 +1172,22 @@ int unsharedfs_listxattr(const char *path, char *list, size_t size)
 {
 	int retstat = 0;
 	char fpath[PATH_MAX];
+	struct unsharedfs_opctx op;
 
+	unsharedfs_op_begin(&op, OP_LISTXATTR, path);
+	op.args.size = size;
 	if (!unsharedfs_fullpath(fpath, path))
-		return -errno;
+		return unsharedfs_op_end(&op, -errno);
 
 	unsharedfs_take_context_id();
 	retstat = llistxattr(fpath, list, size);
 	unsharedfs_drop_context_id();
 	if (retstat < 0)
 		retstat = -errno;
+	else if (retstat > 0)
+		retstat = unsharedfs_filter_xattr_list(list, size, retstat);
 
-	return retstat;
+	return unsharedfs_op_end(&op, retstat);
 }
 
 /** Remove extended attributes */
@@ -743,19 +1195,36 @@ int unsharedfs_removexattr(const char *path, const char *name)
 {
 	int retstat = 0;
 	char fpath[PATH_MAX];
+	struct unsharedfs_opctx op;
 
+	unsharedfs_op_begin(&op, OP_REMOVEXATTR, path);
+	op.args.path2 = name;
+	if (strcmp(name, UNSHAREDFS_XATTR_INFO) == 0)
+		return unsharedfs_op_end(&op, -EPERM);
 	if (!unsharedfs_fullpath(fpath, path))
-		return -errno;
+		return unsharedfs_op_end(&op, -errno);
 
+	unsharedfs_change_begin(fpath);
 	unsharedfs_take_context_id();
 	retstat = lremovexattr(fpath, name);
 	unsharedfs_drop_context_id();
 	if (retstat < 0)
 		retstat = -errno;
+	else if (unsharedfs_cachehint_enabled && strcmp(name, UNSHAREDFS_XATTR_CACHE) == 0)
+		unsharedfs_cachehint_invalidate();
+	unsharedfs_change_end(fpath);
 
-	return retstat;
+	return unsharedfs_op_end(&op, retstat);
 }
 
+// a directory handle
+struct unsharedfs_dirhandle {
+	DIR *dp;                                /* NULL when listing from the index */
+	struct unsharedfs_dirindex_list *list;  /* the index of a huge directory */
+	unsigned long entries;                  /* entries of a complete listing of dp */
+	char *fpath;                            /* for indexing the directory (NULL: don't) */
+};
+
 /** Open directory
  *
  * This method should check if the open operation is permitted for
@@ -766,21 +1235,69 @@ int unsharedfs_removexattr(const char *path, const char *name)
 int unsharedfs_opendir(const char *path, struct fuse_file_info *fi)
 {
 	DIR *dp;
+	struct unsharedfs_dirhandle *dh;
 	int retstat = 0;
 	char fpath[PATH_MAX];
+	struct unsharedfs_opctx op;
 
+	unsharedfs_op_begin(&op, OP_OPENDIR, path);
 	if (!unsharedfs_fullpath(fpath, path))
-		return -errno;
+		return unsharedfs_op_end(&op, -errno);
 
 	unsharedfs_take_context_id();
 	dp = opendir(fpath);
 	unsharedfs_drop_context_id();
 	if (dp == NULL)
-		retstat = -errno;
+		return unsharedfs_op_end(&op, -errno);
+
+	dh = calloc(1, sizeof(*dh));
+	if (dh == NULL)
+	{
+		closedir(dp);
+		return unsharedfs_op_end(&op, -ENOMEM);
+	}
+	dh->dp = dp;
+	// opendir() checked the permissions; a huge directory is listed from its index:
+	if (unsharedfs_dirindex_enabled)
+	{
+		dh->list = unsharedfs_dirindex_open(fpath, dirfd(dp));
+		if (dh->list != NULL)
+		{
+			closedir(dp);
+			dh->dp = NULL;
+		}
+		else
+			dh->fpath = strdup(fpath);
+	}
 
-	fi->fh = (intptr_t) dp;
+	fi->fh = (intptr_t) dh;
+	op.args.fh = fi->fh;
 
-	return retstat;
+	return unsharedfs_op_end(&op, retstat);
+}
+
+/**
+ * List a directory from its index.  Unlike the backing directory, the index
+ * keeps track of offsets: "." and ".." have the offsets 1 and 2, the name at
+ * position i has the offset i + 3 (removed names leave a gap).
+ */
+static void unsharedfs_readdir_index(const struct unsharedfs_dirindex_list *list, void *buf,
+		fuse_fill_dir_t filler, off_t offset)
+{
+	size_t count = unsharedfs_dirindex_count(list);
+	size_t i;
+
+	if (offset < 1 && filler(buf, ".", NULL, 1) != 0)
+		return;
+	if (offset < 2 && filler(buf, "..", NULL, 2) != 0)
+		return;
+	for (i = offset > 2 ? offset - 2 : 0; i < count; i++)
+	{
+		const char *name = unsharedfs_dirindex_name(list, i);
+
+		if (name != NULL && filler(buf, name, NULL, i + 3) != 0)
+			return;
+	}
 }
 
 /** Read directory
@@ -804,15 +1321,33 @@ int unsharedfs_opendir(const char *path, struct fuse_file_info *fi)
 int unsharedfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset,
 		struct fuse_file_info *fi)
 {
-	unsharedfs_take_context_id();
 	int retstat = 0;
+	struct unsharedfs_dirhandle *dh;
 	DIR *dp;
 	struct dirent *de;
+	unsigned long entries = 0;
+	struct unsharedfs_opctx op;
+
+	unsharedfs_op_begin(&op, OP_READDIR, path);
+	op.args.fh = fi->fh;
+	op.args.offset = offset;
 
-	// unsharedfs_open() already put the (directory-)file handle into fi->fh.
+	// unsharedfs_opendir() already put the directory handle into fi->fh.
 	// once again, no need for fullpath -- but note that I need to cast fi->fh
 	// with flag_nopath, path is not even set!
-	dp = (DIR *) (uintptr_t) fi->fh;
+	dh = (struct unsharedfs_dirhandle *) (uintptr_t) fi->fh;
+
+	// huge directories are listed from the index (mode 2 below):
+	if (dh->list != NULL)
+	{
+		unsharedfs_op_phase(PHASE_REPLY);
+		unsharedfs_readdir_index(dh->list, buf, filler, offset);
+		unsharedfs_op_phase(PHASE_DAEMON);
+		return unsharedfs_op_end(&op, retstat);
+	}
+
+	unsharedfs_take_context_id();
+	dp = dh->dp;
 
 	// Every directory contains at least two entries: . and ..  If my
 	// first call to the system readdir() returns NULL I've got an
@@ -822,7 +1357,7 @@ int unsharedfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_
 	if (de == 0) {
 		retstat = -errno;
 		unsharedfs_drop_context_id();
-		return retstat;
+		return unsharedfs_op_end(&op, retstat);
 	}
 
 	// This will copy the entire directory into the buffer.  The loop exits
@@ -830,14 +1365,22 @@ int unsharedfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_
 	// returns something non-zero.  The first case just means I've
 	// read the whole directory; the second means the buffer is full.
 	do {
-		if (filler(buf, de->d_name, NULL, 0) != 0) {
+		int full;
+
+		unsharedfs_op_phase(PHASE_REPLY);
+		full = filler(buf, de->d_name, NULL, 0);
+		unsharedfs_op_phase(PHASE_BACKING);
+		if (full != 0) {
 			unsharedfs_drop_context_id();
-			return -ENOMEM;
+			return unsharedfs_op_end(&op, -ENOMEM);
 		}
+		entries++;
 	} while ((de = readdir(dp)) != NULL);
+	// releasedir indexes the directory if it is huge:
+	dh->entries = entries;
 
 	unsharedfs_drop_context_id();
-	return retstat;
+	return unsharedfs_op_end(&op, retstat);
 }
 
 /** Release directory
@@ -847,14 +1390,27 @@ int unsharedfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_
 int unsharedfs_releasedir(const char *path, struct fuse_file_info *fi)
 {
 	int retstat = 0;
+	struct unsharedfs_dirhandle *dh;
+	struct unsharedfs_opctx op;
 
-	// unsharedfs_open() already put the file handle into fi->fh.
+	unsharedfs_op_begin(&op, OP_RELEASEDIR, path);
+	op.args.fh = fi->fh;
+	// unsharedfs_opendir() already put the directory handle into fi->fh.
 	// with flag_nopath, path is not even set!
-	unsharedfs_take_context_id();
-	closedir((DIR *) (uintptr_t) fi->fh);
-	unsharedfs_drop_context_id();
+	dh = (struct unsharedfs_dirhandle *) (uintptr_t) fi->fh;
+	if (dh->dp != NULL)
+	{
+		unsharedfs_take_context_id();
+		closedir(dh->dp);
+		unsharedfs_drop_context_id();
+	}
+	if (dh->fpath != NULL)
+		unsharedfs_dirindex_listed(dh->fpath, dh->entries);
+	unsharedfs_dirindex_close(dh->list);
+	free(dh->fpath);
+	free(dh);
 
-	return retstat;
+	return unsharedfs_op_end(&op, retstat);
 }
 
 /**
@@ -880,11 +1436,121 @@ void *unsharedfs_init(struct fuse_conn_info *conn)
 #ifdef HAVE_SYSLOG
 	openlog("unsharedfs",LOG_PID,LOG_USER);
 #endif
+	unsharedfs_loglevel = pdata->loglevel;
+	if (!unsharedfs_log_start(pdata->use_syslog, pdata->log_burst, pdata->log_interval))
+		logmsg(LOG_ERR,"could not start the logger thread, logging synchronously: %s",strerror(errno));
 	logmsg(LOG_INFO,"initialising unsharedfs with base uid/gid %d/%d at %s"
 			,pdata->base_uid
 			,pdata->base_gid
 			,pdata->rootdir);
 
+	if (pdata->flightrec_file)
+	{
+		if (unsharedfs_flightrec_init(pdata->flightrec_size, pdata->flightrec_file, pdata->flightrec_threshold_ms))
+			unsharedfs_op_instrumented = true;
+		else
+			logmsg(LOG_ERR,"could not allocate the flight recorder: %s",strerror(errno));
+	}
+	if (pdata->slowop_threshold_ms)
+	{
+		unsharedfs_slowop_threshold_ns = (uint64_t) pdata->slowop_threshold_ms * 1000000;
+		unsharedfs_op_phases = true;
+		unsharedfs_op_instrumented = true;
+	}
+	if (pdata->trace_file)
+	{
+		if (unsharedfs_trace_start(pdata->trace_file, pdata->trace_seconds))
+		{
+			unsharedfs_op_phases = true;
+			unsharedfs_op_instrumented = true;
+		}
+		else
+			logmsg(LOG_ERR,"could not start tracing to %s: %s",pdata->trace_file,strerror(errno));
+	}
+	if (pdata->record_file)
+	{
+		if (unsharedfs_record_start(pdata->record_file))
+			unsharedfs_op_instrumented = true;
+		else
+			logmsg(LOG_ERR,"could not start recording to %s: %s",pdata->record_file,strerror(errno));
+	}
+	if (pdata->changes_file || pdata->changes_socket)
+	{
+		// writes only have the file handle; the table keeps their paths:
+		unsharedfs_fdtab_paths = true;
+		if (!unsharedfs_fdtab_init())
+			logmsg(LOG_ERR,"could not allocate the file handle table: %s",strerror(errno));
+		else if (unsharedfs_changes_start(pdata->changes_file, pdata->changes_socket, pdata->changes_buffer_kb * 1024))
+			unsharedfs_op_instrumented = true;
+		else
+			logmsg(LOG_ERR,"could not start the change feed: %s",strerror(errno));
+	}
+	if (pdata->cache_hints && !unsharedfs_cachehint_init())
+		logmsg(LOG_ERR,"could not allocate the cache of caching hints: %s",strerror(errno));
+	if (pdata->compress)
+	{
+		// reads of compressed files find them in the file handle table:
+		if (!unsharedfs_fdtab_init())
+			logmsg(LOG_ERR,"could not allocate the file handle table: %s",strerror(errno));
+		else if (!unsharedfs_compress_init(pdata->rootdir, pdata->compress_idle, pdata->compress_level,
+					pdata->io_uring))
+			logmsg(LOG_ERR,"could not enable compression: %s",strerror(errno));
+	}
+	if (pdata->dir_index && !unsharedfs_dirindex_init(pdata->dir_index, pdata->dir_index_min))
+		logmsg(LOG_ERR,"could not use the directory index in %s: %s",pdata->dir_index,strerror(errno));
+	if (pdata->heavy_hitters)
+	{
+		if (unsharedfs_fdtab_init())
+			unsharedfs_hot_enabled = true;
+		else
+			logmsg(LOG_ERR,"could not allocate the file handle table: %s",strerror(errno));
+	}
+	if (pdata->io_stats)
+	{
+		if (unsharedfs_fdtab_init())
+			unsharedfs_iostats_init(conn->max_write, conn->max_readahead);
+		else
+			logmsg(LOG_ERR,"could not allocate the file handle table: %s",strerror(errno));
+	}
+	if (pdata->perf_counters)
+	{
+		if (unsharedfs_perf_init())
+		{
+			unsharedfs_op_phases = true;
+			unsharedfs_op_instrumented = true;
+		}
+		else
+			logmsg(LOG_ERR,"no CPU performance counters available: %s",strerror(errno));
+	}
+	if (pdata->cpu_time)
+	{
+		if (unsharedfs_cputime_init())
+			unsharedfs_op_instrumented = true;
+		else
+			logmsg(LOG_ERR,"the thread CPU time clock is not available: %s",strerror(errno));
+	}
+	if (pdata->stats_file || unsharedfs_hot_enabled || unsharedfs_iostats_enabled || unsharedfs_perf_enabled
+			|| unsharedfs_cputime_enabled)
+	{
+		if (unsharedfs_stats_init(pdata->stats_file))
+			unsharedfs_op_instrumented = true;
+		else
+			logmsg(LOG_ERR,"could not initialise the statistics: %s",strerror(errno));
+	}
+	if (pdata->shm_stats)
+	{
+		if (unsharedfs_shm_init(pdata->shm_stats))
+			unsharedfs_op_instrumented = true;
+		else
+			logmsg(LOG_ERR,"could not create the shared memory segment %s: %s",pdata->shm_stats,
+					errno == EEXIST ? "in use by another instance" : strerror(errno));
+	}
+	// the control socket may start a trace, which needs the monitor thread:
+	if ((unsharedfs_op_instrumented || pdata->control_socket) && !unsharedfs_monitor_start(pdata))
+		logmsg(LOG_ERR,"could not start the monitor thread: %s",strerror(errno));
+	if (pdata->control_socket && !unsharedfs_control_start(pdata, pdata->control_socket))
+		logmsg(LOG_ERR,"could not create the control socket %s: %s",pdata->control_socket,strerror(errno));
+
 	return pdata;
 }
 
@@ -900,6 +1566,25 @@ void unsharedfs_destroy(void *userdata)
 	struct unsharedfs_state *pdata = (struct unsharedfs_state*) userdata;
 
 	logmsg(LOG_INFO,"releasing unsharedfs at %s",pdata->rootdir);
+	unsharedfs_control_stop();
+	unsharedfs_monitor_stop();
+	unsharedfs_stats_dump("unmount");
+	unsharedfs_op_instrumented = false;
+	unsharedfs_trace_stop();
+	unsharedfs_record_stop();
+	unsharedfs_changes_stop();
+	unsharedfs_flightrec_destroy();
+	unsharedfs_stats_destroy();
+	unsharedfs_shm_destroy();
+	unsharedfs_hot_enabled = false;
+	unsharedfs_iostats_enabled = false;
+	unsharedfs_cputime_enabled = false;
+	unsharedfs_compress_destroy();
+	unsharedfs_fdtab_destroy();
+	unsharedfs_dirindex_destroy();
+	unsharedfs_cachehint_destroy();
+	unsharedfs_log_stop();
+	unsharedfs_thread_destroy_all();
 #ifdef HAVE_SYSLOG
 	closelog();
 #endif
@@ -907,6 +1592,16 @@ void unsharedfs_destroy(void *userdata)
 	// not strictly necessary, since the memory is freed on exit anyways:
 	free(pdata->rootdir);
 	free(pdata->defaultdir);
+	free(pdata->mountpoint);
+	free(pdata->flightrec_file);
+	free(pdata->trace_file);
+	free(pdata->record_file);
+	free(pdata->changes_file);
+	free(pdata->changes_socket);
+	free(pdata->dir_index);
+	free(pdata->stats_file);
+	free(pdata->control_socket);
+	free(pdata->shm_stats);
 	free(pdata);
 }
 
@@ -925,9 +1620,12 @@ int unsharedfs_access(const char *path, int mask)
 {
 	int retstat = 0;
 	char fpath[PATH_MAX];
+	struct unsharedfs_opctx op;
 
+	unsharedfs_op_begin(&op, OP_ACCESS, path);
+	op.args.flags = mask;
 	if (!unsharedfs_fullpath(fpath, path))
-		return -errno;
+		return unsharedfs_op_end(&op, -errno);
 
 	unsharedfs_take_context_id();
 	retstat = access(fpath, mask);
@@ -936,7 +1634,7 @@ int unsharedfs_access(const char *path, int mask)
 	if (retstat < 0)
 		retstat = -errno;
 
-	return retstat;
+	return unsharedfs_op_end(&op, retstat);
 }
 
 /**
@@ -956,10 +1654,16 @@ int unsharedfs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 	int retstat = 0;
 	char fpath[PATH_MAX];
 	int fd;
+	struct unsharedfs_opctx op;
+	struct unsharedfs_dirindex_op dop;
 
+	unsharedfs_op_begin(&op, OP_CREATE, path);
+	op.args.mode = mode;
+	op.args.flags = fi->flags;
 	if (!unsharedfs_fullpath(fpath, path))
-		return -errno;
+		return unsharedfs_op_end(&op, -errno);
 
+	unsharedfs_dirindex_begin(&dop, NULL, fpath);
 	unsharedfs_take_context_id();
 	// fd = creat(fpath, mode);
 	// some programs seemingly don't cope well with O_WRONLY
@@ -967,10 +1671,20 @@ int unsharedfs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 	unsharedfs_drop_context_id();
 	if (fd < 0)
 		retstat = -errno;
+	else
+	{
+		if (unsharedfs_fdtab_enabled)
+			unsharedfs_fdtab_open(fd, path, fpath, PRIVATE_DATA->rootdir);
+		// a new file gets the hint of its directory:
+		if (unsharedfs_cachehint_enabled)
+			unsharedfs_cachehint_apply(unsharedfs_cachehint_get(fpath, strlen(fpath) - strlen(path)), fd, fi);
+	}
+	unsharedfs_dirindex_end(&dop, retstat);
 
 	fi->fh = fd;
+	op.args.fh = fi->fh;
 
-	return retstat;
+	return unsharedfs_op_end(&op, retstat);
 }
 
 /**
@@ -988,7 +1702,11 @@ int unsharedfs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 int unsharedfs_ftruncate(const char *path, off_t offset, struct fuse_file_info *fi)
 {
 	int retstat = 0;
+	struct unsharedfs_opctx op;
 
+	unsharedfs_op_begin(&op, OP_FTRUNCATE, path);
+	op.args.fh = fi->fh;
+	op.args.offset = offset;
 	// unsharedfs_open() already put the file handle into fi->fh.
 	// with flag_nopath, path is not even set!
 	unsharedfs_take_context_id();
@@ -997,7 +1715,7 @@ int unsharedfs_ftruncate(const char *path, off_t offset, struct fuse_file_info *
 	if (retstat < 0)
 		retstat = -errno;
 
-	return retstat;
+	return unsharedfs_op_end(&op, retstat);
 }
 
 /**
@@ -1015,7 +1733,11 @@ int unsharedfs_ftruncate(const char *path, off_t offset, struct fuse_file_info *
 int unsharedfs_fgetattr(const char *path, struct stat *statbuf, struct fuse_file_info *fi)
 {
 	int retstat = 0;
+	struct unsharedfs_opctx op;
+	struct unsharedfs_compressed *z;
 
+	unsharedfs_op_begin(&op, OP_FGETATTR, path);
+	op.args.fh = fi->fh;
 	// unsharedfs_open() already put the file handle into fi->fh.
 	// with flag_nopath, path is not even set!
 	unsharedfs_take_context_id();
@@ -1023,9 +1745,14 @@ int unsharedfs_fgetattr(const char *path, struct stat *statbuf, struct fuse_file
 	unsharedfs_drop_context_id();
 	if (retstat < 0)
 		retstat = -errno;
+	else if ((z = unsharedfs_compressed_of(fi->fh)) != NULL)
+	{
+		statbuf->st_size = unsharedfs_compress_size(z);
+		statbuf->st_mode &= ~S_ISVTX;
+	}
 
 
-	return retstat;
+	return unsharedfs_op_end(&op, retstat);
 }
 
 
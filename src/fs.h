@@ -28,6 +28,13 @@
 #include <stdbool.h>
 #include <fuse.h>
 
+// extended attributes in this namespace are reserved for unsharedfs:
+#define UNSHAREDFS_XATTR_PREFIX "user.unsharedfs."
+// diagnostic information about a file (read-only, root and the mounting user only):
+#define UNSHAREDFS_XATTR_INFO UNSHAREDFS_XATTR_PREFIX "info"
+// caching hint of a file or directory tree, set by the user (see cachehint.h):
+#define UNSHAREDFS_XATTR_CACHE UNSHAREDFS_XATTR_PREFIX "cache"
+
 enum unsharedfs_fsmode {
 	UID_ONLY   /* look up the "real" path based on the accessors uid */
 	,GID_ONLY  /* look up the "real" path based on the accessors gid */
@@ -40,10 +47,47 @@ struct unsharedfs_state {
 	gid_t base_gid;
     char *rootdir;
 	char *defaultdir;
+	char *mountpoint;                   /* absolute path of the mount point (NULL: none given) */
 	bool allow_other_isset;
 	enum unsharedfs_fsmode fsmode; 
 	bool check_ownership;
 	bool use_syslog;
+	int loglevel;                       /* least important log level that is logged */
+	unsigned long log_burst;            /* identical messages per log interval */
+	unsigned long log_interval;         /* log rate limiting interval (seconds) */
+	char *flightrec_file;               /* flight recorder dump file (NULL: disabled) */
+	size_t flightrec_size;              /* flight recorder ring size (entries) */
+	unsigned long flightrec_threshold_ms; /* auto-dump the flight recorder for slower ops (0: never) */
+	unsigned long slowop_threshold_ms;  /* log slower ops with a phase breakdown (0: never) */
+	char *trace_file;                   /* Chrome trace output (NULL: disabled) */
+	unsigned long trace_seconds;        /* length of the trace */
+	char *record_file;                  /* operation record for unsharedfs-replay (NULL: disabled) */
+	char *changes_file;                 /* append-only change feed (NULL: disabled) */
+	char *changes_socket;               /* Unix socket for change feed clients (NULL: disabled) */
+	unsigned long changes_buffer_kb;    /* events queued per change feed client */
+	char *dir_index;                    /* directory for the index files of huge directories (NULL: disabled) */
+	unsigned long dir_index_min;        /* index directories with at least this many entries */
+	char *stats_file;                   /* statistics report (NULL: disabled) */
+	bool heavy_hitters;                 /* track the hottest paths and uids */
+	bool io_stats;                      /* track read/write sizes and access patterns */
+	bool perf_counters;                 /* collect CPU performance counters per operation and phase */
+	bool cpu_time;                      /* track the daemon's CPU time per operation and uid */
+	bool cache_hints;                   /* apply the UNSHAREDFS_XATTR_CACHE hints when opening files */
+	bool compress;                      /* handle compressed files */
+	unsigned long compress_idle;        /* compress cold files unused for this many hours (0: never) */
+	unsigned long compress_level;       /* zstd compression level */
+	int io_uring;                       /* enum unsharedfs_batch_mode */
+	char *control_socket;               /* path of the control socket (NULL: disabled) */
+	char *shm_stats;                    /* name of the shared memory statistics segment (NULL: disabled, "": named after the mount point) */
+	bool provision;                     /* create the directories in rootdir instead of mounting */
+	unsigned long provision_uid_min;    /* only provision users with a uid in this range */
+	unsigned long provision_uid_max;
+	unsigned long provision_threads;    /* worker threads for provisioning */
+	bool provision_dry_run;             /* only print what provisioning would do */
+	bool audit;                         /* check rootdir instead of mounting */
+	bool audit_sizes;                   /* walk the views to report their sizes */
+	unsigned long audit_max_size_mb;    /* report larger views (0: no limit) */
+	unsigned long audit_threads;        /* worker threads for the audit */
 };
 
 int unsharedfs_access(const char *path, int mask);
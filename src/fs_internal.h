@@ -0,0 +1,42 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_FS_INTERNAL_H_
+#define UNSHAREDFS_FS_INTERNAL_H_
+
+/*
+ * Helpers of the file system operations in fs.c.
+ * Not part of the FUSE interface; exported for the microbenchmarks in bench/.
+ */
+
+#include <limits.h>
+
+/**
+ * Compute the diverted full path for a relative path.
+ * The path supplied by fuse is always relative to the mountpoint,
+ * and has been sanitized.
+ *
+ * @param fpath the a reference to the return buffer
+ * @param path the relative path to the mountpoint
+ * @return 1 on success, 0 on error (errno is set).
+ */
+int unsharedfs_fullpath(char fpath[PATH_MAX], const char *path);
+
+/**
+ * Take the uid/gid of the current context.
+ */
+void unsharedfs_take_context_id(void);
+
+/**
+ * Drop the uid/gid of the current context.
+ */
+void unsharedfs_drop_context_id(void);
+
+#endif
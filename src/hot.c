@@ -0,0 +1,245 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#include "hot.h"
+#include "thread.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+// give up on a consistent snapshot of a summary after this many attempts:
+#define HOT_SNAPSHOT_RETRIES 16
+
+bool unsharedfs_hot_enabled = false;
+
+static const char *const hot_titles[HOT_COUNT] = {
+	[HOT_PATH_OPS] = "hot paths by operations",
+	[HOT_PATH_BYTES] = "hot paths by bytes",
+	[HOT_UID_OPS] = "hot uids by operations",
+	[HOT_UID_BYTES] = "hot uids by bytes",
+};
+
+/* return the summaries of the calling thread, allocating them if necessary */
+static struct unsharedfs_hot *unsharedfs_hot_self(void)
+{
+	struct unsharedfs_thread *t = unsharedfs_thread_self();
+	struct unsharedfs_hot *hot;
+
+	if (t == NULL)
+		return NULL;
+	hot = atomic_load_explicit(&t->hot, memory_order_acquire);
+	if (hot == NULL)
+	{
+		hot = calloc(1, sizeof(*hot));
+		if (hot == NULL)
+			return NULL;
+		atomic_store_explicit(&t->hot, hot, memory_order_release);
+	}
+	return hot;
+}
+
+/*
+ * Space-Saving update: count the key if it is monitored, otherwise replace
+ * the entry with the smallest count.
+ * The label is only computed (from fpath) when a new entry is created.
+ */
+static void unsharedfs_hot_add(struct unsharedfs_hot_summary *s, uint64_t key, uint64_t weight
+		, const char *label, const char *fpath, const char *rootdir)
+{
+	unsigned int seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+	struct unsharedfs_hot_entry *e = NULL, *min = NULL;
+	unsigned int i;
+
+	for (i = 0; i < s->used; i++)
+	{
+		if (s->e[i].key == key)
+		{
+			e = &s->e[i];
+			break;
+		}
+		if (min == NULL || s->e[i].count < min->count)
+			min = &s->e[i];
+	}
+
+	atomic_store_explicit(&s->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	if (e != NULL)
+		e->count += weight;
+	else
+	{
+		if (s->used < HOT_TOPK)
+		{
+			e = &s->e[s->used++];
+			e->error = 0;
+			e->count = weight;
+		}
+		else
+		{
+			e = min;
+			e->error = min->count;
+			e->count = min->count + weight;
+		}
+		e->key = key;
+		if (label)
+			strcpy(e->label, label);
+		else if (fpath)
+			unsharedfs_path_label(e->label, fpath, rootdir);
+		else
+			e->label[0] = '\0';
+	}
+	atomic_store_explicit(&s->seq, seq + 2, memory_order_release);
+}
+
+/* count an operation; label or fpath give the label for a new path entry */
+static void unsharedfs_hot_record(uint64_t path_hash, const char *label, const char *fpath, const char *rootdir
+		, uid_t uid, uint64_t bytes)
+{
+	struct unsharedfs_hot *hot = unsharedfs_hot_self();
+
+	if (hot == NULL)
+		return;
+	unsharedfs_hot_add(&hot->s[HOT_PATH_OPS], path_hash, 1, label, fpath, rootdir);
+	unsharedfs_hot_add(&hot->s[HOT_UID_OPS], uid, 1, NULL, NULL, NULL);
+	if (bytes > 0)
+	{
+		unsharedfs_hot_add(&hot->s[HOT_PATH_BYTES], path_hash, bytes, label, fpath, rootdir);
+		unsharedfs_hot_add(&hot->s[HOT_UID_BYTES], uid, bytes, NULL, NULL, NULL);
+	}
+}
+
+void unsharedfs_hot_record_path(const char *fpath, const char *rootdir, uid_t uid, uint64_t bytes)
+{
+	unsharedfs_hot_record(unsharedfs_path_hash(fpath), NULL, fpath, rootdir, uid, bytes);
+}
+
+void unsharedfs_hot_record_fd(const struct unsharedfs_fdinfo *info, uid_t uid, uint64_t bytes)
+{
+	unsharedfs_hot_record(info->path_hash, info->label, NULL, NULL, uid, bytes);
+}
+
+/* take a consistent copy of a summary written by another thread */
+static int unsharedfs_hot_snapshot(struct unsharedfs_hot_summary *s, struct unsharedfs_hot_summary *copy)
+{
+	int tries;
+
+	for (tries = 0; tries < HOT_SNAPSHOT_RETRIES; tries++)
+	{
+		unsigned int seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+		if (seq & 1)
+			continue;
+		copy->used = s->used;
+		memcpy(copy->e, s->e, sizeof(copy->e));
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&s->seq, memory_order_relaxed) == seq)
+			return 1;
+	}
+	return 0;
+}
+
+static int unsharedfs_hot_cmp_key(const void *a, const void *b)
+{
+	const struct unsharedfs_hot_entry *x = a, *y = b;
+	return x->key < y->key ? -1 : x->key > y->key;
+}
+
+static int unsharedfs_hot_cmp_count(const void *a, const void *b)
+{
+	const struct unsharedfs_hot_entry *x = a, *y = b;
+	return x->count > y->count ? -1 : x->count < y->count;
+}
+
+size_t unsharedfs_hot_top(enum unsharedfs_hot_kind kind, struct unsharedfs_hot_entry *out, size_t max)
+{
+	size_t nthreads = unsharedfs_thread_count();
+	struct unsharedfs_hot_entry *all;
+	struct unsharedfs_hot_summary copy;
+	size_t i, n = 0, merged = 0;
+
+	all = malloc((nthreads ? nthreads : 1) * HOT_TOPK * sizeof(*all));
+	if (all == NULL)
+		return 0;
+	for (i = 0; i < nthreads; i++)
+	{
+		struct unsharedfs_thread *t = unsharedfs_thread_get(i);
+		struct unsharedfs_hot *hot = t ? atomic_load_explicit(&t->hot, memory_order_acquire) : NULL;
+		if (hot == NULL || !unsharedfs_hot_snapshot(&hot->s[kind], &copy))
+			continue;
+		memcpy(all + n, copy.e, copy.used * sizeof(*all));
+		n += copy.used;
+	}
+
+	// the same key may be monitored by several threads:
+	qsort(all, n, sizeof(*all), unsharedfs_hot_cmp_key);
+	for (i = 0; i < n; i++)
+	{
+		if (merged > 0 && all[merged - 1].key == all[i].key)
+		{
+			all[merged - 1].count += all[i].count;
+			all[merged - 1].error += all[i].error;
+		}
+		else
+			all[merged++] = all[i];
+	}
+	qsort(all, merged, sizeof(*all), unsharedfs_hot_cmp_count);
+	if (merged > max)
+		merged = max;
+	memcpy(out, all, merged * sizeof(*all));
+	free(all);
+	return merged;
+}
+
+uint64_t unsharedfs_hot_estimate(const char *fpath)
+{
+	uint64_t key = unsharedfs_path_hash(fpath);
+	uint64_t sum = 0;
+	size_t i, j, nthreads = unsharedfs_thread_count();
+	struct unsharedfs_hot_summary copy;
+
+	for (i = 0; i < nthreads; i++)
+	{
+		struct unsharedfs_thread *t = unsharedfs_thread_get(i);
+		struct unsharedfs_hot *hot = t ? atomic_load_explicit(&t->hot, memory_order_acquire) : NULL;
+		if (hot == NULL || !unsharedfs_hot_snapshot(&hot->s[HOT_PATH_OPS], &copy))
+			continue;
+		for (j = 0; j < copy.used; j++)
+			if (copy.e[j].key == key)
+				sum += copy.e[j].count;
+	}
+	return sum;
+}
+
+void unsharedfs_hot_report(FILE *fp)
+{
+	struct unsharedfs_hot_entry top[HOT_TOPK];
+	int kind;
+	size_t i, n;
+
+	for (kind = 0; kind < HOT_COUNT; kind++)
+	{
+		bool uids = kind == HOT_UID_OPS || kind == HOT_UID_BYTES;
+
+		fprintf(fp, "\n## %s\n%20s %20s  %s\n", hot_titles[kind], "count", "max.error", uids ? "uid" : "path");
+		n = unsharedfs_hot_top(kind, top, HOT_TOPK);
+		for (i = 0; i < n; i++)
+		{
+			if (uids)
+				fprintf(fp, "%20llu %20llu  %llu\n"
+						, (unsigned long long) top[i].count
+						, (unsigned long long) top[i].error
+						, (unsigned long long) top[i].key);
+			else
+				fprintf(fp, "%20llu %20llu  %s\n"
+						, (unsigned long long) top[i].count
+						, (unsigned long long) top[i].error
+						, top[i].label);
+		}
+	}
+}
@@ -0,0 +1,103 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_HOT_H_
+#define UNSHAREDFS_HOT_H_
+
+#include "fdtab.h"
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Heavy-hitter detection: the hottest backing paths and uids, by number of
+ * operations and by bytes transferred.
+ *
+ * Every thread maintains its own Space-Saving summaries of HOT_TOPK entries,
+ * so updates need neither locks nor atomic read-modify-write operations.
+ * Readers take consistent snapshots through a per-summary sequence counter
+ * and merge the summaries of all threads.
+ * Counts are upper bounds; the reported error is the maximum overestimation.
+ */
+
+#define HOT_TOPK 32
+
+enum unsharedfs_hot_kind {
+	HOT_PATH_OPS
+	,HOT_PATH_BYTES
+	,HOT_UID_OPS
+	,HOT_UID_BYTES
+	,HOT_COUNT
+};
+
+struct unsharedfs_hot_entry {
+	uint64_t key;
+	uint64_t count;
+	uint64_t error;
+	char label[UNSHAREDFS_LABEL_LEN];
+};
+
+struct unsharedfs_hot_summary {
+	_Atomic unsigned int seq;
+	unsigned int used;
+	struct unsharedfs_hot_entry e[HOT_TOPK];
+};
+
+/* the summaries of one thread */
+struct unsharedfs_hot {
+	struct unsharedfs_hot_summary s[HOT_COUNT];
+};
+
+/**
+ * True if heavy hitters are tracked.
+ */
+extern bool unsharedfs_hot_enabled;
+
+/**
+ * Count an operation on a backing path.
+ * @param fpath the backing path
+ * @param rootdir the base directory (used for the label)
+ * @param uid the uid of the caller
+ * @param bytes the number of bytes transferred
+ */
+void unsharedfs_hot_record_path(const char *fpath, const char *rootdir, uid_t uid, uint64_t bytes);
+
+/**
+ * Count an operation on an open file.
+ * @param info the file handle information
+ * @param uid the uid of the caller
+ * @param bytes the number of bytes transferred
+ */
+void unsharedfs_hot_record_fd(const struct unsharedfs_fdinfo *info, uid_t uid, uint64_t bytes);
+
+/**
+ * Estimate the number of operations on a backing path, summed over all
+ * threads.
+ * @return the estimate, or 0 if the path is not among the heavy hitters.
+ */
+uint64_t unsharedfs_hot_estimate(const char *fpath);
+
+/**
+ * Merge the summaries of all threads.
+ * @param kind the summary
+ * @param out the top entries, sorted by descending count
+ * @param max the size of out
+ * @return the number of entries written to out.
+ */
+size_t unsharedfs_hot_top(enum unsharedfs_hot_kind kind, struct unsharedfs_hot_entry *out, size_t max);
+
+/**
+ * Write the heavy hitters in human-readable form.
+ */
+void unsharedfs_hot_report(FILE *fp);
+
+#endif
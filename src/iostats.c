@@ -0,0 +1,198 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#include "iostats.h"
+#include "thread.h"
+
+#include <string.h>
+
+// recommendations need at least this many requests to be meaningful:
+#define IOSTATS_MIN_SAMPLE 1000
+// FUSE 2 without big_writes splits writes into page-sized requests:
+#define IOSTATS_PAGE_SIZE 4096
+
+bool unsharedfs_iostats_enabled = false;
+
+static unsigned int conn_max_write;
+static unsigned int conn_max_readahead;
+
+static const char *const io_dir_names[IO_DIRS] = {
+	[IO_READ] = "reads",
+	[IO_WRITE] = "writes",
+};
+
+void unsharedfs_iostats_init(unsigned int max_write, unsigned int max_readahead)
+{
+	conn_max_write = max_write;
+	conn_max_readahead = max_readahead;
+	unsharedfs_iostats_enabled = true;
+}
+
+static int unsharedfs_iostats_bucket(size_t size)
+{
+	int b = 0;
+
+	size = (size - 1) >> IOSTATS_MIN_SHIFT;
+	while (size > 0 && b < IOSTATS_BUCKETS - 1)
+	{
+		size >>= 1;
+		b++;
+	}
+	return b;
+}
+
+void unsharedfs_iostats_record(struct unsharedfs_fdinfo *info, enum unsharedfs_io_dir dir, off_t offset, size_t size, ssize_t ret)
+{
+	struct unsharedfs_thread *t = unsharedfs_thread_self();
+
+	if (t == NULL || size == 0)
+		return;
+	unsharedfs_counter_add(&t->io.size_hist[dir][unsharedfs_iostats_bucket(size)], 1);
+	if (ret > 0)
+		unsharedfs_counter_add(&t->io.bytes[dir], ret);
+	if (info == NULL)
+		return;
+	// a request is sequential if it starts where the previous one on the same handle ended:
+	if (atomic_load_explicit(&info->next_offset[dir], memory_order_relaxed) == offset)
+		unsharedfs_counter_add(&t->io.sequential[dir], 1);
+	else
+		unsharedfs_counter_add(&t->io.random[dir], 1);
+	atomic_store_explicit(&info->next_offset[dir], offset + (ret > 0 ? ret : 0), memory_order_relaxed);
+}
+
+/* sum the counters of all threads */
+static void unsharedfs_iostats_sum(struct unsharedfs_iostats *sum)
+{
+	size_t i, n = unsharedfs_thread_count();
+	int d, b;
+
+	memset(sum, 0, sizeof(*sum));
+	for (i = 0; i < n; i++)
+	{
+		struct unsharedfs_thread *t = unsharedfs_thread_get(i);
+		if (t == NULL)
+			continue;
+		for (d = 0; d < IO_DIRS; d++)
+		{
+			for (b = 0; b < IOSTATS_BUCKETS; b++)
+				sum->size_hist[d][b] += atomic_load_explicit(&t->io.size_hist[d][b], memory_order_relaxed);
+			sum->bytes[d] += atomic_load_explicit(&t->io.bytes[d], memory_order_relaxed);
+			sum->sequential[d] += atomic_load_explicit(&t->io.sequential[d], memory_order_relaxed);
+			sum->random[d] += atomic_load_explicit(&t->io.random[d], memory_order_relaxed);
+		}
+	}
+}
+
+/* the upper bound (in bytes) of the bucket containing the median request */
+static uint64_t unsharedfs_iostats_median(const struct unsharedfs_iostats *sum, int dir, uint64_t total)
+{
+	uint64_t acc = 0;
+	int b;
+
+	for (b = 0; b < IOSTATS_BUCKETS; b++)
+	{
+		acc += sum->size_hist[dir][b];
+		if (acc * 2 >= total)
+			break;
+	}
+	return (uint64_t) 1 << (IOSTATS_MIN_SHIFT + b);
+}
+
+static void unsharedfs_iostats_recommend(FILE *fp, const struct unsharedfs_iostats *sum, const uint64_t total[IO_DIRS])
+{
+	double seq_share[IO_DIRS];
+	uint64_t median[IO_DIRS];
+	int d, recommendations = 0;
+
+	fprintf(fp, "\n## recommendations (negotiated max_write=%u max_readahead=%u)\n", conn_max_write, conn_max_readahead);
+	for (d = 0; d < IO_DIRS; d++)
+	{
+		uint64_t classified = sum->sequential[d] + sum->random[d];
+		seq_share[d] = classified ? (double) sum->sequential[d] / classified : 0;
+		median[d] = total[d] ? unsharedfs_iostats_median(sum, d, total[d]) : 0;
+	}
+
+	if (total[IO_WRITE] >= IOSTATS_MIN_SAMPLE && seq_share[IO_WRITE] > 0.8)
+	{
+		if (median[IO_WRITE] <= IOSTATS_PAGE_SIZE && conn_max_write <= IOSTATS_PAGE_SIZE)
+		{
+			fprintf(fp, "- writes are sequential but arrive in %u byte requests: mount with -o big_writes,max_write=131072\n", conn_max_write);
+			recommendations++;
+		}
+		else if (median[IO_WRITE] >= conn_max_write && conn_max_write < 131072)
+		{
+			fprintf(fp, "- most writes are as large as max_write allows: raise it with -o max_write=131072\n");
+			recommendations++;
+		}
+	}
+	if (total[IO_READ] >= IOSTATS_MIN_SAMPLE)
+	{
+		if (seq_share[IO_READ] > 0.8 && conn_max_readahead < 1048576)
+		{
+			fprintf(fp, "- %.0f%% of reads are sequential: a larger readahead helps streaming, e.g. -o max_readahead=1048576\n", seq_share[IO_READ] * 100);
+			recommendations++;
+		}
+		else if (seq_share[IO_READ] < 0.2 && median[IO_READ] * 4 < conn_max_readahead)
+		{
+			fprintf(fp, "- %.0f%% of reads are random with a median size of %llu bytes: readahead wastes bandwidth, e.g. -o max_readahead=%llu\n"
+					, (1 - seq_share[IO_READ]) * 100
+					, (unsigned long long) median[IO_READ]
+					, (unsigned long long) median[IO_READ] * 4);
+			recommendations++;
+		}
+		// no -o auto_cache or kernel_cache for read-mostly workloads: the kernel
+		// keeps one page cache per path, but every uid sees a different backing
+		// file there, so one uid would be served the data of another.
+	}
+	if (recommendations == 0)
+		fprintf(fp, "- none (fewer than %d requests, or no clear pattern)\n", IOSTATS_MIN_SAMPLE);
+}
+
+void unsharedfs_iostats_report(FILE *fp)
+{
+	struct unsharedfs_iostats sum;
+	uint64_t total[IO_DIRS] = { 0 };
+	int d, b;
+
+	unsharedfs_iostats_sum(&sum);
+	for (d = 0; d < IO_DIRS; d++)
+		for (b = 0; b < IOSTATS_BUCKETS; b++)
+			total[d] += sum.size_hist[d][b];
+
+	fprintf(fp, "\n## I/O request sizes\n%-12s %20s %20s\n", "size", io_dir_names[IO_READ], io_dir_names[IO_WRITE]);
+	for (b = 0; b < IOSTATS_BUCKETS; b++)
+	{
+		char label[16];
+		if (b == IOSTATS_BUCKETS - 1)
+			snprintf(label, sizeof(label), "> %lluK", (unsigned long long) 1 << (IOSTATS_MIN_SHIFT + b - 1 - 10));
+		else if (IOSTATS_MIN_SHIFT + b < 10)
+			snprintf(label, sizeof(label), "<= %llu", (unsigned long long) 1 << (IOSTATS_MIN_SHIFT + b));
+		else
+			snprintf(label, sizeof(label), "<= %lluK", (unsigned long long) 1 << (IOSTATS_MIN_SHIFT + b - 10));
+		fprintf(fp, "%-12s %20llu %20llu\n", label
+				, (unsigned long long) sum.size_hist[IO_READ][b]
+				, (unsigned long long) sum.size_hist[IO_WRITE][b]);
+	}
+
+	fprintf(fp, "\n## I/O access patterns\n");
+	for (d = 0; d < IO_DIRS; d++)
+	{
+		uint64_t classified = sum.sequential[d] + sum.random[d];
+		fprintf(fp, "%s: %llu requests, %llu bytes, %llu sequential (%.1f%%), %llu random\n"
+				, io_dir_names[d]
+				, (unsigned long long) total[d]
+				, (unsigned long long) sum.bytes[d]
+				, (unsigned long long) sum.sequential[d]
+				, classified ? 100.0 * sum.sequential[d] / classified : 0.0
+				, (unsigned long long) sum.random[d]);
+	}
+
+	unsharedfs_iostats_recommend(fp, &sum, total);
+}
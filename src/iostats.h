@@ -0,0 +1,73 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_IOSTATS_H_
+#define UNSHAREDFS_IOSTATS_H_
+
+#include "fdtab.h"
+
+#include <sys/types.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * I/O pattern statistics: request size histograms, and the share of
+ * sequential requests, for reads and writes.  The report includes mount
+ * option recommendations based on the observed distribution.
+ */
+
+// request size buckets: <= 512 bytes, <= 1 KiB, ..., <= 1 MiB, larger
+#define IOSTATS_MIN_SHIFT 9
+#define IOSTATS_BUCKETS 13
+
+enum unsharedfs_io_dir {
+	IO_READ
+	,IO_WRITE
+	,IO_DIRS
+};
+
+/* per-thread I/O counters */
+struct unsharedfs_iostats {
+	_Atomic uint64_t size_hist[IO_DIRS][IOSTATS_BUCKETS];
+	_Atomic uint64_t bytes[IO_DIRS];
+	_Atomic uint64_t sequential[IO_DIRS];
+	_Atomic uint64_t random[IO_DIRS];
+};
+
+/**
+ * True if I/O statistics are collected.
+ */
+extern bool unsharedfs_iostats_enabled;
+
+/**
+ * Enable the I/O statistics.
+ * @param max_write the max_write negotiated with the kernel
+ * @param max_readahead the max_readahead negotiated with the kernel
+ */
+void unsharedfs_iostats_init(unsigned int max_write, unsigned int max_readahead);
+
+/**
+ * Count a read or write request.
+ * @param info the file handle information (may be NULL)
+ * @param dir IO_READ or IO_WRITE
+ * @param offset the requested offset
+ * @param size the requested size
+ * @param ret the result of the backing call
+ */
+void unsharedfs_iostats_record(struct unsharedfs_fdinfo *info, enum unsharedfs_io_dir dir, off_t offset, size_t size, ssize_t ret);
+
+/**
+ * Write the histograms and mount option recommendations.
+ */
+void unsharedfs_iostats_report(FILE *fp);
+
+#endif
@@ -0,0 +1,361 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#include "log.h"
+#include "opctx.h"
+#include "ring.h"
+#include "thread.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+// longer messages are truncated:
+#define LOG_LINE_MAX 1024
+// per-thread message queue:
+#define LOG_RING_SIZE (64 * 1024)
+// the logger thread empties the queues this often:
+#define LOG_TICK_MS 50
+// number of distinct messages that are rate limited at a time:
+#define LOG_KEYS 256
+
+struct unsharedfs_log_rec {
+	int prio;
+	char text[LOG_LINE_MAX];
+};
+
+/* rate limiting state of a single message text (only used by the logger thread) */
+struct unsharedfs_log_key {
+	uint64_t key;    /* unsharedfs_log_hash() of the text (0: unused) */
+	uint64_t window_start_ns;
+	unsigned long logged;
+	unsigned long suppressed;
+	int prio;
+	char last[LOG_LINE_MAX];
+};
+
+_Atomic int unsharedfs_loglevel = LOG_INFO;
+
+static bool log_use_syslog = false;
+static _Atomic bool log_running = false;
+static pthread_t log_thread;
+// the rate limit may be changed while the logger thread runs:
+static _Atomic unsigned long log_burst;
+static _Atomic uint64_t log_interval_ns;
+static struct unsharedfs_log_key log_keys[LOG_KEYS];
+// the messages that don't fit into log_keys:
+static struct unsharedfs_log_key log_other;
+
+// the first name of each level is its canonical name:
+static const struct { const char *name; int level; } log_levels[] = {
+	{ "err", LOG_ERR },
+	{ "error", LOG_ERR },
+	{ "warning", LOG_WARNING },
+	{ "notice", LOG_NOTICE },
+	{ "info", LOG_INFO },
+	{ "debug", LOG_DEBUG },
+};
+
+int unsharedfs_log_parse_level(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(log_levels) / sizeof(log_levels[0]); i++)
+		if (strcasecmp(name, log_levels[i].name) == 0)
+			return log_levels[i].level;
+	return -1;
+}
+
+const char *unsharedfs_log_level_name(int level)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(log_levels) / sizeof(log_levels[0]); i++)
+		if (log_levels[i].level == level)
+			return log_levels[i].name;
+	return "?";
+}
+
+/* write a formatted message to its destinations */
+static void unsharedfs_log_write(int prio, const char *text)
+{
+#ifdef HAVE_SYSLOG
+	if (prio < LOG_DEBUG && log_use_syslog)
+		syslog(prio, "%s", text);
+#endif
+	// when in foreground-mode, this gets printed:
+	fprintf(stderr, "%s\n", text);
+}
+
+void unsharedfs_logmsg(int prio, const char *fmt, ...)
+{
+	struct unsharedfs_log_rec rec;
+	struct unsharedfs_thread *t;
+	struct unsharedfs_ring *ring;
+	va_list args;
+	int len;
+	int saved_errno = errno;
+
+	va_start(args, fmt);
+	len = vsnprintf(rec.text, sizeof(rec.text), fmt, args);
+	va_end(args);
+	if (len < 0)
+		goto out;
+	if ((size_t) len >= sizeof(rec.text))
+		len = sizeof(rec.text) - 1;
+	rec.prio = prio;
+
+	if (!atomic_load_explicit(&log_running, memory_order_relaxed)
+			|| (t = unsharedfs_thread_self()) == NULL)
+	{
+		unsharedfs_log_write(prio, rec.text);
+		goto out;
+	}
+	ring = atomic_load_explicit(&t->log, memory_order_acquire);
+	if (ring == NULL)
+	{
+		// first message of this thread:
+		ring = malloc(sizeof(*ring));
+		if (ring == NULL || !unsharedfs_ring_init(ring, LOG_RING_SIZE))
+		{
+			free(ring);
+			unsharedfs_log_write(prio, rec.text);
+			goto out;
+		}
+		atomic_store_explicit(&t->log, ring, memory_order_release);
+	}
+	// if the queue is full, the message is dropped and counted:
+	unsharedfs_ring_put(ring, &rec, offsetof(struct unsharedfs_log_rec, text) + len + 1);
+out:
+	errno = saved_errno;
+}
+
+/* format n with thousands separators */
+static const char *unsharedfs_log_count(unsigned long n, char buf[32])
+{
+	char tmp[32];
+	int len = snprintf(tmp, sizeof(tmp), "%lu", n);
+	int i, j = 0;
+
+	for (i = 0; i < len; i++)
+	{
+		if (i > 0 && (len - i) % 3 == 0)
+			buf[j++] = ',';
+		buf[j++] = tmp[i];
+	}
+	buf[j] = '\0';
+	return buf;
+}
+
+/* log a summary of the suppressed messages of a key, and start a new window */
+static void unsharedfs_log_key_flush(struct unsharedfs_log_key *k, uint64_t now)
+{
+	char count[32];
+
+	if (k->suppressed > 0 && k == &log_other)
+	{
+		char text[200];
+		snprintf(text, sizeof(text), "%s other messages suppressed in the last %llu seconds"
+				, unsharedfs_log_count(k->suppressed, count)
+				, (unsigned long long) (now - k->window_start_ns) / 1000000000);
+		unsharedfs_log_write(k->prio, text);
+	}
+	else if (k->suppressed > 0)
+	{
+		char text[LOG_LINE_MAX + 100];
+		snprintf(text, sizeof(text), "%s (message repeated %s times in the last %llu seconds)"
+				, k->last
+				, unsharedfs_log_count(k->suppressed, count)
+				, (unsigned long long) (now - k->window_start_ns) / 1000000000);
+		unsharedfs_log_write(k->prio, text);
+	}
+	k->window_start_ns = now;
+	k->logged = 0;
+	k->suppressed = 0;
+}
+
+/* FNV-1a hash of a message text; never 0 */
+static uint64_t unsharedfs_log_hash(const char *text)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	for (; *text != '\0'; text++)
+		h = (h ^ (unsigned char) *text) * 0x100000001b3ULL;
+	return h ? h : 1;
+}
+
+/*
+ * Find the rate limiting state of a message text, or a free one.  Keys are
+ * never removed, so that the probe sequences stay intact; the key of a
+ * window that is over is taken over instead.
+ * @return the state, or NULL if all keys are in use
+ */
+static struct unsharedfs_log_key *unsharedfs_log_key_find(uint64_t key, uint64_t now)
+{
+	struct unsharedfs_log_key *expired = NULL;
+	size_t i;
+
+	for (i = 0; i < LOG_KEYS; i++)
+	{
+		struct unsharedfs_log_key *k = &log_keys[(key + i) % LOG_KEYS];
+
+		if (k->key == key)
+			return k;
+		if (k->key == 0)
+			return expired ? expired : k;
+		if (expired == NULL && now - k->window_start_ns >= log_interval_ns)
+			expired = k;
+	}
+	return expired;
+}
+
+/* log a message, unless the same text has exceeded its rate limit */
+static void unsharedfs_log_limit(const struct unsharedfs_log_rec *rec, uint64_t now)
+{
+	uint64_t key;
+	struct unsharedfs_log_key *k;
+
+	if (log_burst == 0)
+	{
+		// no rate limiting:
+		unsharedfs_log_write(rec->prio, rec->text);
+		return;
+	}
+	key = unsharedfs_log_hash(rec->text);
+	k = unsharedfs_log_key_find(key, now);
+	if (k == NULL)
+		k = &log_other;
+	else if (k->key != key)
+	{
+		// a new key, or one whose window is over:
+		unsharedfs_log_key_flush(k, now);
+		k->key = key;
+	}
+	if (now - k->window_start_ns >= log_interval_ns)
+		unsharedfs_log_key_flush(k, now);
+	if (k->logged < log_burst)
+	{
+		k->logged++;
+		unsharedfs_log_write(rec->prio, rec->text);
+	}
+	else
+	{
+		k->suppressed++;
+		k->prio = rec->prio;
+		strcpy(k->last, rec->text);
+	}
+}
+
+/* empty the message queues of all threads */
+static void unsharedfs_log_drain(void)
+{
+	struct unsharedfs_log_rec rec;
+	uint64_t now = unsharedfs_now_ns();
+	size_t i, n = unsharedfs_thread_count();
+	unsigned long dropped = 0;
+
+	for (i = 0; i < n; i++)
+	{
+		struct unsharedfs_thread *t = unsharedfs_thread_get(i);
+		struct unsharedfs_ring *ring;
+		size_t len;
+
+		if (t == NULL)
+			continue;
+		ring = atomic_load_explicit(&t->log, memory_order_acquire);
+		if (ring == NULL)
+			continue;
+		while ((len = unsharedfs_ring_get(ring, &rec, sizeof(rec))) != 0)
+		{
+			rec.text[len - offsetof(struct unsharedfs_log_rec, text) - 1] = '\0';
+			unsharedfs_log_limit(&rec, now);
+		}
+		dropped += atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+	}
+	if (dropped > 0)
+	{
+		char count[32];
+		char text[100];
+		snprintf(text, sizeof(text), "log queue overflow: %s messages dropped", unsharedfs_log_count(dropped, count));
+		unsharedfs_log_write(LOG_WARNING, text);
+	}
+
+	// report suppressed messages once their window is over:
+	for (i = 0; i < LOG_KEYS; i++)
+		if (log_keys[i].suppressed > 0 && now - log_keys[i].window_start_ns >= log_interval_ns)
+			unsharedfs_log_key_flush(&log_keys[i], now);
+	if (log_other.suppressed > 0 && now - log_other.window_start_ns >= log_interval_ns)
+		unsharedfs_log_key_flush(&log_other, now);
+}
+
+static void *unsharedfs_log_main(void *arg)
+{
+	const struct timespec tick = { 0, LOG_TICK_MS * 1000000L };
+
+	while (atomic_load(&log_running))
+	{
+		nanosleep(&tick, NULL);
+		unsharedfs_log_drain();
+	}
+	return NULL;
+}
+
+int unsharedfs_log_start(bool use_syslog, unsigned long burst, unsigned long interval)
+{
+	int rc;
+
+	log_use_syslog = use_syslog;
+	unsharedfs_log_set_limit(burst, interval);
+	atomic_store(&log_running, true);
+	rc = pthread_create(&log_thread, NULL, unsharedfs_log_main, NULL);
+	if (rc != 0)
+	{
+		atomic_store(&log_running, false);
+		errno = rc;
+		return 0;
+	}
+	return 1;
+}
+
+void unsharedfs_log_set_limit(unsigned long burst, unsigned long interval)
+{
+	atomic_store(&log_burst, burst);
+	atomic_store(&log_interval_ns, (uint64_t) interval * 1000000000);
+}
+
+void unsharedfs_log_get_limit(unsigned long *burst, unsigned long *interval)
+{
+	*burst = atomic_load(&log_burst);
+	*interval = atomic_load(&log_interval_ns) / 1000000000;
+}
+
+void unsharedfs_log_stop(void)
+{
+	size_t i;
+
+	if (!atomic_exchange(&log_running, false))
+		return;
+	pthread_join(log_thread, NULL);
+	// messages that were queued after the last tick:
+	unsharedfs_log_drain();
+	for (i = 0; i < LOG_KEYS; i++)
+		if (log_keys[i].suppressed > 0)
+			unsharedfs_log_key_flush(&log_keys[i], unsharedfs_now_ns());
+	if (log_other.suppressed > 0)
+		unsharedfs_log_key_flush(&log_other, unsharedfs_now_ns());
+}
@@ -0,0 +1,92 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_LOG_H_
+#define UNSHAREDFS_LOG_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#ifdef HAVE_SYSLOG
+#include <syslog.h>
+#endif
+
+#ifndef HAVE_SYSLOG
+#	define LOG_ERR     0
+#	define LOG_WARNING 1
+#	define LOG_NOTICE  2
+#	define LOG_INFO    3
+#	define LOG_DEBUG   4
+#endif
+
+// messages less important than this are compiled out:
+#ifndef UNSHAREDFS_LOG_MAX
+#	define UNSHAREDFS_LOG_MAX LOG_DEBUG
+#endif
+
+/**
+ * Messages less important than this are dropped before they are formatted.
+ * May be changed at any time.
+ */
+extern _Atomic int unsharedfs_loglevel;
+
+/**
+ * Log a message to syslog (unless disabled) and to stderr.
+ *
+ * Messages are formatted on the calling thread and handed to the logger
+ * thread, which rate-limits them per message text.
+ */
+#define logmsg(prio, ...) \
+	do { \
+		if ((prio) <= UNSHAREDFS_LOG_MAX && (prio) <= unsharedfs_loglevel) \
+			unsharedfs_logmsg((prio), __VA_ARGS__); \
+	} while (0)
+
+void unsharedfs_logmsg(int prio, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * Parse a log level name (err, warning, notice, info or debug).
+ * @return the level, or -1 if the name is unknown.
+ */
+int unsharedfs_log_parse_level(const char *name);
+
+/**
+ * Return the name of a log level.
+ */
+const char *unsharedfs_log_level_name(int level);
+
+/**
+ * Start the logger thread.  Until this is called (and after
+ * unsharedfs_log_stop()), messages are written synchronously.
+ * @param use_syslog also send messages to syslog
+ * @param burst number of identical messages that are logged per
+ *        rate limiting interval before further messages are suppressed
+ * @param interval the rate limiting interval in seconds
+ * @return 1 on success, 0 on error (errno is set).
+ */
+int unsharedfs_log_start(bool use_syslog, unsigned long burst, unsigned long interval);
+
+/**
+ * Change the rate limit.  Takes effect with the next message.
+ * @param burst see unsharedfs_log_start()
+ * @param interval see unsharedfs_log_start()
+ */
+void unsharedfs_log_set_limit(unsigned long burst, unsigned long interval);
+
+/**
+ * Return the current rate limit.
+ */
+void unsharedfs_log_get_limit(unsigned long *burst, unsigned long *interval);
+
+/**
+ * Flush all pending messages and stop the logger thread.
+ */
+void unsharedfs_log_stop(void);
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+// for sigaction
+#define _XOPEN_SOURCE 700
+
+#include "monitor.h"
+#include "changes.h"
+#include "flightrec.h"
+#include "record.h"
+#include "shmstats.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+// the monitor thread wakes up at least this often:
+#define MONITOR_TICK_MS 100
+
+static sem_t monitor_sem;
+static _Atomic unsigned int monitor_pending = 0;
+static pthread_t monitor_thread;
+static bool monitor_running = false;
+
+void unsharedfs_monitor_post(unsigned int events)
+{
+	if (!monitor_running)
+		return;
+	atomic_fetch_or(&monitor_pending, events);
+	sem_post(&monitor_sem);
+}
+
+static void unsharedfs_monitor_sigusr1(int signum)
+{
+	unsharedfs_monitor_post(MONITOR_EVENT_FLIGHTREC_SIGNAL);
+}
+
+static void unsharedfs_monitor_sigusr2(int signum)
+{
+	unsharedfs_monitor_post(MONITOR_EVENT_STATS);
+}
+
+static void *unsharedfs_monitor_main(void *arg)
+{
+	for (;;)
+	{
+		struct timespec deadline;
+		unsigned int events;
+
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += MONITOR_TICK_MS * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		while (sem_timedwait(&monitor_sem, &deadline) != 0 && errno == EINTR)
+			;
+
+		events = atomic_exchange(&monitor_pending, 0);
+		if (events & MONITOR_EVENT_FLIGHTREC_SIGNAL)
+			unsharedfs_flightrec_dump("SIGUSR1");
+		if (events & MONITOR_EVENT_FLIGHTREC_SLOW)
+			unsharedfs_flightrec_dump("slow operation");
+		if (events & MONITOR_EVENT_FLIGHTREC_CONTROL)
+			unsharedfs_flightrec_dump("control request");
+		if (events & MONITOR_EVENT_STATS)
+			unsharedfs_stats_dump("SIGUSR2");
+		if (events & MONITOR_EVENT_STATS_CONTROL)
+			unsharedfs_stats_dump("control request");
+		// periodic work:
+		unsharedfs_trace_flush();
+		unsharedfs_record_flush();
+		unsharedfs_changes_flush();
+		unsharedfs_shm_publish();
+		if (events & MONITOR_EVENT_STOP)
+			break;
+	}
+	return NULL;
+}
+
+int unsharedfs_monitor_start(struct unsharedfs_state *pdata)
+{
+	struct sigaction sa;
+	int rc;
+
+	if (sem_init(&monitor_sem, 0, 0) != 0)
+		return 0;
+
+	rc = pthread_create(&monitor_thread, NULL, unsharedfs_monitor_main, pdata);
+	if (rc != 0)
+	{
+		sem_destroy(&monitor_sem);
+		errno = rc;
+		return 0;
+	}
+	monitor_running = true;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = unsharedfs_monitor_sigusr1;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGUSR1, &sa, NULL);
+	sa.sa_handler = unsharedfs_monitor_sigusr2;
+	sigaction(SIGUSR2, &sa, NULL);
+	return 1;
+}
+
+void unsharedfs_monitor_stop(void)
+{
+	if (!monitor_running)
+		return;
+	signal(SIGUSR1, SIG_IGN);
+	signal(SIGUSR2, SIG_IGN);
+	unsharedfs_monitor_post(MONITOR_EVENT_STOP);
+	pthread_join(monitor_thread, NULL);
+	sem_destroy(&monitor_sem);
+	monitor_running = false;
+}
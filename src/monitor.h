@@ -0,0 +1,50 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_MONITOR_H_
+#define UNSHAREDFS_MONITOR_H_
+
+#include "fs.h"
+
+/*
+ * The monitor thread does all the diagnostic work that must not happen on the
+ * request threads or inside a signal handler (e.g. writing dump files).
+ * Work is requested by posting events.
+ */
+
+enum unsharedfs_monitor_event {
+	MONITOR_EVENT_STOP = 1 << 0
+	,MONITOR_EVENT_FLIGHTREC_SIGNAL = 1 << 1 /* SIGUSR1 was received */
+	,MONITOR_EVENT_FLIGHTREC_SLOW = 1 << 2   /* an operation exceeded the flight recorder threshold */
+	,MONITOR_EVENT_STATS = 1 << 3            /* SIGUSR2 was received */
+	,MONITOR_EVENT_FLIGHTREC_CONTROL = 1 << 4 /* dump requested on the control socket */
+	,MONITOR_EVENT_STATS_CONTROL = 1 << 5    /* dump requested on the control socket */
+};
+
+/**
+ * Start the monitor thread and install the signal handlers.
+ * @param pdata the file system state
+ * @return 1 on success, 0 on error (errno is set).
+ */
+int unsharedfs_monitor_start(struct unsharedfs_state *pdata);
+
+/**
+ * Stop the monitor thread, if it is running.
+ */
+void unsharedfs_monitor_stop(void);
+
+/**
+ * Request work from the monitor thread.
+ * This function is async-signal-safe.
+ * @param events a bitwise or of unsharedfs_monitor_event values
+ */
+void unsharedfs_monitor_post(unsigned int events);
+
+#endif
@@ -0,0 +1,221 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+// for syscall
+#define _GNU_SOURCE
+
+#include "fs.h"
+#include "opctx.h"
+#include "flightrec.h"
+#include "log.h"
+#include "perf.h"
+#include "record.h"
+#include "changes.h"
+#include "cputime.h"
+#include "shmstats.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+const char *const unsharedfs_op_names[OP_COUNT] = {
+	[OP_ACCESS] = "access",
+	[OP_CHMOD] = "chmod",
+	[OP_CHOWN] = "chown",
+	[OP_CREATE] = "create",
+	[OP_FGETATTR] = "fgetattr",
+	[OP_FSYNC] = "fsync",
+	[OP_FTRUNCATE] = "ftruncate",
+	[OP_GETATTR] = "getattr",
+	[OP_GETXATTR] = "getxattr",
+	[OP_LINK] = "link",
+	[OP_LISTXATTR] = "listxattr",
+	[OP_MKDIR] = "mkdir",
+	[OP_MKNOD] = "mknod",
+	[OP_OPEN] = "open",
+	[OP_OPENDIR] = "opendir",
+	[OP_READ] = "read",
+	[OP_READDIR] = "readdir",
+	[OP_READLINK] = "readlink",
+	[OP_RELEASE] = "release",
+	[OP_RELEASEDIR] = "releasedir",
+	[OP_REMOVEXATTR] = "removexattr",
+	[OP_RENAME] = "rename",
+	[OP_RMDIR] = "rmdir",
+	[OP_SETXATTR] = "setxattr",
+	[OP_STATFS] = "statfs",
+	[OP_SYMLINK] = "symlink",
+	[OP_TRUNCATE] = "truncate",
+	[OP_UNLINK] = "unlink",
+	[OP_UTIMENS] = "utimens",
+	[OP_WRITE] = "write",
+};
+
+const char *const unsharedfs_phase_names[PHASE_COUNT] = {
+	[PHASE_DAEMON] = "other",
+	[PHASE_RESOLVE] = "resolve",
+	[PHASE_RESOLVE_STAT] = "uid-dir stat",
+	[PHASE_CREDS] = "credentials",
+	[PHASE_BACKING] = "syscall",
+	[PHASE_REPLY] = "reply",
+};
+
+_Atomic bool unsharedfs_op_instrumented = false;
+_Atomic bool unsharedfs_op_phases = false;
+_Atomic uint64_t unsharedfs_slowop_threshold_ns = 0;
+__thread struct unsharedfs_opctx *unsharedfs_current_op = NULL;
+
+uint64_t unsharedfs_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+pid_t unsharedfs_gettid(void)
+{
+	static __thread pid_t tid = 0;
+	// gettid is a syscall -- only call it once per thread:
+	if (tid == 0)
+		tid = syscall(SYS_gettid);
+	return tid;
+}
+
+void unsharedfs_op_begin(struct unsharedfs_opctx *op, enum unsharedfs_op code, const char *path)
+{
+	op->op = code;
+	op->path = path;
+	// instrumentation may be switched on while the operation runs; 0 marks it as not instrumented:
+	op->start_ns = 0;
+	if (!atomic_load_explicit(&unsharedfs_op_instrumented, memory_order_relaxed))
+		return;
+	op->uid = fuse_get_context()->uid;
+	// the handler fills in the arguments it has:
+	memset(&op->args, 0, sizeof(op->args));
+	op->start_ns = unsharedfs_now_ns();
+	op->cputime = unsharedfs_cputime_enabled;
+	if (op->cputime)
+		op->cputime_start_ns = unsharedfs_cputime_now();
+	if (atomic_load_explicit(&unsharedfs_op_phases, memory_order_relaxed))
+	{
+		op->traced = atomic_load_explicit(&unsharedfs_tracing, memory_order_relaxed);
+		memset(op->phase_ns, 0, sizeof(op->phase_ns));
+		op->phase = PHASE_DAEMON;
+		op->phase_start_ns = op->start_ns;
+		op->perf = unsharedfs_perf_enabled;
+		if (op->perf)
+			unsharedfs_perf_read(op->perf_start);
+		unsharedfs_current_op = op;
+	}
+}
+
+/* attribute the CPU counters since the last sample to the current phase */
+static void unsharedfs_op_perf_sample(struct unsharedfs_opctx *op)
+{
+	uint64_t now[PERF_COUNTERS];
+
+	unsharedfs_perf_read(now);
+	unsharedfs_perf_account(op->op, op->phase, op->perf_start, now);
+	memcpy(op->perf_start, now, sizeof(now));
+}
+
+void unsharedfs_op_switch_phase(struct unsharedfs_opctx *op, enum unsharedfs_phase phase)
+{
+	uint64_t now = unsharedfs_now_ns();
+
+	if (op->traced && op->phase != PHASE_DAEMON)
+		unsharedfs_trace_span(op->op, op->phase, op->uid, op->phase_start_ns, now);
+	if (op->perf)
+		unsharedfs_op_perf_sample(op);
+	op->phase_ns[op->phase] += now - op->phase_start_ns;
+	op->phase = phase;
+	op->phase_start_ns = now;
+}
+
+/**
+ * Log an operation together with its phase breakdown.
+ * Time spent in the backing file system is reported separately from the time
+ * spent in the daemon, so that slow operations can be attributed to either.
+ */
+static void unsharedfs_op_log_slow(const struct unsharedfs_opctx *op, uint64_t duration_ns, int retstat)
+{
+	uint64_t backing_ns = op->phase_ns[PHASE_RESOLVE_STAT] + op->phase_ns[PHASE_BACKING];
+	uint64_t daemon_ns = duration_ns - backing_ns;
+
+	logmsg(LOG_WARNING,"slow operation: %s uid=%u path=%s result=%d total=%.3fms"
+			" daemon=%.3fms [resolve=%.3fms credentials=%.3fms reply=%.3fms other=%.3fms]"
+			" backing=%.3fms [uid-dir stat=%.3fms syscall=%.3fms] (mostly %s)"
+			,unsharedfs_op_names[op->op]
+			,(unsigned) op->uid
+			,op->path ? op->path : "-"
+			,retstat
+			,duration_ns / 1e6
+			,daemon_ns / 1e6
+			,op->phase_ns[PHASE_RESOLVE] / 1e6
+			,op->phase_ns[PHASE_CREDS] / 1e6
+			,op->phase_ns[PHASE_REPLY] / 1e6
+			,op->phase_ns[PHASE_DAEMON] / 1e6
+			,backing_ns / 1e6
+			,op->phase_ns[PHASE_RESOLVE_STAT] / 1e6
+			,op->phase_ns[PHASE_BACKING] / 1e6
+			,backing_ns > daemon_ns ? "backing file system" : "daemon"
+		  );
+}
+
+int unsharedfs_op_end(struct unsharedfs_opctx *op, int retstat)
+{
+	uint64_t end_ns, threshold_ns;
+	// errno is still used by the handlers after some error paths:
+	int saved_errno = errno;
+	bool phases = unsharedfs_current_op == op;
+
+	if (op->start_ns == 0)
+		return retstat;
+
+	end_ns = unsharedfs_now_ns();
+	if (op->cputime)
+		unsharedfs_cputime_account(op->op, op->uid, unsharedfs_cputime_now() - op->cputime_start_ns);
+	if (phases)
+	{
+		op->phase_ns[op->phase] += end_ns - op->phase_start_ns;
+		unsharedfs_current_op = NULL;
+		if (op->perf)
+		{
+			unsharedfs_op_perf_sample(op);
+			unsharedfs_perf_finish(op->op);
+		}
+		if (op->traced)
+		{
+			if (op->phase != PHASE_DAEMON)
+				unsharedfs_trace_span(op->op, op->phase, op->uid, op->phase_start_ns, end_ns);
+			unsharedfs_trace_span(op->op, TRACE_SPAN_OP, op->uid, op->start_ns, end_ns);
+		}
+	}
+	if (unsharedfs_stats_enabled)
+		unsharedfs_stats_record(op, end_ns - op->start_ns, retstat);
+	if (unsharedfs_shm_enabled)
+		unsharedfs_shm_record(op, end_ns - op->start_ns, retstat);
+	if (unsharedfs_flightrec_enabled())
+		unsharedfs_flightrec_record(op, end_ns - op->start_ns, retstat);
+	if (atomic_load_explicit(&unsharedfs_recording, memory_order_relaxed))
+		unsharedfs_record_op(op, end_ns - op->start_ns, retstat);
+	if (atomic_load_explicit(&unsharedfs_changes_enabled, memory_order_relaxed))
+		unsharedfs_changes_op(op, retstat);
+	threshold_ns = atomic_load_explicit(&unsharedfs_slowop_threshold_ns, memory_order_relaxed);
+	if (phases && threshold_ns != 0 && end_ns - op->start_ns >= threshold_ns)
+		unsharedfs_op_log_slow(op, end_ns - op->start_ns, retstat);
+
+	errno = saved_errno;
+	return retstat;
+}
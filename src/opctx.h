@@ -0,0 +1,170 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_OPCTX_H_
+#define UNSHAREDFS_OPCTX_H_
+
+#include <sys/types.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* One entry per file system operation implemented in fs.c */
+enum unsharedfs_op {
+	OP_ACCESS
+	,OP_CHMOD
+	,OP_CHOWN
+	,OP_CREATE
+	,OP_FGETATTR
+	,OP_FSYNC
+	,OP_FTRUNCATE
+	,OP_GETATTR
+	,OP_GETXATTR
+	,OP_LINK
+	,OP_LISTXATTR
+	,OP_MKDIR
+	,OP_MKNOD
+	,OP_OPEN
+	,OP_OPENDIR
+	,OP_READ
+	,OP_READDIR
+	,OP_READLINK
+	,OP_RELEASE
+	,OP_RELEASEDIR
+	,OP_REMOVEXATTR
+	,OP_RENAME
+	,OP_RMDIR
+	,OP_SETXATTR
+	,OP_STATFS
+	,OP_SYMLINK
+	,OP_TRUNCATE
+	,OP_UNLINK
+	,OP_UTIMENS
+	,OP_WRITE
+	,OP_COUNT
+};
+
+extern const char *const unsharedfs_op_names[OP_COUNT];
+
+/*
+ * The phases of an operation.
+ * Time spent queued inside libfuse, and sending the reply after the handler
+ * returned, is not visible through the high-level FUSE API.
+ */
+enum unsharedfs_phase {
+	PHASE_DAEMON        /* unsharedfs itself, outside of the other phases */
+	,PHASE_RESOLVE      /* unsharedfs_fullpath(), without the stat of the uid directory */
+	,PHASE_RESOLVE_STAT /* stat of the uid directory in unsharedfs_fullpath() */
+	,PHASE_CREDS        /* switching fsuid/fsgid */
+	,PHASE_BACKING      /* the backing file system call(s) */
+	,PHASE_REPLY        /* filling the reply buffer */
+	,PHASE_COUNT
+};
+
+extern const char *const unsharedfs_phase_names[PHASE_COUNT];
+
+/*
+ * The arguments of an operation besides its path, for the operation recorder
+ * (see record.h).  Set by the handlers; only meaningful while recording.
+ */
+struct unsharedfs_opargs {
+	const char *path2;  /* rename, link: the new path; symlink: the target; xattr: the name */
+	uint64_t fh;        /* the file handle (open, create, opendir: the new one) */
+	uint64_t offset;    /* read, write, readdir: the offset; (f)truncate: the size; chown: the uid */
+	uint64_t size;      /* read, write, readlink, xattr: the size; chown: the gid */
+	uint32_t mode;      /* mknod, mkdir, chmod, create: the mode */
+	uint32_t flags;     /* open, create, setxattr: the flags; access: the mask; fsync: datasync */
+};
+
+// number of CPU performance counters (see perf.h):
+#define OP_PERF_COUNTERS 4
+
+/**
+ * Book-keeping for a single file system operation.
+ * Lives on the stack of the operation handler.
+ */
+struct unsharedfs_opctx {
+	enum unsharedfs_op op;
+	const char *path;
+	uid_t uid;
+	uint64_t start_ns;
+	bool traced;
+	enum unsharedfs_phase phase;
+	uint64_t phase_start_ns;
+	uint64_t phase_ns[PHASE_COUNT];
+	bool perf;
+	uint64_t perf_start[OP_PERF_COUNTERS];
+	bool cputime;
+	uint64_t cputime_start_ns;
+	struct unsharedfs_opargs args;
+};
+
+/**
+ * True if any consumer of operation timings is enabled.
+ * Set during initialisation, and when a consumer is enabled at runtime.
+ */
+extern _Atomic bool unsharedfs_op_instrumented;
+
+/**
+ * True if operations should be broken down into phases.
+ * Implies unsharedfs_op_instrumented.
+ */
+extern _Atomic bool unsharedfs_op_phases;
+
+/**
+ * Operations taking at least this long are logged with their phase breakdown
+ * (0: disabled).
+ */
+extern _Atomic uint64_t unsharedfs_slowop_threshold_ns;
+
+/**
+ * The operation handled by the current thread, if phases are tracked.
+ */
+extern __thread struct unsharedfs_opctx *unsharedfs_current_op;
+
+void unsharedfs_op_switch_phase(struct unsharedfs_opctx *op, enum unsharedfs_phase phase);
+
+/**
+ * Attribute the time from now on to the given phase of the current operation.
+ */
+static inline void unsharedfs_op_phase(enum unsharedfs_phase phase)
+{
+	if (unsharedfs_current_op != NULL)
+		unsharedfs_op_switch_phase(unsharedfs_current_op, phase);
+}
+
+/**
+ * Return the current CLOCK_MONOTONIC time in nanoseconds.
+ */
+uint64_t unsharedfs_now_ns(void);
+
+/**
+ * Return the kernel thread id of the calling thread (cached per thread).
+ */
+pid_t unsharedfs_gettid(void);
+
+/**
+ * Start book-keeping for an operation.
+ * @param op the context to initialise
+ * @param code the operation
+ * @param path the path as supplied by fuse (may be NULL)
+ */
+void unsharedfs_op_begin(struct unsharedfs_opctx *op, enum unsharedfs_op code, const char *path);
+
+/**
+ * Finish book-keeping for an operation.
+ * @param op the context initialised by unsharedfs_op_begin()
+ * @param retstat the return value of the operation
+ * @return retstat
+ */
+int unsharedfs_op_end(struct unsharedfs_opctx *op, int retstat);
+
+#endif
@@ -0,0 +1,279 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+// for syscall
+#define _GNU_SOURCE
+
+#include "perf.h"
+#include "thread.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+struct unsharedfs_perf_event {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+};
+
+static const struct unsharedfs_perf_event perf_events[PERF_COUNTERS] = {
+	[PERF_CYCLES] = { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	[PERF_INSTRUCTIONS] = { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	[PERF_CACHE_MISSES] = { "cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	[PERF_CTX_SWITCHES] = { "ctx-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+};
+
+/* the sums over all threads */
+struct unsharedfs_perf_totals {
+	uint64_t calls[OP_COUNT];
+	uint64_t value[OP_COUNT][PHASE_COUNT][PERF_COUNTERS];
+};
+
+bool unsharedfs_perf_enabled = false;
+
+// the counters that could be opened during initialisation:
+static bool perf_available[PERF_COUNTERS];
+// count kernel code as well, if perf_event_paranoid allows it:
+static bool perf_kernel = true;
+// file descriptors of the calling thread (group leader first):
+static __thread int perf_fds[PERF_COUNTERS] = { -1, -1, -1, -1 };
+static __thread bool perf_opened = false;
+static __thread unsigned int perf_nfds = 0;
+static pthread_key_t perf_key;
+static pthread_once_t perf_key_once = PTHREAD_ONCE_INIT;
+
+static int unsharedfs_perf_open(int counter, int group_fd, bool kernel)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = perf_events[counter].type;
+	attr.config = perf_events[counter].config;
+	attr.read_format = PERF_FORMAT_GROUP;
+	attr.exclude_kernel = !kernel;
+	attr.exclude_hv = 1;
+	// the calling thread, on any cpu:
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+}
+
+/* called on thread exit */
+static void unsharedfs_perf_close(void *arg)
+{
+	unsigned int i;
+
+	for (i = 0; i < PERF_COUNTERS; i++)
+		if (perf_fds[i] >= 0)
+		{
+			close(perf_fds[i]);
+			perf_fds[i] = -1;
+		}
+}
+
+static void unsharedfs_perf_make_key(void)
+{
+	pthread_key_create(&perf_key, unsharedfs_perf_close);
+}
+
+int unsharedfs_perf_init(void)
+{
+	int i, fd, any = 0;
+
+	for (i = 0; i < PERF_COUNTERS; i++)
+	{
+		fd = unsharedfs_perf_open(i, -1, perf_kernel);
+		if (fd < 0 && perf_kernel && (errno == EACCES || errno == EPERM))
+		{
+			// perf_event_paranoid > 1: user space only
+			perf_kernel = false;
+			fd = unsharedfs_perf_open(i, -1, perf_kernel);
+		}
+		perf_available[i] = fd >= 0;
+		if (fd >= 0)
+		{
+			close(fd);
+			any = 1;
+		}
+	}
+	if (!any)
+		return 0;
+	pthread_once(&perf_key_once, unsharedfs_perf_make_key);
+	unsharedfs_perf_enabled = true;
+	return 1;
+}
+
+/* open the counter group of the calling thread */
+static void unsharedfs_perf_open_thread(void)
+{
+	int i, leader = -1;
+
+	perf_opened = true;
+	for (i = 0; i < PERF_COUNTERS; i++)
+	{
+		if (!perf_available[i])
+			continue;
+		perf_fds[i] = unsharedfs_perf_open(i, leader, perf_kernel);
+		if (perf_fds[i] < 0)
+			continue;
+		if (leader < 0)
+			leader = perf_fds[i];
+		perf_nfds++;
+	}
+	if (leader >= 0)
+		pthread_setspecific(perf_key, perf_fds);
+}
+
+void unsharedfs_perf_read(uint64_t value[PERF_COUNTERS])
+{
+	// PERF_FORMAT_GROUP: the number of counters, followed by their values in the order they were opened
+	uint64_t buf[1 + PERF_COUNTERS];
+	unsigned int i, j;
+	int leader = -1;
+
+	if (!perf_opened)
+		unsharedfs_perf_open_thread();
+	for (i = 0; i < PERF_COUNTERS; i++)
+		if (perf_fds[i] >= 0)
+		{
+			leader = perf_fds[i];
+			break;
+		}
+	memset(value, 0, PERF_COUNTERS * sizeof(value[0]));
+	if (leader < 0 || read(leader, buf, sizeof(buf)) < (ssize_t) ((1 + perf_nfds) * sizeof(uint64_t)))
+		return;
+	for (i = 0, j = 1; i < PERF_COUNTERS; i++)
+		if (perf_fds[i] >= 0)
+			value[i] = buf[j++];
+}
+
+static struct unsharedfs_perfstats *unsharedfs_perf_stats(void)
+{
+	struct unsharedfs_thread *t = unsharedfs_thread_self();
+	struct unsharedfs_perfstats *ps;
+
+	if (t == NULL)
+		return NULL;
+	ps = atomic_load_explicit(&t->perf, memory_order_acquire);
+	if (ps == NULL)
+	{
+		// first use on this thread:
+		ps = calloc(1, sizeof(*ps));
+		if (ps == NULL)
+			return NULL;
+		atomic_store_explicit(&t->perf, ps, memory_order_release);
+	}
+	return ps;
+}
+
+void unsharedfs_perf_account(enum unsharedfs_op op, enum unsharedfs_phase phase, const uint64_t start[PERF_COUNTERS], const uint64_t end[PERF_COUNTERS])
+{
+	struct unsharedfs_perfstats *ps = unsharedfs_perf_stats();
+	int i;
+
+	if (ps == NULL)
+		return;
+	for (i = 0; i < PERF_COUNTERS; i++)
+		unsharedfs_counter_add(&ps->value[op][phase][i], end[i] - start[i]);
+}
+
+void unsharedfs_perf_finish(enum unsharedfs_op op)
+{
+	struct unsharedfs_perfstats *ps = unsharedfs_perf_stats();
+
+	if (ps != NULL)
+		unsharedfs_counter_add(&ps->calls[op], 1);
+}
+
+/* sum the counters of all threads */
+static void unsharedfs_perf_sum(struct unsharedfs_perf_totals *sum)
+{
+	size_t i, n = unsharedfs_thread_count();
+	int op, ph, c;
+
+	memset(sum, 0, sizeof(*sum));
+	for (i = 0; i < n; i++)
+	{
+		struct unsharedfs_thread *t = unsharedfs_thread_get(i);
+		struct unsharedfs_perfstats *ps = t ? atomic_load_explicit(&t->perf, memory_order_acquire) : NULL;
+		if (ps == NULL)
+			continue;
+		for (op = 0; op < OP_COUNT; op++)
+		{
+			sum->calls[op] += atomic_load_explicit(&ps->calls[op], memory_order_relaxed);
+			for (ph = 0; ph < PHASE_COUNT; ph++)
+				for (c = 0; c < PERF_COUNTERS; c++)
+					sum->value[op][ph][c] += atomic_load_explicit(&ps->value[op][ph][c], memory_order_relaxed);
+		}
+	}
+}
+
+static void unsharedfs_perf_row(FILE *fp, const char *op, const char *phase, uint64_t calls, const uint64_t value[PERF_COUNTERS])
+{
+	int c;
+
+	fprintf(fp, "%-12s %-14s %12llu", op, phase, (unsigned long long) calls);
+	for (c = 0; c < PERF_COUNTERS; c++)
+	{
+		if (perf_available[c])
+			fprintf(fp, " %14.2f", calls ? (double) value[c] / calls : 0.0);
+		else
+			fprintf(fp, " %14s", "n/a");
+	}
+	if (perf_available[PERF_CYCLES] && perf_available[PERF_INSTRUCTIONS] && value[PERF_CYCLES] > 0)
+		fprintf(fp, " %6.2f\n", (double) value[PERF_INSTRUCTIONS] / value[PERF_CYCLES]);
+	else
+		fprintf(fp, " %6s\n", "-");
+}
+
+void unsharedfs_perf_report(FILE *fp)
+{
+	struct unsharedfs_perf_totals *sum;
+	uint64_t phase_total[PHASE_COUNT][PERF_COUNTERS] = { { 0 } };
+	uint64_t calls_total = 0;
+	int op, ph, c;
+
+	sum = malloc(sizeof(*sum));
+	if (sum == NULL)
+		return;
+	unsharedfs_perf_sum(sum);
+
+	fprintf(fp, "\n## CPU counters per call (%s)\n%-12s %-14s %12s", perf_kernel ? "user and kernel" : "user space only", "op", "phase", "calls");
+	for (c = 0; c < PERF_COUNTERS; c++)
+		fprintf(fp, " %14s", perf_events[c].name);
+	fprintf(fp, " %6s\n", "IPC");
+	for (op = 0; op < OP_COUNT; op++)
+	{
+		if (sum->calls[op] == 0)
+			continue;
+		calls_total += sum->calls[op];
+		for (ph = 0; ph < PHASE_COUNT; ph++)
+		{
+			bool used = false;
+			for (c = 0; c < PERF_COUNTERS; c++)
+			{
+				phase_total[ph][c] += sum->value[op][ph][c];
+				used |= sum->value[op][ph][c] != 0;
+			}
+			if (used)
+				unsharedfs_perf_row(fp, unsharedfs_op_names[op], unsharedfs_phase_names[ph], sum->calls[op], sum->value[op][ph]);
+		}
+	}
+	// which phase dominates, over all operations:
+	fprintf(fp, "\n## CPU counters per phase, all operations\n");
+	for (ph = 0; ph < PHASE_COUNT; ph++)
+		unsharedfs_perf_row(fp, "all", unsharedfs_phase_names[ph], calls_total, phase_total[ph]);
+	free(sum);
+}
@@ -0,0 +1,80 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_PERF_H_
+#define UNSHAREDFS_PERF_H_
+
+#include "opctx.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * CPU performance counters per operation and phase.
+ *
+ * Every request thread opens a perf_event_open() group for itself and reads
+ * it whenever the current operation changes phase, so the counters are
+ * attributed to resolving paths, switching credentials, the backing syscalls
+ * and so on.  Each read is a system call, so this is meant for profiling the
+ * daemon, not for production.
+ */
+
+enum unsharedfs_perf_counter {
+	PERF_CYCLES
+	,PERF_INSTRUCTIONS
+	,PERF_CACHE_MISSES
+	,PERF_CTX_SWITCHES
+	,PERF_COUNTERS
+};
+
+_Static_assert(PERF_COUNTERS == OP_PERF_COUNTERS, "OP_PERF_COUNTERS must match the number of counters");
+
+/* per-thread counter sums; only ever written by the owning thread */
+struct unsharedfs_perfstats {
+	_Atomic uint64_t calls[OP_COUNT];
+	_Atomic uint64_t value[OP_COUNT][PHASE_COUNT][PERF_COUNTERS];
+};
+
+/**
+ * True if performance counters are collected.
+ */
+extern bool unsharedfs_perf_enabled;
+
+/**
+ * Check which counters are available, and enable collection if any is.
+ * @return 1 on success, 0 on error (errno is set).
+ */
+int unsharedfs_perf_init(void);
+
+/**
+ * Read the counters of the calling thread (opening them on first use).
+ * Counters that are not available read as 0.
+ */
+void unsharedfs_perf_read(uint64_t value[PERF_COUNTERS]);
+
+/**
+ * Attribute the counter deltas between start and end to a phase of an
+ * operation.
+ */
+void unsharedfs_perf_account(enum unsharedfs_op op, enum unsharedfs_phase phase, const uint64_t start[PERF_COUNTERS], const uint64_t end[PERF_COUNTERS]);
+
+/**
+ * Count a finished operation.
+ */
+void unsharedfs_perf_finish(enum unsharedfs_op op);
+
+/**
+ * Write the counters per operation and phase.
+ */
+void unsharedfs_perf_report(FILE *fp);
+
+#endif
@@ -0,0 +1,304 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#include "provision.h"
+#include "basedir.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// users handed to a worker at once:
+#define PROVISION_BATCH 256
+// ids are up to 10 digits long:
+#define PROVISION_NAME_LEN 16
+
+struct provision_entry {
+	unsigned long id;
+	uid_t uid;
+	gid_t gid;
+};
+
+struct provision_batch {
+	struct provision_batch *next;
+	size_t count;
+	struct provision_entry entries[PROVISION_BATCH];
+};
+
+/* work queue between the NSS enumeration and the workers */
+struct provision_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct provision_batch *head;
+	struct provision_batch *tail;
+	bool done;
+	int basefd;
+	enum unsharedfs_fsmode fsmode;
+	_Atomic unsigned long created;
+	_Atomic unsigned long existed;
+	_Atomic unsigned long failed;
+};
+
+/* add the ids of the existing uid directories to the set, marked */
+static int provision_scan_entry(const char *name, unsigned char type, void *arg)
+{
+	unsigned long id;
+
+	if (unsharedfs_basedir_parse_id(name, &id) && !unsharedfs_idset_add(arg, id, true) && errno != 0)
+		return 0;
+	return 1;
+}
+
+/* create and chown the directory for one entry */
+static void provision_create(struct provision_queue *q, const struct provision_entry *e)
+{
+	char name[PROVISION_NAME_LEN];
+	uid_t uid = (uid_t)-1;
+	gid_t gid = (gid_t)-1;
+
+	snprintf(name, sizeof(name), "%lu", e->id);
+	if (mkdirat(q->basefd, name, 0777) != 0)
+	{
+		if (errno == EEXIST)
+		{
+			// created since the scan
+			atomic_fetch_add_explicit(&q->existed, 1, memory_order_relaxed);
+			return;
+		}
+		fprintf(stderr, "mkdir %s: %s\n", name, strerror(errno));
+		atomic_fetch_add_explicit(&q->failed, 1, memory_order_relaxed);
+		return;
+	}
+	// like unsharedfs-prepare: chown the user, or chgrp the group
+	if (q->fsmode == GID_ONLY)
+		gid = e->gid;
+	else
+		uid = e->uid;
+	if (fchownat(q->basefd, name, uid, gid, AT_SYMLINK_NOFOLLOW) != 0)
+	{
+		fprintf(stderr, "chown %s: %s\n", name, strerror(errno));
+		atomic_fetch_add_explicit(&q->failed, 1, memory_order_relaxed);
+		return;
+	}
+	atomic_fetch_add_explicit(&q->created, 1, memory_order_relaxed);
+}
+
+static void *provision_worker(void *arg)
+{
+	struct provision_queue *q = arg;
+
+	for (;;)
+	{
+		struct provision_batch *b;
+		size_t i;
+
+		pthread_mutex_lock(&q->lock);
+		while (q->head == NULL && !q->done)
+			pthread_cond_wait(&q->cond, &q->lock);
+		b = q->head;
+		if (b != NULL)
+		{
+			q->head = b->next;
+			if (q->head == NULL)
+				q->tail = NULL;
+		}
+		pthread_mutex_unlock(&q->lock);
+		if (b == NULL)
+			return NULL;
+		for (i = 0; i < b->count; i++)
+			provision_create(q, &b->entries[i]);
+		free(b);
+	}
+}
+
+static void provision_push(struct provision_queue *q, struct provision_batch *b)
+{
+	pthread_mutex_lock(&q->lock);
+	if (q->tail != NULL)
+		q->tail->next = b;
+	else
+		q->head = b;
+	q->tail = b;
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+/* create the fallback directory, owned by the caller */
+static int provision_defaultdir(int basefd, const char *defaultdir, bool dry_run)
+{
+	if (dry_run)
+	{
+		printf("mkdir %s\n", defaultdir);
+		return 1;
+	}
+	if (mkdirat(basefd, defaultdir, 0777) != 0 && errno != EEXIST)
+	{
+		fprintf(stderr, "mkdir %s: %s\n", defaultdir, strerror(errno));
+		return 0;
+	}
+	return 1;
+}
+
+int unsharedfs_provision(const struct unsharedfs_state *pdata)
+{
+	struct unsharedfs_idset set = { NULL, 0, 0 };
+	struct provision_queue q;
+	struct provision_batch *batch = NULL;
+	pthread_t *workers;
+	unsigned long nworkers = 0, users = 0, i;
+	struct timespec start, end;
+	struct passwd *pw;
+	int ok = 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	memset(&q, 0, sizeof(q));
+	q.fsmode = pdata->fsmode;
+	q.basefd = open(pdata->rootdir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (q.basefd < 0)
+	{
+		fprintf(stderr, "Cannot open %s: %s\n", pdata->rootdir, strerror(errno));
+		return 0;
+	}
+	if (!unsharedfs_basedir_scan(q.basefd, provision_scan_entry, &set))
+	{
+		fprintf(stderr, "Cannot read %s: %s\n", pdata->rootdir, strerror(errno));
+		close(q.basefd);
+		unsharedfs_idset_free(&set);
+		return 0;
+	}
+	if (pdata->defaultdir != NULL && !provision_defaultdir(q.basefd, pdata->defaultdir, pdata->provision_dry_run))
+		ok = 0;
+
+	workers = calloc(pdata->provision_threads, sizeof(*workers));
+	if (workers == NULL)
+	{
+		perror("unsharedfs provision");
+		close(q.basefd);
+		unsharedfs_idset_free(&set);
+		return 0;
+	}
+	pthread_mutex_init(&q.lock, NULL);
+	pthread_cond_init(&q.cond, NULL);
+	if (!pdata->provision_dry_run)
+	{
+		for (nworkers = 0; nworkers < pdata->provision_threads; nworkers++)
+			if (pthread_create(&workers[nworkers], NULL, provision_worker, &q) != 0)
+				break;
+		if (nworkers == 0)
+		{
+			fprintf(stderr, "unsharedfs provision: cannot start worker threads\n");
+			ok = 0;
+		}
+	}
+
+	// enumerate NSS once, and stream the missing ids to the workers:
+	setpwent();
+	while (ok)
+	{
+		unsigned long id;
+
+		errno = 0;
+		pw = getpwent();
+		if (pw == NULL)
+		{
+			if (errno != 0 && errno != ENOENT)
+			{
+				fprintf(stderr, "Cannot enumerate users: %s\n", strerror(errno));
+				ok = 0;
+			}
+			break;
+		}
+		if (pw->pw_uid < pdata->provision_uid_min || pw->pw_uid > pdata->provision_uid_max)
+			continue;
+		users++;
+		id = pdata->fsmode == GID_ONLY ? pw->pw_gid : pw->pw_uid;
+		if (!unsharedfs_idset_add(&set, id, false))
+		{
+			if (errno != 0)
+			{
+				perror("unsharedfs provision");
+				ok = 0;
+				break;
+			}
+			// count each existing directory once, not once per member of a group:
+			if (unsharedfs_idset_mark(&set, id, false) == 1)
+				atomic_fetch_add_explicit(&q.existed, 1, memory_order_relaxed);
+			continue;
+		}
+		if (pdata->provision_dry_run)
+		{
+			if (pdata->fsmode == GID_ONLY)
+				printf("mkdir %lu; chgrp %lu %lu\n", id, (unsigned long)pw->pw_gid, id);
+			else
+				printf("mkdir %lu; chown %lu %lu\n", id, (unsigned long)pw->pw_uid, id);
+			atomic_fetch_add_explicit(&q.created, 1, memory_order_relaxed);
+			continue;
+		}
+		if (batch == NULL)
+		{
+			batch = malloc(sizeof(*batch));
+			if (batch == NULL)
+			{
+				perror("unsharedfs provision");
+				ok = 0;
+				break;
+			}
+			batch->next = NULL;
+			batch->count = 0;
+		}
+		batch->entries[batch->count].id = id;
+		batch->entries[batch->count].uid = pw->pw_uid;
+		batch->entries[batch->count].gid = pw->pw_gid;
+		if (++batch->count == PROVISION_BATCH)
+		{
+			provision_push(&q, batch);
+			batch = NULL;
+		}
+	}
+	endpwent();
+	if (batch != NULL)
+		provision_push(&q, batch);
+
+	pthread_mutex_lock(&q.lock);
+	q.done = true;
+	pthread_cond_broadcast(&q.cond);
+	pthread_mutex_unlock(&q.lock);
+	for (i = 0; i < nworkers; i++)
+		pthread_join(workers[i], NULL);
+	// left over if no worker could be started:
+	while (q.head != NULL)
+	{
+		batch = q.head;
+		q.head = batch->next;
+		free(batch);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("%s%lu users, %lu directories %s, %lu existed, %lu failed (%.2f s)\n",
+			pdata->provision_dry_run ? "dry run: " : "", users,
+			atomic_load(&q.created), pdata->provision_dry_run ? "to create" : "created",
+			atomic_load(&q.existed), atomic_load(&q.failed),
+			(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+	pthread_cond_destroy(&q.cond);
+	pthread_mutex_destroy(&q.lock);
+	free(workers);
+	unsharedfs_idset_free(&set);
+	close(q.basefd);
+	return ok && atomic_load(&q.failed) == 0;
+}
@@ -0,0 +1,34 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_PROVISION_H_
+#define UNSHAREDFS_PROVISION_H_
+
+#include "fs.h"
+
+/*
+ * Provisioning creates the uid (or gid) directories in the base directory
+ * for all users known to NSS, like scripts/unsharedfs-prepare -a, but without
+ * forking per user: the password database is enumerated once, existing
+ * directories are found with a single scan of the base directory, and the
+ * missing ones are created by a pool of threads with mkdirat/fchownat.
+ */
+
+/**
+ * Create the missing directories in pdata->rootdir, and the fallback
+ * directory (pdata->defaultdir) if one is set.
+ * Progress and errors are printed to stdout and stderr.
+ * @param pdata the file system configuration (rootdir, defaultdir, fsmode and
+ *        the provision_* options are used)
+ * @return 1 if all directories were created, 0 on error.
+ */
+int unsharedfs_provision(const struct unsharedfs_state *pdata);
+
+#endif
@@ -0,0 +1,205 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#include "fs.h"
+#include "record.h"
+#include "thread.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// per-thread record buffer; the monitor empties it every MONITOR_TICK_MS:
+#define RECORD_RING_SIZE (4 * 1024 * 1024)
+// paths are cut off at this length:
+#define RECORD_PATH_MAX (PATH_MAX - 1)
+
+struct unsharedfs_record_buf {
+	struct unsharedfs_record_op rec;
+	char paths[2 * RECORD_PATH_MAX];
+};
+
+_Atomic bool unsharedfs_recording = false;
+
+// serialises flushing and stopping (never taken by request threads):
+static pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *record_fp = NULL;
+static struct unsharedfs_record_header record_header;
+static uint64_t record_start_ns;
+
+int unsharedfs_record_start(const char *file)
+{
+	char names[OP_COUNT][UNSHAREDFS_RECORD_NAME_LEN];
+	struct timespec real;
+	FILE *fp;
+	int i, fd;
+
+	pthread_mutex_lock(&record_lock);
+	if (record_fp != NULL)
+	{
+		pthread_mutex_unlock(&record_lock);
+		errno = EBUSY;
+		return 0;
+	}
+	// the recording holds the paths of all users:
+	fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	if (fd < 0 || (fp = fdopen(fd, "w")) == NULL)
+	{
+		if (fd >= 0)
+			close(fd);
+		pthread_mutex_unlock(&record_lock);
+		return 0;
+	}
+	clock_gettime(CLOCK_REALTIME, &real);
+	memset(&record_header, 0, sizeof(record_header));
+	memcpy(record_header.magic, UNSHAREDFS_RECORD_MAGIC, sizeof(UNSHAREDFS_RECORD_MAGIC));
+	record_header.version = UNSHAREDFS_RECORD_VERSION;
+	record_header.header_size = sizeof(struct unsharedfs_record_header);
+	record_header.record_size = sizeof(struct unsharedfs_record_op);
+	record_header.op_count = OP_COUNT;
+	record_header.start_ns = (uint64_t) real.tv_sec * 1000000000 + real.tv_nsec;
+	memset(names, 0, sizeof(names));
+	for (i = 0; i < OP_COUNT; i++)
+		strncpy(names[i], unsharedfs_op_names[i], UNSHAREDFS_RECORD_NAME_LEN - 1);
+	if (fwrite(&record_header, sizeof(record_header), 1, fp) != 1
+			|| fwrite(names, sizeof(names), 1, fp) != 1)
+	{
+		fclose(fp);
+		pthread_mutex_unlock(&record_lock);
+		return 0;
+	}
+	record_fp = fp;
+	record_start_ns = unsharedfs_now_ns();
+	atomic_store(&unsharedfs_recording, true);
+	pthread_mutex_unlock(&record_lock);
+	return 1;
+}
+
+static size_t unsharedfs_record_path(char *dst, const char *path, uint16_t *len)
+{
+	size_t n = path ? strlen(path) : 0;
+
+	if (n > RECORD_PATH_MAX)
+		n = RECORD_PATH_MAX;
+	memcpy(dst, path, n);
+	*len = n;
+	return n;
+}
+
+void unsharedfs_record_op(const struct unsharedfs_opctx *op, uint64_t duration_ns, int retstat)
+{
+	struct unsharedfs_thread *t = unsharedfs_thread_self();
+	struct unsharedfs_ring *ring;
+	struct unsharedfs_record_buf buf;
+	struct unsharedfs_record_op *rec = &buf.rec;
+	size_t len;
+
+	// operations that started before the recording are left out:
+	if (t == NULL || op->start_ns < record_start_ns)
+		return;
+	ring = atomic_load_explicit(&t->record, memory_order_acquire);
+	if (ring == NULL)
+	{
+		// first operation of this thread:
+		ring = malloc(sizeof(*ring));
+		if (ring == NULL)
+			return;
+		if (!unsharedfs_ring_init(ring, RECORD_RING_SIZE))
+		{
+			free(ring);
+			return;
+		}
+		atomic_store_explicit(&t->record, ring, memory_order_release);
+	}
+	rec->start_ns = op->start_ns - record_start_ns;
+	rec->duration_ns = duration_ns;
+	rec->fh = op->args.fh;
+	rec->offset = op->args.offset;
+	rec->size = op->args.size;
+	rec->tid = t->tid;
+	rec->uid = op->uid;
+	rec->gid = fuse_get_context()->gid;
+	rec->mode = op->args.mode;
+	rec->flags = op->args.flags;
+	rec->result = retstat;
+	rec->op = op->op;
+	rec->reserved = 0;
+	len = unsharedfs_record_path(buf.paths, op->path, &rec->pathlen);
+	len += unsharedfs_record_path(buf.paths + len, op->args.path2, &rec->path2len);
+	unsharedfs_ring_put(ring, &buf, sizeof(*rec) + len);
+}
+
+/* write all buffered records; record_lock must be held */
+static void unsharedfs_record_drain(void)
+{
+	size_t i, n = unsharedfs_thread_count();
+	struct unsharedfs_record_buf buf;
+
+	for (i = 0; i < n; i++)
+	{
+		struct unsharedfs_thread *t = unsharedfs_thread_get(i);
+		struct unsharedfs_ring *ring;
+		size_t len;
+
+		if (t == NULL)
+			continue;
+		ring = atomic_load_explicit(&t->record, memory_order_acquire);
+		if (ring == NULL)
+			continue;
+		while ((len = unsharedfs_ring_get(ring, &buf, sizeof(buf))) != 0)
+		{
+			fwrite(&buf, len, 1, record_fp);
+			record_header.records++;
+		}
+	}
+}
+
+void unsharedfs_record_flush(void)
+{
+	pthread_mutex_lock(&record_lock);
+	if (record_fp != NULL)
+	{
+		unsharedfs_record_drain();
+		fflush(record_fp);
+	}
+	pthread_mutex_unlock(&record_lock);
+}
+
+void unsharedfs_record_stop(void)
+{
+	size_t i, n = unsharedfs_thread_count();
+
+	pthread_mutex_lock(&record_lock);
+	if (record_fp != NULL)
+	{
+		atomic_store(&unsharedfs_recording, false);
+		unsharedfs_record_drain();
+		for (i = 0; i < n; i++)
+		{
+			struct unsharedfs_thread *t = unsharedfs_thread_get(i);
+			struct unsharedfs_ring *ring = t ? atomic_load(&t->record) : NULL;
+			if (ring)
+				record_header.dropped += atomic_exchange(&ring->dropped, 0);
+		}
+		// the final counts go into the header:
+		if (fseek(record_fp, 0, SEEK_SET) == 0)
+			fwrite(&record_header, sizeof(record_header), 1, record_fp);
+		fclose(record_fp);
+		record_fp = NULL;
+	}
+	pthread_mutex_unlock(&record_lock);
+}
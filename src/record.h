@@ -0,0 +1,96 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_RECORD_H_
+#define UNSHAREDFS_RECORD_H_
+
+#include "opctx.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * The operation recorder writes every operation (with its arguments, timing
+ * and result) to a binary file, for replaying it later with
+ * bench/unsharedfs-replay.  Operations are queued in per-thread buffers and
+ * written by the monitor thread.
+ *
+ * File layout (native byte order):
+ *   struct unsharedfs_record_header
+ *   op_count names of UNSHAREDFS_RECORD_NAME_LEN bytes each, indexed by
+ *     the op field of the records
+ *   records: struct unsharedfs_record_op, followed by pathlen bytes of
+ *     path and path2len bytes of path2 (not NUL-terminated)
+ * Records are ordered by the thread that wrote them, not globally by time.
+ */
+
+#define UNSHAREDFS_RECORD_MAGIC "USFSREC"
+#define UNSHAREDFS_RECORD_VERSION 1
+#define UNSHAREDFS_RECORD_NAME_LEN 16
+
+struct unsharedfs_record_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;  /* sizeof(struct unsharedfs_record_header) */
+	uint32_t record_size;  /* sizeof(struct unsharedfs_record_op) */
+	uint32_t op_count;
+	uint64_t start_ns;     /* CLOCK_REALTIME at the start of the recording */
+	uint64_t records;      /* updated when the recording is finished */
+	uint64_t dropped;      /* operations lost because a buffer was full */
+};
+
+struct unsharedfs_record_op {
+	uint64_t start_ns;     /* relative to the start of the recording */
+	uint64_t duration_ns;
+	uint64_t fh;
+	uint64_t offset;
+	uint64_t size;
+	uint32_t tid;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t mode;
+	uint32_t flags;
+	int32_t result;
+	uint16_t op;
+	uint16_t pathlen;
+	uint16_t path2len;
+	uint16_t reserved;
+};
+
+/**
+ * True while operations are recorded.
+ */
+extern _Atomic bool unsharedfs_recording;
+
+/**
+ * Start recording operations.
+ * @param file the record file (overwritten)
+ * @return 1 on success, 0 on error (errno is set).
+ */
+int unsharedfs_record_start(const char *file);
+
+/**
+ * Record a finished operation.  Called on the request thread.
+ */
+void unsharedfs_record_op(const struct unsharedfs_opctx *op, uint64_t duration_ns, int retstat);
+
+/**
+ * Move the recorded operations to the file.  Called periodically from the
+ * monitor thread.
+ */
+void unsharedfs_record_flush(void);
+
+/**
+ * Finish the recording, if any.
+ */
+void unsharedfs_record_stop(void);
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#include "ring.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+int unsharedfs_ring_init(struct unsharedfs_ring *ring, size_t size)
+{
+	size_t rsize = 64;
+
+	while (rsize < size)
+		rsize <<= 1;
+	ring->buf = malloc(rsize);
+	if (ring->buf == NULL)
+		return 0;
+	ring->mask = rsize - 1;
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	atomic_init(&ring->dropped, 0);
+	return 1;
+}
+
+void unsharedfs_ring_destroy(struct unsharedfs_ring *ring)
+{
+	free(ring->buf);
+	ring->buf = NULL;
+}
+
+/* copy len bytes to the ring, starting at position pos */
+static void unsharedfs_ring_copy_in(struct unsharedfs_ring *ring, size_t pos, const void *src, size_t len)
+{
+	size_t off = pos & ring->mask;
+	size_t first = ring->mask + 1 - off;
+
+	if (first >= len)
+		memcpy(ring->buf + off, src, len);
+	else
+	{
+		memcpy(ring->buf + off, src, first);
+		memcpy(ring->buf, (const char *) src + first, len - first);
+	}
+}
+
+/* copy len bytes from the ring, starting at position pos */
+static void unsharedfs_ring_copy_out(const struct unsharedfs_ring *ring, size_t pos, void *dst, size_t len)
+{
+	size_t off = pos & ring->mask;
+	size_t first = ring->mask + 1 - off;
+
+	if (first >= len)
+		memcpy(dst, ring->buf + off, len);
+	else
+	{
+		memcpy(dst, ring->buf + off, first);
+		memcpy((char *) dst + first, ring->buf, len - first);
+	}
+}
+
+bool unsharedfs_ring_put(struct unsharedfs_ring *ring, const void *rec, size_t len)
+{
+	uint32_t hdr = len;
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+	if (head - tail + sizeof(hdr) + len > ring->mask + 1)
+	{
+		atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+		return false;
+	}
+	unsharedfs_ring_copy_in(ring, head, &hdr, sizeof(hdr));
+	unsharedfs_ring_copy_in(ring, head + sizeof(hdr), rec, len);
+	atomic_store_explicit(&ring->head, head + sizeof(hdr) + len, memory_order_release);
+	return true;
+}
+
+size_t unsharedfs_ring_get(struct unsharedfs_ring *ring, void *rec, size_t maxlen)
+{
+	uint32_t hdr;
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+	if (head == tail)
+		return 0;
+	unsharedfs_ring_copy_out(ring, tail, &hdr, sizeof(hdr));
+	unsharedfs_ring_copy_out(ring, tail + sizeof(hdr), rec, hdr < maxlen ? hdr : maxlen);
+	atomic_store_explicit(&ring->tail, tail + sizeof(hdr) + hdr, memory_order_release);
+	return hdr < maxlen ? hdr : maxlen;
+}
@@ -0,0 +1,62 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_RING_H_
+#define UNSHAREDFS_RING_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A lock-free ring buffer for variable-sized records with exactly one
+ * producer and one consumer thread.
+ * Records that do not fit are dropped (and counted) rather than blocking the
+ * producer.
+ */
+struct unsharedfs_ring {
+	// written by the producer:
+	_Atomic size_t head __attribute__((aligned(64)));
+	_Atomic unsigned long dropped;
+	// written by the consumer:
+	_Atomic size_t tail __attribute__((aligned(64)));
+	// constant:
+	char *buf __attribute__((aligned(64)));
+	size_t mask;
+};
+
+/**
+ * Allocate a ring buffer.
+ * @param ring the ring to initialise
+ * @param size buffer size in bytes (rounded up to a power of two)
+ * @return 1 on success, 0 on error (errno is set).
+ */
+int unsharedfs_ring_init(struct unsharedfs_ring *ring, size_t size);
+
+/**
+ * Free the buffer of a ring.
+ */
+void unsharedfs_ring_destroy(struct unsharedfs_ring *ring);
+
+/**
+ * Append a record (producer side).
+ * @return true if the record was added, false if it was dropped.
+ */
+bool unsharedfs_ring_put(struct unsharedfs_ring *ring, const void *rec, size_t len);
+
+/**
+ * Remove the oldest record (consumer side).
+ * @param rec the buffer for the record
+ * @param maxlen size of rec; longer records are truncated
+ * @return the length of the record, or 0 if the ring is empty.
+ */
+size_t unsharedfs_ring_get(struct unsharedfs_ring *ring, void *rec, size_t maxlen);
+
+#endif
@@ -0,0 +1,194 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#include "shmstats.h"
+#include "hot.h"
+#include "thread.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// the top uids are merged at most this often:
+#define SHM_TOP_INTERVAL_NS 1000000000ULL
+
+bool unsharedfs_shm_enabled = false;
+
+static struct unsharedfs_shm_header *shm_header = NULL;
+static struct unsharedfs_shm_thread *shm_blocks = NULL;
+static size_t shm_size;
+static char shm_name[NAME_MAX];
+static uint64_t shm_top_ns = 0;
+
+static uint64_t unsharedfs_shm_realtime_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* true if the segment of this name was left behind by a crashed instance of this user */
+static bool unsharedfs_shm_stale(const char *name)
+{
+	const struct unsharedfs_shm_header *h;
+	struct stat st;
+	bool stale = false;
+	int fd = shm_open(name, O_RDONLY, 0);
+
+	if (fd < 0)
+		return false;
+	if (fstat(fd, &st) == 0 && st.st_uid == geteuid())
+	{
+		if ((size_t) st.st_size < sizeof(*h))
+			stale = true;
+		else if ((h = mmap(NULL, sizeof(*h), PROT_READ, MAP_SHARED, fd, 0)) != MAP_FAILED)
+		{
+			// an instance that died while creating the segment leaves no magic:
+			stale = atomic_load(&h->magic) != UNSHAREDFS_SHM_MAGIC
+				|| (kill(h->pid, 0) != 0 && errno == ESRCH);
+			munmap((void *) h, sizeof(*h));
+		}
+	}
+	close(fd);
+	return stale;
+}
+
+int unsharedfs_shm_init(const char *name)
+{
+	struct unsharedfs_shm_header *h;
+	void *seg;
+	int fd, i, saved_errno;
+
+	if (snprintf(shm_name, sizeof(shm_name), "%s%s", name[0] == '/' ? "" : "/", name) >= (int) sizeof(shm_name))
+	{
+		errno = ENAMETOOLONG;
+		return 0;
+	}
+	shm_size = sizeof(struct unsharedfs_shm_header) + UNSHAREDFS_MAX_THREADS * sizeof(struct unsharedfs_shm_thread);
+	// never share a segment with another instance, or with another user:
+	fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+	if (fd < 0 && errno == EEXIST && unsharedfs_shm_stale(shm_name))
+	{
+		shm_unlink(shm_name);
+		fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+	}
+	if (fd < 0)
+		return 0;
+	if (ftruncate(fd, shm_size) != 0)
+		goto error;
+	seg = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (seg == MAP_FAILED)
+		goto error;
+	close(fd);
+
+	h = seg;
+	h->version = UNSHAREDFS_SHM_VERSION;
+	h->header_size = sizeof(struct unsharedfs_shm_header);
+	h->block_size = sizeof(struct unsharedfs_shm_thread);
+	h->max_threads = UNSHAREDFS_MAX_THREADS;
+	h->op_count = OP_COUNT;
+	h->lat_buckets = SHM_LAT_BUCKETS;
+	h->pid = getpid();
+	h->start_ns = unsharedfs_shm_realtime_ns();
+	atomic_store(&h->update_ns, h->start_ns);
+	for (i = 0; i < OP_COUNT; i++)
+		snprintf(h->op_names[i], SHM_OP_NAME_LEN, "%s", unsharedfs_op_names[i]);
+	atomic_store_explicit(&h->magic, UNSHAREDFS_SHM_MAGIC, memory_order_release);
+
+	shm_header = h;
+	shm_blocks = (struct unsharedfs_shm_thread *) ((char *) seg + sizeof(*h));
+	unsharedfs_shm_enabled = true;
+	return 1;
+
+error:
+	saved_errno = errno;
+	close(fd);
+	shm_unlink(shm_name);
+	errno = saved_errno;
+	return 0;
+}
+
+void unsharedfs_shm_destroy(void)
+{
+	unsharedfs_shm_enabled = false;
+	if (shm_header == NULL)
+		return;
+	munmap(shm_header, shm_size);
+	shm_header = NULL;
+	shm_blocks = NULL;
+	shm_unlink(shm_name);
+}
+
+void unsharedfs_shm_record(const struct unsharedfs_opctx *op, uint64_t duration_ns, int retstat)
+{
+	struct unsharedfs_thread *t = unsharedfs_thread_self();
+	struct unsharedfs_shm_thread *b;
+	uint32_t seq;
+
+	if (t == NULL)
+		return;
+	b = &shm_blocks[t->slot];
+	// only the owning thread writes the block, so plain increments of seq suffice:
+	seq = atomic_load_explicit(&b->seq, memory_order_relaxed);
+	atomic_store_explicit(&b->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	// the slot may have been handed over from an exited thread:
+	b->tid = t->tid;
+	unsharedfs_counter_add(&b->count[op->op], 1);
+	if (retstat < 0)
+		unsharedfs_counter_add(&b->errors[op->op], 1);
+	unsharedfs_counter_add(&b->ns[op->op], duration_ns);
+	unsharedfs_counter_add(&b->latency[op->op][unsharedfs_shm_lat_bucket(duration_ns)], 1);
+	atomic_store_explicit(&b->seq, seq + 2, memory_order_release);
+}
+
+void unsharedfs_shm_publish(void)
+{
+	struct unsharedfs_hot_entry top[SHM_TOP_UIDS];
+	struct unsharedfs_hot_entry bytes[HOT_TOPK];
+	struct unsharedfs_shm_header *h = shm_header;
+	uint64_t now;
+	uint32_t seq;
+	size_t i, j, n, nbytes;
+
+	if (h == NULL)
+		return;
+	now = unsharedfs_shm_realtime_ns();
+	atomic_store_explicit(&h->update_ns, now, memory_order_relaxed);
+	atomic_store_explicit(&h->nthreads, unsharedfs_thread_count(), memory_order_relaxed);
+
+	if (!unsharedfs_hot_enabled || now - shm_top_ns < SHM_TOP_INTERVAL_NS)
+		return;
+	shm_top_ns = now;
+	n = unsharedfs_hot_top(HOT_UID_OPS, top, SHM_TOP_UIDS);
+	nbytes = unsharedfs_hot_top(HOT_UID_BYTES, bytes, HOT_TOPK);
+	seq = atomic_load_explicit(&h->top_seq, memory_order_relaxed);
+	atomic_store_explicit(&h->top_seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	for (i = 0; i < n; i++)
+	{
+		h->top_uids[i].uid = top[i].key;
+		h->top_uids[i].ops = top[i].count;
+		h->top_uids[i].bytes = 0;
+		for (j = 0; j < nbytes; j++)
+			if (bytes[j].key == top[i].key)
+				h->top_uids[i].bytes = bytes[j].count;
+	}
+	h->top_used = n;
+	atomic_store_explicit(&h->top_seq, seq + 2, memory_order_release);
+}
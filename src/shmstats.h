@@ -0,0 +1,149 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_SHMSTATS_H_
+#define UNSHAREDFS_SHMSTATS_H_
+
+#include "opctx.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Shared-memory statistics segment.
+ *
+ * Request threads update their own block in the segment; external readers
+ * (such as unsharedfs-top) map it read-only and take snapshots without any
+ * involvement of the daemon.
+ *
+ * Layout: a header, followed by max_threads blocks of block_size bytes.
+ * Every block is protected by a sequence counter: it is odd while the owning
+ * thread updates the block, and readers retry if it was odd or changed while
+ * they copied the block.  The same applies to the top uid table in the header,
+ * which is published by the monitor thread.
+ *
+ * Readers must check magic and version (magic is written last when the
+ * segment is created) and should check header_size and block_size.
+ */
+
+#define UNSHAREDFS_SHM_MAGIC 0x53465355 /* "USFS" */
+#define UNSHAREDFS_SHM_VERSION 1
+// prefix of the name of the segment if none is given (see unsharedfs_shm_default_name()):
+#define UNSHAREDFS_SHM_DEFAULT_NAME "/unsharedfs"
+
+// latency bucket b counts operations taking less than 2^b microseconds (and at least 2^(b-1)):
+#define SHM_LAT_BUCKETS 32
+#define SHM_TOP_UIDS 16
+#define SHM_OP_NAME_LEN 16
+
+/* the statistics of one request thread */
+struct unsharedfs_shm_thread {
+	_Atomic uint32_t seq;
+	int32_t tid;
+	_Atomic uint64_t count[OP_COUNT];
+	_Atomic uint64_t errors[OP_COUNT];
+	_Atomic uint64_t ns[OP_COUNT];
+	_Atomic uint64_t latency[OP_COUNT][SHM_LAT_BUCKETS];
+} __attribute__((aligned(64)));
+
+struct unsharedfs_shm_uid {
+	uint64_t uid;
+	uint64_t ops;
+	uint64_t bytes;
+};
+
+struct unsharedfs_shm_header {
+	_Atomic uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t block_size;
+	uint32_t max_threads;
+	uint32_t op_count;
+	uint32_t lat_buckets;
+	int32_t pid;
+	uint64_t start_ns;            /* CLOCK_REALTIME when the segment was created */
+	_Atomic uint64_t update_ns;   /* CLOCK_REALTIME of the last monitor tick */
+	_Atomic uint32_t nthreads;    /* number of blocks that have been used */
+	char op_names[OP_COUNT][SHM_OP_NAME_LEN];
+	// heavy-hitter uids (only with --heavy-hitters), by operations:
+	_Atomic uint32_t top_seq;
+	uint32_t top_used;
+	struct unsharedfs_shm_uid top_uids[SHM_TOP_UIDS];
+} __attribute__((aligned(64)));
+
+/**
+ * Return the latency bucket of a duration.
+ */
+static inline unsigned int unsharedfs_shm_lat_bucket(uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	unsigned int b = 0;
+
+	while (us > 0 && b < SHM_LAT_BUCKETS - 1)
+	{
+		us >>= 1;
+		b++;
+	}
+	return b;
+}
+
+/**
+ * The name of the segment of a mount without --shm-stats=name: the default
+ * name followed by the mount point, with '-' for '/'
+ * (/my-directory: /unsharedfs-my-directory).
+ * @param mountpoint the absolute path of the mount point
+ * @return true on success, false if the name would be too long.
+ */
+static inline bool unsharedfs_shm_default_name(const char *mountpoint, char *name, size_t size)
+{
+	int len = snprintf(name, size, "%s%s", UNSHAREDFS_SHM_DEFAULT_NAME, mountpoint);
+	char *c;
+
+	if (len < 0 || (size_t) len >= size)
+		return false;
+	for (c = name + 1; *c != '\0'; c++)
+		if (*c == '/')
+			*c = '-';
+	return true;
+}
+
+/**
+ * True if the statistics segment is in use.
+ */
+extern bool unsharedfs_shm_enabled;
+
+/**
+ * Create the statistics segment.  A segment of the same name is only
+ * replaced if it was left behind by an instance of the same user that is no
+ * longer running; otherwise, errno is EEXIST.
+ * @param name the POSIX shared memory name (a leading '/' is added if missing)
+ * @return 1 on success, 0 on error (errno is set).
+ */
+int unsharedfs_shm_init(const char *name);
+
+/**
+ * Unmap and remove the segment.
+ */
+void unsharedfs_shm_destroy(void);
+
+/**
+ * Count a finished operation in the block of the calling thread.
+ */
+void unsharedfs_shm_record(const struct unsharedfs_opctx *op, uint64_t duration_ns, int retstat);
+
+/**
+ * Update the header (heartbeat, thread count, top uids).
+ * Called periodically from the monitor thread.
+ */
+void unsharedfs_shm_publish(void);
+
+#endif
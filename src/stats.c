@@ -0,0 +1,144 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+// for localtime_r, mkostemp
+#define _GNU_SOURCE
+
+#include "stats.h"
+#include "cputime.h"
+#include "hot.h"
+#include "iostats.h"
+#include "perf.h"
+#include "thread.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+bool unsharedfs_stats_enabled = false;
+
+static char *stats_file = NULL;
+static uint64_t stats_start_ns;
+
+int unsharedfs_stats_init(const char *file)
+{
+	if (file != NULL)
+	{
+		stats_file = strdup(file);
+		if (stats_file == NULL)
+			return 0;
+	}
+	stats_start_ns = unsharedfs_now_ns();
+	unsharedfs_stats_enabled = true;
+	return 1;
+}
+
+void unsharedfs_stats_destroy(void)
+{
+	unsharedfs_stats_enabled = false;
+	free(stats_file);
+	stats_file = NULL;
+}
+
+void unsharedfs_stats_record(const struct unsharedfs_opctx *op, uint64_t duration_ns, int retstat)
+{
+	struct unsharedfs_thread *t = unsharedfs_thread_self();
+
+	if (t == NULL)
+		return;
+	unsharedfs_counter_add(&t->ops[op->op].count, 1);
+	if (retstat < 0)
+		unsharedfs_counter_add(&t->ops[op->op].errors, 1);
+	unsharedfs_counter_add(&t->ops[op->op].ns, duration_ns);
+}
+
+void unsharedfs_stats_report(FILE *fp)
+{
+	uint64_t count[OP_COUNT] = { 0 }, errors[OP_COUNT] = { 0 }, ns[OP_COUNT] = { 0 };
+	size_t i, nthreads = unsharedfs_thread_count();
+	time_t now = time(NULL);
+	struct tm tm;
+	char timebuf[32];
+	int op;
+
+	localtime_r(&now, &tm);
+	strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S", &tm);
+	fprintf(fp, "# unsharedfs statistics at %s\n", timebuf);
+	fprintf(fp, "uptime: %llu s\n", (unsigned long long) (unsharedfs_now_ns() - stats_start_ns) / 1000000000);
+	fprintf(fp, "threads: %zu\n", nthreads);
+
+	for (i = 0; i < nthreads; i++)
+	{
+		struct unsharedfs_thread *t = unsharedfs_thread_get(i);
+		if (t == NULL)
+			continue;
+		for (op = 0; op < OP_COUNT; op++)
+		{
+			count[op] += atomic_load_explicit(&t->ops[op].count, memory_order_relaxed);
+			errors[op] += atomic_load_explicit(&t->ops[op].errors, memory_order_relaxed);
+			ns[op] += atomic_load_explicit(&t->ops[op].ns, memory_order_relaxed);
+		}
+	}
+
+	fprintf(fp, "\n## operations\n%-12s %20s %20s %12s\n", "op", "count", "errors", "avg.us");
+	for (op = 0; op < OP_COUNT; op++)
+	{
+		if (count[op] == 0)
+			continue;
+		fprintf(fp, "%-12s %20llu %20llu %12.1f\n"
+				, unsharedfs_op_names[op]
+				, (unsigned long long) count[op]
+				, (unsigned long long) errors[op]
+				, ns[op] / 1e3 / count[op]);
+	}
+
+	if (unsharedfs_hot_enabled)
+		unsharedfs_hot_report(fp);
+	if (unsharedfs_iostats_enabled)
+		unsharedfs_iostats_report(fp);
+	if (unsharedfs_perf_enabled)
+		unsharedfs_perf_report(fp);
+	if (unsharedfs_cputime_enabled)
+		unsharedfs_cputime_report(fp);
+}
+
+void unsharedfs_stats_dump(const char *reason)
+{
+	char tmpfile[PATH_MAX];
+	FILE *fp;
+	int fd;
+
+	if (stats_file == NULL)
+		return;
+	// write to a temporary file first, so readers never see a partial report;
+	// it lists the paths of all users, so it is only readable by the daemon's user:
+	if (snprintf(tmpfile, sizeof(tmpfile), "%s.XXXXXX", stats_file) >= (int) sizeof(tmpfile))
+		return;
+	fd = mkostemp(tmpfile, O_CLOEXEC);
+	if (fd < 0)
+		return;
+	fp = fdopen(fd, "w");
+	if (fp == NULL)
+	{
+		close(fd);
+		unlink(tmpfile);
+		return;
+	}
+	unsharedfs_stats_report(fp);
+	fprintf(fp, "\n# end of report (%s)\n", reason);
+	if (fclose(fp) == 0)
+		rename(tmpfile, stats_file);
+	else
+		unlink(tmpfile);
+}
@@ -0,0 +1,59 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_STATS_H_
+#define UNSHAREDFS_STATS_H_
+
+#include "opctx.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * The statistics report collects the per-thread counters of all threads.
+ * It is written to the stats file on SIGUSR2 and when the file system is
+ * unmounted.
+ */
+
+/**
+ * True if per-operation counters are maintained.
+ */
+extern bool unsharedfs_stats_enabled;
+
+/**
+ * Enable the statistics.
+ * @param file the stats file (may be NULL)
+ * @return 1 on success, 0 on error (errno is set).
+ */
+int unsharedfs_stats_init(const char *file);
+
+/**
+ * Release the resources of the statistics.
+ */
+void unsharedfs_stats_destroy(void);
+
+/**
+ * Count a finished operation.  Called on the request thread.
+ */
+void unsharedfs_stats_record(const struct unsharedfs_opctx *op, uint64_t duration_ns, int retstat);
+
+/**
+ * Write the statistics report.
+ */
+void unsharedfs_stats_report(FILE *fp);
+
+/**
+ * Replace the stats file with a fresh report.
+ * @param reason a short description why the report was triggered
+ */
+void unsharedfs_stats_dump(const char *reason);
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#include "thread.h"
+#include "opctx.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+static _Atomic(struct unsharedfs_thread *) threads[UNSHAREDFS_MAX_THREADS];
+static _Atomic size_t thread_count = 0;
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+static __thread struct unsharedfs_thread *thread_self = NULL;
+
+/* called on thread exit: hand the slot over to the next new thread */
+static void unsharedfs_thread_release(void *arg)
+{
+	struct unsharedfs_thread *t = arg;
+	atomic_store(&t->active, false);
+}
+
+static void unsharedfs_thread_make_key(void)
+{
+	pthread_key_create(&thread_key, unsharedfs_thread_release);
+}
+
+struct unsharedfs_thread *unsharedfs_thread_self(void)
+{
+	struct unsharedfs_thread *t;
+	size_t i, n;
+
+	if (thread_self != NULL)
+		return thread_self;
+
+	pthread_once(&thread_key_once, unsharedfs_thread_make_key);
+
+	// reuse the slot of an exited thread:
+	n = atomic_load(&thread_count);
+	for (i = 0; i < n && i < UNSHAREDFS_MAX_THREADS; i++)
+	{
+		bool inactive = false;
+		t = atomic_load(&threads[i]);
+		if (t != NULL && atomic_compare_exchange_strong(&t->active, &inactive, true))
+			goto found;
+	}
+
+	i = atomic_fetch_add(&thread_count, 1);
+	if (i >= UNSHAREDFS_MAX_THREADS)
+	{
+		atomic_fetch_sub(&thread_count, 1);
+		return NULL;
+	}
+	if (posix_memalign((void **) &t, 64, sizeof(*t)) != 0)
+	{
+		// leave the slot empty:
+		return NULL;
+	}
+	memset(t, 0, sizeof(*t));
+	t->slot = i;
+	atomic_init(&t->active, true);
+	atomic_store(&threads[i], t);
+
+found:
+	t->tid = unsharedfs_gettid();
+	thread_self = t;
+	pthread_setspecific(thread_key, t);
+	return t;
+}
+
+size_t unsharedfs_thread_count(void)
+{
+	size_t n = atomic_load(&thread_count);
+	return n < UNSHAREDFS_MAX_THREADS ? n : UNSHAREDFS_MAX_THREADS;
+}
+
+struct unsharedfs_thread *unsharedfs_thread_get(size_t index)
+{
+	return atomic_load(&threads[index]);
+}
+
+void unsharedfs_thread_destroy_all(void)
+{
+	size_t i, n = unsharedfs_thread_count();
+
+	for (i = 0; i < n; i++)
+	{
+		struct unsharedfs_thread *t = atomic_load(&threads[i]);
+		struct unsharedfs_ring *ring;
+
+		if (t == NULL)
+			continue;
+		ring = atomic_exchange(&t->trace, NULL);
+		if (ring)
+		{
+			unsharedfs_ring_destroy(ring);
+			free(ring);
+		}
+		ring = atomic_exchange(&t->record, NULL);
+		if (ring)
+		{
+			unsharedfs_ring_destroy(ring);
+			free(ring);
+		}
+		ring = atomic_exchange(&t->changes, NULL);
+		if (ring)
+		{
+			unsharedfs_ring_destroy(ring);
+			free(ring);
+		}
+		ring = atomic_exchange(&t->log, NULL);
+		if (ring)
+		{
+			unsharedfs_ring_destroy(ring);
+			free(ring);
+		}
+		free(atomic_exchange(&t->hot, NULL));
+		free(atomic_exchange(&t->perf, NULL));
+		free(atomic_exchange(&t->cputime, NULL));
+	}
+}
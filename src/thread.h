@@ -0,0 +1,100 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_THREAD_H_
+#define UNSHAREDFS_THREAD_H_
+
+#include "iostats.h"
+#include "opctx.h"
+#include "ring.h"
+
+#include <sys/types.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// maximum number of threads that get per-thread diagnostic state:
+#define UNSHAREDFS_MAX_THREADS 256
+
+struct unsharedfs_hot;
+struct unsharedfs_perfstats;
+struct unsharedfs_cputime;
+
+/* operation counters; only ever written by the owning thread */
+struct unsharedfs_opstats {
+	_Atomic uint64_t count;
+	_Atomic uint64_t errors;
+	_Atomic uint64_t ns;
+};
+
+/**
+ * Add to a counter that has a single writer.
+ * Cheaper than an atomic increment, but still safe to read from other threads.
+ */
+static inline void unsharedfs_counter_add(_Atomic uint64_t *counter, uint64_t value)
+{
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+/*
+ * Per-thread diagnostic state.
+ * Each thread handling requests owns one of these; background threads read
+ * them without locking.  Slots of exited threads are reused by new threads.
+ */
+struct unsharedfs_thread {
+	pid_t tid;
+	// index in the thread table:
+	unsigned int slot;
+	_Atomic bool active;
+	// span buffer for the request tracer (NULL until first used):
+	_Atomic(struct unsharedfs_ring *) trace;
+	// operation buffer for the recorder (NULL until first used):
+	_Atomic(struct unsharedfs_ring *) record;
+	// event buffer for the change feed (NULL until first used):
+	_Atomic(struct unsharedfs_ring *) changes;
+	// message queue for the logger thread (NULL until first used):
+	_Atomic(struct unsharedfs_ring *) log;
+	// heavy-hitter summaries (NULL until first used):
+	_Atomic(struct unsharedfs_hot *) hot;
+	// performance counter sums (NULL until first used):
+	_Atomic(struct unsharedfs_perfstats *) perf;
+	// CPU time per operation and uid (NULL until first used):
+	_Atomic(struct unsharedfs_cputime *) cputime;
+	struct unsharedfs_opstats ops[OP_COUNT];
+	struct unsharedfs_iostats io;
+} __attribute__((aligned(64)));
+
+/**
+ * Return the state of the calling thread, registering it if necessary.
+ * @return the thread state, or NULL if UNSHAREDFS_MAX_THREADS is exceeded.
+ */
+struct unsharedfs_thread *unsharedfs_thread_self(void);
+
+/**
+ * Return the number of slots that have been handed out so far.
+ * Slots are never removed, so any index below this number is valid for
+ * unsharedfs_thread_get().
+ */
+size_t unsharedfs_thread_count(void);
+
+/**
+ * Return the thread state at the given slot (may be NULL while a thread is
+ * registering).
+ */
+struct unsharedfs_thread *unsharedfs_thread_get(size_t index);
+
+/**
+ * Free the buffers held by the per-thread state.  Must only be called when no
+ * request threads are running anymore.
+ */
+void unsharedfs_thread_destroy_all(void);
+
+#endif
@@ -0,0 +1,189 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#include "trace.h"
+#include "thread.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// per-thread span buffer; the monitor empties it every MONITOR_TICK_MS:
+#define TRACE_RING_SIZE (1024 * 1024)
+
+struct unsharedfs_trace_span_rec {
+	uint64_t start_ns;
+	uint64_t duration_ns;
+	uint32_t uid;
+	uint16_t op;
+	uint16_t phase;
+};
+
+_Atomic bool unsharedfs_tracing = false;
+
+// serialises starting, flushing and stopping traces (never taken by request threads):
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *trace_fp = NULL;
+static uint64_t trace_end_ns;
+static unsigned long trace_spans;
+static pid_t trace_named_tids[UNSHAREDFS_MAX_THREADS];
+
+int unsharedfs_trace_start(const char *file, unsigned long seconds)
+{
+	FILE *fp;
+	int fd;
+
+	pthread_mutex_lock(&trace_lock);
+	if (trace_fp != NULL)
+	{
+		pthread_mutex_unlock(&trace_lock);
+		errno = EBUSY;
+		return 0;
+	}
+	// the trace holds the operations of all users:
+	fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	if (fd < 0 || (fp = fdopen(fd, "w")) == NULL)
+	{
+		if (fd >= 0)
+			close(fd);
+		pthread_mutex_unlock(&trace_lock);
+		return 0;
+	}
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"unsharedfs\"}}", (int) getpid());
+	trace_spans = 0;
+	// every trace names its threads again:
+	memset(trace_named_tids, 0, sizeof(trace_named_tids));
+	trace_fp = fp;
+	trace_end_ns = unsharedfs_now_ns() + (uint64_t) seconds * 1000000000;
+	atomic_store(&unsharedfs_tracing, true);
+	pthread_mutex_unlock(&trace_lock);
+	return 1;
+}
+
+void unsharedfs_trace_span(enum unsharedfs_op op, int phase, uid_t uid, uint64_t start_ns, uint64_t end_ns)
+{
+	struct unsharedfs_thread *t = unsharedfs_thread_self();
+	struct unsharedfs_ring *ring;
+	struct unsharedfs_trace_span_rec rec;
+
+	if (t == NULL)
+		return;
+	ring = atomic_load_explicit(&t->trace, memory_order_acquire);
+	if (ring == NULL)
+	{
+		// first span of this thread:
+		ring = malloc(sizeof(*ring));
+		if (ring == NULL)
+			return;
+		if (!unsharedfs_ring_init(ring, TRACE_RING_SIZE))
+		{
+			free(ring);
+			return;
+		}
+		atomic_store_explicit(&t->trace, ring, memory_order_release);
+	}
+	rec.start_ns = start_ns;
+	rec.duration_ns = end_ns - start_ns;
+	rec.uid = uid;
+	rec.op = op;
+	rec.phase = phase;
+	unsharedfs_ring_put(ring, &rec, sizeof(rec));
+}
+
+/* write all buffered spans; trace_lock must be held */
+static void unsharedfs_trace_drain(void)
+{
+	size_t i, n = unsharedfs_thread_count();
+	int pid = getpid();
+
+	for (i = 0; i < n; i++)
+	{
+		struct unsharedfs_thread *t = unsharedfs_thread_get(i);
+		struct unsharedfs_ring *ring;
+		struct unsharedfs_trace_span_rec rec;
+
+		if (t == NULL)
+			continue;
+		ring = atomic_load_explicit(&t->trace, memory_order_acquire);
+		if (ring == NULL)
+			continue;
+		if (trace_named_tids[i] != t->tid)
+		{
+			trace_named_tids[i] = t->tid;
+			fprintf(trace_fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"worker %d\"}}"
+					, pid, (int) t->tid, (int) t->tid);
+		}
+		while (unsharedfs_ring_get(ring, &rec, sizeof(rec)) == sizeof(rec))
+		{
+			const char *name;
+			if (rec.phase == TRACE_SPAN_OP)
+				name = rec.op < OP_COUNT ? unsharedfs_op_names[rec.op] : "?";
+			else
+				name = rec.phase < PHASE_COUNT ? unsharedfs_phase_names[rec.phase] : "?";
+			fprintf(trace_fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"pid\":%d,\"tid\":%d,\"args\":{\"uid\":%u}}"
+					, name
+					, rec.phase == TRACE_SPAN_OP ? "op" : "phase"
+					, (unsigned long long) rec.start_ns / 1000, (unsigned) (rec.start_ns % 1000)
+					, (unsigned long long) rec.duration_ns / 1000, (unsigned) (rec.duration_ns % 1000)
+					, pid, (int) t->tid, rec.uid);
+			trace_spans++;
+		}
+	}
+}
+
+/* finish the trace file; trace_lock must be held */
+static void unsharedfs_trace_close(void)
+{
+	unsigned long dropped = 0;
+	size_t i, n = unsharedfs_thread_count();
+
+	atomic_store(&unsharedfs_tracing, false);
+	unsharedfs_trace_drain();
+	for (i = 0; i < n; i++)
+	{
+		struct unsharedfs_thread *t = unsharedfs_thread_get(i);
+		struct unsharedfs_ring *ring = t ? atomic_load(&t->trace) : NULL;
+		if (ring)
+			dropped += atomic_exchange(&ring->dropped, 0);
+	}
+	fprintf(trace_fp, "\n],\"otherData\":{\"spans\":\"%lu\",\"dropped_spans\":\"%lu\"}}\n", trace_spans, dropped);
+	fclose(trace_fp);
+	trace_fp = NULL;
+}
+
+void unsharedfs_trace_flush(void)
+{
+	pthread_mutex_lock(&trace_lock);
+	if (trace_fp != NULL)
+	{
+		if (unsharedfs_now_ns() >= trace_end_ns)
+			unsharedfs_trace_close();
+		else
+		{
+			unsharedfs_trace_drain();
+			fflush(trace_fp);
+		}
+	}
+	pthread_mutex_unlock(&trace_lock);
+}
+
+void unsharedfs_trace_stop(void)
+{
+	pthread_mutex_lock(&trace_lock);
+	if (trace_fp != NULL)
+		unsharedfs_trace_close();
+	pthread_mutex_unlock(&trace_lock);
+}
@@ -0,0 +1,62 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ */
+
+#ifndef UNSHAREDFS_TRACE_H_
+#define UNSHAREDFS_TRACE_H_
+
+#include "opctx.h"
+
+#include <sys/types.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * The request tracer records a span for every operation, and nested spans for
+ * its phases (see enum unsharedfs_phase), into per-thread buffers.  The
+ * monitor thread periodically moves the spans to a file in the Chrome trace
+ * event format, which can be loaded into Perfetto or chrome://tracing.
+ */
+
+// pseudo-phase used for the span covering the whole operation:
+#define TRACE_SPAN_OP PHASE_COUNT
+
+/**
+ * True while a trace is being captured.
+ */
+extern _Atomic bool unsharedfs_tracing;
+
+/**
+ * Start capturing a trace.
+ * @param file the trace file (overwritten)
+ * @param seconds stop capturing after this many seconds
+ * @return 1 on success, 0 on error (errno is set).
+ */
+int unsharedfs_trace_start(const char *file, unsigned long seconds);
+
+/**
+ * Record a span.  Called on the request thread.
+ * @param op the operation
+ * @param phase the phase, or TRACE_SPAN_OP for the operation itself
+ */
+void unsharedfs_trace_span(enum unsharedfs_op op, int phase, uid_t uid, uint64_t start_ns, uint64_t end_ns);
+
+/**
+ * Move the recorded spans to the trace file, and finish the trace if its time
+ * is up.  Called periodically from the monitor thread.
+ */
+void unsharedfs_trace_flush(void);
+
+/**
+ * Finish the current trace, if any.
+ */
+void unsharedfs_trace_stop(void);
+
+#endif
@@ -0,0 +1,293 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ *
+ * unsharedfs-top shows live statistics from the shared memory segment of a
+ * running unsharedfs (see --shm-stats).  It never talks to the daemon.
+ */
+
+#include "shmstats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// give up on a block that keeps changing while we copy it:
+#define TOP_SNAPSHOT_RETRIES 100
+
+/* the sum of all thread blocks */
+struct unsharedfs_top_totals {
+	uint64_t count[OP_COUNT];
+	uint64_t errors[OP_COUNT];
+	uint64_t ns[OP_COUNT];
+	uint64_t latency[OP_COUNT][SHM_LAT_BUCKETS];
+	unsigned int threads;
+};
+
+static void unsharedfs_top_usage()
+{
+	printf( "Show live statistics of a running unsharedfs.\n"
+			"\n"
+			"Usage: unsharedfs-top [OPTIONS] MOUNTPOINT\n"
+			"       unsharedfs-top [OPTIONS] -n NAME\n"
+			"\n"
+			"Options:\n"
+			"  -n NAME                   Name of the statistics segment (see unsharedfs --shm-stats=name;\n"
+			"                            default: the name derived from MOUNTPOINT).\n"
+			"  -d SECONDS                Refresh interval (default: 1).\n"
+			"  -c COUNT                  Exit after COUNT refreshes.\n"
+			"  -b                        Batch mode: don't clear the screen between refreshes.\n"
+			"  -h, --help                Print help.\n"
+		  );
+}
+
+static uint64_t unsharedfs_top_realtime_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* copy a block, retrying while its owner updates it */
+static int unsharedfs_top_copy_block(const struct unsharedfs_shm_thread *b, struct unsharedfs_shm_thread *copy)
+{
+	int tries;
+
+	for (tries = 0; tries < TOP_SNAPSHOT_RETRIES; tries++)
+	{
+		uint32_t seq = atomic_load_explicit(&b->seq, memory_order_acquire);
+		if (seq & 1)
+			continue;
+		memcpy(copy, b, sizeof(*copy));
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&b->seq, memory_order_relaxed) == seq)
+			return 1;
+	}
+	return 0;
+}
+
+static void unsharedfs_top_snapshot(const struct unsharedfs_shm_header *h, struct unsharedfs_top_totals *tot)
+{
+	const struct unsharedfs_shm_thread *blocks = (const void *) ((const char *) h + h->header_size);
+	struct unsharedfs_shm_thread copy;
+	uint32_t i, n = atomic_load(&h->nthreads);
+	int op, b;
+
+	memset(tot, 0, sizeof(*tot));
+	for (i = 0; i < n && i < h->max_threads; i++)
+	{
+		if (!unsharedfs_top_copy_block(&blocks[i], &copy))
+			continue;
+		if (copy.tid != 0)
+			tot->threads++;
+		for (op = 0; op < OP_COUNT; op++)
+		{
+			tot->count[op] += copy.count[op];
+			tot->errors[op] += copy.errors[op];
+			tot->ns[op] += copy.ns[op];
+			for (b = 0; b < SHM_LAT_BUCKETS; b++)
+				tot->latency[op][b] += copy.latency[op][b];
+		}
+	}
+}
+
+/* the upper bound (in microseconds) of the bucket containing the given percentile */
+static uint64_t unsharedfs_top_percentile(const uint64_t *hist, uint64_t total, double pct)
+{
+	uint64_t acc = 0;
+	int b;
+
+	for (b = 0; b < SHM_LAT_BUCKETS; b++)
+	{
+		acc += hist[b];
+		if (acc >= total * pct)
+			break;
+	}
+	return (uint64_t) 1 << b;
+}
+
+static void unsharedfs_top_show(const struct unsharedfs_shm_header *h
+		, const struct unsharedfs_top_totals *cur, const struct unsharedfs_top_totals *prev
+		, double seconds, int clear)
+{
+	struct unsharedfs_shm_uid top[SHM_TOP_UIDS];
+	uint64_t now = unsharedfs_top_realtime_ns();
+	uint64_t uptime = (now - h->start_ns) / 1000000000;
+	uint64_t age_ms = (now - atomic_load(&h->update_ns)) / 1000000;
+	uint32_t used = 0;
+	int op, b, tries;
+
+	if (clear)
+		printf("\033[H\033[2J");
+	printf("unsharedfs pid %d, up %llu:%02llu:%02llu, %u threads%s\n\n"
+			, h->pid
+			, (unsigned long long) uptime / 3600
+			, (unsigned long long) (uptime / 60) % 60
+			, (unsigned long long) uptime % 60
+			, cur->threads
+			, age_ms > 3000 ? " (not responding)" : "");
+	printf("%-14s %10s %8s %9s %8s %8s %8s %14s\n", "op", "ops/s", "err/s", "avg.us", "p50.us", "p90.us", "p99.us", "total");
+	for (op = 0; op < OP_COUNT; op++)
+	{
+		uint64_t hist[SHM_LAT_BUCKETS];
+		uint64_t count = cur->count[op] - prev->count[op];
+		uint64_t errors = cur->errors[op] - prev->errors[op];
+		uint64_t ns = cur->ns[op] - prev->ns[op];
+
+		if (cur->count[op] == 0)
+			continue;
+		for (b = 0; b < SHM_LAT_BUCKETS; b++)
+			hist[b] = cur->latency[op][b] - prev->latency[op][b];
+		if (count == 0)
+			printf("%-14.*s %10.1f %8.1f %9s %8s %8s %8s %14llu\n"
+					, SHM_OP_NAME_LEN, h->op_names[op], 0.0, 0.0, "-", "-", "-", "-"
+					, (unsigned long long) cur->count[op]);
+		else
+			printf("%-14.*s %10.1f %8.1f %9.1f %8llu %8llu %8llu %14llu\n"
+					, SHM_OP_NAME_LEN, h->op_names[op]
+					, count / seconds
+					, errors / seconds
+					, ns / 1e3 / count
+					, (unsigned long long) unsharedfs_top_percentile(hist, count, 0.5)
+					, (unsigned long long) unsharedfs_top_percentile(hist, count, 0.9)
+					, (unsigned long long) unsharedfs_top_percentile(hist, count, 0.99)
+					, (unsigned long long) cur->count[op]);
+	}
+
+	for (tries = 0; tries < TOP_SNAPSHOT_RETRIES; tries++)
+	{
+		uint32_t seq = atomic_load_explicit(&h->top_seq, memory_order_acquire);
+		if (seq & 1)
+			continue;
+		used = h->top_used < SHM_TOP_UIDS ? h->top_used : SHM_TOP_UIDS;
+		memcpy(top, h->top_uids, sizeof(top));
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&h->top_seq, memory_order_relaxed) == seq)
+			break;
+		used = 0;
+	}
+	if (used > 0)
+	{
+		uint32_t i;
+		printf("\n%-10s %14s %16s   (since start)\n", "uid", "ops", "bytes");
+		for (i = 0; i < used; i++)
+			printf("%-10llu %14llu %16llu\n"
+					, (unsigned long long) top[i].uid
+					, (unsigned long long) top[i].ops
+					, (unsigned long long) top[i].bytes);
+	}
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *name = NULL, *mountpoint = NULL;
+	char shm_name[NAME_MAX], *path;
+	unsigned long interval = 1, count = 0, n;
+	int clear = isatty(STDOUT_FILENO);
+	struct unsharedfs_shm_header *h;
+	struct unsharedfs_top_totals totals[2];
+	struct stat st;
+	uint64_t last_ns;
+	int i, fd;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			name = argv[++i];
+		else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc && (interval = strtoul(argv[++i], NULL, 10)) > 0)
+			;
+		else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			count = strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-b") == 0)
+			clear = 0;
+		else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0)
+		{
+			unsharedfs_top_usage();
+			return 0;
+		}
+		else if (argv[i][0] != '-' && mountpoint == NULL)
+			mountpoint = argv[i];
+		else
+		{
+			unsharedfs_top_usage();
+			return 1;
+		}
+	}
+
+	if (name != NULL)
+		snprintf(shm_name, sizeof(shm_name), "%s%s", name[0] == '/' ? "" : "/", name);
+	else if (mountpoint != NULL)
+	{
+		// unsharedfs names the segment after the canonical path:
+		if ((path = realpath(mountpoint, NULL)) == NULL)
+		{
+			fprintf(stderr, "unsharedfs-top: %s: %s\n", mountpoint, strerror(errno));
+			return 1;
+		}
+		if (!unsharedfs_shm_default_name(path, shm_name, sizeof(shm_name)))
+		{
+			fprintf(stderr, "unsharedfs-top: the segment name for %s is too long\n", path);
+			return 1;
+		}
+		free(path);
+	}
+	else
+	{
+		unsharedfs_top_usage();
+		return 1;
+	}
+	fd = shm_open(shm_name, O_RDONLY, 0);
+	if (fd < 0 || fstat(fd, &st) != 0)
+	{
+		fprintf(stderr, "unsharedfs-top: cannot open %s: %s\n", shm_name, strerror(errno));
+		return 1;
+	}
+	if ((size_t) st.st_size < sizeof(*h)
+			|| (h = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+	{
+		fprintf(stderr, "unsharedfs-top: cannot map %s\n", shm_name);
+		return 1;
+	}
+	close(fd);
+	if (atomic_load_explicit(&h->magic, memory_order_acquire) != UNSHAREDFS_SHM_MAGIC
+			|| h->version != UNSHAREDFS_SHM_VERSION
+			|| h->header_size != sizeof(*h)
+			|| h->block_size != sizeof(struct unsharedfs_shm_thread)
+			|| h->op_count != OP_COUNT
+			|| (size_t) st.st_size < h->header_size + (size_t) h->max_threads * h->block_size)
+	{
+		fprintf(stderr, "unsharedfs-top: %s has an unsupported format (version %u, expected %u)\n"
+				, shm_name, h->version, UNSHAREDFS_SHM_VERSION);
+		return 1;
+	}
+
+	// the first screen shows the rates since the daemon started:
+	memset(&totals[1], 0, sizeof(totals[1]));
+	last_ns = h->start_ns;
+	for (n = 0; count == 0 || n < count; n++)
+	{
+		struct unsharedfs_top_totals *cur = &totals[n % 2], *prev = &totals[(n + 1) % 2];
+		uint64_t now = unsharedfs_top_realtime_ns();
+		double seconds = (now - last_ns) / 1e9;
+
+		unsharedfs_top_snapshot(h, cur);
+		unsharedfs_top_show(h, cur, prev, seconds > 0.001 ? seconds : 0.001, clear);
+		last_ns = now;
+		if (count == 0 || n + 1 < count)
+			sleep(interval);
+	}
+	return 0;
+}
@@ -19,9 +19,16 @@
 #define UNSHAREDFS_VERSION_STRING "unsharedfs 1.2git"
 
 #include "fs.h"
+#include "audit.h"
+#include "batch.h"
+#include "log.h"
+#include "provision.h"
+#include "shmstats.h"
 
 #include <fuse.h>
 #include <fuse_opt.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -70,6 +77,8 @@ static void unsharedfs_usage()
 	printf( "Redirect file system access to another directory depending on the user id.\n"
 			"\n"
 			"Usage: unsharedfs -o allow_other [OPTIONS] BASEDIR MOUNTPOINT\n"
+			"       unsharedfs --provision [OPTIONS] BASEDIR\n"
+			"       unsharedfs --audit [OPTIONS] BASEDIR\n"
 			"\n"
 			"Options:\n"
 			"  BASEDIR                   Base directory.\n"
@@ -86,6 +95,97 @@ static void unsharedfs_usage()
 			"                            does not match the directory name.\n"
 			"      --use-gid             Use group id (gid) instead of the user id to determine\n"
 			"                            the diverted path. Currently this implies \"--no-check-ownership\"\n"
+			"      --cache-hints         Apply the caching hint that users set in the\n"
+			"                            user.unsharedfs.cache attribute of a file or directory\n"
+			"                            (immutable, nocache or stream) when opening files.\n"
+			"      --io-uring=mode       Batch the metadata calls of the walks over BASEDIR\n"
+			"                            (--audit-sizes, compression) with io_uring: yes, no or\n"
+			"                            auto (default: only on network file systems).\n"
+			"\n"
+			"Compression:\n"
+			"      --compress-idle=hours Compress the files in directory trees that users marked\n"
+			"                            as cold (user.unsharedfs.cache) when they have not been\n"
+			"                            read or written for this many hours; 0 only reads the\n"
+			"                            files that are compressed already.\n"
+			"      --compress-level=n    zstd compression level (default: 3).\n"
+			"\n"
+			"Provisioning:\n"
+			"      --provision           Create the missing uid directories (gid directories with\n"
+			"                            --use-gid) in BASEDIR for all users in the password\n"
+			"                            database, and the --fallback directory; then exit.\n"
+			"      --provision-uids=min[-max]\n"
+			"                            Only provision users with a uid in this range.\n"
+			"      --provision-threads=n Create directories with n threads (default: 16).\n"
+			"      --provision-dry-run   Only print what --provision would do.\n"
+			"\n"
+			"Auditing:\n"
+			"      --audit               Check all entries of BASEDIR for owner mismatches, entries\n"
+			"                            that are not directories, symbolic links, ids without a\n"
+			"                            user (group with --use-gid) and unexpected names; print one\n"
+			"                            JSON object per problem and a summary, then exit with status\n"
+			"                            0 (no problems), 1 (problems found) or 2 (error).\n"
+			"      --audit-sizes         Also report the size of every directory (walks all views).\n"
+			"      --audit-max-size=MiB  Report views larger than this (implies --audit-sizes).\n"
+			"      --audit-threads=n     Check entries with n threads (default: 16).\n"
+			"\n"
+			"Logging:\n"
+			"      --log-level=level     Log messages up to this level: err, warning, notice,\n"
+			"                            info or debug (default: info; debug with -d).\n"
+			"      --log-burst=n         Log at most n identical messages per interval,\n"
+			"                            and summarise the rest (default: 10, 0 disables).\n"
+			"      --log-interval=s      Length of the log rate limiting interval in seconds\n"
+			"                            (default: 60).\n"
+			"\n"
+			"Diagnostics:\n"
+			"      --stats=file          Write statistics to this file on SIGUSR2 and on unmount.\n"
+			"      --heavy-hitters       Include the hottest paths and uids (by operations and by\n"
+			"                            bytes) in the statistics.\n"
+			"      --io-stats            Include read/write size histograms and access patterns,\n"
+			"                            with recommended mount options, in the statistics.\n"
+			"      --perf-counters       Include CPU cycles, instructions, cache misses and context\n"
+			"                            switches per operation and phase in the statistics\n"
+			"                            (uses perf_event_open; adds system calls to every operation).\n"
+			"      --cpu-time            Include the daemon's CPU time per operation and per uid in\n"
+			"                            the statistics (adds two system calls to every operation).\n"
+			"      --flight-recorder=file\n"
+			"                            Keep a record of the most recent operations in memory\n"
+			"                            and append it to this file on SIGUSR1.\n"
+			"      --flight-recorder-size=n\n"
+			"                            Number of operations kept by the flight recorder (default: 4096).\n"
+			"      --flight-recorder-threshold=ms\n"
+			"                            Also dump the flight recorder when an operation takes longer\n"
+			"                            than this many milliseconds (default: 1000, 0 disables).\n"
+			"      --slow-op-threshold=ms\n"
+			"                            Log operations that take longer than this many milliseconds,\n"
+			"                            broken down into time spent in the daemon and in the backing\n"
+			"                            file system (default: 0, disabled).\n"
+			"      --trace=file          Record a timeline of all operations and their phases in\n"
+			"                            Chrome trace format (load into Perfetto or chrome://tracing).\n"
+			"      --trace-duration=s    Stop recording the trace after this many seconds (default: 10).\n"
+			"      --record=file         Record all operations with their arguments, timing and results\n"
+			"                            to this file, for replaying them with unsharedfs-replay.\n"
+			"      --control=socket      Accept commands from unsharedfsctl on this Unix socket, e.g.\n"
+			"                            to change the log level or start a trace at runtime.\n"
+			"      --shm-stats[=name]    Keep live statistics in a shared memory segment for\n"
+			"                            unsharedfs-top (default name: " UNSHAREDFS_SHM_DEFAULT_NAME " followed by\n"
+			"                            the mount point with '-' for '/').  The name must not be in\n"
+			"                            use by a running instance.\n"
+			"\n"
+			"Change feed:\n"
+			"      --changes=file        Append every successful modification (create, write ranges,\n"
+			"                            truncate, rename, unlink, attribute changes, ...) to this\n"
+			"                            file as a JSON line, with the uid and the path.\n"
+			"      --changes-socket=socket\n"
+			"                            Send the same lines to all clients of this Unix socket.\n"
+			"      --changes-buffer=KiB  Disconnect socket clients that fall further behind than\n"
+			"                            this (default: 4096).\n"
+			"\n"
+			"Directory index:\n"
+			"      --dir-index=dir       Keep a sorted index of every huge directory in this\n"
+			"                            directory; list huge directories from their index, and\n"
+			"                            answer lookups of names that don't exist without the\n"
+			"                            backing file system.\n"
+			"      --dir-index-min=n     Index directories with at least n entries (default: 10000).\n"
 			"\n"
 			"FUSE options:\n"
 			"  -o opt[,opt,...]          Mount options.\n"
@@ -104,6 +204,41 @@ enum unsharedfs_opt_key {
 	KEY_ALLOW_OTHER,
 	KEY_NO_CHECK_OWNERSHIP,
 	KEY_USE_GID,
+	KEY_CACHE_HINTS,
+	KEY_IO_URING,
+	KEY_COMPRESS_IDLE,
+	KEY_COMPRESS_LEVEL,
+	KEY_LOG_LEVEL,
+	KEY_LOG_BURST,
+	KEY_LOG_INTERVAL,
+	KEY_STATS,
+	KEY_HEAVY_HITTERS,
+	KEY_IO_STATS,
+	KEY_PERF_COUNTERS,
+	KEY_CPU_TIME,
+	KEY_FLIGHTREC,
+	KEY_FLIGHTREC_SIZE,
+	KEY_FLIGHTREC_THRESHOLD,
+	KEY_SLOWOP_THRESHOLD,
+	KEY_TRACE,
+	KEY_CONTROL,
+	KEY_SHM_STATS,
+	KEY_SHM_STATS_NAME,
+	KEY_TRACE_DURATION,
+	KEY_RECORD,
+	KEY_CHANGES,
+	KEY_CHANGES_SOCKET,
+	KEY_CHANGES_BUFFER,
+	KEY_DIR_INDEX,
+	KEY_DIR_INDEX_MIN,
+	KEY_PROVISION,
+	KEY_PROVISION_UIDS,
+	KEY_PROVISION_THREADS,
+	KEY_PROVISION_DRY_RUN,
+	KEY_AUDIT,
+	KEY_AUDIT_SIZES,
+	KEY_AUDIT_MAX_SIZE,
+	KEY_AUDIT_THREADS,
 	KEY_FUSE_PASSTHROUGH,
 	KEY_FUSE_DEBUG,
 };
@@ -115,6 +250,41 @@ static const struct fuse_opt unsharedfs_options[] = {
 	FUSE_OPT_KEY( "--fallback=", KEY_FALLBACK),
 	FUSE_OPT_KEY( "--no-check-ownership", KEY_NO_CHECK_OWNERSHIP),
 	FUSE_OPT_KEY( "--use-gid", KEY_USE_GID),
+	FUSE_OPT_KEY( "--cache-hints", KEY_CACHE_HINTS),
+	FUSE_OPT_KEY( "--io-uring=", KEY_IO_URING),
+	FUSE_OPT_KEY( "--compress-idle=", KEY_COMPRESS_IDLE),
+	FUSE_OPT_KEY( "--compress-level=", KEY_COMPRESS_LEVEL),
+	FUSE_OPT_KEY( "--log-level=", KEY_LOG_LEVEL),
+	FUSE_OPT_KEY( "--log-burst=", KEY_LOG_BURST),
+	FUSE_OPT_KEY( "--log-interval=", KEY_LOG_INTERVAL),
+	FUSE_OPT_KEY( "--stats=", KEY_STATS),
+	FUSE_OPT_KEY( "--heavy-hitters", KEY_HEAVY_HITTERS),
+	FUSE_OPT_KEY( "--io-stats", KEY_IO_STATS),
+	FUSE_OPT_KEY( "--perf-counters", KEY_PERF_COUNTERS),
+	FUSE_OPT_KEY( "--cpu-time", KEY_CPU_TIME),
+	FUSE_OPT_KEY( "--flight-recorder=", KEY_FLIGHTREC),
+	FUSE_OPT_KEY( "--flight-recorder-size=", KEY_FLIGHTREC_SIZE),
+	FUSE_OPT_KEY( "--flight-recorder-threshold=", KEY_FLIGHTREC_THRESHOLD),
+	FUSE_OPT_KEY( "--slow-op-threshold=", KEY_SLOWOP_THRESHOLD),
+	FUSE_OPT_KEY( "--trace=", KEY_TRACE),
+	FUSE_OPT_KEY( "--trace-duration=", KEY_TRACE_DURATION),
+	FUSE_OPT_KEY( "--record=", KEY_RECORD),
+	FUSE_OPT_KEY( "--changes=", KEY_CHANGES),
+	FUSE_OPT_KEY( "--changes-socket=", KEY_CHANGES_SOCKET),
+	FUSE_OPT_KEY( "--changes-buffer=", KEY_CHANGES_BUFFER),
+	FUSE_OPT_KEY( "--dir-index=", KEY_DIR_INDEX),
+	FUSE_OPT_KEY( "--dir-index-min=", KEY_DIR_INDEX_MIN),
+	FUSE_OPT_KEY( "--provision", KEY_PROVISION),
+	FUSE_OPT_KEY( "--provision-uids=", KEY_PROVISION_UIDS),
+	FUSE_OPT_KEY( "--provision-threads=", KEY_PROVISION_THREADS),
+	FUSE_OPT_KEY( "--provision-dry-run", KEY_PROVISION_DRY_RUN),
+	FUSE_OPT_KEY( "--audit", KEY_AUDIT),
+	FUSE_OPT_KEY( "--audit-sizes", KEY_AUDIT_SIZES),
+	FUSE_OPT_KEY( "--audit-max-size=", KEY_AUDIT_MAX_SIZE),
+	FUSE_OPT_KEY( "--audit-threads=", KEY_AUDIT_THREADS),
+	FUSE_OPT_KEY( "--control=", KEY_CONTROL),
+	FUSE_OPT_KEY( "--shm-stats", KEY_SHM_STATS),
+	FUSE_OPT_KEY( "--shm-stats=", KEY_SHM_STATS_NAME),
 	FUSE_OPT_KEY( "allow_other", KEY_ALLOW_OTHER),
 	FUSE_OPT_KEY( "debug", KEY_FUSE_DEBUG),
 	FUSE_OPT_KEY( "-d", KEY_FUSE_DEBUG),
@@ -123,6 +293,91 @@ static const struct fuse_opt unsharedfs_options[] = {
 	FUSE_OPT_END
 };
 
+/**
+ * Parse the value of an option of the form "--name=number".
+ * @return 1 on success, 0 if the value is not a valid number.
+ */
+static int unsharedfs_option_ulong(const char *arg, unsigned long *value)
+{
+	const char *val = strchr(arg, '=');
+	char *end;
+
+	if (val != NULL && val[1] != '\0')
+	{
+		errno = 0;
+		*value = strtoul(val + 1, &end, 10);
+		if (errno == 0 && *end == '\0')
+			return 1;
+	}
+	fprintf(stderr, "Invalid numeric value in option %s\n", arg);
+	return 0;
+}
+
+/**
+ * Copy the value of an option of the form "--name=string".
+ * @return a newly allocated string, or NULL on error.
+ */
+static char *unsharedfs_option_string(const char *arg)
+{
+	const char *val = strchr(arg, '=');
+	char *copy;
+
+	if (val == NULL || val[1] == '\0')
+	{
+		fprintf(stderr, "Missing value in option %s\n", arg);
+		return NULL;
+	}
+	copy = strdup(val + 1);
+	if (copy == NULL)
+		perror("unsharedfs parse options: strdup failed");
+	return copy;
+}
+
+/**
+ * Copy the value of an option of the form "--name=path", which must be an
+ * absolute path: unsharedfs changes to / when it daemonizes.
+ * @return a newly allocated string, or NULL on error.
+ */
+static char *unsharedfs_option_path(const char *arg)
+{
+	char *path = unsharedfs_option_string(arg);
+
+	if (path != NULL && path[0] != '/')
+	{
+		fprintf(stderr, "The value of option %s must be an absolute path\n", arg);
+		free(path);
+		return NULL;
+	}
+	return path;
+}
+
+/**
+ * Parse the value of an option of the form "--name=min[-max]".
+ * @return 1 on success, 0 if the value is not a valid range.
+ */
+static int unsharedfs_option_range(const char *arg, unsigned long *min, unsigned long *max)
+{
+	const char *val = strchr(arg, '=');
+	char *end;
+
+	if (val != NULL && val[1] != '\0')
+	{
+		errno = 0;
+		*min = strtoul(val + 1, &end, 10);
+		if (errno == 0 && end != val + 1 && *end == '-')
+		{
+			val = end;
+			*max = strtoul(val + 1, &end, 10);
+			if (errno == 0 && end != val + 1 && *end == '\0' && *min <= *max)
+				return 1;
+		}
+		else if (errno == 0 && end != val + 1 && *end == '\0')
+			return 1;
+	}
+	fprintf(stderr, "Invalid range in option %s\n", arg);
+	return 0;
+}
+
 /* for a description of this function, see the fuse_opt_proc_t definition in fuse_opt.h. */
 static int unsharedfs_parse_options(void *data, const char *arg, int key, struct fuse_args *outargs)
 {
@@ -176,6 +431,181 @@ static int unsharedfs_parse_options(void *data, const char *arg, int key, struct
 			pdata->check_ownership = false;
 			return 0;
 		break;
+		case KEY_CACHE_HINTS:
+			pdata->cache_hints = true;
+			return 0;
+		break;
+		case KEY_IO_URING:
+			pdata->io_uring = unsharedfs_batch_parse_mode(arg + strlen("--io-uring="));
+			if (pdata->io_uring < 0)
+			{
+				fprintf(stderr, "Invalid value in option %s\n", arg);
+				return -1;
+			}
+			return 0;
+		break;
+		case KEY_COMPRESS_IDLE:
+#ifdef HAVE_ZSTD
+			if (!unsharedfs_option_ulong(arg, &pdata->compress_idle))
+				return -1;
+			pdata->compress = true;
+			return 0;
+#else
+			fprintf(stderr, "unsharedfs was built without zstd, --compress-idle is not available\n");
+			return -1;
+#endif
+		break;
+		case KEY_COMPRESS_LEVEL:
+			if (!unsharedfs_option_ulong(arg, &pdata->compress_level) || pdata->compress_level == 0
+					|| pdata->compress_level > 19)
+				return -1;
+			return 0;
+		break;
+		case KEY_LOG_LEVEL:
+			pdata->loglevel = unsharedfs_log_parse_level(arg + strlen("--log-level="));
+			if (pdata->loglevel < 0)
+			{
+				fprintf(stderr, "Invalid log level in option %s\n", arg);
+				return -1;
+			}
+			return 0;
+		break;
+		case KEY_LOG_BURST:
+			return unsharedfs_option_ulong(arg, &pdata->log_burst) ? 0 : -1;
+		break;
+		case KEY_LOG_INTERVAL:
+			if (!unsharedfs_option_ulong(arg, &pdata->log_interval) || pdata->log_interval == 0)
+				return -1;
+			return 0;
+		break;
+		case KEY_STATS:
+			free(pdata->stats_file);
+			pdata->stats_file = unsharedfs_option_path(arg);
+			return pdata->stats_file ? 0 : -1;
+		break;
+		case KEY_HEAVY_HITTERS:
+			pdata->heavy_hitters = true;
+			return 0;
+		break;
+		case KEY_IO_STATS:
+			pdata->io_stats = true;
+			return 0;
+		break;
+		case KEY_PERF_COUNTERS:
+			pdata->perf_counters = true;
+			return 0;
+		break;
+		case KEY_CPU_TIME:
+			pdata->cpu_time = true;
+			return 0;
+		break;
+		case KEY_FLIGHTREC:
+			free(pdata->flightrec_file);
+			pdata->flightrec_file = unsharedfs_option_path(arg);
+			return pdata->flightrec_file ? 0 : -1;
+		break;
+		case KEY_FLIGHTREC_SIZE:
+			{
+				unsigned long size;
+				if (!unsharedfs_option_ulong(arg, &size) || size == 0)
+					return -1;
+				pdata->flightrec_size = size;
+			}
+			return 0;
+		break;
+		case KEY_FLIGHTREC_THRESHOLD:
+			return unsharedfs_option_ulong(arg, &pdata->flightrec_threshold_ms) ? 0 : -1;
+		break;
+		case KEY_SLOWOP_THRESHOLD:
+			return unsharedfs_option_ulong(arg, &pdata->slowop_threshold_ms) ? 0 : -1;
+		break;
+		case KEY_TRACE:
+			free(pdata->trace_file);
+			pdata->trace_file = unsharedfs_option_path(arg);
+			return pdata->trace_file ? 0 : -1;
+		break;
+		case KEY_TRACE_DURATION:
+			return unsharedfs_option_ulong(arg, &pdata->trace_seconds) ? 0 : -1;
+		break;
+		case KEY_RECORD:
+			free(pdata->record_file);
+			pdata->record_file = unsharedfs_option_path(arg);
+			return pdata->record_file ? 0 : -1;
+		break;
+		case KEY_CHANGES:
+			free(pdata->changes_file);
+			pdata->changes_file = unsharedfs_option_path(arg);
+			return pdata->changes_file ? 0 : -1;
+		break;
+		case KEY_CHANGES_SOCKET:
+			free(pdata->changes_socket);
+			pdata->changes_socket = unsharedfs_option_path(arg);
+			return pdata->changes_socket ? 0 : -1;
+		break;
+		case KEY_CHANGES_BUFFER:
+			if (!unsharedfs_option_ulong(arg, &pdata->changes_buffer_kb) || pdata->changes_buffer_kb == 0)
+				return -1;
+			return 0;
+		break;
+		case KEY_DIR_INDEX:
+			free(pdata->dir_index);
+			pdata->dir_index = unsharedfs_option_path(arg);
+			return pdata->dir_index ? 0 : -1;
+		break;
+		case KEY_DIR_INDEX_MIN:
+			if (!unsharedfs_option_ulong(arg, &pdata->dir_index_min) || pdata->dir_index_min == 0)
+				return -1;
+			return 0;
+		break;
+		case KEY_PROVISION:
+			pdata->provision = true;
+			return 0;
+		break;
+		case KEY_PROVISION_UIDS:
+			return unsharedfs_option_range(arg, &pdata->provision_uid_min, &pdata->provision_uid_max) ? 0 : -1;
+		break;
+		case KEY_PROVISION_THREADS:
+			if (!unsharedfs_option_ulong(arg, &pdata->provision_threads) || pdata->provision_threads == 0)
+				return -1;
+			return 0;
+		break;
+		case KEY_PROVISION_DRY_RUN:
+			pdata->provision_dry_run = true;
+			return 0;
+		break;
+		case KEY_AUDIT:
+			pdata->audit = true;
+			return 0;
+		break;
+		case KEY_AUDIT_SIZES:
+			pdata->audit_sizes = true;
+			return 0;
+		break;
+		case KEY_AUDIT_MAX_SIZE:
+			pdata->audit_sizes = true;
+			return unsharedfs_option_ulong(arg, &pdata->audit_max_size_mb) ? 0 : -1;
+		break;
+		case KEY_AUDIT_THREADS:
+			if (!unsharedfs_option_ulong(arg, &pdata->audit_threads) || pdata->audit_threads == 0)
+				return -1;
+			return 0;
+		break;
+		case KEY_SHM_STATS:
+			free(pdata->shm_stats);
+			// named after the mount point once it is known:
+			pdata->shm_stats = strdup("");
+			return pdata->shm_stats ? 0 : -1;
+		break;
+		case KEY_SHM_STATS_NAME:
+			free(pdata->shm_stats);
+			pdata->shm_stats = unsharedfs_option_string(arg);
+			return pdata->shm_stats ? 0 : -1;
+		break;
+		case KEY_CONTROL:
+			free(pdata->control_socket);
+			pdata->control_socket = unsharedfs_option_path(arg);
+			return pdata->control_socket ? 0 : -1;
+		break;
 		case KEY_ALLOW_OTHER:
 			pdata->allow_other_isset = true;
 			return 1;
@@ -183,6 +613,7 @@ static int unsharedfs_parse_options(void *data, const char *arg, int key, struct
 		case KEY_FUSE_DEBUG:
 			// don't spam the syslog when debugging
 			pdata->use_syslog = false;
+			pdata->loglevel = LOG_DEBUG;
 			return 1;
 		// just forward fuse-specific options
 		case KEY_FUSE_PASSTHROUGH:
@@ -194,6 +625,13 @@ static int unsharedfs_parse_options(void *data, const char *arg, int key, struct
 				pdata->rootdir = realpath(arg, NULL);
 				return 0;
 			}
+			if ( arg[0] != '-' && pdata->mountpoint == NULL )
+			{
+				// remember the mount point, but leave it to fuse:
+				pdata->mountpoint = realpath(arg, NULL);
+				if (pdata->mountpoint == NULL)
+					pdata->mountpoint = strdup(arg);
+			}
 		return 1;
 	}
 }
@@ -215,7 +653,44 @@ int main(int argc, char *argv[])
 	pdata->base_gid = getgid();
 	pdata->check_ownership = false;
 	pdata->fsmode = UID_ONLY;
+	pdata->cache_hints = false;
+	pdata->compress = false;
+	pdata->compress_idle = 0;
+	pdata->compress_level = 3;
+	pdata->io_uring = BATCH_AUTO;
 	pdata->use_syslog = true;
+	pdata->loglevel = LOG_INFO;
+	pdata->log_burst = 10;
+	pdata->log_interval = 60;
+	pdata->stats_file = NULL;
+	pdata->heavy_hitters = false;
+	pdata->io_stats = false;
+	pdata->perf_counters = false;
+	pdata->cpu_time = false;
+	pdata->flightrec_file = NULL;
+	pdata->flightrec_size = 4096;
+	pdata->flightrec_threshold_ms = 1000;
+	pdata->slowop_threshold_ms = 0;
+	pdata->trace_file = NULL;
+	pdata->trace_seconds = 10;
+	pdata->record_file = NULL;
+	pdata->changes_file = NULL;
+	pdata->changes_socket = NULL;
+	pdata->changes_buffer_kb = 4096;
+	pdata->dir_index = NULL;
+	pdata->dir_index_min = 10000;
+	pdata->control_socket = NULL;
+	pdata->shm_stats = NULL;
+	pdata->mountpoint = NULL;
+	pdata->provision = false;
+	pdata->provision_uid_min = 0;
+	pdata->provision_uid_max = (uid_t)-1;
+	pdata->provision_threads = 16;
+	pdata->provision_dry_run = false;
+	pdata->audit = false;
+	pdata->audit_sizes = false;
+	pdata->audit_max_size_mb = 0;
+	pdata->audit_threads = 16;
 
 	if (fuse_opt_parse(&args, pdata, unsharedfs_options, unsharedfs_parse_options) == -1)
 	{
@@ -223,11 +698,50 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if ( pdata->provision )
+	{
+		if ( pdata->rootdir == NULL )
+		{
+			fprintf(stderr,"Missing or invalid BASEDIR for --provision.\n");
+			return 1;
+		}
+		return unsharedfs_provision(pdata) ? 0 : 1;
+	}
+	if ( pdata->audit )
+	{
+		unsigned long problems;
+		if ( pdata->rootdir == NULL )
+		{
+			fprintf(stderr,"Missing or invalid BASEDIR for --audit.\n");
+			return 2;
+		}
+		if ( ! unsharedfs_audit(pdata, &problems) )
+			return 2;
+		return problems ? 1 : 0;
+	}
+
 	if ( getuid() != 0 && geteuid() != 0 )
 	{
 		fprintf(stderr,"warning: file system needs root privileges for proper function.\n");
 		fprintf(stderr,"All accesses will be redirected to %s/%d and be executed under the uid of the current user.\n",pdata->rootdir,getuid());
 	}
+	if ( pdata->shm_stats != NULL && pdata->shm_stats[0] == '\0' )
+	{
+		char name[NAME_MAX];
+		if ( pdata->mountpoint == NULL || pdata->mountpoint[0] != '/'
+				|| ! unsharedfs_shm_default_name(pdata->mountpoint, name, sizeof(name)) )
+		{
+			fprintf(stderr,"Cannot name the statistics segment after the mount point, use --shm-stats=name.\n");
+			return 1;
+		}
+		free(pdata->shm_stats);
+		pdata->shm_stats = strdup(name);
+		if ( pdata->shm_stats == NULL )
+		{
+			perror("unsharedfs init");
+			return 1;
+		}
+	}
 	if ( ! pdata->allow_other_isset )
 	{
 		fprintf(stderr,"warning: allow_other is not set. Specify \"-o allow_other\" to allow other users to access the mount point.\n");
@@ -0,0 +1,128 @@
+/*
+ * Unshared File System
+ * Copyright 2014 Johannes Zarl <johannes.zarl@jku.at>
+ * A FUSE Filesystem that diverts access to a different locations
+ * based on the accessor's uid.
+ *
+ * This program can be distributed under the terms of the GNU GPLv3.
+ * See the file COPYING.
+ *
+ * unsharedfsctl sends a command to the control socket of a running unsharedfs.
+ */
+
+#include "control.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static void unsharedfsctl_usage()
+{
+	printf( "Control a running unsharedfs.\n"
+			"\n"
+			"Usage: unsharedfsctl -s SOCKET COMMAND [ARGS...]\n"
+			"\n"
+			"Options:\n"
+			"  -s SOCKET                 The control socket (see unsharedfs --control).\n"
+			"  -h, --help                Print help.\n"
+			"\n"
+			"Run \"unsharedfsctl -s SOCKET help\" for a list of commands and tunables.\n"
+		  );
+}
+
+int main(int argc, char *argv[])
+{
+	const char *socket_path = NULL;
+	char line[UNSHAREDFS_CONTROL_LINE_MAX];
+	char reply[4096];
+	struct sockaddr_un addr;
+	size_t len = 0;
+	int i, fd, status = 1;
+	FILE *in;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++)
+	{
+		if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			socket_path = argv[++i];
+		else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0)
+		{
+			unsharedfsctl_usage();
+			return 0;
+		}
+		else
+		{
+			unsharedfsctl_usage();
+			return 1;
+		}
+	}
+	if (socket_path == NULL || i == argc)
+	{
+		unsharedfsctl_usage();
+		return 1;
+	}
+
+	// the command line is the remaining arguments, separated by blanks:
+	for (; i < argc; i++)
+	{
+		size_t arglen = strlen(argv[i]);
+		if (len + arglen + 2 > sizeof(line) || strpbrk(argv[i], " \t\r\n") != NULL)
+		{
+			fprintf(stderr, "unsharedfsctl: invalid argument: %s\n", argv[i]);
+			return 1;
+		}
+		memcpy(line + len, argv[i], arglen);
+		len += arglen;
+		line[len++] = (i + 1 < argc) ? ' ' : '\n';
+	}
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "unsharedfsctl: socket path too long: %s\n", socket_path);
+		return 1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+	{
+		fprintf(stderr, "unsharedfsctl: cannot connect to %s: %s\n", socket_path, strerror(errno));
+		return 1;
+	}
+	if (write(fd, line, len) != (ssize_t) len)
+	{
+		fprintf(stderr, "unsharedfsctl: cannot send command: %s\n", strerror(errno));
+		return 1;
+	}
+	shutdown(fd, SHUT_WR);
+
+	in = fdopen(fd, "r");
+	if (in == NULL)
+	{
+		perror("unsharedfsctl: fdopen");
+		return 1;
+	}
+	// copy the output, up to the status line:
+	while (fgets(reply, sizeof(reply), in) != NULL)
+	{
+		if (strcmp(reply, "OK\n") == 0)
+		{
+			status = 0;
+			break;
+		}
+		if (strncmp(reply, "ERR ", 4) == 0)
+		{
+			fprintf(stderr, "unsharedfsctl: %s", reply + 4);
+			break;
+		}
+		fputs(reply, stdout);
+	}
+	if (ferror(in) || (status != 0 && feof(in)))
+		fprintf(stderr, "unsharedfsctl: connection closed unexpectedly\n");
+	fclose(in);
+	return status;
+}